@@ -1,10 +1,15 @@
 /* 信号待ち時間計算（基準信号を指定した待ち時間計算） */
 
+#define _POSIX_C_SOURCE 200809L  // mmap / stat（graph_snapshot.h）
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
 #include <stdbool.h>
+#include "graph_snapshot.h"
+#include "edge_index.h"
+#include "csv_reader.h"
 
 #define MAX_EDGES 1000
 #define MAX_PATH_LENGTH 200
@@ -26,6 +31,7 @@ typedef struct {
 // グローバル変数
 EdgeData edgeDataArray[MAX_EDGES];
 int edgeDataCount = 0;
+EdgeIndex edgeIndex; // 正規化した (from,to) → edgeDataArray のインデックス
 double walkingSpeed = 80.0; // m/min
 
 // エッジキーを正規化（小さいノードを先に）
@@ -39,19 +45,9 @@ void normalizeEdgeKey(int from, int to, int *outFrom, int *outTo) {
     }
 }
 
-// エッジキーからインデックスを取得
+// エッジキーからインデックスを取得（ハッシュ表で定数時間）
 int findEdgeIndex(int from, int to) {
-    int normFrom, normTo;
-    normalizeEdgeKey(from, to, &normFrom, &normTo);
-    
-    for (int i = 0; i < edgeDataCount; i++) {
-        int edgeFrom, edgeTo;
-        normalizeEdgeKey(edgeDataArray[i].from, edgeDataArray[i].to, &edgeFrom, &edgeTo);
-        if (edgeFrom == normFrom && edgeTo == normTo) {
-            return i;
-        }
-    }
-    return -1;
+    return edgeIndexFind(&edgeIndex, from, to);
 }
 
 // エッジキー文字列からノードを取得
@@ -59,107 +55,136 @@ int parseEdgeKey(const char *edgeKey, int *from, int *to) {
     return sscanf(edgeKey, "%d-%d", from, to);
 }
 
-// CSVファイルからエッジデータを読み込む
+// 1行分のエッジデータを反映する
+void addRouteRow(int from, int to, double distance, double gradient, int isSignal) {
+    if (from > 0 && to > 0) {
+        int edgeIdx = findEdgeIndex(from, to);
+        if (edgeIdx < 0 && edgeDataCount < MAX_EDGES) {
+            edgeIdx = edgeDataCount++;
+            edgeDataArray[edgeIdx].from = from;
+            edgeDataArray[edgeIdx].to = to;
+            edgeIndexInsert(&edgeIndex, from, to, edgeIdx);
+            edgeDataArray[edgeIdx].signalCycle = 0;
+            edgeDataArray[edgeIdx].signalGreen = 0;
+            edgeDataArray[edgeIdx].signalPhase = 0.0;
+        }
+        if (edgeIdx >= 0) {
+            edgeDataArray[edgeIdx].distance = distance;
+            edgeDataArray[edgeIdx].gradient = gradient;
+            edgeDataArray[edgeIdx].isSignal = isSignal;
+        }
+    }
+}
+
+// CSVファイルからエッジデータを読み込む（カラムはヘッダ行の名前で引く）
 void loadRouteData(const char *filename) {
-    FILE *file = fopen(filename, "r");
-    if (!file) {
+    CsvReader csv;
+    if (!csvOpen(&csv, filename, true)) {
         fprintf(stderr, "Error: Cannot open %s\n", filename);
         return;
     }
     
-    char line[MAX_LINE_LENGTH];
-    fgets(line, sizeof(line), file); // ヘッダーをスキップ
-    
-    while (fgets(line, sizeof(line), file)) {
-        if (line[0] == '\n' || line[0] == '\0') continue;
-        
-        int from, to;
-        double distance, gradient;
-        int isSignal;
-        char *token = strtok(line, ",");
-        if (!token) continue;
-        from = atoi(token);
-        
-        token = strtok(NULL, ",");
-        if (!token) continue;
-        to = atoi(token);
-        
-        token = strtok(NULL, ",");
-        if (!token) continue;
-        distance = atof(token);
-        
-        token = strtok(NULL, ",");
-        if (!token) continue;
-        // time_minutes をスキップ
+    int columns[CSV_ROUTE_COLUMNS];
+    csvRouteColumns(&csv, columns);
+    while (csvNextRow(&csv)) {
+        double values[CSV_ROUTE_COLUMNS];
+        int count;
+        if (!csvRouteValues(&csv, columns, values, &count) || count < 5) continue;
         
-        token = strtok(NULL, ",");
-        if (!token) continue;
-        gradient = atof(token);
-        
-        // 残りのカラムをスキップして信号フラグを取得
-        for (int i = 0; i < 3; i++) {
-            token = strtok(NULL, ",");
-            if (!token) break;
-        }
-        if (token) {
-            isSignal = atoi(token);
-        } else {
-            isSignal = 0;
-        }
-        
-        if (from > 0 && to > 0) {
-            int edgeIdx = findEdgeIndex(from, to);
-            if (edgeIdx < 0 && edgeDataCount < MAX_EDGES) {
-                edgeIdx = edgeDataCount++;
-                edgeDataArray[edgeIdx].from = from;
-                edgeDataArray[edgeIdx].to = to;
-                edgeDataArray[edgeIdx].signalCycle = 0;
-                edgeDataArray[edgeIdx].signalGreen = 0;
-                edgeDataArray[edgeIdx].signalPhase = 0.0;
-            }
-            if (edgeIdx >= 0) {
-                edgeDataArray[edgeIdx].distance = distance;
-                edgeDataArray[edgeIdx].gradient = gradient;
-                edgeDataArray[edgeIdx].isSignal = isSignal;
-            }
-        }
+        // 信号フラグは8番目のカラム（スナップショットからの読み込みと同じ位置）
+        int isSignal = count >= 8 ? (int)values[7] : 0;
+        addRouteRow((int)values[0], (int)values[1], values[2], values[4], isSignal);
     }
     
-    fclose(file);
+    csvClose(&csv);
+}
+
+// 1行分の信号情報を反映する
+void addSignalRow(int from, int to, int cycle, int green, double phase) {
+    int edgeIdx = findEdgeIndex(from, to);
+    if (edgeIdx >= 0) {
+        edgeDataArray[edgeIdx].signalCycle = cycle;
+        edgeDataArray[edgeIdx].signalGreen = green;
+        edgeDataArray[edgeIdx].signalPhase = phase;
+    }
 }
 
 // 信号情報を読み込む
+// signal_inf.csv の "from,to,cycle,green,phase,expected" 形式と、
+// 旧形式の "from-to,cycle,green,phase" の両方を受け付ける
 void loadSignalData(const char *filename) {
-    FILE *file = fopen(filename, "r");
-    if (!file) {
+    CsvReader csv;
+    if (!csvOpen(&csv, filename, true)) {
         fprintf(stderr, "Warning: Cannot open %s\n", filename);
         return;
     }
     
-    char line[MAX_LINE_LENGTH];
-    fgets(line, sizeof(line), file); // ヘッダーをスキップ
+    // ヘッダに node1,node2 が無ければ旧形式（先頭カラムが "from-to"）
+    int colFrom  = csvColumn(&csv, "node1");
+    int colTo    = csvColumn(&csv, "node2");
+    bool legacy  = colFrom < 0 || colTo < 0;
+    int colCycle = legacy ? 1 : csvColumn(&csv, "cycle");
+    int colGreen = legacy ? 2 : csvColumn(&csv, "green");
+    int colPhase = legacy ? 3 : csvColumn(&csv, "phase");
     
-    while (fgets(line, sizeof(line), file)) {
-        if (line[0] == '\n' || line[0] == '\0') continue;
-        
-        char edgeKey[64];
+    while (csvNextRow(&csv)) {
+        int from, to;
         int cycle, green;
         double phase;
         
-        if (sscanf(line, "%[^,],%d,%d,%lf", edgeKey, &cycle, &green, &phase) == 4) {
-            int from, to;
-            if (parseEdgeKey(edgeKey, &from, &to) == 2) {
-                int edgeIdx = findEdgeIndex(from, to);
-                if (edgeIdx >= 0) {
-                    edgeDataArray[edgeIdx].signalCycle = cycle;
-                    edgeDataArray[edgeIdx].signalGreen = green;
-                    edgeDataArray[edgeIdx].signalPhase = phase;
-                }
+        if (!csvInt(&csv, colCycle, &cycle) || !csvInt(&csv, colGreen, &green) ||
+            !csvDouble(&csv, colPhase, &phase)) {
+            csvWarn(&csv, "信号情報として読めません");
+            continue;
+        }
+        if (legacy) {
+            char edgeKey[64];
+            int len = csv.fieldLength[0] < 63 ? csv.fieldLength[0] : 63;
+            memcpy(edgeKey, csv.fieldStart[0], (size_t)len);
+            edgeKey[len] = '\0';
+            if (parseEdgeKey(edgeKey, &from, &to) != 2) {
+                csvWarn(&csv, "信号情報として読めません");
+                continue;
             }
+        } else if (!csvInt(&csv, colFrom, &from) || !csvInt(&csv, colTo, &to)) {
+            csvWarn(&csv, "信号情報として読めません");
+            continue;
         }
+        addSignalRow(from, to, cycle, green, phase);
     }
     
-    fclose(file);
+    csvClose(&csv);
+}
+
+// スナップショットがあればそこから、無ければテキストから読み込む
+void loadAllData(void) {
+    GraphSnapshot snap;
+    bool hasSnap = snapshotOpen(SNAPSHOT_FILE, &snap, SNAP_SECTION(SNAP_SRC_ROUTE) | SNAP_SECTION(SNAP_SRC_SIGNAL));
+
+    edgeIndexInit(&edgeIndex, MAX_EDGES);
+
+    if (hasSnap && snap.valid[SNAP_SRC_ROUTE]) {
+        const SnapRouteRow *rows = snapshotRouteRows(&snap);
+        for (uint32_t i = 0; i < snap.hdr->routeCount; i++) {
+            const SnapRouteRow *r = &rows[i];
+            if (r->tokenCount < 5) continue;
+            int isSignal = r->tokenCount >= 8 ? (int)r->values[7] : 0;
+            addRouteRow((int)r->values[0], (int)r->values[1], r->values[2], r->values[4], isSignal);
+        }
+    } else {
+        loadRouteData("oomiya_route_inf_4.csv");
+    }
+
+    if (hasSnap && snap.valid[SNAP_SRC_SIGNAL]) {
+        const SnapSignalRow *rows = snapshotSignalRows(&snap);
+        for (uint32_t i = 0; i < snap.hdr->signalCount; i++) {
+            addSignalRow(rows[i].from, rows[i].to, (int)rows[i].cycle, (int)rows[i].green, rows[i].phase);
+        }
+    } else {
+        loadSignalData("signal_inf.csv");
+    }
+
+    if (hasSnap) snapshotClose(&snap);
 }
 
 // result2.txtから経路を読み込む
@@ -231,8 +256,7 @@ int main(int argc, char *argv[]) {
     }
     
     // データを読み込む
-    loadRouteData("oomiya_route_inf_4.csv");
-    loadSignalData("signal_inf.csv");
+    loadAllData();
     
     // 基準信号の位相を取得
     int refFrom, refTo;
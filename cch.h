@@ -0,0 +1,600 @@
+/* カスタマイズ可能な縮約階層（CCH: Customizable Contraction Hierarchies）
+ *
+ * ユーザーの好み（重み）が変わるたびに全エッジのコストを作り直して最初から探索する代わりに、
+ * 処理を次の3段階に分ける。
+ *   1. 縮約順序とショートカットの形（ネットワークごとに1回。エッジの重みに依存しない）
+ *   2. カスタマイズ（重みごとに、下三角を順位の低い方から処理してショートカットの重みを決める）
+ *   3. クエリ（順位の高い方へだけ進む双方向ダイクストラ。ショートカットは元のエッジ列に展開する）
+ *
+ * 縮約順序は座標による入れ子分割（nested dissection）で作る。ノードを座標に沿って2つに分け、
+ * 両側をつなぐ境界のノード（セパレータ）を最後に縮約し、両側を再帰的に処理する。
+ * 分け方は4方向の座標軸と中央付近の分割位置を試し、セパレータが最も小さくなるものを選ぶ。
+ * 順序は cchSaveOrder でファイルに保存でき、グラフの形が同じなら cchLoadOrder で読み直せる。
+ * グラフは無向（エッジの重みは向きによらない）とする。
+ */
+
+#ifndef CCH_H
+#define CCH_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <float.h>
+#include "node_heap.h"
+
+#define CCH_MAGIC       "VTCCH\0\0"
+#define CCH_VERSION     1
+#define CCH_INF         DBL_MAX
+#define CCH_LEAF_SIZE   4   // これ以下のノード数になったら分割しない
+#define CCH_SPLIT_MIN   30  // 分割位置を探す範囲（両側とも少なくともこの割合[%]を残す）
+#define CCH_SPLIT_STEPS 32  // 分割位置の候補の細かさ（ノード数 / これ ごとに試す）
+
+// 縮約順序のファイル（ヘッダの後に nodeCount 個の順位が続く）
+typedef struct {
+    char     magic[8];
+    uint32_t version;
+    uint32_t nodeCount;
+    uint64_t topologyHash;  // 隣接リストのハッシュ（グラフの形が同じか確認する）
+    uint64_t rankOffset;
+    uint64_t fileSize;
+} CchFileHeader;
+
+typedef struct {
+    int     nodeCount;
+    int     arcCount;
+    int    *rank;       // ノード → 縮約の順位（小さいほど先に縮約する）
+    int    *order;      // 順位 → ノード
+    // 上向きアーク（縮約で残る辺のうち、相手の順位が高いもの）。CSR 形式で順位の昇順に並べる
+    int    *upOffset;   // ノード u のアークは [upOffset[u], upOffset[u+1])
+    int    *upTarget;   // アークの上側のノード
+    int    *arcTail;    // アークの下側のノード
+    int    *arcEdge;    // 元のエッジ番号（ショートカットだけのアークは -1）
+    // アーク u→v の下三角 (x, u, v)（x は u より順位が低い）。x→u と x→v のアークを持つ
+    int    *triOffset;  // アーク a の下三角は [triOffset[a], triOffset[a+1])
+    int    *triFirst;   // x→u
+    int    *triSecond;  // x→v
+    // カスタマイズの結果
+    double *weight;     // アークの重み
+    int    *middle;     // 重みを与えた下三角の x（元のエッジのままなら -1）
+} CchGraph;
+
+// クエリの作業領域（0: 始点側、1: 終点側）
+typedef struct {
+    double  *dist[2];
+    int     *prevArc[2];   // そのノードに到達した上向きアーク（起点なら -1）
+    int     *touched[2];   // dist を書き換えたノード（次のクエリの前に戻す）
+    int      touchedCount[2];
+    NodeHeap heap[2];
+    int     *chain;        // 経路復元用
+    long     settledCount; // 確定したノード数
+} CchQuery;
+
+static inline void *cchAlloc(size_t count, size_t elemSize) {
+    void *p = malloc((count > 0 ? count : 1) * elemSize);
+    if (!p) {
+        fprintf(stderr, "Error: CCH のメモリを確保できません\n");
+        exit(1);
+    }
+    return p;
+}
+
+static inline void cchFree(CchGraph *g) {
+    free(g->rank);
+    free(g->order);
+    free(g->upOffset);
+    free(g->upTarget);
+    free(g->arcTail);
+    free(g->arcEdge);
+    free(g->triOffset);
+    free(g->triFirst);
+    free(g->triSecond);
+    free(g->weight);
+    free(g->middle);
+    memset(g, 0, sizeof(*g));
+}
+
+/* ---------- 1. 縮約順序（入れ子分割） ---------- */
+
+typedef struct {
+    double key;
+    int    node;
+} CchSortItem;
+
+static inline int cchCompareItems(const void *a, const void *b) {
+    const CchSortItem *x = (const CchSortItem *)a;
+    const CchSortItem *y = (const CchSortItem *)b;
+    if (x->key != y->key) return x->key < y->key ? -1 : 1;
+    return x->node - y->node;
+}
+
+// 分割で使う共有の作業領域
+typedef struct {
+    const int    *adjOffset;
+    const int    *adjTarget;
+    const double *x;
+    const double *y;
+    int          *rank;
+    int          *mark;   // ノードがどの部分に属するか（stamp の値）
+    int           stamp;
+    CchSortItem  *items;
+} CchDissection;
+
+// 方向 dir（0: x, 1: y, 2: x+y, 3: x-y）に射影した座標
+static inline double cchProject(const CchDissection *d, int node, int dir) {
+    switch (dir) {
+        case 0:  return d->x[node];
+        case 1:  return d->y[node];
+        case 2:  return d->x[node] + d->y[node];
+        default: return d->x[node] - d->y[node];
+    }
+}
+
+// items[0..count) を先頭 split 個（A）と残り（B）に分けたときの境界のノード数
+// （相手側に隣接するノードの数。boundary[0] が A 側、boundary[1] が B 側）
+static inline void cchCountBoundary(CchDissection *d, int count, int split, int *stampA, int *stampB,
+                                    int boundary[2]) {
+    *stampA = ++d->stamp;
+    *stampB = ++d->stamp;
+    for (int i = 0; i < count; i++) d->mark[d->items[i].node] = i < split ? *stampA : *stampB;
+
+    boundary[0] = boundary[1] = 0;
+    for (int i = 0; i < count; i++) {
+        int u = d->items[i].node;
+        int other = i < split ? *stampB : *stampA;
+        for (int k = d->adjOffset[u]; k < d->adjOffset[u + 1]; k++) {
+            if (d->mark[d->adjTarget[k]] == other) {
+                boundary[i < split ? 0 : 1]++;
+                break;
+            }
+        }
+    }
+}
+
+// nodes[0..count) に順位 [firstRank, firstRank + count) を割り当てる（nodes は並べ替える）
+static inline void cchDissect(CchDissection *d, int *nodes, int count, int firstRank) {
+    if (count <= CCH_LEAF_SIZE) {
+        for (int i = 0; i < count; i++) d->rank[nodes[i]] = firstRank + i;
+        return;
+    }
+
+    // 4方向 × 中央付近の分割位置を試し、セパレータ（少ない方の側の境界）が最小のものを選ぶ
+    // 同じ大きさなら中央に近い方を選ぶ
+    int bestDir = 0, bestSplit = count / 2, bestSize = count + 1, bestSkew = count;
+    int step = count / CCH_SPLIT_STEPS > 0 ? count / CCH_SPLIT_STEPS : 1;
+    for (int dir = 0; dir < 4; dir++) {
+        for (int i = 0; i < count; i++) {
+            d->items[i].key  = cchProject(d, nodes[i], dir);
+            d->items[i].node = nodes[i];
+        }
+        qsort(d->items, (size_t)count, sizeof(CchSortItem), cchCompareItems);
+        for (int split = count * CCH_SPLIT_MIN / 100; split <= count - count * CCH_SPLIT_MIN / 100; split += step) {
+            if (split <= 0 || split >= count) continue;
+            int stampA, stampB, boundary[2];
+            cchCountBoundary(d, count, split, &stampA, &stampB, boundary);
+            int size = boundary[0] < boundary[1] ? boundary[0] : boundary[1];
+            int skew = abs(2 * split - count);
+            if (size < bestSize || (size == bestSize && skew < bestSkew)) {
+                bestDir   = dir;
+                bestSplit = split;
+                bestSize  = size;
+                bestSkew  = skew;
+            }
+        }
+    }
+
+    for (int i = 0; i < count; i++) {
+        d->items[i].key  = cchProject(d, nodes[i], bestDir);
+        d->items[i].node = nodes[i];
+    }
+    qsort(d->items, (size_t)count, sizeof(CchSortItem), cchCompareItems);
+    int stampA, stampB, boundary[2];
+    cchCountBoundary(d, count, bestSplit, &stampA, &stampB, boundary);
+
+    int sepSide  = boundary[0] <= boundary[1] ? 0 : 1;
+    int other    = sepSide == 0 ? stampB : stampA;
+    int sepStamp = ++d->stamp;
+    for (int i = 0; i < count; i++) {
+        nodes[i] = d->items[i].node;
+        if ((i < bestSplit) != (sepSide == 0)) continue;
+        int u = nodes[i];
+        for (int k = d->adjOffset[u]; k < d->adjOffset[u + 1]; k++) {
+            if (d->mark[d->adjTarget[k]] == other) {
+                d->mark[u] = sepStamp;
+                break;
+            }
+        }
+    }
+
+    // A（セパレータ以外）, B（セパレータ以外）, セパレータ の順に詰め直す
+    int countA = 0, countB = 0, countS = 0;
+    for (int i = 0; i < count; i++) {
+        if (d->mark[nodes[i]] == stampA) d->items[countA++].node = nodes[i];
+    }
+    for (int i = 0; i < count; i++) {
+        if (d->mark[nodes[i]] == stampB) d->items[countA + countB++].node = nodes[i];
+    }
+    for (int i = 0; i < count; i++) {
+        if (d->mark[nodes[i]] == sepStamp) d->items[countA + countB + countS++].node = nodes[i];
+    }
+    for (int i = 0; i < count; i++) nodes[i] = d->items[i].node;
+
+    // セパレータを最後に縮約する（順位を高くする）
+    for (int i = 0; i < countS; i++) d->rank[nodes[countA + countB + i]] = firstRank + countA + countB + i;
+    cchDissect(d, nodes, countA, firstRank);
+    cchDissect(d, nodes + countA, countB, firstRank + countA);
+}
+
+// 座標 (x, y) を使って縮約順序を作る（g->rank / g->order を確保して設定する）
+static inline void cchComputeOrder(CchGraph *g, int nodeCount, const int *adjOffset, const int *adjTarget,
+                                   const double *x, const double *y) {
+    g->nodeCount = nodeCount;
+    g->rank  = (int *)cchAlloc((size_t)nodeCount, sizeof(int));
+    g->order = (int *)cchAlloc((size_t)nodeCount, sizeof(int));
+
+    CchDissection d;
+    d.adjOffset = adjOffset;
+    d.adjTarget = adjTarget;
+    d.x         = x;
+    d.y         = y;
+    d.rank      = g->rank;
+    d.mark      = (int *)calloc((size_t)(nodeCount > 0 ? nodeCount : 1), sizeof(int));
+    d.stamp     = 0;
+    d.items     = (CchSortItem *)cchAlloc((size_t)nodeCount, sizeof(CchSortItem));
+    if (!d.mark) {
+        fprintf(stderr, "Error: CCH のメモリを確保できません\n");
+        exit(1);
+    }
+
+    int *nodes = (int *)cchAlloc((size_t)nodeCount, sizeof(int));
+    for (int i = 0; i < nodeCount; i++) nodes[i] = i;
+    cchDissect(&d, nodes, nodeCount, 0);
+    for (int i = 0; i < nodeCount; i++) g->order[g->rank[i]] = i;
+
+    free(nodes);
+    free(d.mark);
+    free(d.items);
+}
+
+/* ---------- 縮約順序の保存・読み込み ---------- */
+
+// 一時ファイルに書いてから置き換える
+static inline bool cchSaveOrder(const CchGraph *g, const char *path, uint64_t topologyHash) {
+    CchFileHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, CCH_MAGIC, sizeof(hdr.magic));
+    hdr.version      = CCH_VERSION;
+    hdr.nodeCount    = (uint32_t)g->nodeCount;
+    hdr.topologyHash = topologyHash;
+    hdr.rankOffset   = sizeof(CchFileHeader);
+    hdr.fileSize     = hdr.rankOffset + sizeof(int32_t) * (uint64_t)g->nodeCount;
+
+    char tmpPath[512];
+    snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", path);
+    FILE *fp = fopen(tmpPath, "wb");
+    if (!fp) return false;
+
+    bool ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1;
+    for (int i = 0; ok && i < g->nodeCount; i++) {
+        int32_t r = g->rank[i];
+        ok = fwrite(&r, sizeof(r), 1, fp) == 1;
+    }
+    if (fclose(fp) != 0) ok = false;
+    if (!ok || rename(tmpPath, path) != 0) {
+        remove(tmpPath);
+        return false;
+    }
+    return true;
+}
+
+// ファイルの順序がグラフと一致すれば g->rank / g->order を設定して true
+static inline bool cchLoadOrder(CchGraph *g, const char *path, int nodeCount, uint64_t topologyHash) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return false;
+
+    CchFileHeader hdr;
+    if (fread(&hdr, sizeof(hdr), 1, fp) != 1 ||
+        memcmp(hdr.magic, CCH_MAGIC, sizeof(hdr.magic)) != 0 ||
+        hdr.version != CCH_VERSION ||
+        hdr.nodeCount != (uint32_t)nodeCount ||
+        hdr.topologyHash != topologyHash ||
+        hdr.fileSize != hdr.rankOffset + sizeof(int32_t) * (uint64_t)nodeCount ||
+        fseek(fp, (long)hdr.rankOffset, SEEK_SET) != 0) {
+        fclose(fp);
+        fprintf(stderr, "Warning: %s の形式またはグラフが一致しません（使用しません）\n", path);
+        return false;
+    }
+
+    int *rank  = (int *)cchAlloc((size_t)nodeCount, sizeof(int));
+    int *order = (int *)cchAlloc((size_t)nodeCount, sizeof(int));
+    for (int i = 0; i < nodeCount; i++) order[i] = -1;
+    bool ok = true;
+    for (int i = 0; ok && i < nodeCount; i++) {
+        int32_t r;
+        ok = fread(&r, sizeof(r), 1, fp) == 1 && r >= 0 && r < nodeCount && order[r] < 0;
+        if (ok) {
+            rank[i]  = r;
+            order[r] = i;
+        }
+    }
+    fclose(fp);
+    if (!ok) {
+        free(rank);
+        free(order);
+        fprintf(stderr, "Warning: %s の順序が壊れています（使用しません）\n", path);
+        return false;
+    }
+
+    g->nodeCount = nodeCount;
+    g->rank      = rank;
+    g->order     = order;
+    return true;
+}
+
+/* ---------- 縮約（ショートカットの形と下三角） ---------- */
+
+static inline int cchCompareInts(const void *a, const void *b) {
+    int x = *(const int *)a, y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+// アーク u→v（rank[u] < rank[v]）を探す（無ければ -1）
+static inline int cchFindArc(const CchGraph *g, int u, int v) {
+    int lo = g->upOffset[u], hi = g->upOffset[u + 1] - 1;
+    int key = g->rank[v];
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        int r = g->rank[g->upTarget[mid]];
+        if (r == key) return mid;
+        if (r < key) lo = mid + 1;
+        else         hi = mid - 1;
+    }
+    return -1;
+}
+
+// 縮約順序に従ってノードを縮約したときに残る辺（上向きアーク）と下三角を作る
+// adjEdge は元のエッジ番号（カスタマイズで渡す重み配列の添字）
+static inline void cchBuildTopology(CchGraph *g, const int *adjOffset, const int *adjTarget, const int *adjEdge) {
+    int n = g->nodeCount;
+
+    // ノードごとの上向きの隣接（順位で持つ）
+    int **up    = (int **)calloc((size_t)(n > 0 ? n : 1), sizeof(int *));
+    int  *upCnt = (int *)calloc((size_t)(n > 0 ? n : 1), sizeof(int));
+    int  *upCap = (int *)calloc((size_t)(n > 0 ? n : 1), sizeof(int));
+    if (!up || !upCnt || !upCap) {
+        fprintf(stderr, "Error: CCH のメモリを確保できません\n");
+        exit(1);
+    }
+#define CCH_PUSH_UP(u, r) do {                                                   \
+        if (upCnt[u] == upCap[u]) {                                              \
+            upCap[u] = upCap[u] ? upCap[u] * 2 : 4;                              \
+            up[u] = (int *)realloc(up[u], sizeof(int) * (size_t)upCap[u]);       \
+            if (!up[u]) {                                                        \
+                fprintf(stderr, "Error: CCH のメモリを確保できません\n");         \
+                exit(1);                                                         \
+            }                                                                    \
+        }                                                                        \
+        up[u][upCnt[u]++] = (r);                                                 \
+    } while (0)
+
+    for (int u = 0; u < n; u++) {
+        for (int k = adjOffset[u]; k < adjOffset[u + 1]; k++) {
+            int v = adjTarget[k];
+            if (g->rank[v] > g->rank[u]) CCH_PUSH_UP(u, g->rank[v]);
+        }
+    }
+
+    // 順位の低い方から縮約する。x の上向きの隣接は互いに結ばれるので、
+    // そのうち最も順位の低いノード p に残りを引き継げば十分（p を縮約するときに伝わる）
+    for (int r = 0; r < n; r++) {
+        int x = g->order[r];
+        if (upCnt[x] == 0) continue;
+        qsort(up[x], (size_t)upCnt[x], sizeof(int), cchCompareInts);
+        int m = 1;
+        for (int i = 1; i < upCnt[x]; i++) {
+            if (up[x][i] != up[x][m - 1]) up[x][m++] = up[x][i];
+        }
+        upCnt[x] = m;
+        int p = g->order[up[x][0]];
+        for (int i = 1; i < m; i++) CCH_PUSH_UP(p, up[x][i]);
+    }
+#undef CCH_PUSH_UP
+
+    g->upOffset = (int *)cchAlloc((size_t)n + 1, sizeof(int));
+    g->upOffset[0] = 0;
+    for (int u = 0; u < n; u++) g->upOffset[u + 1] = g->upOffset[u] + upCnt[u];
+    g->arcCount  = g->upOffset[n];
+    g->upTarget  = (int *)cchAlloc((size_t)g->arcCount, sizeof(int));
+    g->arcTail   = (int *)cchAlloc((size_t)g->arcCount, sizeof(int));
+    g->arcEdge   = (int *)cchAlloc((size_t)g->arcCount, sizeof(int));
+    g->weight    = (double *)cchAlloc((size_t)g->arcCount, sizeof(double));
+    g->middle    = (int *)cchAlloc((size_t)g->arcCount, sizeof(int));
+    for (int u = 0; u < n; u++) {
+        for (int i = 0; i < upCnt[u]; i++) {
+            int a = g->upOffset[u] + i;
+            g->upTarget[a] = g->order[up[u][i]];
+            g->arcTail[a]  = u;
+            g->arcEdge[a]  = -1;
+        }
+        free(up[u]);
+    }
+    free(up);
+    free(upCnt);
+    free(upCap);
+
+    for (int u = 0; u < n; u++) {
+        for (int k = adjOffset[u]; k < adjOffset[u + 1]; k++) {
+            int v = adjTarget[k];
+            if (g->rank[v] > g->rank[u]) g->arcEdge[cchFindArc(g, u, v)] = adjEdge[k];
+        }
+    }
+
+    // 下三角: x の上向きアーク x→u, x→v（rank[u] < rank[v]）はアーク u→v の下三角になる
+    g->triOffset = (int *)calloc((size_t)g->arcCount + 1, sizeof(int));
+    if (!g->triOffset) {
+        fprintf(stderr, "Error: CCH のメモリを確保できません\n");
+        exit(1);
+    }
+    for (int pass = 0; pass < 2; pass++) {
+        int *fill = NULL;
+        if (pass == 1) {
+            for (int a = 0; a < g->arcCount; a++) g->triOffset[a + 1] += g->triOffset[a];
+            g->triFirst  = (int *)cchAlloc((size_t)g->triOffset[g->arcCount], sizeof(int));
+            g->triSecond = (int *)cchAlloc((size_t)g->triOffset[g->arcCount], sizeof(int));
+            fill = (int *)cchAlloc((size_t)g->arcCount, sizeof(int));
+            memcpy(fill, g->triOffset, sizeof(int) * (size_t)g->arcCount);
+        }
+        for (int x = 0; x < n; x++) {
+            for (int i = g->upOffset[x]; i < g->upOffset[x + 1]; i++) {
+                for (int j = i + 1; j < g->upOffset[x + 1]; j++) {
+                    int a = cchFindArc(g, g->upTarget[i], g->upTarget[j]);
+                    if (pass == 0) {
+                        g->triOffset[a + 1]++;
+                    } else {
+                        g->triFirst[fill[a]]  = i;
+                        g->triSecond[fill[a]] = j;
+                        fill[a]++;
+                    }
+                }
+            }
+        }
+        free(fill);
+    }
+}
+
+/* ---------- 2. カスタマイズ ---------- */
+
+// 元のエッジの重み（edgeWeight[エッジ番号]、通れないエッジは CCH_INF）からアークの重みを決める
+// 下三角 x→u, x→v は x の順位が u より低いので、順位の低いアークから処理すれば確定済み
+static inline void cchCustomize(CchGraph *g, const double *edgeWeight) {
+    for (int a = 0; a < g->arcCount; a++) {
+        g->weight[a] = g->arcEdge[a] >= 0 ? edgeWeight[g->arcEdge[a]] : CCH_INF;
+        g->middle[a] = -1;
+    }
+    for (int r = 0; r < g->nodeCount; r++) {
+        int u = g->order[r];
+        for (int a = g->upOffset[u]; a < g->upOffset[u + 1]; a++) {
+            for (int t = g->triOffset[a]; t < g->triOffset[a + 1]; t++) {
+                double w1 = g->weight[g->triFirst[t]];
+                double w2 = g->weight[g->triSecond[t]];
+                if (w1 >= CCH_INF || w2 >= CCH_INF) continue;
+                if (w1 + w2 < g->weight[a]) {
+                    g->weight[a] = w1 + w2;
+                    g->middle[a] = g->arcTail[g->triFirst[t]];
+                }
+            }
+        }
+    }
+}
+
+/* ---------- 3. クエリ ---------- */
+
+static inline void cchQueryInit(CchQuery *q, int nodeCount) {
+    for (int d = 0; d < 2; d++) {
+        q->dist[d]    = (double *)cchAlloc((size_t)nodeCount, sizeof(double));
+        q->prevArc[d] = (int *)cchAlloc((size_t)nodeCount, sizeof(int));
+        q->touched[d] = (int *)cchAlloc((size_t)nodeCount, sizeof(int));
+        q->touchedCount[d] = 0;
+        for (int i = 0; i < nodeCount; i++) q->dist[d][i] = CCH_INF;
+        nodeHeapInit(&q->heap[d], nodeCount);
+    }
+    q->chain = (int *)cchAlloc((size_t)nodeCount, sizeof(int));
+    q->settledCount = 0;
+}
+
+static inline void cchQueryFree(CchQuery *q) {
+    for (int d = 0; d < 2; d++) {
+        free(q->dist[d]);
+        free(q->prevArc[d]);
+        free(q->touched[d]);
+        nodeHeapFree(&q->heap[d]);
+    }
+    free(q->chain);
+    memset(q, 0, sizeof(*q));
+}
+
+// u と v を結ぶアークを u→v の向きで元のエッジ列に展開して out に追加する
+static inline bool cchUnpack(const CchGraph *g, int u, int v, int *out, int maxEdges, int *count) {
+    int a = g->rank[u] < g->rank[v] ? cchFindArc(g, u, v) : cchFindArc(g, v, u);
+    if (a < 0) return false;
+    if (g->middle[a] < 0) {
+        if (*count >= maxEdges) return false;
+        out[(*count)++] = g->arcEdge[a];
+        return true;
+    }
+    int x = g->middle[a];
+    return cchUnpack(g, u, x, out, maxEdges, count) && cchUnpack(g, x, v, out, maxEdges, count);
+}
+
+// s から t への最短経路（カスタマイズ済みの重み）を元のエッジ列で outEdges に入れる
+// 到達できない・エッジ数が maxEdges を超える場合は false
+static inline bool cchQuery(const CchGraph *g, CchQuery *q, int s, int t,
+                            int *outEdges, int maxEdges, int *outCount, double *outCost) {
+    for (int d = 0; d < 2; d++) {
+        for (int i = 0; i < q->touchedCount[d]; i++) q->dist[d][q->touched[d][i]] = CCH_INF;
+        q->touchedCount[d] = 0;
+        nodeHeapReset(&q->heap[d], q->dist[d]);
+    }
+    int src[2] = { s, t };
+    for (int d = 0; d < 2; d++) {
+        q->dist[d][src[d]]    = 0.0;
+        q->prevArc[d][src[d]] = -1;
+        q->touched[d][q->touchedCount[d]++] = src[d];
+        nodeHeapUpdate(&q->heap[d], src[d]);
+    }
+
+    double best = CCH_INF;
+    int    meet = -1;
+    for (;;) {
+        // キーが最良値未満の側のうち、小さい方を進める
+        int dir = -1;
+        for (int d = 0; d < 2; d++) {
+            int top = nodeHeapPeek(&q->heap[d]);
+            if (top < 0 || q->dist[d][top] >= best) continue;
+            if (dir < 0 || q->dist[d][top] < q->dist[dir][nodeHeapPeek(&q->heap[dir])]) dir = d;
+        }
+        if (dir < 0) break;
+
+        int u = nodeHeapPop(&q->heap[dir]);
+        q->settledCount++;
+        double du = q->dist[dir][u];
+        if (q->dist[1 - dir][u] < CCH_INF && du + q->dist[1 - dir][u] < best) {
+            best = du + q->dist[1 - dir][u];
+            meet = u;
+        }
+        for (int a = g->upOffset[u]; a < g->upOffset[u + 1]; a++) {
+            if (g->weight[a] >= CCH_INF) continue;
+            int    v  = g->upTarget[a];
+            double nd = du + g->weight[a];
+            if (nd < q->dist[dir][v]) {
+                if (q->dist[dir][v] >= CCH_INF) q->touched[dir][q->touchedCount[dir]++] = v;
+                q->dist[dir][v]    = nd;
+                q->prevArc[dir][v] = a;
+                nodeHeapUpdate(&q->heap[dir], v);
+            }
+        }
+    }
+    if (meet < 0) return false;
+
+    // 始点側: meet から s へ遡ったアークを s 側から展開する
+    int count = 0, chainLen = 0;
+    for (int v = meet; q->prevArc[0][v] >= 0; v = g->arcTail[q->prevArc[0][v]]) {
+        q->chain[chainLen++] = q->prevArc[0][v];
+    }
+    for (int i = chainLen - 1; i >= 0; i--) {
+        int a = q->chain[i];
+        if (!cchUnpack(g, g->arcTail[a], g->upTarget[a], outEdges, maxEdges, &count)) return false;
+    }
+    // 終点側: meet から t へ下る
+    for (int v = meet; q->prevArc[1][v] >= 0; v = g->arcTail[q->prevArc[1][v]]) {
+        int a = q->prevArc[1][v];
+        if (!cchUnpack(g, v, g->arcTail[a], outEdges, maxEdges, &count)) return false;
+    }
+
+    *outCount = count;
+    *outCost  = best;
+    return true;
+}
+
+#endif
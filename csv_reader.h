@@ -0,0 +1,397 @@
+/* CSV の読み込み（各プログラム共通）
+ *
+ * これまで各プログラムが fgets（固定長バッファ）と strtok / atof / sscanf で
+ * 個別に解析していた oomiya_route_inf_4.csv / signal_inf.csv / result.csv を
+ * 同じ方法で読み込むためのもの。
+ * - ファイルは mmap して行・カラムをその場で区切る（行の長さに上限はない）
+ * - カラムはヘッダ行の名前から位置を引く（csvColumn）
+ * - 数値は桁数が少ない場合は strtod を呼ばずに変換する（結果は strtod と同じ）
+ * - 数値にならないカラムは false を返し、呼び出し側が csvWarn で行番号付きで報告する
+ * 空のカラムもカラムとして数える（strtok のように詰めない）。引用符は扱わない。
+ *
+ * カラムの区切り位置は csvDouble などで最初に参照したときに求める。
+ * 行の全カラムを数値として読む場合は csvRowDoubles が区切りと変換を1回の走査で行う。
+ */
+
+#ifndef CSV_READER_H
+#define CSV_READER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define CSV_MAX_ROW_DOUBLES 64  // csvRowDoubles で値を返すカラム数の上限
+
+typedef struct {
+    const char  *path;
+    char        *data;           // ファイルの内容（mmap または malloc）
+    size_t       size;
+    bool         mapped;         // data を munmap で解放する
+    const char  *cur;            // 次の行の先頭
+    const char  *lineBegin;      // 現在の行（改行は含まない）
+    const char  *lineEnd;
+    int          lineNo;         // 現在の行の行番号（1始まり）
+    int          fieldCount;     // 現在の行のカラム数（まだ区切っていなければ -1）
+    int          fieldCapacity;
+    const char **fieldStart;     // 現在の行の各カラム（前後の空白・改行は除く。NUL 終端ではない）
+    int         *fieldLength;
+    int          headerCount;    // ヘッダ行のカラム数（ヘッダ行が無ければ 0）
+    const char **headerStart;
+    int         *headerLength;
+} CsvReader;
+
+/* ---------- 行の分割 ---------- */
+
+static inline bool csvIsSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+static inline void csvGrowFields(CsvReader *r, int need) {
+    if (need <= r->fieldCapacity) return;
+    int cap = r->fieldCapacity ? r->fieldCapacity * 2 : 32;
+    while (cap < need) cap *= 2;
+    r->fieldStart  = (const char **)realloc(r->fieldStart, sizeof(const char *) * (size_t)cap);
+    r->fieldLength = (int *)realloc(r->fieldLength, sizeof(int) * (size_t)cap);
+    if (!r->fieldStart || !r->fieldLength) {
+        fprintf(stderr, "Error: CSV のメモリを確保できません\n");
+        exit(1);
+    }
+    r->fieldCapacity = cap;
+}
+
+// [s, e) の前後の空白を除いてカラムとして追加する
+static inline void csvAddField(CsvReader *r, const char *s, const char *e) {
+    while (s < e && csvIsSpace(*s)) s++;
+    while (e > s && csvIsSpace(e[-1])) e--;
+    if (r->fieldCount == r->fieldCapacity) csvGrowFields(r, r->fieldCount + 1);
+    r->fieldStart[r->fieldCount]  = s;
+    r->fieldLength[r->fieldCount] = (int)(e - s);
+    r->fieldCount++;
+}
+
+// 現在の行をカンマで区切る（区切り済みなら何もしない）
+static inline void csvSplit(CsvReader *r) {
+    if (r->fieldCount >= 0) return;
+    r->fieldCount = 0;
+    const char *field = r->lineBegin;
+    for (const char *p = r->lineBegin; p < r->lineEnd; p++) {
+        if (*p == ',') {
+            csvAddField(r, field, p);
+            field = p + 1;
+        }
+    }
+    csvAddField(r, field, r->lineEnd);
+}
+
+// 次の空でない行に進む（ファイルの終わりなら false）
+static inline bool csvNextRow(CsvReader *r) {
+    const char *end = r->data + r->size;
+    while (r->cur && r->cur < end) {
+        const char *line    = r->cur;
+        const char *lineEnd = (const char *)memchr(line, '\n', (size_t)(end - line));
+        if (!lineEnd) lineEnd = end;
+        r->cur = lineEnd < end ? lineEnd + 1 : end;
+        r->lineNo++;
+
+        // 空白だけの行は読み飛ばす
+        const char *p = line;
+        while (p < lineEnd && csvIsSpace(*p)) p++;
+        if (p == lineEnd) continue;
+
+        r->lineBegin  = line;
+        r->lineEnd    = lineEnd;
+        r->fieldCount = -1;
+        return true;
+    }
+    r->fieldCount = 0;
+    return false;
+}
+
+// 現在の行のカラム数
+static inline int csvFieldCount(CsvReader *r) {
+    csvSplit(r);
+    return r->fieldCount;
+}
+
+// 現在の行の col 番目のカラム（無ければ NULL）。*len に長さを入れる
+static inline const char *csvField(CsvReader *r, int col, int *len) {
+    csvSplit(r);
+    if (col < 0 || col >= r->fieldCount) return NULL;
+    *len = r->fieldLength[col];
+    return r->fieldStart[col];
+}
+
+/* ---------- 開く・閉じる ---------- */
+
+static inline void csvClose(CsvReader *r) {
+    if (r->data) {
+        if (r->mapped) munmap(r->data, r->size);
+        else free(r->data);
+    }
+    free(r->fieldStart);
+    free(r->fieldLength);
+    free(r->headerStart);
+    free(r->headerLength);
+    memset(r, 0, sizeof(*r));
+}
+
+// ファイルを開く。hasHeader なら1行目をヘッダ行として読み、csvColumn で名前から位置を引けるようにする
+// 開けない場合は false（メッセージは呼び出し側が出す）
+static inline bool csvOpen(CsvReader *r, const char *path, bool hasHeader) {
+    memset(r, 0, sizeof(*r));
+    r->path = path;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return false;
+    }
+    r->size = (size_t)st.st_size;
+    if (r->size > 0) {
+        void *base = mmap(NULL, r->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (base != MAP_FAILED) {
+            r->data   = (char *)base;
+            r->mapped = true;
+        } else {
+            // mmap できないファイルは全体を読み込む
+            r->data = (char *)malloc(r->size);
+            if (!r->data) {
+                fprintf(stderr, "Error: CSV のメモリを確保できません\n");
+                exit(1);
+            }
+            size_t got = 0;
+            while (got < r->size) {
+                ssize_t n = read(fd, r->data + got, r->size - got);
+                if (n <= 0) break;
+                got += (size_t)n;
+            }
+            r->size = got;
+        }
+    }
+    close(fd);
+
+    r->cur = r->data;
+    // UTF-8 の BOM は読み飛ばす
+    if (r->size >= 3 && memcmp(r->data, "\xEF\xBB\xBF", 3) == 0) r->cur += 3;
+
+    if (hasHeader && csvNextRow(r)) {
+        csvSplit(r);
+        r->headerCount  = r->fieldCount;
+        r->headerStart  = (const char **)malloc(sizeof(const char *) * (size_t)r->headerCount);
+        r->headerLength = (int *)malloc(sizeof(int) * (size_t)r->headerCount);
+        if (!r->headerStart || !r->headerLength) {
+            fprintf(stderr, "Error: CSV のメモリを確保できません\n");
+            exit(1);
+        }
+        memcpy(r->headerStart, r->fieldStart, sizeof(const char *) * (size_t)r->headerCount);
+        memcpy(r->headerLength, r->fieldLength, sizeof(int) * (size_t)r->headerCount);
+    }
+    return true;
+}
+
+// ヘッダ行で name のカラムの位置（無ければ -1）
+static inline int csvColumn(const CsvReader *r, const char *name) {
+    size_t len = strlen(name);
+    for (int i = 0; i < r->headerCount; i++) {
+        if ((size_t)r->headerLength[i] == len && memcmp(r->headerStart[i], name, len) == 0) return i;
+    }
+    return -1;
+}
+
+// "Warning: <path>:<行番号>: ..." の形で現在の行についての警告を出す
+static inline void csvWarn(const CsvReader *r, const char *fmt, ...) {
+    va_list ap;
+    fprintf(stderr, "Warning: %s:%d: ", r->path, r->lineNo);
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fputc('\n', stderr);
+}
+
+/* ---------- 数値の変換 ---------- */
+
+// 10^0 .. 10^22 は double で正確に表せる
+static const double csvPow10[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+// strtod で変換する（カラム全体が数値でなければ false）
+static inline bool csvParseDoubleSlow(const char *s, int len, double *out) {
+    char buf[128];
+    if (len <= 0 || len >= (int)sizeof(buf)) return false;
+    memcpy(buf, s, (size_t)len);
+    buf[len] = '\0';
+    char *end;
+    *out = strtod(buf, &end);
+    return end == buf + len;
+}
+
+// p から10進の数値を読み、読み終えた位置を返す。仮数が 2^53 以下で指数が ±22 以内なら、
+// 仮数と 10 のべき乗はどちらも double で正確に表せるので1回の乗除算で正しく丸められる
+// （strtod と同じ値）。それ以外（桁数が多い・指数が大きい・inf など）は NULL を返す
+static inline const char *csvScanFast(const char *p, const char *end, double *out) {
+    bool     neg   = false;
+    uint64_t mant  = 0;
+    int      exp10 = 0;
+
+    if (p < end && (*p == '+' || *p == '-')) neg = (*p++ == '-');
+    const char *intBegin = p;
+    for (; p < end; p++) {
+        unsigned d = (unsigned)(unsigned char)*p - '0';
+        if (d > 9) break;
+        mant = mant * 10 + d;
+    }
+    int digitCount = (int)(p - intBegin);
+    if (p < end && *p == '.') {
+        const char *fracBegin = ++p;
+        for (; p < end; p++) {
+            unsigned d = (unsigned)(unsigned char)*p - '0';
+            if (d > 9) break;
+            mant = mant * 10 + d;
+        }
+        exp10 = -(int)(p - fracBegin);
+        digitCount -= exp10;
+    }
+    // 19桁を超えると仮数があふれる（先頭の 0 も数えるので安全側）
+    if (digitCount == 0 || digitCount > 19) return NULL;
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        p++;
+        bool expNeg = false;
+        int  e = 0;
+        if (p < end && (*p == '+' || *p == '-')) expNeg = (*p++ == '-');
+        if (p == end || *p < '0' || *p > '9') return NULL;
+        for (; p < end && *p >= '0' && *p <= '9'; p++) {
+            if (e < 10000) e = e * 10 + (*p - '0');
+        }
+        exp10 += expNeg ? -e : e;
+    }
+
+    double v = (double)mant;
+    if (mant != 0) {
+        if (mant > (1ULL << 53) || exp10 < -22 || exp10 > 22) return NULL;
+        v = exp10 < 0 ? v / csvPow10[-exp10] : v * csvPow10[exp10];
+    }
+    *out = neg ? -v : v;
+    return p;
+}
+
+// カラム全体を数値にする（数値でなければ false）
+static inline bool csvParseDouble(const char *s, int len, double *out) {
+    if (csvScanFast(s, s + len, out) == s + len) return true;
+    return csvParseDoubleSlow(s, len, out);
+}
+
+// 現在の行の col 番目のカラムを数値にする（カラムが無い・数値でなければ false）
+static inline bool csvDouble(CsvReader *r, int col, double *out) {
+    int len;
+    const char *s = csvField(r, col, &len);
+    return s && csvParseDouble(s, len, out);
+}
+
+// 現在の行の col 番目のカラムを整数にする（カラムが無い・整数でなければ false）
+static inline bool csvInt(CsvReader *r, int col, int *out) {
+    int len;
+    const char *p = csvField(r, col, &len);
+    if (!p) return false;
+    const char *end = p + len;
+    bool neg = false;
+    if (p < end && (*p == '+' || *p == '-')) neg = (*p++ == '-');
+    if (p == end) return false;
+    long v = 0;
+    for (; p < end; p++) {
+        if (*p < '0' || *p > '9') return false;
+        v = v * 10 + (*p - '0');
+        if (v > 2147483647L) return false;
+    }
+    *out = (int)(neg ? -v : v);
+    return true;
+}
+
+// 現在の行の先頭から maxFields 個のカラムを数値として values に読み、カラム数を返す
+// ok[i] はそのカラムが数値だったか。区切りと変換を1回の走査で行う（csvSplit は使わない）
+static inline int csvRowDoubles(const CsvReader *r, double *values, bool *ok, int maxFields) {
+    const char *p   = r->lineBegin;
+    const char *end = r->lineEnd;
+    int n = 0;
+    for (;;) {
+        while (p < end && csvIsSpace(*p)) p++;
+        double v = 0.0;
+        bool good = false;
+        const char *fieldEnd = csvScanFast(p, end, &v);
+        if (fieldEnd) {
+            while (fieldEnd < end && csvIsSpace(*fieldEnd)) fieldEnd++;
+            good = fieldEnd == end || *fieldEnd == ',';
+        }
+        if (!good) {
+            // 速く変換できないカラムは区切ってから strtod に任せる
+            fieldEnd = (const char *)memchr(p, ',', (size_t)(end - p));
+            if (!fieldEnd) fieldEnd = end;
+            const char *e = fieldEnd;
+            while (e > p && csvIsSpace(e[-1])) e--;
+            good = csvParseDoubleSlow(p, (int)(e - p), &v);
+        }
+        if (n < maxFields) {
+            values[n] = v;
+            ok[n]     = good;
+        }
+        n++;
+        if (fieldEnd >= end) break;
+        p = fieldEnd + 1;
+    }
+    return n;
+}
+
+/* ---------- oomiya_route_inf_4.csv ---------- */
+
+#define CSV_ROUTE_COLUMNS 16
+
+// 各プログラムが使うカラムの順（values[k] は CSV_ROUTE_COLUMN_NAMES[k] のカラム）
+static const char *const CSV_ROUTE_COLUMN_NAMES[CSV_ROUTE_COLUMNS] = {
+    "node1", "node2", "distance", "time_minutes", "gradient", "max_gradient", "min_gradient",
+    "sidewalk", "signal", "road_width", "illumination", "nature", "park", "garbage",
+    "toilet", "crosswalk"
+};
+
+// ヘッダ行から各カラムの位置を引く（無いカラムは -1）
+static inline void csvRouteColumns(const CsvReader *r, int columns[CSV_ROUTE_COLUMNS]) {
+    for (int k = 0; k < CSV_ROUTE_COLUMNS; k++) {
+        columns[k] = csvColumn(r, CSV_ROUTE_COLUMN_NAMES[k]);
+    }
+}
+
+// 現在の行を values に読み込み、先頭から続けてそろっているカラム数を *count に入れる
+// （ヘッダに無い・行に無いカラムでそこまでとする。以前の strtok のトークン数に当たる）
+// 数値にならないカラムがあれば行番号付きで警告して false を返す
+static inline bool csvRouteValues(const CsvReader *r, const int columns[CSV_ROUTE_COLUMNS],
+                                  double values[CSV_ROUTE_COLUMNS], int *count) {
+    double row[CSV_MAX_ROW_DOUBLES];
+    bool   ok[CSV_MAX_ROW_DOUBLES];
+    int fields = csvRowDoubles(r, row, ok, CSV_MAX_ROW_DOUBLES);
+    if (fields > CSV_MAX_ROW_DOUBLES) fields = CSV_MAX_ROW_DOUBLES;
+
+    int n = 0;
+    while (n < CSV_ROUTE_COLUMNS && columns[n] >= 0 && columns[n] < fields) {
+        if (!ok[columns[n]]) {
+            csvWarn(r, "%s が数値ではありません", CSV_ROUTE_COLUMN_NAMES[n]);
+            return false;
+        }
+        values[n] = row[columns[n]];
+        n++;
+    }
+    for (int k = n; k < CSV_ROUTE_COLUMNS; k++) values[k] = 0.0;
+    *count = n;
+    return true;
+}
+
+#endif
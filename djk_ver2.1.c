@@ -1,53 +1,91 @@
 //全ての辺が非負数であれば問題なし、全ての辺に一律1000を足していたが辺の数変動によりコストが変わってしまう、ベルマンフォード法を使うべし
+#define _POSIX_C_SOURCE 200809L //mmap / stat（graph_snapshot.h）
 #include<stdio.h>
 #include<stdlib.h>
 #include<float.h>
 #include<limits.h>
 #include<time.h>
+#include "graph_snapshot.h"
+#include "node_heap.h"
+#include "csv_reader.h"
 
-#define MAX_NODES 250//20241119時点大宮241の頂点，追加可能
 #define INF DBL_MAX
 
 typedef struct {
     int node;
     double weight;
 } Edge;
-//2024_09_10時点対象経路では1つの頂点から出る辺の最大数6のためedges[7]，変更、問題あり→修正完了
+//頂点数・辺の数は result.csv から決める（以前は MAX_NODES 250、1頂点あたり edges[7] の固定長）
+//頂点 u から出る辺は edges[offset[u]] 〜 edges[offset[u+1]-1]（CSR形式）
 typedef struct {
-    Edge edges[7];
-    int edge_count;
+    int num_nodes;
+    int *offset;
+    Edge *edges;
 } Graph;
 
+//読み込んだ辺（build_graph で Graph に変換する）
+typedef struct {
+    int from;
+    int to;
+    double weight;
+} EdgeInput;
+
 //保存するグラフ，始点からの最短距離，ある交差点から１つ前の頂点（最短のもの），訪問の有無（関数内部でも使用するため）
-Graph graph[MAX_NODES];
-double distances[MAX_NODES];
-int previous[MAX_NODES];
-int visited[MAX_NODES];
+Graph graph;
+double *distances;
+int *previous;
+int *visited;
+NodeHeap heap;  //未訪問ノードの優先度付きキュー（キーは distances）
+
+EdgeInput *edge_list;
+int edge_list_count = 0;
+int edge_list_capacity = 0;
 
 //グラフに辺を追加、片方の辺追加に変更
 void add_edge(int from, int to, int weight) {
-    if (graph[from].edge_count >= 7) {
-    printf("Error: Too many edges from node %d.\n", from);
-    exit(1);
+    if (from < 0 || to < 0) return;
+    if (edge_list_count == edge_list_capacity) {
+        edge_list_capacity = edge_list_capacity ? edge_list_capacity * 2 : 1024;
+        edge_list = realloc(edge_list, sizeof(EdgeInput) * edge_list_capacity);
+        if (edge_list == NULL) {
+            printf("Error: memory allocation failed\n");
+            exit(1);
+        }
     }
-    graph[from].edges[graph[from].edge_count].node = to;
-    graph[from].edges[graph[from].edge_count].weight = weight;
-    graph[from].edge_count++;
+    edge_list[edge_list_count].from = from;
+    edge_list[edge_list_count].to = to;
+    edge_list[edge_list_count].weight = weight;
+    edge_list_count++;
 }
-//最短のノードを算出
-int extract_min(int num_nodes) {
-    double min_distance = INF;
-    int min_index = -1;
 
-    //未訪問&&最小距離以下
-    for (int i = 0; i < num_nodes; i++) {
-        if (!visited[i] && distances[i] < min_distance) {
-            min_distance = distances[i];
-            min_index = i;
-        }
+//読み込んだ辺から CSR 形式のグラフを作る（同じ頂点から出る辺は読み込み順）
+void build_graph(int num_nodes) {
+    graph.num_nodes = num_nodes;
+    graph.offset = calloc(num_nodes + 1, sizeof(int));
+    graph.edges = malloc(sizeof(Edge) * (edge_list_count + 1));
+    distances = malloc(sizeof(double) * num_nodes);
+    previous = malloc(sizeof(int) * num_nodes);
+    visited = malloc(sizeof(int) * num_nodes);
+    int *fill = malloc(sizeof(int) * num_nodes);
+    nodeHeapInit(&heap, num_nodes);
+    if (!graph.offset || !graph.edges || !distances || !previous || !visited || !fill) {
+        printf("Error: memory allocation failed\n");
+        exit(1);
     }
 
-    return min_index;
+    for (int i = 0; i < edge_list_count; i++) graph.offset[edge_list[i].from + 1]++;
+    for (int u = 0; u < num_nodes; u++) graph.offset[u + 1] += graph.offset[u];
+    for (int u = 0; u < num_nodes; u++) fill[u] = graph.offset[u];
+    for (int i = 0; i < edge_list_count; i++) {
+        Edge *edge = &graph.edges[fill[edge_list[i].from]++];
+        edge->node = edge_list[i].to;
+        edge->weight = edge_list[i].weight;
+    }
+    free(fill);
+}
+//最短のノードを算出（ヒープには未訪問で距離が決まったノードだけが入っている）
+int extract_min(void) {
+    return nodeHeapPop(&heap);
 }
 
 void dijkstra(int start_node, int num_nodes) {
@@ -59,21 +97,24 @@ void dijkstra(int start_node, int num_nodes) {
     }
 
     distances[start_node] = 0;  // 開始ノードの距離は0
+    nodeHeapReset(&heap, distances);
+    nodeHeapUpdate(&heap, start_node);
 
     for (int i = 0; i < num_nodes - 1; i++) {
-        int u = extract_min(num_nodes);  // 最短距離のノードを取得
+        int u = extract_min();  // 最短距離のノードを取得
         if (u == -1) break;
         visited[u] = 1;
 
         // 隣接ノードの距離を更新
-        for (int j = 0; j < graph[u].edge_count; j++) {
-            Edge edge = graph[u].edges[j];
+        for (int j = graph.offset[u]; j < graph.offset[u + 1]; j++) {
+            Edge edge = graph.edges[j];
             int v = edge.node;
             double weight = edge.weight;
             //訪れてない&&距離が限界値ではない&&合計が
             if (!visited[v] && distances[u] != INF && distances[u] + weight < distances[v]) {
                 distances[v] = distances[u] + weight;
                 previous[v] = u;
+                nodeHeapUpdate(&heap, v);
             }
         }
     }
@@ -99,51 +140,73 @@ void write_path(int node,FILE *file) {
 int main(int argc,char *argv[]) {
     clock_t start_clock,end_clock;
     start_clock = clock();
-    int start_node = atoi(argv[1]);  // 開始ノード
-    int end_node = atoi(argv[2]);    // 終了ノード
-
-    printf("start:%d,end:%d\n",start_node,end_node);
-
 //printf("%d\n",argc);
     if(argc != 3){
         printf("始点と終点の指定をしてください ex) ./djk 1 241\n");
         exit(1);
     }
 
-    if( (start_node<1 || 241<start_node) || (end_node<1 || 241<end_node)){
-        printf("正しい値を入力してください。東大宮周辺:1~241\n");
-        exit(1);
-    }
+    int start_node = atoi(argv[1]);  // 開始ノード
+    int end_node = atoi(argv[2]);    // 終了ノード
 
-    
-    FILE *file = fopen("result.csv", "r");
-    //FILE *file = fopen("result_2.csv", "r");
-    //FILE *file = fopen("result_3.csv", "r");
-    if (file == NULL) {
-        printf("Error: Could not open file.\n");
-        return 1;
-    }
+    printf("start:%d,end:%d\n",start_node,end_node);
 
+
+    FILE *file;
     int from, to;
     double weight;
     int num_nodes = 0;
     //int count_data = 0;//データ確認用
 
-    // ファイルから辺の情報を読み込み 問題なし
-    while (fscanf(file, "%d,%d,%lf", &from, &to, &weight) != EOF) {
-        //printf("%d,%d,%lf\n", from, to, weight);
-        //count_data++;
-        add_edge(from, to, weight);
+    //スナップショットのresult.csvが最新であればそこから読み込む（テキストの解析を省略）
+    GraphSnapshot snap;
+    if (snapshotOpen(SNAPSHOT_FILE, &snap, SNAP_SECTION(SNAP_SRC_RESULT)) && snap.valid[SNAP_SRC_RESULT]) {
+        const SnapResultRow *rows = snapshotResultRows(&snap);
+        for (uint32_t i = 0; i < snap.hdr->resultCount; i++) {
+            add_edge(rows[i].from, rows[i].to, rows[i].weight);
 
-        if (from > num_nodes) num_nodes = from;
-        if (to > num_nodes) num_nodes = to;
-    }
-    //確認用
-    //printf("%d\n",count_data);
+            if (rows[i].from > num_nodes) num_nodes = rows[i].from;
+            if (rows[i].to > num_nodes) num_nodes = rows[i].to;
+        }
+        snapshotClose(&snap);
+    } else {
+        snapshotClose(&snap);
+
+        CsvReader csv;
+        if (!csvOpen(&csv, "result.csv", false)) {
+        //if (!csvOpen(&csv, "result_2.csv", false)) {
+        //if (!csvOpen(&csv, "result_3.csv", false)) {
+            printf("Error: Could not open file.\n");
+            return 1;
+        }
 
-    fclose(file);
+        // ファイルから辺の情報を読み込み 問題なし
+        while (csvNextRow(&csv)) {
+            if (!csvInt(&csv, 0, &from) || !csvInt(&csv, 1, &to) || !csvDouble(&csv, 2, &weight)) {
+                csvWarn(&csv, "from,to,weight として読めません");
+                continue;
+            }
+            //printf("%d,%d,%lf\n", from, to, weight);
+            //count_data++;
+            add_edge(from, to, weight);
+
+            if (from > num_nodes) num_nodes = from;
+            if (to > num_nodes) num_nodes = to;
+        }
+        //確認用
+        //printf("%d\n",count_data);
+
+        csvClose(&csv);
+    }
     num_nodes++;  // ノードの数は最大交差点番号+1
 
+    //交差点番号の上限は読み込んだデータで決まる
+    if( (start_node<1 || num_nodes<=start_node) || (end_node<1 || num_nodes<=end_node)){
+        printf("正しい値を入力してください。東大宮周辺:1~%d\n", num_nodes - 1);
+        exit(1);
+    }
+    build_graph(num_nodes);
+
     // ダイクストラ法の実行
     dijkstra(start_node, num_nodes);
 
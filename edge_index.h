@@ -0,0 +1,100 @@
+/* エッジ索引（正規化した (from,to) → edgeIndex のハッシュ表）
+ *
+ * EdgeData 配列を先頭から線形探索していた findEdgeIndex を定数時間にするためのもの。
+ * キーは normalizeEdgeKey と同じく小さいノード番号を先にした組で、
+ * 値は EdgeData 配列のインデックス。オープンアドレス法（線形探査）で格納する。
+ */
+
+#ifndef EDGE_INDEX_H
+#define EDGE_INDEX_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+typedef struct {
+    uint64_t *keys;      // 0 は空きスロット
+    int      *values;
+    size_t    capacity;  // 2のべき乗
+    size_t    count;
+} EdgeIndex;
+
+static inline uint64_t edgeIndexKey(int from, int to) {
+    uint32_t a = (uint32_t)(from < to ? from : to);
+    uint32_t b = (uint32_t)(from < to ? to : from);
+    // ノード番号は1以上なので 0 にはならない
+    return ((uint64_t)a << 32) | (uint64_t)b;
+}
+
+static inline size_t edgeIndexSlot(uint64_t key, size_t capacity) {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    return (size_t)key & (capacity - 1);
+}
+
+static inline void edgeIndexFree(EdgeIndex *ix) {
+    free(ix->keys);
+    free(ix->values);
+    ix->keys = NULL;
+    ix->values = NULL;
+    ix->capacity = 0;
+    ix->count = 0;
+}
+
+// expectedEdges 本を格納できる大きさで初期化する（足りなくなれば自動で拡張する）
+static inline void edgeIndexInit(EdgeIndex *ix, size_t expectedEdges) {
+    size_t cap = 16;
+    while (cap < expectedEdges * 2) cap <<= 1;
+    ix->keys     = (uint64_t *)calloc(cap, sizeof(uint64_t));
+    ix->values   = (int *)malloc(cap * sizeof(int));
+    ix->capacity = cap;
+    ix->count    = 0;
+    if (!ix->keys || !ix->values) {
+        fprintf(stderr, "Error: エッジ索引のメモリを確保できません\n");
+        exit(1);
+    }
+}
+
+static inline int edgeIndexFind(const EdgeIndex *ix, int from, int to) {
+    if (ix->capacity == 0) return -1;
+    uint64_t key = edgeIndexKey(from, to);
+    size_t   i   = edgeIndexSlot(key, ix->capacity);
+    while (ix->keys[i] != 0) {
+        if (ix->keys[i] == key) return ix->values[i];
+        i = (i + 1) & (ix->capacity - 1);
+    }
+    return -1;
+}
+
+static inline void edgeIndexInsert(EdgeIndex *ix, int from, int to, int edgeIdx);
+
+static inline void edgeIndexGrow(EdgeIndex *ix) {
+    EdgeIndex old = *ix;
+    edgeIndexInit(ix, old.capacity);  // 容量は2倍になる
+    for (size_t i = 0; i < old.capacity; i++) {
+        if (old.keys[i] != 0) {
+            edgeIndexInsert(ix, (int)(old.keys[i] >> 32), (int)(old.keys[i] & 0xffffffffu), old.values[i]);
+        }
+    }
+    edgeIndexFree(&old);
+}
+
+// 既に同じキーがあれば値を上書きする
+static inline void edgeIndexInsert(EdgeIndex *ix, int from, int to, int edgeIdx) {
+    if (ix->capacity == 0) edgeIndexInit(ix, 64);
+    if ((ix->count + 1) * 2 > ix->capacity) edgeIndexGrow(ix);
+
+    uint64_t key = edgeIndexKey(from, to);
+    size_t   i   = edgeIndexSlot(key, ix->capacity);
+    while (ix->keys[i] != 0 && ix->keys[i] != key) {
+        i = (i + 1) & (ix->capacity - 1);
+    }
+    if (ix->keys[i] == 0) {
+        ix->keys[i] = key;
+        ix->count++;
+    }
+    ix->values[i] = edgeIdx;
+}
+
+#endif
@@ -0,0 +1,219 @@
+/* グラフスナップショットの作成
+ * oomiya_route_inf_4.csv / signal_inf.csv / result.csv / oomiya_point/<id>.geojson を
+ * 1つのバイナリファイル（既定: oomiya_graph.snap）にまとめる
+ *
+ * 使い方: ./build_snapshot [出力ファイル]
+ * 形式は graph_snapshot.h を参照
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "graph_snapshot.h"
+#include "csv_reader.h"
+
+#define MAX_LINE_LENGTH 1024
+
+typedef struct {
+    void  *data;
+    size_t count;
+    size_t capacity;
+    size_t elemSize;
+} RowBuffer;
+
+static void rowPush(RowBuffer *buf, const void *row) {
+    if (buf->count == buf->capacity) {
+        buf->capacity = buf->capacity ? buf->capacity * 2 : 256;
+        buf->data = realloc(buf->data, buf->capacity * buf->elemSize);
+        if (!buf->data) {
+            fprintf(stderr, "Error: メモリを確保できません\n");
+            exit(1);
+        }
+    }
+    memcpy((char *)buf->data + buf->count * buf->elemSize, row, buf->elemSize);
+    buf->count++;
+}
+
+// oomiya_route_inf_4.csv（ヘッダ行は除く。カラムはヘッダ行の名前で引く）
+static bool readRouteRows(RowBuffer *out) {
+    CsvReader csv;
+    if (!csvOpen(&csv, SNAPSHOT_ROUTE_FILE, true)) {
+        fprintf(stderr, "Error: cannot open %s\n", SNAPSHOT_ROUTE_FILE);
+        return false;
+    }
+
+    int columns[CSV_ROUTE_COLUMNS];
+    csvRouteColumns(&csv, columns);
+    while (csvNextRow(&csv)) {
+        SnapRouteRow row;
+        memset(&row, 0, sizeof(row));
+        int count;
+        if (!csvRouteValues(&csv, columns, row.values, &count)) continue;
+        row.tokenCount = count;
+        rowPush(out, &row);
+    }
+
+    csvClose(&csv);
+    return true;
+}
+
+// signal_inf.csv（ヘッダ行は除く）
+static bool readSignalRows(RowBuffer *out) {
+    CsvReader csv;
+    if (!csvOpen(&csv, SNAPSHOT_SIGNAL_FILE, true)) {
+        fprintf(stderr, "Error: cannot open %s\n", SNAPSHOT_SIGNAL_FILE);
+        return false;
+    }
+
+    int colFrom     = csvColumn(&csv, "node1");
+    int colTo       = csvColumn(&csv, "node2");
+    int colCycle    = csvColumn(&csv, "cycle");
+    int colGreen    = csvColumn(&csv, "green");
+    int colPhase    = csvColumn(&csv, "phase");
+    int colExpected = csvColumn(&csv, "expected");
+    while (csvNextRow(&csv)) {
+        SnapSignalRow row;
+        int from, to;
+        if (!csvInt(&csv, colFrom, &from) || !csvInt(&csv, colTo, &to) ||
+            !csvDouble(&csv, colCycle, &row.cycle) || !csvDouble(&csv, colGreen, &row.green) ||
+            !csvDouble(&csv, colPhase, &row.phase) || !csvDouble(&csv, colExpected, &row.expected)) {
+            csvWarn(&csv, "failed to parse signal line");
+            continue;
+        }
+        row.from = from;
+        row.to   = to;
+        rowPush(out, &row);
+    }
+
+    csvClose(&csv);
+    return true;
+}
+
+// result.csv: "from,to,weight"
+static bool readResultRows(RowBuffer *out) {
+    CsvReader csv;
+    if (!csvOpen(&csv, SNAPSHOT_RESULT_FILE, false)) {
+        fprintf(stderr, "Error: cannot open %s\n", SNAPSHOT_RESULT_FILE);
+        return false;
+    }
+
+    while (csvNextRow(&csv)) {
+        SnapResultRow row;
+        int from, to;
+        if (!csvInt(&csv, 0, &from) || !csvInt(&csv, 1, &to) || !csvDouble(&csv, 2, &row.weight)) {
+            csvWarn(&csv, "from,to,weight として読めません");
+            continue;
+        }
+        row.from = from;
+        row.to   = to;
+        rowPush(out, &row);
+    }
+
+    csvClose(&csv);
+    return true;
+}
+
+// oomiya_point/<id>.geojson の座標
+static void readPoints(SnapPoint *points, int capacity) {
+    memset(points, 0, sizeof(SnapPoint) * (size_t)capacity);
+
+    for (int nodeId = 1; nodeId < capacity; nodeId++) {
+        char filename[256];
+        snapshotPointPath(filename, sizeof(filename), nodeId);
+
+        FILE *fp = fopen(filename, "r");
+        if (!fp) continue;
+
+        char line[MAX_LINE_LENGTH];
+        if (fgets(line, sizeof(line), fp)) {
+            char *coordsStart = strstr(line, "\"coordinates\":[");
+            if (coordsStart) {
+                double lon, lat;
+                if (sscanf(coordsStart, "\"coordinates\":[%lf,%lf]", &lon, &lat) == 2) {
+                    points[nodeId].lon = lon;
+                    points[nodeId].lat = lat;
+                }
+            }
+        }
+        fclose(fp);
+    }
+}
+
+static uint64_t alignUp(uint64_t v) {
+    return (v + 7) & ~(uint64_t)7;
+}
+
+static bool writeSection(FILE *fp, uint64_t offset, const void *data, size_t bytes) {
+    if (bytes == 0) return true;
+    if (fseek(fp, (long)offset, SEEK_SET) != 0) return false;
+    return fwrite(data, 1, bytes, fp) == bytes;
+}
+
+int main(int argc, char *argv[]) {
+    const char *outPath = argc >= 2 ? argv[1] : SNAPSHOT_FILE;
+
+    RowBuffer routes  = { NULL, 0, 0, sizeof(SnapRouteRow) };
+    RowBuffer signals = { NULL, 0, 0, sizeof(SnapSignalRow) };
+    RowBuffer results = { NULL, 0, 0, sizeof(SnapResultRow) };
+    SnapPoint points[SNAPSHOT_MAX_POINT_ID];
+
+    if (!readRouteRows(&routes) || !readSignalRows(&signals) || !readResultRows(&results)) {
+        return 1;
+    }
+    readPoints(points, SNAPSHOT_MAX_POINT_ID);
+
+    SnapshotHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, SNAPSHOT_MAGIC, sizeof(hdr.magic));
+    hdr.version       = SNAPSHOT_VERSION;
+    hdr.headerSize    = sizeof(SnapshotHeader);
+    hdr.routeCount    = (uint32_t)routes.count;
+    hdr.signalCount   = (uint32_t)signals.count;
+    hdr.resultCount   = (uint32_t)results.count;
+    hdr.pointCapacity = SNAPSHOT_MAX_POINT_ID;
+
+    hdr.routeOffset  = alignUp(sizeof(SnapshotHeader));
+    hdr.signalOffset = alignUp(hdr.routeOffset  + routes.count  * sizeof(SnapRouteRow));
+    hdr.resultOffset = alignUp(hdr.signalOffset + signals.count * sizeof(SnapSignalRow));
+    hdr.pointOffset  = alignUp(hdr.resultOffset + results.count * sizeof(SnapResultRow));
+    hdr.fileSize     = hdr.pointOffset + sizeof(points);
+
+    for (int k = 0; k < SNAP_SRC_COUNT; k++) {
+        if (!snapshotStatSource(k, &hdr.sources[k], true)) {
+            fprintf(stderr, "Error: %s のチェックサムを計算できません\n", hdr.sources[k].path);
+            return 1;
+        }
+    }
+
+    // 途中で失敗しても古いスナップショットを壊さないよう、一時ファイルに書いてから置き換える
+    char tmpPath[512];
+    snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", outPath);
+    FILE *fp = fopen(tmpPath, "wb");
+    if (!fp) {
+        perror("エラー：出力ファイル");
+        return 1;
+    }
+
+    bool ok = writeSection(fp, 0, &hdr, sizeof(hdr)) &&
+              writeSection(fp, hdr.routeOffset,  routes.data,  routes.count  * sizeof(SnapRouteRow)) &&
+              writeSection(fp, hdr.signalOffset, signals.data, signals.count * sizeof(SnapSignalRow)) &&
+              writeSection(fp, hdr.resultOffset, results.data, results.count * sizeof(SnapResultRow)) &&
+              writeSection(fp, hdr.pointOffset,  points, sizeof(points));
+    if (fclose(fp) != 0) ok = false;
+
+    if (!ok || rename(tmpPath, outPath) != 0) {
+        fprintf(stderr, "Error: %s を書き込めません\n", outPath);
+        remove(tmpPath);
+        return 1;
+    }
+
+    printf("スナップショットを作成しました: %s (route=%zu, signal=%zu, result=%zu, %llu bytes)\n",
+           outPath, routes.count, signals.count, results.count, (unsigned long long)hdr.fileSize);
+
+    free(routes.data);
+    free(signals.data);
+    free(results.data);
+    return 0;
+}
@@ -0,0 +1,275 @@
+/* グラフスナップショット（バイナリ形式）の定義と読み込み
+ *
+ * build_snapshot（graph_snapshot.c）が oomiya_route_inf_4.csv / signal_inf.csv /
+ * result.csv / oomiya_point/<id>.geojson を1つのファイルにまとめる。
+ * 各プログラムは mmap してそのまま参照し、テキストの解析を省略する。
+ *
+ * スナップショットには元ファイルのサイズ・更新時刻・チェックサムを記録しておき、
+ * 読み込み時に元ファイルと照合する。元ファイルが変わっていれば該当セクションは
+ * 無効とみなし、呼び出し側は従来どおりテキストから読み込む。
+ * 照合するのは呼び出し側が使うセクションだけ（snapshotOpen の sections）。
+ *
+ * result.csv は up44 が実行ごとに書き直す嗜好コストなので、そのセクションが古いのは
+ * 通常の状態として警告しない。道路・信号・ノード位置のセクションはそれとは独立に使う。
+ */
+
+#ifndef GRAPH_SNAPSHOT_H
+#define GRAPH_SNAPSHOT_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define SNAPSHOT_FILE       "oomiya_graph.snap"
+#define SNAPSHOT_MAGIC      "VTSNAP\0"
+#define SNAPSHOT_VERSION    1
+
+#define SNAPSHOT_ROUTE_FILE  "oomiya_route_inf_4.csv"
+#define SNAPSHOT_SIGNAL_FILE "signal_inf.csv"
+#define SNAPSHOT_RESULT_FILE "result.csv"
+#define SNAPSHOT_POINT_DIR   "oomiya_point"
+
+#define SNAPSHOT_FEATURE_COLUMNS 16   // oomiya_route_inf_4.csv のカラム数
+#define SNAPSHOT_MAX_POINT_ID    300  // oomiya_point/<id>.geojson を探す範囲
+
+// 元ファイルの種類（セクションと1対1）
+enum {
+    SNAP_SRC_ROUTE = 0,
+    SNAP_SRC_SIGNAL,
+    SNAP_SRC_RESULT,
+    SNAP_SRC_POINT,
+    SNAP_SRC_COUNT
+};
+
+// snapshotOpen に渡すセクションの指定
+#define SNAP_SECTION(kind) (1u << (kind))
+
+// 元ファイルの情報（oomiya_point はディレクトリ内のファイル全体をまとめて1つとして扱う）
+typedef struct {
+    char     path[64];
+    uint64_t size;        // バイト数（oomiya_point は合計）
+    int64_t  mtimeSec;    // 更新時刻（oomiya_point は最新のもの）
+    int64_t  mtimeNsec;
+    uint64_t fileCount;   // oomiya_point のファイル数（その他は1）
+    uint64_t checksum;    // FNV-1a 64bit
+} SnapshotSource;
+
+typedef struct {
+    char     magic[8];
+    uint32_t version;
+    uint32_t headerSize;
+    uint32_t routeCount;      // oomiya_route_inf_4.csv のデータ行数（ヘッダ行を除く）
+    uint32_t signalCount;     // signal_inf.csv のデータ行数
+    uint32_t resultCount;     // result.csv の行数
+    uint32_t pointCapacity;   // ノード位置配列の要素数（最大ノード番号+1）
+    uint64_t routeOffset;
+    uint64_t signalOffset;
+    uint64_t resultOffset;
+    uint64_t pointOffset;
+    uint64_t fileSize;
+    SnapshotSource sources[SNAP_SRC_COUNT];
+} SnapshotHeader;
+
+// oomiya_route_inf_4.csv の1行
+// csv_reader.h の CSV_ROUTE_COLUMN_NAMES の順に SNAPSHOT_FEATURE_COLUMNS 個の値を持つ
+typedef struct {
+    int32_t tokenCount;   // 先頭からそろっているカラム数（各プログラムの読み飛ばし条件の再現に使う）
+    int32_t reserved;
+    double  values[SNAPSHOT_FEATURE_COLUMNS];
+} SnapRouteRow;
+
+// signal_inf.csv の1行
+typedef struct {
+    int32_t from;
+    int32_t to;
+    double  cycle;
+    double  green;
+    double  phase;
+    double  expected;
+} SnapSignalRow;
+
+// result.csv の1行
+typedef struct {
+    int32_t from;
+    int32_t to;
+    double  weight;
+} SnapResultRow;
+
+// ノード位置（読み込まれていないノードは 0.0）
+typedef struct {
+    double lat;
+    double lon;
+} SnapPoint;
+
+typedef struct {
+    void                 *base;
+    size_t                size;
+    const SnapshotHeader *hdr;
+    bool valid[SNAP_SRC_COUNT];   // セクションごとの有効フラグ（指定され、元ファイルと一致するか）
+} GraphSnapshot;
+
+/* ---------- チェックサム ---------- */
+
+#define SNAPSHOT_FNV_OFFSET 1469598103934665603ULL
+#define SNAPSHOT_FNV_PRIME  1099511628211ULL
+
+static inline uint64_t snapshotHashBytes(uint64_t h, const void *data, size_t len) {
+    const unsigned char *p = (const unsigned char *)data;
+    for (size_t i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= SNAPSHOT_FNV_PRIME;
+    }
+    return h;
+}
+
+// ファイル全体をハッシュに加える（開けない場合は false）
+static inline bool snapshotHashFile(const char *path, uint64_t *h) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return false;
+    unsigned char buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        *h = snapshotHashBytes(*h, buf, n);
+    }
+    fclose(fp);
+    return true;
+}
+
+/* ---------- 元ファイルの情報取得 ---------- */
+
+static inline void snapshotPointPath(char *buf, size_t len, int nodeId) {
+    snprintf(buf, len, "%s/%d.geojson", SNAPSHOT_POINT_DIR, nodeId);
+}
+
+// stat のみで元ファイルのサイズ・更新時刻を集める（withChecksum が true ならチェックサムも計算）
+static inline bool snapshotStatSource(int kind, SnapshotSource *out, bool withChecksum) {
+    static const char *paths[SNAP_SRC_COUNT] = {
+        SNAPSHOT_ROUTE_FILE, SNAPSHOT_SIGNAL_FILE, SNAPSHOT_RESULT_FILE, SNAPSHOT_POINT_DIR
+    };
+    memset(out, 0, sizeof(*out));
+    snprintf(out->path, sizeof(out->path), "%s", paths[kind]);
+    out->checksum = SNAPSHOT_FNV_OFFSET;
+
+    if (kind != SNAP_SRC_POINT) {
+        struct stat st;
+        if (stat(out->path, &st) != 0) return false;
+        out->size      = (uint64_t)st.st_size;
+        out->mtimeSec  = (int64_t)st.st_mtim.tv_sec;
+        out->mtimeNsec = (int64_t)st.st_mtim.tv_nsec;
+        out->fileCount = 1;
+        if (withChecksum && !snapshotHashFile(out->path, &out->checksum)) return false;
+        return true;
+    }
+
+    // oomiya_point: 存在するファイルをノード番号順にまとめる
+    for (int nodeId = 1; nodeId < SNAPSHOT_MAX_POINT_ID; nodeId++) {
+        char filename[256];
+        snapshotPointPath(filename, sizeof(filename), nodeId);
+        struct stat st;
+        if (stat(filename, &st) != 0) continue;
+
+        out->size += (uint64_t)st.st_size;
+        out->fileCount++;
+        if (st.st_mtim.tv_sec > out->mtimeSec ||
+            (st.st_mtim.tv_sec == out->mtimeSec && st.st_mtim.tv_nsec > out->mtimeNsec)) {
+            out->mtimeSec  = (int64_t)st.st_mtim.tv_sec;
+            out->mtimeNsec = (int64_t)st.st_mtim.tv_nsec;
+        }
+        if (withChecksum) {
+            int32_t id = nodeId;
+            out->checksum = snapshotHashBytes(out->checksum, &id, sizeof(id));
+            if (!snapshotHashFile(filename, &out->checksum)) return false;
+        }
+    }
+    return true;
+}
+
+// 記録されている元ファイル情報と現在のファイルを照合する
+// サイズと更新時刻が一致すればそのまま有効、異なる場合はチェックサムで判定する
+static inline bool snapshotSourceIsFresh(int kind, const SnapshotSource *recorded) {
+    SnapshotSource cur;
+    if (!snapshotStatSource(kind, &cur, false)) return false;
+    if (cur.size != recorded->size || cur.fileCount != recorded->fileCount) return false;
+    if (cur.mtimeSec == recorded->mtimeSec && cur.mtimeNsec == recorded->mtimeNsec) return true;
+
+    if (!snapshotStatSource(kind, &cur, true)) return false;
+    return cur.checksum == recorded->checksum;
+}
+
+/* ---------- 読み込み ---------- */
+
+static inline void snapshotClose(GraphSnapshot *snap) {
+    if (snap->base) munmap(snap->base, snap->size);
+    memset(snap, 0, sizeof(*snap));
+}
+
+// スナップショットを mmap して検証する
+// sections（SNAP_SECTION の OR）で指定したセクションだけを元ファイルと照合し、valid に反映する
+// ファイルが無い・形式が違う場合は false（呼び出し側はテキスト読み込みにフォールバックする）
+static inline bool snapshotOpen(const char *path, GraphSnapshot *snap, unsigned sections) {
+    memset(snap, 0, sizeof(*snap));
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(SnapshotHeader)) {
+        close(fd);
+        return false;
+    }
+
+    void *base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) return false;
+
+    snap->base = base;
+    snap->size = (size_t)st.st_size;
+    snap->hdr  = (const SnapshotHeader *)base;
+
+    const SnapshotHeader *h = snap->hdr;
+    if (memcmp(h->magic, SNAPSHOT_MAGIC, sizeof(h->magic)) != 0 ||
+        h->version != SNAPSHOT_VERSION ||
+        h->headerSize != sizeof(SnapshotHeader) ||
+        h->fileSize != snap->size ||
+        h->routeOffset  + (uint64_t)h->routeCount  * sizeof(SnapRouteRow)  > snap->size ||
+        h->signalOffset + (uint64_t)h->signalCount * sizeof(SnapSignalRow) > snap->size ||
+        h->resultOffset + (uint64_t)h->resultCount * sizeof(SnapResultRow) > snap->size ||
+        h->pointOffset  + (uint64_t)h->pointCapacity * sizeof(SnapPoint)   > snap->size) {
+        fprintf(stderr, "Warning: %s の形式またはバージョンが一致しません（テキストから読み込みます）\n", path);
+        snapshotClose(snap);
+        return false;
+    }
+
+    for (int k = 0; k < SNAP_SRC_COUNT; k++) {
+        if (!(sections & SNAP_SECTION(k))) continue;
+        snap->valid[k] = snapshotSourceIsFresh(k, &h->sources[k]);
+        if (!snap->valid[k] && k != SNAP_SRC_RESULT) {
+            fprintf(stderr, "Warning: %s は %s より古いため使用しません\n", path, h->sources[k].path);
+        }
+    }
+    return true;
+}
+
+static inline const SnapRouteRow *snapshotRouteRows(const GraphSnapshot *snap) {
+    return (const SnapRouteRow *)((const char *)snap->base + snap->hdr->routeOffset);
+}
+
+static inline const SnapSignalRow *snapshotSignalRows(const GraphSnapshot *snap) {
+    return (const SnapSignalRow *)((const char *)snap->base + snap->hdr->signalOffset);
+}
+
+static inline const SnapResultRow *snapshotResultRows(const GraphSnapshot *snap) {
+    return (const SnapResultRow *)((const char *)snap->base + snap->hdr->resultOffset);
+}
+
+static inline const SnapPoint *snapshotPoints(const GraphSnapshot *snap) {
+    return (const SnapPoint *)((const char *)snap->base + snap->hdr->pointOffset);
+}
+
+#endif
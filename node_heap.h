@@ -0,0 +1,121 @@
+/* ダイクストラ用のインデックス付き4分ヒープ（decrease-key 対応）
+ *
+ * 未確定ノードから最短距離のものを取り出すために、全ノードを線形に走査していた処理を
+ * O(log V) にするためのもの。キーは呼び出し側の距離配列を直接参照し、
+ * 距離を更新したら nodeHeapUpdate を呼ぶ。
+ * 距離が同じ場合はノード番号の小さい方を先に取り出す（線形走査と同じ順序になる）。
+ */
+
+#ifndef NODE_HEAP_H
+#define NODE_HEAP_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define NODE_HEAP_ARITY 4
+
+typedef struct {
+    int          *nodes;     // ヒープ配列（ノード番号）
+    int          *pos;       // ノード番号 → ヒープ内の位置（入っていなければ -1）
+    const double *key;       // 距離配列（呼び出し側が所有）
+    int           size;
+    int           capacity;  // ノード数
+} NodeHeap;
+
+static inline void nodeHeapFree(NodeHeap *h) {
+    free(h->nodes);
+    free(h->pos);
+    h->nodes = NULL;
+    h->pos = NULL;
+    h->size = 0;
+    h->capacity = 0;
+}
+
+// ノード番号 0..nodeCount-1 を扱えるように確保する
+static inline void nodeHeapInit(NodeHeap *h, int nodeCount) {
+    h->nodes    = (int *)calloc((size_t)(nodeCount > 0 ? nodeCount : 1), sizeof(int));
+    h->pos      = (int *)malloc(sizeof(int) * (size_t)(nodeCount > 0 ? nodeCount : 1));
+    h->key      = NULL;
+    h->size     = 0;
+    h->capacity = nodeCount;
+    if (!h->nodes || !h->pos) {
+        fprintf(stderr, "Error: ヒープのメモリを確保できません\n");
+        exit(1);
+    }
+    for (int i = 0; i < nodeCount; i++) h->pos[i] = -1;
+}
+
+// 探索ごとに空にして、参照する距離配列を設定する（残っていたノードの分だけ戻す）
+static inline void nodeHeapReset(NodeHeap *h, const double *key) {
+    for (int i = 0; i < h->size; i++) h->pos[h->nodes[i]] = -1;
+    h->size = 0;
+    h->key  = key;
+}
+
+static inline int nodeHeapLess(const NodeHeap *h, int a, int b) {
+    return h->key[a] < h->key[b] || (h->key[a] == h->key[b] && a < b);
+}
+
+static inline void nodeHeapPlace(NodeHeap *h, int i, int node) {
+    h->nodes[i]  = node;
+    h->pos[node] = i;
+}
+
+static inline void nodeHeapSiftUp(NodeHeap *h, int i) {
+    int node = h->nodes[i];
+    while (i > 0) {
+        int parent = (i - 1) / NODE_HEAP_ARITY;
+        if (!nodeHeapLess(h, node, h->nodes[parent])) break;
+        nodeHeapPlace(h, i, h->nodes[parent]);
+        i = parent;
+    }
+    nodeHeapPlace(h, i, node);
+}
+
+static inline void nodeHeapSiftDown(NodeHeap *h, int i) {
+    int node = h->nodes[i];
+    for (;;) {
+        int first = i * NODE_HEAP_ARITY + 1;
+        if (first >= h->size) break;
+        int last = first + NODE_HEAP_ARITY;
+        if (last > h->size) last = h->size;
+
+        int best = first;
+        for (int c = first + 1; c < last; c++) {
+            if (nodeHeapLess(h, h->nodes[c], h->nodes[best])) best = c;
+        }
+        if (!nodeHeapLess(h, h->nodes[best], node)) break;
+        nodeHeapPlace(h, i, h->nodes[best]);
+        i = best;
+    }
+    nodeHeapPlace(h, i, node);
+}
+
+// ノードを追加する。既に入っていれば位置を更新する（キーは小さくなる前提: decrease-key）
+static inline void nodeHeapUpdate(NodeHeap *h, int node) {
+    int i = h->pos[node];
+    if (i < 0) {
+        i = h->size++;
+        nodeHeapPlace(h, i, node);
+    }
+    nodeHeapSiftUp(h, i);
+}
+
+// 最小のノード（取り出さない。空なら -1）
+static inline int nodeHeapPeek(const NodeHeap *h) {
+    return h->size > 0 ? h->nodes[0] : -1;
+}
+
+// 最小のノードを取り出す（空なら -1）
+static inline int nodeHeapPop(NodeHeap *h) {
+    if (h->size == 0) return -1;
+    int top = h->nodes[0];
+    h->pos[top] = -1;
+    if (--h->size > 0) {
+        nodeHeapPlace(h, 0, h->nodes[h->size]);
+        nodeHeapSiftDown(h, 0);
+    }
+    return top;
+}
+
+#endif
@@ -0,0 +1,103 @@
+/* 経路のエッジ列を置くアリーナ
+ *
+ * RouteResult はエッジ列を埋め込まず、ここから切り出した edgeCount 個の領域を指す。
+ * 固定長のブロックを先頭から順に使い、クエリの最初に routeArenaReset で先頭のブロックへ
+ * 戻すだけで全ての経路を解放したことになる（ブロックは次のクエリで使い回す）。
+ * ブロックは realloc しないため、切り出した領域のアドレスはリセットまで変わらない。
+ * 一時的に使う経路は routeArenaMark / routeArenaRewind でスタックのように解放できる。
+ */
+
+#ifndef ROUTE_ARENA_H
+#define ROUTE_ARENA_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define ROUTE_ARENA_BLOCK_SIZE 65536  // 1ブロックの int の個数
+
+typedef struct RouteArenaBlock {
+    struct RouteArenaBlock *next;
+    size_t capacity;  // int の個数
+    size_t used;
+    int    data[];
+} RouteArenaBlock;
+
+typedef struct {
+    RouteArenaBlock *head;
+    RouteArenaBlock *current;  // NULL ならまだ1ブロックも使っていない
+    size_t           used;     // リセット後に切り出した int の個数
+    size_t           reserved; // 確保済みのブロックの int の個数の合計
+} RouteArena;
+
+// 全ての領域を解放したことにする（O(1)）
+static inline void routeArenaReset(RouteArena *a) {
+    a->current = a->head;
+    if (a->head) a->head->used = 0;
+    a->used = 0;
+}
+
+// count 個の int の領域を切り出す（確保できなければ終了）
+static inline int *routeArenaAlloc(RouteArena *a, size_t count) {
+    RouteArenaBlock *b = a->current;
+    if (!b || b->used + count > b->capacity) {
+        // 次のブロックを使い回し、無いか小さすぎれば新しく作ってその手前につなぐ
+        RouteArenaBlock *next = b ? b->next : a->head;
+        if (!next || next->capacity < count) {
+            size_t cap = count > ROUTE_ARENA_BLOCK_SIZE ? count : ROUTE_ARENA_BLOCK_SIZE;
+            RouteArenaBlock *nb = (RouteArenaBlock *)malloc(sizeof(RouteArenaBlock) + cap * sizeof(int));
+            if (!nb) {
+                fprintf(stderr, "Error: 経路のメモリを確保できません\n");
+                exit(1);
+            }
+            nb->capacity = cap;
+            nb->next     = next;
+            if (b) b->next = nb; else a->head = nb;
+            a->reserved += cap;
+            next = nb;
+        }
+        next->used = 0;
+        a->current = b = next;
+    }
+    int *p = b->data + b->used;
+    b->used += count;
+    a->used += count;
+    return p;
+}
+
+// 現在の切り出し位置（routeArenaRewind でここまで戻せる）
+typedef struct {
+    RouteArenaBlock *block;
+    size_t           blockUsed;
+    size_t           used;
+} RouteArenaMark;
+
+static inline RouteArenaMark routeArenaMark(const RouteArena *a) {
+    RouteArenaMark m = { a->current, a->current ? a->current->used : 0, a->used };
+    return m;
+}
+
+// mark より後に切り出した領域をまとめて解放したことにする（O(1)）
+static inline void routeArenaRewind(RouteArena *a, RouteArenaMark m) {
+    if (!m.block) {
+        routeArenaReset(a);
+        return;
+    }
+    a->current       = m.block;
+    a->current->used = m.blockUsed;
+    a->used          = m.used;
+}
+
+static inline void routeArenaFree(RouteArena *a) {
+    RouteArenaBlock *b = a->head;
+    while (b) {
+        RouteArenaBlock *next = b->next;
+        free(b);
+        b = next;
+    }
+    a->head     = NULL;
+    a->current  = NULL;
+    a->used     = 0;
+    a->reserved = 0;
+}
+
+#endif
@@ -0,0 +1,186 @@
+/* 経路集ディレクトリから経路アトラスを作成する
+ * 18-22_green/<N>.csv や 22_25_red/<N>.txt（1ファイル1経路、"a-b.geojson" を1行ずつ並べたもの）を
+ * 1つのバイナリファイル（既定: oomiya_routes.atlas）にまとめる
+ * キーは (ディレクトリ名の2つのノード, N)。*_red のものは N に ROUTE_ATLAS_RED を足す
+ *
+ * 使い方: ./build_route_atlas [--output FILE] [DIR...]
+ *   DIR を省略するとカレントディレクトリの "<a>-<b>_green" / "<a>-<b>_red"（"_" 区切りも可）を全て読む
+ * 形式は route_atlas.h を参照
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <dirent.h>
+#include "route_atlas.h"
+
+#define MAX_ATLAS_DIRS 256
+
+typedef struct {
+    int  number;    // ファイル番号 N
+    bool csv;       // N.csv なら true、N.txt なら false
+} RouteFile;
+
+// "<a>-<b>_green" / "<a>_<b>_red" を解析する
+static bool parseDirName(const char *path, int *origin, int *destination, bool *red) {
+    const char *name = strrchr(path, '/');
+    name = name ? name + 1 : path;
+    char sep, color[8];
+    int  consumed = 0;
+    if (sscanf(name, "%d%c%d_%7[a-z]%n", origin, &sep, destination, color, &consumed) != 4) return false;
+    if ((sep != '-' && sep != '_') || name[consumed] != '\0') return false;
+    if (strcmp(color, "green") == 0) {
+        *red = false;
+    } else if (strcmp(color, "red") == 0) {
+        *red = true;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static int compareRouteFiles(const void *a, const void *b) {
+    const RouteFile *fa = (const RouteFile *)a, *fb = (const RouteFile *)b;
+    if (fa->number != fb->number) return fa->number < fb->number ? -1 : 1;
+    return (int)fb->csv - (int)fa->csv;  // 同じ番号なら距離・時間がある .csv を先にする
+}
+
+static char *readWholeFile(const char *path) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return NULL;
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    char *buf = (char *)malloc((size_t)(size > 0 ? size : 0) + 1);
+    if (!buf) {
+        fclose(fp);
+        return NULL;
+    }
+    size_t n = fread(buf, 1, (size_t)(size > 0 ? size : 0), fp);
+    buf[n] = '\0';
+    fclose(fp);
+    return buf;
+}
+
+// 1ファイル分の経路を追加する
+// .csv は "<a-b.geojson の改行区切り>",距離,歩行時間,待ち時間 の1行、.txt は a-b.geojson の行だけ
+static bool addRouteFile(RouteAtlasBuilder *b, const char *path, bool csv) {
+    char *text = readWholeFile(path);
+    if (!text) {
+        fprintf(stderr, "Warning: %s を読み込めません\n", path);
+        return false;
+    }
+
+    char  *list = text;
+    double distance = NAN, walkTime = NAN, waitTime = NAN;
+    if (csv) {
+        char *open  = strchr(text, '"');
+        char *close = open ? strchr(open + 1, '"') : NULL;
+        if (!close || sscanf(close + 1, ",%lf,%lf,%lf", &distance, &walkTime, &waitTime) != 3) {
+            fprintf(stderr, "Warning: %s の形式が違います\n", path);
+            free(text);
+            return false;
+        }
+        list   = open + 1;
+        *close = '\0';
+    }
+
+    routeAtlasAddRoute(b, distance, walkTime, waitTime, 0, 0);
+    for (char *line = strtok(list, "\r\n"); line; line = strtok(NULL, "\r\n")) {
+        int from, to;
+        if (sscanf(line, " %d-%d.geojson", &from, &to) == 2) routeAtlasAddEdge(b, from, to);
+    }
+    free(text);
+    return true;
+}
+
+// ディレクトリ内の N.csv / N.txt を番号順に追加する（追加したファイル数を返す）
+static int addRouteDir(RouteAtlasBuilder *b, const char *dirPath) {
+    int  origin, destination;
+    bool red;
+    if (!parseDirName(dirPath, &origin, &destination, &red)) {
+        fprintf(stderr, "Warning: %s は経路集のディレクトリ名ではありません\n", dirPath);
+        return 0;
+    }
+
+    DIR *dir = opendir(dirPath);
+    if (!dir) {
+        fprintf(stderr, "Warning: %s を開けません\n", dirPath);
+        return 0;
+    }
+    RouteFile *files    = NULL;
+    size_t     count    = 0;
+    size_t     capacity = 0;
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL) {
+        int  number, consumed = 0;
+        char ext[4];
+        if (sscanf(ent->d_name, "%d.%3[a-z]%n", &number, ext, &consumed) != 2 || ent->d_name[consumed] != '\0') continue;
+        if (strcmp(ext, "csv") != 0 && strcmp(ext, "txt") != 0) continue;
+        files = (RouteFile *)routeAtlasGrow(files, &capacity, count + 1, sizeof(RouteFile));
+        files[count].number = number;
+        files[count].csv    = strcmp(ext, "csv") == 0;
+        count++;
+    }
+    closedir(dir);
+    qsort(files, count, sizeof(RouteFile), compareRouteFiles);
+
+    int added = 0;
+    for (size_t k = 0; k < count; k++) {
+        if (k > 0 && files[k].number == files[k - 1].number) continue;
+        char path[512];
+        snprintf(path, sizeof(path), "%s/%d.%s", dirPath, files[k].number, files[k].csv ? "csv" : "txt");
+        routeAtlasBeginEntry(b, origin, destination, files[k].number + (red ? ROUTE_ATLAS_RED : 0));
+        if (addRouteFile(b, path, files[k].csv)) added++;
+    }
+    free(files);
+    return added;
+}
+
+int main(int argc, char *argv[]) {
+    const char *outPath = ROUTE_ATLAS_FILE;
+    char       *dirs[MAX_ATLAS_DIRS];
+    int         dirCount = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+            outPath = argv[++i];
+        } else if (dirCount < MAX_ATLAS_DIRS) {
+            dirs[dirCount++] = strdup(argv[i]);
+        }
+    }
+
+    // 指定が無ければカレントディレクトリから経路集のディレクトリを探す
+    if (dirCount == 0) {
+        DIR *dir = opendir(".");
+        struct dirent *ent;
+        while (dir && (ent = readdir(dir)) != NULL && dirCount < MAX_ATLAS_DIRS) {
+            int  origin, destination;
+            bool red;
+            struct stat st;
+            if (!parseDirName(ent->d_name, &origin, &destination, &red)) continue;
+            if (stat(ent->d_name, &st) != 0 || !S_ISDIR(st.st_mode)) continue;
+            dirs[dirCount++] = strdup(ent->d_name);
+        }
+        if (dir) closedir(dir);
+    }
+
+    RouteAtlasBuilder b;
+    routeAtlasBuilderInit(&b);
+    int files = 0;
+    for (int d = 0; d < dirCount; d++) {
+        files += addRouteDir(&b, dirs[d]);
+        free(dirs[d]);
+    }
+
+    if (!routeAtlasWrite(&b, outPath)) return 1;
+
+    struct stat st;
+    printf("経路アトラスを作成しました: %s (ディレクトリ %d 個, ファイル %d 個, エッジ表 %zu 本, %lld bytes)\n",
+           outPath, dirCount, files, b.edgeCount, stat(outPath, &st) == 0 ? (long long)st.st_size : -1LL);
+    routeAtlasBuilderFree(&b);
+    return 0;
+}
@@ -0,0 +1,339 @@
+/* 経路アトラス（バイナリ形式）の定義・作成・読み込み
+ *
+ * スライダーの経路集（18-22_green/<N>.csv など、1ファイル1経路の小さなファイル）や
+ * yen --build-atlas で求めた経路を1つのファイル（既定: oomiya_routes.atlas）にまとめる。
+ * キーは (起点ノード, 終点ノード, 変種) で、キーのハッシュ表を引くだけで O(1) で見つかる。
+ * 経路はファイル内のエッジ表 [[from,to],...] の番号の配列で持つ（from < to に正規化）。
+ *
+ * 経路集の変種はファイル番号 N で、*_red のものは ROUTE_ATLAS_RED を足す。
+ * 読み込み側は mmap してそのまま参照する（src/lib/route-atlas.ts も同じ形式を読む）。
+ */
+
+#ifndef ROUTE_ATLAS_H
+#define ROUTE_ATLAS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "edge_index.h"
+
+#define ROUTE_ATLAS_FILE    "oomiya_routes.atlas"
+#define ROUTE_ATLAS_MAGIC   "VTATLAS"
+#define ROUTE_ATLAS_VERSION 1
+#define ROUTE_ATLAS_RED     0x10000  // 経路集の *_red の変種に足す値
+
+typedef struct {
+    char     magic[8];
+    uint32_t version;
+    uint32_t headerSize;
+    uint32_t entryCount;
+    uint32_t slotCount;       // ハッシュ表のスロット数（2のべき乗）
+    uint32_t routeCount;
+    uint32_t edgeCount;       // エッジ表の要素数
+    uint64_t edgeIdCount;     // 全経路のエッジ番号の合計
+    uint64_t slotOffset;
+    uint64_t entryOffset;
+    uint64_t routeOffset;
+    uint64_t edgeOffset;
+    uint64_t edgeIdOffset;
+    uint64_t fileSize;
+} RouteAtlasHeader;
+
+// キー1つ分の経路の並び
+typedef struct {
+    int32_t  origin;
+    int32_t  destination;
+    int32_t  variant;
+    uint32_t routeStart;      // 経路表の開始位置
+    uint32_t routeCount;
+} RouteAtlasEntry;
+
+// 経路1本（距離・時間が分からないものは NaN）
+typedef struct {
+    double   totalDistance;   // m
+    double   totalTime;       // 分
+    double   totalWaitTime;   // yen の JSON の totalWaitTime と同じ値（経路集の .csv は4列目の値）
+    uint32_t edgeStart;       // エッジ番号の列の開始位置
+    uint32_t edgeCount;
+    int32_t  routeType;
+    int32_t  hasSignal;
+} RouteAtlasRoute;
+
+typedef struct {
+    int32_t from;
+    int32_t to;
+} RouteAtlasEdge;
+
+// キーのハッシュ（src/lib/route-atlas.ts の routeAtlasHash と同じ計算）
+static inline uint32_t routeAtlasHash(int32_t origin, int32_t destination, int32_t variant) {
+    uint32_t h = (uint32_t)origin * 0x9e3779b1u;
+    h ^= (uint32_t)destination * 0x85ebca77u;
+    h = (h << 13) | (h >> 19);
+    h ^= (uint32_t)variant * 0xc2b2ae3du;
+    h ^= h >> 16;
+    h *= 0x7feb352du;
+    h ^= h >> 15;
+    h *= 0x846ca68bu;
+    h ^= h >> 16;
+    return h;
+}
+
+/* ---------- 作成 ---------- */
+
+typedef struct {
+    RouteAtlasEntry *entries;
+    RouteAtlasRoute *routes;
+    RouteAtlasEdge  *edges;
+    uint32_t        *edgeIds;
+    size_t           entryCount, entryCapacity;
+    size_t           routeCount, routeCapacity;
+    size_t           edgeCount, edgeCapacity;
+    size_t           edgeIdCount, edgeIdCapacity;
+    EdgeIndex        edgeIndex;  // 正規化した (from,to) → エッジ表の番号
+} RouteAtlasBuilder;
+
+static inline void *routeAtlasGrow(void *ptr, size_t *capacity, size_t needed, size_t elemSize) {
+    if (needed <= *capacity) return ptr;
+    size_t cap = *capacity > 0 ? *capacity : 256;
+    while (cap < needed) cap *= 2;
+    void *p = realloc(ptr, cap * elemSize);
+    if (!p) {
+        fprintf(stderr, "Error: 経路アトラスのメモリを確保できません\n");
+        exit(1);
+    }
+    *capacity = cap;
+    return p;
+}
+
+static inline void routeAtlasBuilderInit(RouteAtlasBuilder *b) {
+    memset(b, 0, sizeof(*b));
+    edgeIndexInit(&b->edgeIndex, 1024);
+}
+
+static inline void routeAtlasBuilderFree(RouteAtlasBuilder *b) {
+    free(b->entries);
+    free(b->routes);
+    free(b->edges);
+    free(b->edgeIds);
+    edgeIndexFree(&b->edgeIndex);
+    memset(b, 0, sizeof(*b));
+}
+
+// 新しいキーを追加する（以降の routeAtlasAddRoute はこのキーの経路になる）
+static inline void routeAtlasBeginEntry(RouteAtlasBuilder *b, int origin, int destination, int variant) {
+    b->entries = (RouteAtlasEntry *)routeAtlasGrow(b->entries, &b->entryCapacity, b->entryCount + 1,
+                                                   sizeof(RouteAtlasEntry));
+    RouteAtlasEntry *e = &b->entries[b->entryCount++];
+    e->origin      = origin;
+    e->destination = destination;
+    e->variant     = variant;
+    e->routeStart  = (uint32_t)b->routeCount;
+    e->routeCount  = 0;
+}
+
+// 最後のキーに経路を追加する（以降の routeAtlasAddEdge はこの経路のエッジになる）
+static inline void routeAtlasAddRoute(RouteAtlasBuilder *b, double totalDistance, double totalTime,
+                                      double totalWaitTime, int routeType, int hasSignal) {
+    b->routes = (RouteAtlasRoute *)routeAtlasGrow(b->routes, &b->routeCapacity, b->routeCount + 1,
+                                                  sizeof(RouteAtlasRoute));
+    RouteAtlasRoute *r = &b->routes[b->routeCount++];
+    r->totalDistance = totalDistance;
+    r->totalTime     = totalTime;
+    r->totalWaitTime = totalWaitTime;
+    r->edgeStart     = (uint32_t)b->edgeIdCount;
+    r->edgeCount     = 0;
+    r->routeType     = routeType;
+    r->hasSignal     = hasSignal;
+    b->entries[b->entryCount - 1].routeCount++;
+}
+
+// 最後の経路にエッジ (from,to) を追加する
+static inline void routeAtlasAddEdge(RouteAtlasBuilder *b, int from, int to) {
+    int id = edgeIndexFind(&b->edgeIndex, from, to);
+    if (id < 0) {
+        b->edges = (RouteAtlasEdge *)routeAtlasGrow(b->edges, &b->edgeCapacity, b->edgeCount + 1,
+                                                    sizeof(RouteAtlasEdge));
+        id = (int)b->edgeCount++;
+        b->edges[id].from = from < to ? from : to;
+        b->edges[id].to   = from < to ? to : from;
+        edgeIndexInsert(&b->edgeIndex, from, to, id);
+    }
+    b->edgeIds = (uint32_t *)routeAtlasGrow(b->edgeIds, &b->edgeIdCapacity, b->edgeIdCount + 1, sizeof(uint32_t));
+    b->edgeIds[b->edgeIdCount++] = (uint32_t)id;
+    b->routes[b->routeCount - 1].edgeCount++;
+}
+
+static inline bool routeAtlasWriteSection(FILE *fp, uint64_t *offset, const void *data, size_t size) {
+    static const char zero[8] = { 0 };
+    size_t pad = (size_t)((8 - *offset % 8) % 8);  // 各セクションは8バイト境界から始める
+    if (pad > 0 && fwrite(zero, 1, pad, fp) != pad) return false;
+    *offset += pad;
+    if (size > 0 && fwrite(data, 1, size, fp) != size) return false;
+    *offset += size;
+    return true;
+}
+
+// ファイルに書き出す（同じキーが2回追加されていれば後のものを無視する）
+static inline bool routeAtlasWrite(const RouteAtlasBuilder *b, const char *path) {
+    size_t slotCount = 16;
+    while (slotCount < b->entryCount * 2) slotCount <<= 1;
+    uint32_t *slots = (uint32_t *)calloc(slotCount, sizeof(uint32_t));  // 登録番号+1（0 は空き）
+    if (!slots) {
+        fprintf(stderr, "Error: 経路アトラスのメモリを確保できません\n");
+        return false;
+    }
+    for (size_t k = 0; k < b->entryCount; k++) {
+        const RouteAtlasEntry *e = &b->entries[k];
+        size_t i = routeAtlasHash(e->origin, e->destination, e->variant) & (slotCount - 1);
+        bool duplicate = false;
+        while (slots[i] != 0) {
+            const RouteAtlasEntry *o = &b->entries[slots[i] - 1];
+            if (o->origin == e->origin && o->destination == e->destination && o->variant == e->variant) {
+                duplicate = true;
+                break;
+            }
+            i = (i + 1) & (slotCount - 1);
+        }
+        if (duplicate) {
+            fprintf(stderr, "Warning: 経路アトラスのキー (%d, %d, %d) が重複しています（後のものを無視します）\n",
+                    e->origin, e->destination, e->variant);
+            continue;
+        }
+        slots[i] = (uint32_t)k + 1;
+    }
+
+    // 途中で失敗しても古いアトラスを壊さないよう、一時ファイルに書いてから置き換える
+    char tmpPath[512];
+    snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", path);
+    FILE *fp = fopen(tmpPath, "wb");
+    if (!fp) {
+        fprintf(stderr, "Error: %s を作成できません\n", tmpPath);
+        free(slots);
+        return false;
+    }
+
+    RouteAtlasHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, ROUTE_ATLAS_MAGIC, sizeof(ROUTE_ATLAS_MAGIC));
+    h.version     = ROUTE_ATLAS_VERSION;
+    h.headerSize  = sizeof(RouteAtlasHeader);
+    h.entryCount  = (uint32_t)b->entryCount;
+    h.slotCount   = (uint32_t)slotCount;
+    h.routeCount  = (uint32_t)b->routeCount;
+    h.edgeCount   = (uint32_t)b->edgeCount;
+    h.edgeIdCount = b->edgeIdCount;
+
+    // 先にオフセットを決めてからヘッダと各セクションを書く
+    uint64_t offset = sizeof(RouteAtlasHeader);
+#define ROUTE_ATLAS_PLACE(field, size) (offset = (offset + 7) & ~(uint64_t)7, h.field = offset, offset += (size))
+    ROUTE_ATLAS_PLACE(slotOffset,   slotCount * sizeof(uint32_t));
+    ROUTE_ATLAS_PLACE(entryOffset,  b->entryCount * sizeof(RouteAtlasEntry));
+    ROUTE_ATLAS_PLACE(routeOffset,  b->routeCount * sizeof(RouteAtlasRoute));
+    ROUTE_ATLAS_PLACE(edgeOffset,   b->edgeCount * sizeof(RouteAtlasEdge));
+    ROUTE_ATLAS_PLACE(edgeIdOffset, b->edgeIdCount * sizeof(uint32_t));
+#undef ROUTE_ATLAS_PLACE
+    h.fileSize = offset;
+
+    uint64_t written = 0;
+    bool ok = routeAtlasWriteSection(fp, &written, &h, sizeof(h)) &&
+              routeAtlasWriteSection(fp, &written, slots, slotCount * sizeof(uint32_t)) &&
+              routeAtlasWriteSection(fp, &written, b->entries, b->entryCount * sizeof(RouteAtlasEntry)) &&
+              routeAtlasWriteSection(fp, &written, b->routes, b->routeCount * sizeof(RouteAtlasRoute)) &&
+              routeAtlasWriteSection(fp, &written, b->edges, b->edgeCount * sizeof(RouteAtlasEdge)) &&
+              routeAtlasWriteSection(fp, &written, b->edgeIds, b->edgeIdCount * sizeof(uint32_t)) &&
+              written == h.fileSize;
+    if (fclose(fp) != 0) ok = false;
+    free(slots);
+    if (!ok || rename(tmpPath, path) != 0) {
+        fprintf(stderr, "Error: %s を書き込めません\n", path);
+        remove(tmpPath);
+        return false;
+    }
+    return true;
+}
+
+/* ---------- 読み込み ---------- */
+
+typedef struct {
+    void                   *base;
+    size_t                  size;
+    const RouteAtlasHeader *hdr;
+} RouteAtlas;
+
+static inline void routeAtlasClose(RouteAtlas *atlas) {
+    if (atlas->base) munmap(atlas->base, atlas->size);
+    memset(atlas, 0, sizeof(*atlas));
+}
+
+// アトラスを mmap して検証する（ファイルが無い・形式が違う場合は false）
+static inline bool routeAtlasOpen(const char *path, RouteAtlas *atlas) {
+    memset(atlas, 0, sizeof(*atlas));
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(RouteAtlasHeader)) {
+        close(fd);
+        return false;
+    }
+
+    void *base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) return false;
+
+    atlas->base = base;
+    atlas->size = (size_t)st.st_size;
+    atlas->hdr  = (const RouteAtlasHeader *)base;
+
+    const RouteAtlasHeader *h = atlas->hdr;
+    if (memcmp(h->magic, ROUTE_ATLAS_MAGIC, sizeof(ROUTE_ATLAS_MAGIC)) != 0 ||
+        h->version != ROUTE_ATLAS_VERSION ||
+        h->headerSize != sizeof(RouteAtlasHeader) ||
+        h->fileSize != atlas->size ||
+        h->slotCount == 0 || (h->slotCount & (h->slotCount - 1)) != 0 ||
+        h->slotOffset   + (uint64_t)h->slotCount  * sizeof(uint32_t)        > atlas->size ||
+        h->entryOffset  + (uint64_t)h->entryCount * sizeof(RouteAtlasEntry) > atlas->size ||
+        h->routeOffset  + (uint64_t)h->routeCount * sizeof(RouteAtlasRoute) > atlas->size ||
+        h->edgeOffset   + (uint64_t)h->edgeCount  * sizeof(RouteAtlasEdge)  > atlas->size ||
+        h->edgeIdOffset + h->edgeIdCount * sizeof(uint32_t)                 > atlas->size) {
+        fprintf(stderr, "Warning: %s の形式またはバージョンが一致しません\n", path);
+        routeAtlasClose(atlas);
+        return false;
+    }
+    return true;
+}
+
+static inline const RouteAtlasRoute *routeAtlasRoutes(const RouteAtlas *atlas) {
+    return (const RouteAtlasRoute *)((const char *)atlas->base + atlas->hdr->routeOffset);
+}
+
+static inline const RouteAtlasEdge *routeAtlasEdges(const RouteAtlas *atlas) {
+    return (const RouteAtlasEdge *)((const char *)atlas->base + atlas->hdr->edgeOffset);
+}
+
+static inline const uint32_t *routeAtlasEdgeIds(const RouteAtlas *atlas) {
+    return (const uint32_t *)((const char *)atlas->base + atlas->hdr->edgeIdOffset);
+}
+
+// キーの経路の並びを返す（無ければ NULL）
+static inline const RouteAtlasEntry *routeAtlasFind(const RouteAtlas *atlas, int origin, int destination, int variant) {
+    const uint32_t        *slots   = (const uint32_t *)((const char *)atlas->base + atlas->hdr->slotOffset);
+    const RouteAtlasEntry *entries = (const RouteAtlasEntry *)((const char *)atlas->base + atlas->hdr->entryOffset);
+    uint32_t mask = atlas->hdr->slotCount - 1;
+    uint32_t i    = routeAtlasHash(origin, destination, variant) & mask;
+    while (slots[i] != 0) {
+        const RouteAtlasEntry *e = &entries[slots[i] - 1];
+        if (e->origin == origin && e->destination == destination && e->variant == variant) return e;
+        i = (i + 1) & mask;
+    }
+    return NULL;
+}
+
+#endif
@@ -0,0 +1,181 @@
+/* 経路の重複判定（エッジ列 → 登録番号のハッシュ表）
+ *
+ * 全網羅では信号の組み合わせが違っても同じエッジ列になる経路が多いため、
+ * 生成した経路を列挙順に登録して同じものを見つける。エッジ列は表の中に複製して持つので、
+ * 登録元の経路を解放した後も判定に使える。ハッシュはエッジ列の多項式ローリングハッシュで、
+ * 一致したときだけエッジ列そのものを比べる。オープンアドレス法（線形探査）で格納する。
+ */
+
+#ifndef ROUTE_SET_H
+#define ROUTE_SET_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct {
+    uint64_t *hashes;        // 登録番号ごとのハッシュ
+    int      *offsets;       // 登録番号ごとの edges 内の開始位置（count + 1 要素）
+    int      *edges;         // 登録した経路のエッジ列を続けて並べたもの
+    int      *slots;         // 登録番号（-1 は空きスロット）
+    size_t    slotCapacity;  // 2のべき乗
+    int       count;
+    int       capacity;      // hashes / offsets の要素数
+    int       edgeCount;
+    int       edgeCapacity;
+} RouteSet;
+
+static inline uint64_t routeSetHash(const int *edges, int edgeCount) {
+    uint64_t h = 0xcbf29ce484222325ULL ^ (uint64_t)(uint32_t)edgeCount;
+    for (int i = 0; i < edgeCount; i++) {
+        h = (h + (uint64_t)(uint32_t)edges[i] + 1) * 0x100000001b3ULL;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h;
+}
+
+static inline void *routeSetAlloc(void *ptr, size_t size) {
+    void *p = realloc(ptr, size);
+    if (!p) {
+        fprintf(stderr, "Error: 経路の重複判定のメモリを確保できません\n");
+        exit(1);
+    }
+    return p;
+}
+
+static inline void routeSetInit(RouteSet *set) {
+    memset(set, 0, sizeof(*set));
+}
+
+static inline void routeSetFree(RouteSet *set) {
+    free(set->hashes);
+    free(set->offsets);
+    free(set->edges);
+    free(set->slots);
+    routeSetInit(set);
+}
+
+// 登録を全て取り消す（確保した領域は次のクエリで使い回す）
+static inline void routeSetClear(RouteSet *set) {
+    if (set->slots) memset(set->slots, 0xff, set->slotCapacity * sizeof(int));
+    set->count     = 0;
+    set->edgeCount = 0;
+}
+
+static inline bool routeSetSameEdges(const RouteSet *set, int index, const int *edges, int edgeCount) {
+    int offset = set->offsets[index];
+    return set->offsets[index + 1] - offset == edgeCount &&
+           memcmp(set->edges + offset, edges, sizeof(int) * (size_t)edgeCount) == 0;
+}
+
+static inline void routeSetRehash(RouteSet *set, size_t slotCapacity) {
+    set->slots        = (int *)routeSetAlloc(set->slots, slotCapacity * sizeof(int));
+    set->slotCapacity = slotCapacity;
+    memset(set->slots, 0xff, slotCapacity * sizeof(int));
+    for (int k = 0; k < set->count; k++) {
+        size_t i = (size_t)set->hashes[k] & (slotCapacity - 1);
+        while (set->slots[i] >= 0) i = (i + 1) & (slotCapacity - 1);
+        set->slots[i] = k;
+    }
+}
+
+// 同じエッジ列が登録済みなら true を返す（登録はしない）
+static inline bool routeSetContains(const RouteSet *set, const int *edges, int edgeCount) {
+    if (set->count == 0) return false;
+    uint64_t h = routeSetHash(edges, edgeCount);
+    size_t   i = (size_t)h & (set->slotCapacity - 1);
+    while (set->slots[i] >= 0) {
+        int k = set->slots[i];
+        if (set->hashes[k] == h && routeSetSameEdges(set, k, edges, edgeCount)) return true;
+        i = (i + 1) & (set->slotCapacity - 1);
+    }
+    return false;
+}
+
+// 同じエッジ列が登録済みなら false を返し、*index にその登録番号を入れる
+// 無ければ登録して true を返し、*index に新しい登録番号（登録順に 0, 1, ...）を入れる
+static inline bool routeSetInsert(RouteSet *set, const int *edges, int edgeCount, int *index) {
+    if ((size_t)(set->count + 1) * 2 > set->slotCapacity) {
+        routeSetRehash(set, set->slotCapacity > 0 ? set->slotCapacity * 2 : 1024);
+    }
+
+    uint64_t h = routeSetHash(edges, edgeCount);
+    size_t   i = (size_t)h & (set->slotCapacity - 1);
+    while (set->slots[i] >= 0) {
+        int k = set->slots[i];
+        if (set->hashes[k] == h && routeSetSameEdges(set, k, edges, edgeCount)) {
+            *index = k;
+            return false;
+        }
+        i = (i + 1) & (set->slotCapacity - 1);
+    }
+
+    if (set->count + 2 > set->capacity) {
+        set->capacity = set->capacity > 0 ? set->capacity * 2 : 256;
+        set->hashes   = (uint64_t *)routeSetAlloc(set->hashes, sizeof(uint64_t) * (size_t)set->capacity);
+        set->offsets  = (int *)routeSetAlloc(set->offsets, sizeof(int) * (size_t)set->capacity);
+    }
+    if (set->edgeCount + edgeCount > set->edgeCapacity) {
+        while (set->edgeCount + edgeCount > set->edgeCapacity) {
+            set->edgeCapacity = set->edgeCapacity > 0 ? set->edgeCapacity * 2 : 4096;
+        }
+        set->edges = (int *)routeSetAlloc(set->edges, sizeof(int) * (size_t)set->edgeCapacity);
+    }
+
+    int k = set->count++;
+    set->hashes[k]  = h;
+    set->offsets[k] = set->edgeCount;
+    if (edgeCount > 0) memcpy(set->edges + set->edgeCount, edges, sizeof(int) * (size_t)edgeCount);
+    set->edgeCount += edgeCount;
+    set->offsets[k + 1] = set->edgeCount;
+    set->slots[i] = k;
+    *index = k;
+    return true;
+}
+
+// エッジ列のハッシュだけを持つ集合（エッジ列そのものは持たない）
+// 1本あたり数バイトで済むため、見つけた経路を全て覚えておきたいが経路自体は捨てる場合に使う
+// （64ビットのハッシュが一致した別の経路を同じものとみなす可能性は無視できるほど小さい）
+typedef struct {
+    uint64_t *keys;      // 0 は空きスロット
+    size_t    capacity;  // 2のべき乗
+    size_t    count;
+} RouteFingerprints;
+
+static inline void routeFingerprintsFree(RouteFingerprints *fp) {
+    free(fp->keys);
+    memset(fp, 0, sizeof(*fp));
+}
+
+// ハッシュが未登録なら登録して true、登録済みなら false を返す
+static inline bool routeFingerprintsInsert(RouteFingerprints *fp, uint64_t hash) {
+    if (hash == 0) hash = 1;
+    if ((fp->count + 1) * 2 > fp->capacity) {
+        RouteFingerprints old = *fp;
+        fp->capacity = old.capacity > 0 ? old.capacity * 2 : 1024;
+        fp->keys     = (uint64_t *)calloc(fp->capacity, sizeof(uint64_t));
+        fp->count    = 0;
+        if (!fp->keys) {
+            fprintf(stderr, "Error: 経路の重複判定のメモリを確保できません\n");
+            exit(1);
+        }
+        for (size_t i = 0; i < old.capacity; i++) {
+            if (old.keys[i] != 0) routeFingerprintsInsert(fp, old.keys[i]);
+        }
+        free(old.keys);
+    }
+    size_t i = (size_t)hash & (fp->capacity - 1);
+    while (fp->keys[i] != 0) {
+        if (fp->keys[i] == hash) return false;
+        i = (i + 1) & (fp->capacity - 1);
+    }
+    fp->keys[i] = hash;
+    fp->count++;
+    return true;
+}
+
+#endif
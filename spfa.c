@@ -1,55 +1,58 @@
 /* SPFAアルゴリズム */
 
+#define _POSIX_C_SOURCE 200809L // mmap / stat（graph_snapshot.h）
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <float.h>
 #include <time.h>
 #include <stdbool.h>
+#include "graph_snapshot.h"
+#include "csv_reader.h"
 
-#define MAX_NODES 300 // 最大のノード数を指定
 #define INF DBL_MAX
 
-// 
+// リングバッファのキュー
+// in_queue で同じノードを重複して入れないため、容量はノード数あれば足りる
 typedef struct {
-    int items[MAX_NODES];
+    int *items;
+    int capacity;
     int front;
-    int rear;
+    int size;
 } Queue;
 
-void init_queue(Queue* q) {
-    q->front = -1;
-    q->rear = -1;
+void init_queue(Queue* q, int capacity) {
+    q->items = malloc(sizeof(int) * capacity);
+    if (q->items == NULL) {
+        printf("Error: memory allocation failed\n");
+        exit(1);
+    }
+    q->capacity = capacity;
+    q->front = 0;
+    q->size = 0;
 }
 
 bool is_queue_empty(Queue* q) {
-    return q->rear == -1;
+    return q->size == 0;
 }
 
 void enqueue(Queue* q, int value) {
-    if (q->rear == MAX_NODES - 1) {
+    if (q->size == q->capacity) {
         // printf("Queue is full\n");
-    } else {
-        if (q->front == -1) {
-            q->front = 0;
-        }
-        q->rear++;
-        q->items[q->rear] = value;
+        return;
     }
+    q->items[(q->front + q->size) % q->capacity] = value;
+    q->size++;
 }
 
 int dequeue(Queue* q) {
-    int item;
     if (is_queue_empty(q)) {
         // printf("Queue is empty\n");
-        item = -1;
-    } else {
-        item = q->items[q->front];
-        q->front++;
-        if (q->front > q->rear) {
-            // printf("Resetting queue\n");
-            init_queue(q);
-        }
+        return -1;
     }
+    int item = q->items[q->front];
+    q->front = (q->front + 1) % q->capacity;
+    q->size--;
     return item;
 }
 
@@ -59,28 +62,72 @@ typedef struct {
     double weight;
 } Edge;
 
+// 頂点数・辺の数は result.csv から決める
+// 頂点 u から出る辺は edges[offset[u]] 〜 edges[offset[u+1]-1]（CSR形式）
 typedef struct {
-    Edge edges[7];
-    int edge_count;
+    int num_nodes;
+    int *offset;
+    Edge *edges;
 } Graph;
 
-Graph graph[MAX_NODES];
-double distances[MAX_NODES];
-int previous[MAX_NODES];
+// 読み込んだ辺（build_graph で Graph に変換する）
+typedef struct {
+    int from;
+    int to;
+    double weight;
+} EdgeInput;
+
+Graph graph;
+double *distances;
+int *previous;
+
+EdgeInput *edge_list;
+int edge_list_count = 0;
+int edge_list_capacity = 0;
 
 void add_edge(int from, int to, double weight) {
-    if (graph[from].edge_count >= 7) {
-        printf("Error: Too many edges from node %d.\n", from);
+    if (from < 0 || to < 0) return;
+    if (edge_list_count == edge_list_capacity) {
+        edge_list_capacity = edge_list_capacity ? edge_list_capacity * 2 : 1024;
+        edge_list = realloc(edge_list, sizeof(EdgeInput) * edge_list_capacity);
+        if (edge_list == NULL) {
+            printf("Error: memory allocation failed\n");
+            exit(1);
+        }
+    }
+    edge_list[edge_list_count].from = from;
+    edge_list[edge_list_count].to = to;
+    edge_list[edge_list_count].weight = weight;
+    edge_list_count++;
+}
+
+// 読み込んだ辺から CSR 形式のグラフを作る（同じ頂点から出る辺は読み込み順）
+void build_graph(int num_nodes) {
+    graph.num_nodes = num_nodes;
+    graph.offset = calloc(num_nodes + 1, sizeof(int));
+    graph.edges = malloc(sizeof(Edge) * (edge_list_count + 1));
+    distances = malloc(sizeof(double) * num_nodes);
+    previous = malloc(sizeof(int) * num_nodes);
+    int *fill = malloc(sizeof(int) * num_nodes);
+    if (!graph.offset || !graph.edges || !distances || !previous || !fill) {
+        printf("Error: memory allocation failed\n");
         exit(1);
     }
-    graph[from].edges[graph[from].edge_count].node = to;
-    graph[from].edges[graph[from].edge_count].weight = weight;
-    graph[from].edge_count++;
+
+    for (int i = 0; i < edge_list_count; i++) graph.offset[edge_list[i].from + 1]++;
+    for (int u = 0; u < num_nodes; u++) graph.offset[u + 1] += graph.offset[u];
+    for (int u = 0; u < num_nodes; u++) fill[u] = graph.offset[u];
+    for (int i = 0; i < edge_list_count; i++) {
+        Edge *edge = &graph.edges[fill[edge_list[i].from]++];
+        edge->node = edge_list[i].to;
+        edge->weight = edge_list[i].weight;
+    }
+    free(fill);
 }
 
 void spfa(int start_node, int num_nodes) {
-    bool in_queue[MAX_NODES] = {false};
-    int count[MAX_NODES] = {0};
+    bool *in_queue = calloc(num_nodes, sizeof(bool));
+    int *count = calloc(num_nodes, sizeof(int));
     Queue q;
 
     for (int i = 0; i < num_nodes; i++) {
@@ -89,7 +136,7 @@ void spfa(int start_node, int num_nodes) {
     }
 
     distances[start_node] = 0;
-    init_queue(&q);
+    init_queue(&q, num_nodes);
     enqueue(&q, start_node);
     in_queue[start_node] = true;
 
@@ -99,11 +146,11 @@ void spfa(int start_node, int num_nodes) {
 
         if (count[u]++ > num_nodes) {
             printf("負の値が検出されました!\n");
-            return;
+            break;
         }
 
-        for (int i = 0; i < graph[u].edge_count; i++) {
-            Edge edge = graph[u].edges[i];
+        for (int i = graph.offset[u]; i < graph.offset[u + 1]; i++) {
+            Edge edge = graph.edges[i];
             int v = edge.node;
             double weight = edge.weight;
 
@@ -117,6 +164,10 @@ void spfa(int start_node, int num_nodes) {
             }
         }
     }
+
+    free(q.items);
+    free(in_queue);
+    free(count);
 }
 
 void write_path(int node, FILE *file) {
@@ -151,33 +202,58 @@ int main(int argc, char *argv[]) {
 
     printf("start:%d, end:%d\n", start_node, end_node);
 
-    if ((start_node < 1 || MAX_NODES <= start_node) || (end_node < 1 || MAX_NODES <= end_node)) {
-        printf("Please enter valid node numbers (1 to %d)\n", MAX_NODES - 1);
-        exit(1);
-    }
-
-    // result.csvの読み込み
-    FILE *file = fopen("result.csv", "r");
-    if (file == NULL) {
-        printf("Error: result.csvが開けません\n");
-        return 1;
-    }
-
     int from, to;
     double weight;
     int num_nodes = 0;
 
-    while (fscanf(file, "%d,%d,%lf", &from, &to, &weight) != EOF) {
-        if ((from == blocked_node1 && to == blocked_node2) || (from == blocked_node2 && to == blocked_node1)) {
-            continue; // Skip the blocked edge
+    // スナップショットのresult.csvが最新であればそこから読み込む
+    GraphSnapshot snap;
+    if (snapshotOpen(SNAPSHOT_FILE, &snap, SNAP_SECTION(SNAP_SRC_RESULT)) && snap.valid[SNAP_SRC_RESULT]) {
+        const SnapResultRow *rows = snapshotResultRows(&snap);
+        for (uint32_t i = 0; i < snap.hdr->resultCount; i++) {
+            from = rows[i].from;
+            to = rows[i].to;
+            if ((from == blocked_node1 && to == blocked_node2) || (from == blocked_node2 && to == blocked_node1)) {
+                continue; // Skip the blocked edge
+            }
+            add_edge(from, to, rows[i].weight);
+            if (from > num_nodes) num_nodes = from;
+            if (to > num_nodes) num_nodes = to;
         }
-        add_edge(from, to, weight);
-        if (from > num_nodes) num_nodes = from;
-        if (to > num_nodes) num_nodes = to;
+        snapshotClose(&snap);
+    } else {
+        snapshotClose(&snap);
+
+        // result.csvの読み込み
+        CsvReader csv;
+        if (!csvOpen(&csv, "result.csv", false)) {
+            printf("Error: result.csvが開けません\n");
+            return 1;
+        }
+
+        while (csvNextRow(&csv)) {
+            if (!csvInt(&csv, 0, &from) || !csvInt(&csv, 1, &to) || !csvDouble(&csv, 2, &weight)) {
+                csvWarn(&csv, "from,to,weight として読めません");
+                continue;
+            }
+            if ((from == blocked_node1 && to == blocked_node2) || (from == blocked_node2 && to == blocked_node1)) {
+                continue; // Skip the blocked edge
+            }
+            add_edge(from, to, weight);
+            if (from > num_nodes) num_nodes = from;
+            if (to > num_nodes) num_nodes = to;
+        }
+        csvClose(&csv);
     }
-    fclose(file);
     num_nodes++;
 
+    // ノード番号の上限は読み込んだデータで決まる
+    if ((start_node < 1 || num_nodes <= start_node) || (end_node < 1 || num_nodes <= end_node)) {
+        printf("Please enter valid node numbers (1 to %d)\n", num_nodes - 1);
+        exit(1);
+    }
+    build_graph(num_nodes);
+
     // spfaでの計算
     spfa(start_node, num_nodes);
 
@@ -2013,42 +2013,71 @@ export default function Home() {
                 }
             });
 
-            // CSVファイルを読み込む
-            const fileName = `${fileNumber}.csv`;
-            const csvFilePath = `/api/main_server_route/static/${directory}/${fileName}`;
-            console.log(`[CSVファイル読み込み] ${csvFilePath}`);
-            const csvResponse = await fetch(csvFilePath);
-            if (!csvResponse.ok) {
-                let errorData: any = {};
-                try {
-                    errorData = await csvResponse.json();
-                } catch {
-                    errorData = { error: await csvResponse.text().catch(() => '') };
+            // 経路アトラス（oomiya_routes.atlas）から読み込み、無ければ従来どおりCSVファイルを読み込む
+            // キーは edgeId の2つのノードとファイル番号（赤は ROUTE_ATLAS_RED = 0x10000 を足す）
+            let row: string[] | undefined;
+            const [atlasOrigin, atlasDestination] = edgeId.split('-').map(Number);
+            const atlasVariant = fileNumber + (sliderType === 1 ? 0 : 0x10000);
+            const atlasResponse = await fetch(
+                `/api/main_server_route/routeAtlas?origin=${atlasOrigin}&destination=${atlasDestination}&variant=${atlasVariant}`
+            );
+            if (atlasResponse.ok) {
+                const { routes } = await atlasResponse.json();
+                const route = routes[0];
+                // 経路集の N.txt 由来の経路は距離・時間を持たない（JSON では null）。紫の経路は
+                // 距離・時間を表示するので、そのような経路は使わない（CSV も無ければ従来どおり表示しない）
+                const hasMetrics =
+                    route &&
+                    [route.totalDistance, route.totalTime, route.totalWaitTime].every(
+                        (v: unknown) => typeof v === 'number' && Number.isFinite(v)
+                    );
+                if (hasMetrics) {
+                    row = [
+                        route.userPref,
+                        String(route.totalDistance),
+                        String(route.totalTime),
+                        String(route.totalWaitTime),
+                    ];
                 }
-                console.error(
-                    `ファイルが見つかりません: ${csvFilePath}, status: ${csvResponse.status}`,
-                    errorData
-                );
-                return;
             }
 
-            const csvText = await csvResponse.text();
-            
-            // PapaParseを動的にインポート
-            const PapaModule = await import('papaparse');
-            const Papa = PapaModule.default;
-            
-            const parsed = Papa.parse(csvText, {
-                header: false,
-                skipEmptyLines: true,
-            });
+            if (!row) {
+                const fileName = `${fileNumber}.csv`;
+                const csvFilePath = `/api/main_server_route/static/${directory}/${fileName}`;
+                console.log(`[CSVファイル読み込み] ${csvFilePath}`);
+                const csvResponse = await fetch(csvFilePath);
+                if (!csvResponse.ok) {
+                    let errorData: any = {};
+                    try {
+                        errorData = await csvResponse.json();
+                    } catch {
+                        errorData = { error: await csvResponse.text().catch(() => '') };
+                    }
+                    console.error(
+                        `ファイルが見つかりません: ${csvFilePath}, status: ${csvResponse.status}`,
+                        errorData
+                    );
+                    return;
+                }
 
-            if (parsed.errors.length > 0) {
-                console.error('CSV parse error:', parsed.errors);
-                return;
-            }
+                const csvText = await csvResponse.text();
 
-            const row = parsed.data[0] as string[];
+                // PapaParseを動的にインポート
+                const PapaModule = await import('papaparse');
+                const Papa = PapaModule.default;
+
+                const parsed = Papa.parse(csvText, {
+                    header: false,
+                    skipEmptyLines: true,
+                });
+
+                if (parsed.errors.length > 0) {
+                    console.error('CSV parse error:', parsed.errors);
+                    return;
+                }
+
+                row = parsed.data[0] as string[];
+            }
             if (!row || row.length < 4) {
                 console.warn('Invalid CSV format');
                 return;
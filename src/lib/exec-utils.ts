@@ -1,6 +1,7 @@
 import fs from 'fs';
 import path from 'path';
-import { execSync } from 'child_process';
+import { execSync, spawn, ChildProcessWithoutNullStreams } from 'child_process';
+import type { RouteResult } from '@/lib/types';
 
 /**
  * Cバイナリファイルを実行するためのユーティリティ
@@ -29,23 +30,226 @@ async function runCBinary(binaryPath: string, args: string[]): Promise<string> {
 }
 
 /**
- * up44バイナリを実行
+ * yen常駐プロセス（yen --serve）の応答区切り
  */
-export async function runUp44(args: string[]): Promise<void> {
-    await runCBinary('up44', args);
+const YEN_READY_MARKER = '#READY';
+const YEN_END_MARKER = '#END';
+
+interface YenRequest {
+    line: string;
+    output: string;
+    resolve: (output: string) => void;
+    reject: (error: Error) => void;
+}
+
+/**
+ * yenを常駐プロセスとして起動し、1行1クエリでやり取りする
+ * グラフ等の読み込みは起動時の1回だけで済むため、リクエストごとのプロセス起動コストがなくなる
+ */
+class YenDaemon {
+    private child: ChildProcessWithoutNullStreams | null = null;
+    private ready = false;
+    private buffer = '';
+    private queue: YenRequest[] = [];
+    private current: YenRequest | null = null;
+
+    query(line: string): Promise<string> {
+        return new Promise((resolve, reject) => {
+            this.queue.push({ line, output: '', resolve, reject });
+            this.ensureStarted();
+            this.dispatch();
+        });
+    }
+
+    private ensureStarted() {
+        if (this.child) return;
+
+        const child = spawn('./yen', ['--serve'], { cwd: process.cwd() });
+        this.child = child;
+        this.ready = false;
+        this.buffer = '';
+
+        child.stdout.setEncoding('utf8');
+        child.stdout.on('data', (chunk: string) => this.onData(chunk));
+        // ログはこれまで通り親プロセスの標準エラーへ流す
+        child.stderr.on('data', (chunk: Buffer) => process.stderr.write(chunk));
+        child.stdin.on('error', (err) => this.onExit(child, err));
+        child.on('error', (err) => this.onExit(child, err));
+        child.on('exit', (code) => this.onExit(child, new Error(`yen常駐プロセスが終了しました (code=${code})`)));
+    }
+
+    private onData(chunk: string) {
+        this.buffer += chunk;
+        let idx: number;
+        while ((idx = this.buffer.indexOf('\n')) >= 0) {
+            const line = this.buffer.slice(0, idx);
+            this.buffer = this.buffer.slice(idx + 1);
+
+            if (!this.ready) {
+                if (line === YEN_READY_MARKER) {
+                    this.ready = true;
+                    this.dispatch();
+                }
+                continue;
+            }
+            if (!this.current) continue;
+
+            if (line === YEN_END_MARKER) {
+                const req = this.current;
+                this.current = null;
+                req.resolve(req.output);
+                this.dispatch();
+            } else {
+                this.current.output += line + '\n';
+            }
+        }
+    }
+
+    private onExit(child: ChildProcessWithoutNullStreams, err: Error) {
+        // 既に破棄済みのプロセスからの通知は無視する
+        if (this.child !== child) return;
+        this.child = null;
+        this.ready = false;
+        const pending = this.current ? [this.current, ...this.queue] : this.queue;
+        this.current = null;
+        this.queue = [];
+        pending.forEach((req) => req.reject(err));
+    }
+
+    private dispatch() {
+        if (!this.child || !this.ready || this.current) return;
+        const next = this.queue.shift();
+        if (!next) return;
+        this.current = next;
+        this.child.stdin.write(next.line + '\n');
+    }
+}
+
+let yenDaemon: YenDaemon | null = null;
+
+/**
+ * yenバイナリに渡す追加の指定
+ */
+export interface YenOptions {
+    /** 勾配による速度補正係数（省略時はバイナリの既定値 0.5） */
+    kGradient?: number;
+    /** 指定すると全網羅の代わりにK最短経路（移動時間の短い順）を返す */
+    kShortest?: number;
+    /** true なら全網羅の代わりに信号待ち込みの時間依存探索で最速経路を求める */
+    timeDependent?: boolean;
+    /** 信号の組み合わせを評価するスレッド数（0 ならCPU数、省略時は1スレッド） */
+    threads?: number;
+    /** 全網羅で同時に通る信号の最大数（省略時は3、最大6） */
+    depth?: number;
+    /** true なら下界が最短経路より遅い信号の組み合わせを評価・出力しない */
+    prune?: boolean;
+    /** true なら移動時間・待ち時間・距離・嗜好コストでパレート最適な経路だけを返す */
+    pareto?: boolean;
+    /** パレート探索でノードごとに保持するラベル数（返す経路数の上限、省略時は8） */
+    paretoLabels?: number;
+    /** 2点間の最短経路の探し方（省略時は tree: 始点ごとの最短経路木をキャッシュ） */
+    search?: 'tree' | 'dijkstra' | 'astar' | 'bidir';
+    /** up44 と同じ順の13個の重み。user_preference_ver4.4.c の式で嗜好コストを作り、それが最小の経路を CCH で求める（result.csv は使わない） */
+    preferences?: number[];
+    /** up44 と同じ順の13個の重み。user_preference_ver4.4.c の式の嗜好コストを result.csv の代わりにプロセス内で作る（--pareto の嗜好コストに使う） */
+    weights?: number[];
+    /** true なら経路をエッジ表の番号の配列で返す（出力が小さくなる。decodeYenRoutes で従来の形に戻せる） */
+    compact?: boolean;
+    /** 全網羅の経路を総時間の短い上位 K 本だけ保持しながら列挙する（最大5000） */
+    topK?: number;
+    /** 出力する黄（全網羅経路）の上限本数 */
+    yellowLimit?: number;
+}
+
+/**
+ * --compact の出力（{"edges":[[from,to],...],"routes":[{"edges":[番号,...],...}]}）を従来の経路の配列に戻す
+ * userPref は従来どおり "from-to.geojson" の改行区切りで作り、edgePairs に [from, to] の列を付ける
+ * 従来形式（配列）の出力はそのまま返す
+ */
+export function decodeYenRoutes(output: string): (RouteResult & { edgePairs?: [number, number][] })[] {
+    const parsed = JSON.parse(output);
+    if (Array.isArray(parsed)) return parsed;
+
+    const table: [number, number][] = parsed.edges ?? [];
+    const names = table.map(([from, to]) => `${from}-${to}.geojson`);
+    return (parsed.routes ?? []).map((route: any) => {
+        const { edges, ...rest } = route;
+        return {
+            ...rest,
+            userPref: edges.map((id: number) => names[id]).join('\n'),
+            edgePairs: edges.map((id: number) => table[id]),
+        };
+    });
 }
 
 /**
  * yenバイナリを実行
+ * 既定では常駐プロセスを使い、失敗した場合は従来どおり1回ごとに起動する
+ * YEN_DAEMON=0 を指定すると常駐プロセスを使わない
  */
 export async function runYen(
     startNode: number,
     endNode: number,
     walkingSpeed: number,
-    kGradient?: number
+    options: YenOptions = {}
 ): Promise<string> {
-    // バイナリは3つの引数のみ受け付ける: start_node, end_node, walking_speed
+    // 引数: start_node, end_node, walking_speed [gradient_factor] [--ksp K] [--td] [--threads N] [--depth D] [--prune] [--pareto [--labels N]] [--search MODE] [--prefs w0,...,w12] [--weights w0,...,w12] [--compact] [--top K] [--yellow N]
     const args = [startNode.toString(), endNode.toString(), walkingSpeed.toString()];
+    const { kGradient, kShortest, timeDependent, threads, depth, prune, pareto, paretoLabels, search, preferences, weights, compact, topK, yellowLimit } = options;
+    if (kGradient !== undefined && !isNaN(kGradient)) {
+        args.push(kGradient.toString());
+    }
+    if (kShortest !== undefined && kShortest > 0) {
+        args.push('--ksp', Math.floor(kShortest).toString());
+    }
+    if (timeDependent) {
+        args.push('--td');
+    }
+    if (threads !== undefined && threads >= 0) {
+        args.push('--threads', Math.floor(threads).toString());
+    }
+    if (depth !== undefined && depth > 0) {
+        args.push('--depth', Math.floor(depth).toString());
+    }
+    if (prune) {
+        args.push('--prune');
+    }
+    if (pareto) {
+        args.push('--pareto');
+        if (paretoLabels !== undefined && paretoLabels > 0) {
+            args.push('--labels', Math.floor(paretoLabels).toString());
+        }
+    }
+    if (search) {
+        args.push('--search', search);
+    }
+    if (preferences && preferences.length === 13) {
+        args.push('--prefs', preferences.join(','));
+    } else if (weights && weights.length === 13) {
+        args.push('--weights', weights.join(','));
+    }
+    if (compact) {
+        args.push('--compact');
+    }
+    if (topK !== undefined && topK > 0) {
+        args.push('--top', Math.floor(topK).toString());
+    }
+    if (yellowLimit !== undefined && yellowLimit >= 0) {
+        args.push('--yellow', Math.floor(yellowLimit).toString());
+    }
+
+    if (process.env.YEN_DAEMON !== '0') {
+        try {
+            if (!yenDaemon) yenDaemon = new YenDaemon();
+            const output = await yenDaemon.query(args.join(' '));
+            if (output.startsWith('{"error"')) {
+                throw new Error(`yen常駐プロセスのエラー: ${output.trim()}`);
+            }
+            return output;
+        } catch (error: any) {
+            console.error(`[yen常駐プロセス] ${error.message}。単発実行に切り替えます`);
+        }
+    }
     return await runCBinary('yen', args);
 }
 
@@ -0,0 +1,142 @@
+import fs from 'fs';
+import path from 'path';
+import type { RouteResult } from '@/lib/types';
+
+/**
+ * 経路アトラス（oomiya_routes.atlas）の読み込み
+ * 形式は route_atlas.h を参照。build_route_atlas（経路集ディレクトリから）または
+ * yen --build-atlas（経路探索の結果から）で作る。キーは (起点ノード, 終点ノード, 変種)
+ */
+
+export const ROUTE_ATLAS_FILE = 'oomiya_routes.atlas';
+/** 経路集の *_red の変種に足す値（*_green はファイル番号そのまま） */
+export const ROUTE_ATLAS_RED = 0x10000;
+
+const ROUTE_ATLAS_MAGIC = 'VTATLAS\0';
+const ROUTE_ATLAS_VERSION = 1;
+const HEADER_SIZE = 88;
+const ENTRY_SIZE = 20;
+const ROUTE_SIZE = 40;
+const EDGE_SIZE = 8;
+
+export type RouteAtlasRoute = RouteResult & { edgePairs: [number, number][] };
+
+/** キーのハッシュ（route_atlas.h の routeAtlasHash と同じ計算） */
+function routeAtlasHash(origin: number, destination: number, variant: number): number {
+    let h = Math.imul(origin, 0x9e3779b1);
+    h ^= Math.imul(destination, 0x85ebca77);
+    h = (h << 13) | (h >>> 19);
+    h ^= Math.imul(variant, 0xc2b2ae3d);
+    h ^= h >>> 16;
+    h = Math.imul(h, 0x7feb352d);
+    h ^= h >>> 15;
+    h = Math.imul(h, 0x846ca68b);
+    h ^= h >>> 16;
+    return h >>> 0;
+}
+
+export class RouteAtlas {
+    private readonly slotCount: number;
+    private readonly slotOffset: number;
+    private readonly entryOffset: number;
+    private readonly routeOffset: number;
+    private readonly edgeOffset: number;
+    private readonly edgeIdOffset: number;
+
+    private constructor(private readonly buf: Buffer) {
+        this.slotCount = buf.readUInt32LE(20);
+        this.slotOffset = Number(buf.readBigUInt64LE(40));
+        this.entryOffset = Number(buf.readBigUInt64LE(48));
+        this.routeOffset = Number(buf.readBigUInt64LE(56));
+        this.edgeOffset = Number(buf.readBigUInt64LE(64));
+        this.edgeIdOffset = Number(buf.readBigUInt64LE(72));
+    }
+
+    /** ファイルを読み込む（無い・形式が違う場合は null） */
+    static open(filePath: string): RouteAtlas | null {
+        if (!fs.existsSync(filePath)) return null;
+        const buf = fs.readFileSync(filePath);
+        if (
+            buf.length < HEADER_SIZE ||
+            buf.toString('latin1', 0, 8) !== ROUTE_ATLAS_MAGIC ||
+            buf.readUInt32LE(8) !== ROUTE_ATLAS_VERSION ||
+            buf.readUInt32LE(12) !== HEADER_SIZE ||
+            Number(buf.readBigUInt64LE(80)) !== buf.length
+        ) {
+            console.warn(`[経路アトラス] ${filePath} の形式またはバージョンが一致しません`);
+            return null;
+        }
+        return new RouteAtlas(buf);
+    }
+
+    /** キーの経路を返す（無ければ null）。userPref は経路集の .csv と同じ "a-b.geojson" の改行区切り */
+    find(origin: number, destination: number, variant: number): RouteAtlasRoute[] | null {
+        const buf = this.buf;
+        const mask = this.slotCount - 1;
+        let i = routeAtlasHash(origin, destination, variant) & mask;
+        for (;;) {
+            const slot = buf.readUInt32LE(this.slotOffset + i * 4);
+            if (slot === 0) return null;
+            const e = this.entryOffset + (slot - 1) * ENTRY_SIZE;
+            if (
+                buf.readInt32LE(e) === origin &&
+                buf.readInt32LE(e + 4) === destination &&
+                buf.readInt32LE(e + 8) === variant
+            ) {
+                return this.readRoutes(buf.readUInt32LE(e + 12), buf.readUInt32LE(e + 16));
+            }
+            i = (i + 1) & mask;
+        }
+    }
+
+    private readRoutes(routeStart: number, routeCount: number): RouteAtlasRoute[] {
+        const buf = this.buf;
+        const routes: RouteAtlasRoute[] = [];
+        for (let k = 0; k < routeCount; k++) {
+            const r = this.routeOffset + (routeStart + k) * ROUTE_SIZE;
+            const edgeStart = buf.readUInt32LE(r + 24);
+            const edgeCount = buf.readUInt32LE(r + 28);
+            const edgePairs: [number, number][] = [];
+            for (let j = 0; j < edgeCount; j++) {
+                const id = buf.readUInt32LE(this.edgeIdOffset + (edgeStart + j) * 4);
+                const edge = this.edgeOffset + id * EDGE_SIZE;
+                edgePairs.push([buf.readInt32LE(edge), buf.readInt32LE(edge + 4)]);
+            }
+            routes.push({
+                userPref: edgePairs.map(([from, to]) => `${from}-${to}.geojson`).join('\n'),
+                // 距離・時間が無い経路（経路集の .txt）は NaN（JSON では null になる）
+                totalDistance: buf.readDoubleLE(r),
+                totalTime: buf.readDoubleLE(r + 8),
+                totalWaitTime: buf.readDoubleLE(r + 16),
+                routeType: buf.readInt32LE(r + 32),
+                hasSignal: buf.readInt32LE(r + 36),
+                edgePairs,
+            });
+        }
+        return routes;
+    }
+}
+
+let cachedAtlas: RouteAtlas | null = null;
+let cachedMtimeMs = -1;
+
+/**
+ * プロジェクト直下の経路アトラスを返す（無ければ null）
+ * 1回だけ読み込み、ファイルが作り直されたら読み込み直す
+ */
+export function getRouteAtlas(): RouteAtlas | null {
+    const filePath = path.join(process.cwd(), ROUTE_ATLAS_FILE);
+    let mtimeMs: number;
+    try {
+        mtimeMs = fs.statSync(filePath).mtimeMs;
+    } catch {
+        cachedAtlas = null;
+        cachedMtimeMs = -1;
+        return null;
+    }
+    if (mtimeMs !== cachedMtimeMs) {
+        cachedAtlas = RouteAtlas.open(filePath);
+        cachedMtimeMs = mtimeMs;
+    }
+    return cachedAtlas;
+}
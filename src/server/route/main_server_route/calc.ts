@@ -1,7 +1,7 @@
 /* コストと信号まの待ち時間を計算するAPI */
 
 import { Hono } from 'hono';
-import { runUp44, runYen } from '@/lib/exec-utils';
+import { runYen, decodeYenRoutes } from '@/lib/exec-utils';
 import fs from 'fs';
 import path from 'path';
 
@@ -47,8 +47,6 @@ const calc = new Hono().post('/calc', async (c) => {
     try {
         const body = await c.req.json();
         const {
-            weight0, weight1, weight2, weight3, weight4, weight5, weight6,
-            weight7, weight8, weight9, weight10, weight11, weight12,
             param1, param2, walkingSpeed: walkingSpeedStr,
             kGradient: kGradientStr,
         } = body;
@@ -58,17 +56,9 @@ const calc = new Hono().post('/calc', async (c) => {
         const startNode = param1;
         const endNode = param2;
 
-        // Run up44 binary once to generate the cost file
-        try {
-            await runUp44([
-                weight0, weight1, weight2, weight3, weight4, weight5, weight6,
-                weight7, weight8, weight9, weight10, weight11, weight12,
-                param1, param2,
-            ]);
-        } catch (err: any) {
-            console.error(`[up44実行エラー] ${err.message}`);
-            return c.json({ error: 'up44の実行に失敗しました' }, 500);
-        }
+        // yen の既定モードは信号待ちを含めた時間で経路を求め、嗜好コストは使わないため、
+        // リクエストの13個の重み（weight0〜weight12）は渡さない
+        // （以前は up44 で result.csv を書き直していたが、yen はその重みを読み捨てていた）
 
         const startNodeInt = parseInt(startNode || '0', 10);
         const endNodeInt = parseInt(endNode || '0', 10);
@@ -84,13 +74,14 @@ const calc = new Hono().post('/calc', async (c) => {
 
         try {
             // yens_algorithmバイナリを実行
-            const cProgramOutput = await runYen(startNodeInt, endNodeInt, walkingSpeed, kGradient);
+            // 経路はエッジ表の番号で受け取り（--compact）、ファイル名の文字列は decodeYenRoutes で作る
+            const cProgramOutput = await runYen(startNodeInt, endNodeInt, walkingSpeed, { kGradient, compact: true });
 
             const yenTime = Date.now() - yenStartTime;
             console.log(`[Cバイナリ計算完了] ${(yenTime / 1000).toFixed(2)}秒`);
 
             // JSONをパース
-            const top5Routes = JSON.parse(cProgramOutput);
+            const top5Routes = decodeYenRoutes(cProgramOutput);
 
             if (!Array.isArray(top5Routes) || top5Routes.length === 0) {
                 return c.json([]);
@@ -102,46 +93,41 @@ const calc = new Hono().post('/calc', async (c) => {
             // Calculate gradient diff for Blue Route (routeType 0)
             // (Actually we can do it for all routes if we want, but user asked specifically)
             top5Routes.forEach((route: any) => {
-                // Determine edges from userPref
-                // format: "22-25.geojson\n25-26.geojson"
-                if (!route.userPref) return;
+                // Determine edges from edgePairs ([from, to] の列。従来形式の出力なら userPref から作る)
+                // userPref format: "22-25.geojson\n25-26.geojson"
+                const pairs: [number, number][] = route.edgePairs ?? (route.userPref || '')
+                    .split('\n')
+                    .map((seg: string) => seg.trim().match(/^(\d+)-(\d+)\.geojson$/))
+                    .filter((m: RegExpMatchArray | null): m is RegExpMatchArray => m !== null)
+                    .map((m: RegExpMatchArray) => [parseInt(m[1]), parseInt(m[2])]);
+                delete route.edgePairs;
 
                 let flatTimeTotal = 0;
                 let gradientTimeTotal = 0;
                 let calculatedEdges = 0;
                 
-                const segments = route.userPref.split('\n');
-                for (const seg of segments) {
-                    const trimmed = seg.trim();
-                    if (!trimmed) continue;
+                for (const [n1, n2] of pairs) {
+                    const key = n1 < n2 ? `${n1}-${n2}` : `${n2}-${n1}`;
                     
-                    // Extract node IDs from filename "22-25.geojson"
-                    const match = trimmed.match(/^(\d+)-(\d+)\.geojson$/);
-                    if (match) {
-                        const n1 = parseInt(match[1]);
-                        const n2 = parseInt(match[2]);
-                        const key = n1 < n2 ? `${n1}-${n2}` : `${n2}-${n1}`;
+                    const edge = edgeMap.get(key);
+                    if (edge) {
+                        // Calculate times
+                        // Flat time: distance / walkingSpeed
+                        const flatTime = edge.distance / walkingSpeed * 60.0; // seconds
                         
-                        const edge = edgeMap.get(key);
-                        if (edge) {
-                            // Calculate times
-                            // Flat time: distance / walkingSpeed
-                            const flatTime = edge.distance / walkingSpeed * 60.0; // seconds
-                            
-                            // Gradient time
-                            // const kGradient = 0.5; // received from body
-                            const adjustedSpeed = walkingSpeed * (1.0 - kGradient * edge.gradient);
-                            let gradTime = 0;
-                            if (adjustedSpeed > 0) {
-                                gradTime = edge.distance / adjustedSpeed * 60.0; // seconds
-                            } else {
-                                gradTime = flatTime * 10.0; // Fallback penalty
-                            }
-                            
-                            flatTimeTotal += flatTime;
-                            gradientTimeTotal += gradTime;
-                            calculatedEdges++;
+                        // Gradient time
+                        // const kGradient = 0.5; // received from body
+                        const adjustedSpeed = walkingSpeed * (1.0 - kGradient * edge.gradient);
+                        let gradTime = 0;
+                        if (adjustedSpeed > 0) {
+                            gradTime = edge.distance / adjustedSpeed * 60.0; // seconds
+                        } else {
+                            gradTime = flatTime * 10.0; // Fallback penalty
                         }
+                        
+                        flatTimeTotal += flatTime;
+                        gradientTimeTotal += gradTime;
+                        calculatedEdges++;
                     }
                 }
 
@@ -5,6 +5,7 @@ import calcRoute from './calc';
 import csvDataRoute from './csv-data';
 import getSavedRouteRoute from './get-saved-route';
 import listSavedRoutesRoute from './list-saved-routes';
+import routeAtlasRoute from './route-atlas';
 import saveRouteRoute from './save-route';
 import staticRoute from './static';
 
@@ -13,5 +14,6 @@ export const main_server_route = new Hono()
     .route('/', csvDataRoute)
     .route('/', getSavedRouteRoute)
     .route('/', listSavedRoutesRoute)
+    .route('/', routeAtlasRoute)
     .route('/', saveRouteRoute)
     .route('/static', staticRoute);
@@ -0,0 +1,28 @@
+import { Hono } from 'hono';
+import { getRouteAtlas } from '@/lib/route-atlas';
+
+/**
+ * 経路アトラスから (origin, destination, variant) の経路を返す
+ * 経路集（18-22_green/<N>.csv など）は origin-destination がディレクトリ名のノード、
+ * variant がファイル番号（*_red は ROUTE_ATLAS_RED を足す）
+ */
+const route_atlas = new Hono().get('/routeAtlas', async (c) => {
+    const origin = Number(c.req.query('origin'));
+    const destination = Number(c.req.query('destination'));
+    const variant = Number(c.req.query('variant'));
+    if (![origin, destination, variant].every(Number.isInteger)) {
+        return c.json({ error: 'origin, destination, variant are required' }, 400);
+    }
+
+    const atlas = getRouteAtlas();
+    if (!atlas) {
+        return c.json({ error: 'Route atlas not found' }, 404);
+    }
+    const routes = atlas.find(origin, destination, variant);
+    if (!routes) {
+        return c.json({ error: 'Route not found' }, 404);
+    }
+    return c.json({ routes });
+});
+
+export default route_atlas;
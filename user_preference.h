@@ -0,0 +1,299 @@
+/* ユーザー嗜好のコスト（user_preference_ver4.4.c の式）
+ *
+ * oomiya_route_inf_4.csv の1行（16カラム）と13個の重み（ユーザーの好み）から、
+ * その行のエッジのコストを計算する。user_preference_ver4.4.c と yen --prefs / --weights が共有する。
+ * user_preference_ver4.4.c は全行のコストの最小値（0 より大きければ 0）を引き、最小値を0にしてから
+ * result.csv に書き出す。
+ * Dockerfile が up44 としてビルドする user_preference_speed.c はこの式を使わず、重みによらず
+ * time_minutes のカラムをそのままコストにする（yen の嗜好コストとは一致しない）。
+ *
+ * 特徴行列（PreferenceModel）に行を追加しておけば、重みが変わったときは重み付き和の計算だけで済む。
+ * 一部の重みだけが変わったときは、その項だけを計算し直す。コストは重みだけで決まり、
+ * それまでに計算した重みの順序にはよらない。
+ *
+ * 変更 一律加算　→　最後に最小の重みを足して最小値を0にする
+ * 距離にも重みを追加
+ * 各条件の計算式の修正版
+ * 負の値も考慮可能
+ * 6つの条件値を加算から減算に変更（条件が有１の場合、優先されるから）
+ * d依存式をまとめる
+ * d依存式以外を平均距離/10で規格化
+ * その他0,1の値はそのまま加算する
+ */
+
+#ifndef USER_PREFERENCE_H
+#define USER_PREFERENCE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <math.h>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define PREFERENCE_HAVE_X86_SIMD 1  // AVX2 / AVX-512 の版を作り、実行時に CPU を見て選ぶ
+#endif
+
+#define PREFERENCE_COLUMNS 16          // oomiya_route_inf_4.csv のカラム数
+#define PREFERENCE_WEIGHTS 13          // ユーザの好み（距離も含めて13）
+#define PREFERENCE_AVE_DISTANCE 64.35014  // 平均距離（大宮）
+//#define PREFERENCE_AVE_DISTANCE 51.12988  // 平均距離（丸山台）
+
+#define PREFERENCE_PENALTY 5000.0       // 最大・最小勾配の条件を満たす行に加える値
+#define PREFERENCE_INCREMENTAL_MAX 3    // 変わった重みがこの数以下なら、その項だけを計算し直す
+
+/* 特徴行列（oomiya_route_inf_4.csv の行ごとの値）から、重み i に掛かる係数（基底項）を前計算しておき、
+ * コストを sum(basis[i][r] * weights[i]) で求める。最大・最小勾配（i=2,3）は重みがしきい値なので、
+ * 勾配の値を持っておき、比較した結果に PREFERENCE_PENALTY を掛ける。
+ * 項ごとの寄与（term[i][r]）も残しておき、一部の重みが変わったときはその列だけを作り直して
+ * 全ての列を決まった順に足し直す。足す順がカーネルと同じなので、全体を計算した結果とビット単位で一致する。
+ */
+typedef struct {
+    int     rowCount;
+    int     rowCapacity;
+    double *basis[PREFERENCE_WEIGHTS];  // basis[i][r]: 行 r で重み i に掛かる係数（i=2,3 は使わない）
+    double *maxGradient;                // 最大勾配（重み2 と比較）
+    double *minGradient;                // 最小勾配（重み3 と比較）
+    double *term[PREFERENCE_WEIGHTS];   // term[i][r]: weights での行 r の重み i の項の寄与
+    double *cost;                       // weights でのコスト（最小値を引く前）
+    double  weights[PREFERENCE_WEIGHTS];
+    bool    hasCost;                    // cost と term が weights で計算済みか
+} PreferenceModel;
+
+static inline void preferenceModelFree(PreferenceModel *m) {
+    for (int i = 0; i < PREFERENCE_WEIGHTS; i++) {
+        free(m->basis[i]);
+        free(m->term[i]);
+    }
+    free(m->maxGradient);
+    free(m->minGradient);
+    free(m->cost);
+    memset(m, 0, sizeof(*m));
+}
+
+static inline double *preferenceGrow(double *p, int capacity) {
+    p = (double *)realloc(p, sizeof(double) * (size_t)capacity);
+    if (!p) {
+        fprintf(stderr, "Error: 嗜好コストのメモリを確保できません\n");
+        exit(1);
+    }
+    return p;
+}
+
+// 「その他」の条件値（-1 は 5 として扱う）
+static inline double preferenceOtherValue(double v) {
+    return v == -1 ? 5 : v;
+}
+
+// 1行分（16カラム）を特徴行列に追加して基底項を計算する（行番号を返す）
+// values: node1,node2,distance,time_minutes,gradient,max_gradient,min_gradient,sidewalk,signal,
+//         road_width,illumination,nature,park,garbage,toilet,crosswalk
+static inline int preferenceModelAddRow(PreferenceModel *m, const double *values) {
+    if (m->rowCount == m->rowCapacity) {
+        m->rowCapacity = m->rowCapacity ? m->rowCapacity * 2 : 256;
+        for (int i = 0; i < PREFERENCE_WEIGHTS; i++) {
+            m->basis[i] = preferenceGrow(m->basis[i], m->rowCapacity);
+            m->term[i]  = preferenceGrow(m->term[i], m->rowCapacity);
+        }
+        m->maxGradient = preferenceGrow(m->maxGradient, m->rowCapacity);
+        m->minGradient = preferenceGrow(m->minGradient, m->rowCapacity);
+        m->cost        = preferenceGrow(m->cost, m->rowCapacity);
+    }
+    int    r = m->rowCount++;
+    double d = values[2];
+    m->hasCost = false;
+
+    //合計値の計算,最短距離の場合と選択される経路が変わらない
+    m->basis[0][r] = 10*d; // 距離
+    for (int i = 1; i < PREFERENCE_WEIGHTS; i++) {
+        double v = values[i + 3];
+        double b = 0.0;
+        //勾配のとき
+        // 280.5v^5 - 58.7v^4 - 76.8v^3 + 51.9v^2 + 19.6v + 2.5 をホーナー法で計算する
+        if(i == 1)b = (((((280.5*v - 58.7)*v - 76.8)*v + 51.9)*v + 19.6)*v + 2.5) * (d/10);
+        //最大勾配・最小勾配（重みと比較する）
+        else if(i == 2)m->maxGradient[r] = v;
+        else if(i == 3)m->minGradient[r] = v;
+        //道路幅
+        else if(i==6)b = v*(d/10);
+        //照明
+        else if(i==7)b = -v*(d/10);
+        //信号
+        else if((i==5) || (i==10))b = v*PREFERENCE_AVE_DISTANCE;
+        //その他
+        else b = -preferenceOtherValue(v)*PREFERENCE_AVE_DISTANCE;
+        m->basis[i][r] = b;
+    }
+    return r;
+}
+
+/* ---------- コスト計算のカーネル ----------
+ * 行 [from, to) のコストを out に、項ごとの寄与を term[i] に書く。各行の項は元の式と同じ順に足し、
+ * 最大・最小勾配は比較結果のマスクでペナルティを加える（分岐しない）。SIMD 版も乗算と加算を分けて
+ * 同じ順に計算するので、どの版でも結果はビット単位で一致する。
+ * コンパイラが乗算と加算を FMA にまとめると版ごとに丸めが変わるため、ここから
+ * preferenceModelEvaluate までは -std=c99 以外（GNU モードや -ffp-contract=fast）でもまとめさせない。
+ */
+
+#if defined(__clang__)
+#pragma STDC FP_CONTRACT OFF
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC optimize("fp-contract=off")
+#endif
+
+typedef void (*PreferenceKernel)(const PreferenceModel *m, const double *weights, double *const *term, double *out);
+
+// 行 r の重み i の項の寄与
+static inline double preferenceTerm(const PreferenceModel *m, const double *weights, int i, int r) {
+    if (i == 2) return PREFERENCE_PENALTY * (m->maxGradient[r] >= weights[2]);
+    if (i == 3) return PREFERENCE_PENALTY * (m->minGradient[r] <= weights[3]);
+    return m->basis[i][r] * weights[i];
+}
+
+static inline void preferenceKernelRows(const PreferenceModel *m, const double *weights, double *const *term,
+                                        double *out, int from, int to) {
+    for (int r = from; r < to; r++) {
+        double c = term[0][r] = preferenceTerm(m, weights, 0, r);
+        for (int i = 1; i < PREFERENCE_WEIGHTS; i++) c += term[i][r] = preferenceTerm(m, weights, i, r);
+        out[r] = c;
+    }
+}
+
+static void preferenceKernelScalar(const PreferenceModel *m, const double *weights, double *const *term, double *out) {
+    preferenceKernelRows(m, weights, term, out, 0, m->rowCount);
+}
+
+#ifdef PREFERENCE_HAVE_X86_SIMD
+__attribute__((target("avx2")))
+static void preferenceKernelAvx2(const PreferenceModel *m, const double *weights, double *const *term, double *out) {
+    int     n       = m->rowCount;
+    int     r       = 0;
+    __m256d penalty = _mm256_set1_pd(PREFERENCE_PENALTY);
+    __m256d maxW    = _mm256_set1_pd(weights[2]);
+    __m256d minW    = _mm256_set1_pd(weights[3]);
+    for (; r + 4 <= n; r += 4) {
+        __m256d t[PREFERENCE_WEIGHTS];
+        t[0] = _mm256_mul_pd(_mm256_loadu_pd(m->basis[0] + r), _mm256_set1_pd(weights[0]));
+        t[1] = _mm256_mul_pd(_mm256_loadu_pd(m->basis[1] + r), _mm256_set1_pd(weights[1]));
+        t[2] = _mm256_and_pd(_mm256_cmp_pd(_mm256_loadu_pd(m->maxGradient + r), maxW, _CMP_GE_OQ), penalty);
+        t[3] = _mm256_and_pd(_mm256_cmp_pd(_mm256_loadu_pd(m->minGradient + r), minW, _CMP_LE_OQ), penalty);
+        for (int i = 4; i < PREFERENCE_WEIGHTS; i++) {
+            t[i] = _mm256_mul_pd(_mm256_loadu_pd(m->basis[i] + r), _mm256_set1_pd(weights[i]));
+        }
+        __m256d c = t[0];
+        _mm256_storeu_pd(term[0] + r, t[0]);
+        for (int i = 1; i < PREFERENCE_WEIGHTS; i++) {
+            c = _mm256_add_pd(c, t[i]);
+            _mm256_storeu_pd(term[i] + r, t[i]);
+        }
+        _mm256_storeu_pd(out + r, c);
+    }
+    preferenceKernelRows(m, weights, term, out, r, n);
+}
+
+__attribute__((target("avx512f")))
+static void preferenceKernelAvx512(const PreferenceModel *m, const double *weights, double *const *term, double *out) {
+    int     n       = m->rowCount;
+    int     r       = 0;
+    __m512d penalty = _mm512_set1_pd(PREFERENCE_PENALTY);
+    __m512d zero    = _mm512_setzero_pd();
+    __m512d maxW    = _mm512_set1_pd(weights[2]);
+    __m512d minW    = _mm512_set1_pd(weights[3]);
+    for (; r + 8 <= n; r += 8) {
+        __m512d t[PREFERENCE_WEIGHTS];
+        t[0] = _mm512_mul_pd(_mm512_loadu_pd(m->basis[0] + r), _mm512_set1_pd(weights[0]));
+        t[1] = _mm512_mul_pd(_mm512_loadu_pd(m->basis[1] + r), _mm512_set1_pd(weights[1]));
+        __mmask8 maxMask = _mm512_cmp_pd_mask(_mm512_loadu_pd(m->maxGradient + r), maxW, _CMP_GE_OQ);
+        t[2] = _mm512_mask_blend_pd(maxMask, zero, penalty);
+        __mmask8 minMask = _mm512_cmp_pd_mask(_mm512_loadu_pd(m->minGradient + r), minW, _CMP_LE_OQ);
+        t[3] = _mm512_mask_blend_pd(minMask, zero, penalty);
+        for (int i = 4; i < PREFERENCE_WEIGHTS; i++) {
+            t[i] = _mm512_mul_pd(_mm512_loadu_pd(m->basis[i] + r), _mm512_set1_pd(weights[i]));
+        }
+        __m512d c = t[0];
+        _mm512_storeu_pd(term[0] + r, t[0]);
+        for (int i = 1; i < PREFERENCE_WEIGHTS; i++) {
+            c = _mm512_add_pd(c, t[i]);
+            _mm512_storeu_pd(term[i] + r, t[i]);
+        }
+        _mm512_storeu_pd(out + r, c);
+    }
+    preferenceKernelRows(m, weights, term, out, r, n);
+}
+#endif
+
+// CPU が対応している中で最も幅の広い版を選ぶ（環境変数 PREFERENCE_KERNEL=scalar|avx2|avx512 で指定もできる）
+static inline PreferenceKernel preferenceSelectKernel(const char **name) {
+    const char *want = getenv("PREFERENCE_KERNEL");
+#ifdef PREFERENCE_HAVE_X86_SIMD
+    __builtin_cpu_init();
+    bool hasAvx512 = __builtin_cpu_supports("avx512f");
+    bool hasAvx2   = __builtin_cpu_supports("avx2");
+    if (hasAvx512 && (!want || strcmp(want, "avx512") == 0)) {
+        if (name) *name = "avx512";
+        return preferenceKernelAvx512;
+    }
+    if (hasAvx2 && (!want || strcmp(want, "avx2") == 0 || strcmp(want, "avx512") == 0)) {
+        if (name) *name = "avx2";
+        return preferenceKernelAvx2;
+    }
+#endif
+    (void)want;
+    if (name) *name = "scalar";
+    return preferenceKernelScalar;
+}
+
+// 全ての項を計算し直す（カーネルは最初の呼び出しで選ぶ）
+static inline void preferenceModelEvaluateAll(PreferenceModel *m, const double *weights) {
+    static PreferenceKernel kernel = NULL;
+    if (!kernel) kernel = preferenceSelectKernel(NULL);
+    kernel(m, weights, m->term, m->cost);
+}
+
+// changed の項の列だけを作り直し、全ての列をカーネルと同じ順に足し直す
+static inline void preferenceModelUpdateTerms(PreferenceModel *m, const double *weights,
+                                              const int *changed, int changedCount) {
+    int n = m->rowCount;
+    for (int k = 0; k < changedCount; k++) {
+        int     i = changed[k];
+        double *t = m->term[i];
+        for (int r = 0; r < n; r++) t[r] = preferenceTerm(m, weights, i, r);
+    }
+    for (int r = 0; r < n; r++) {
+        double c = m->term[0][r];
+        for (int i = 1; i < PREFERENCE_WEIGHTS; i++) c += m->term[i][r];
+        m->cost[r] = c;
+    }
+}
+
+// weights での行ごとのコスト（最小値を引く前）を返す
+// 直前に計算した重みとの違いが PREFERENCE_INCREMENTAL_MAX 個以下なら、その項だけを計算し直す
+// どちらの経路でも結果は重みだけで決まる（常駐モードで前のクエリの重みに左右されない）
+static inline const double *preferenceModelEvaluate(PreferenceModel *m, const double *weights) {
+    int changed[PREFERENCE_WEIGHTS];
+    int changedCount = 0;
+    if (m->hasCost) {
+        for (int i = 0; i < PREFERENCE_WEIGHTS; i++) {
+            if (memcmp(&weights[i], &m->weights[i], sizeof(double)) != 0) changed[changedCount++] = i;
+        }
+        if (changedCount == 0) return m->cost;
+    }
+
+    if (m->hasCost && changedCount <= PREFERENCE_INCREMENTAL_MAX) {
+        preferenceModelUpdateTerms(m, weights, changed, changedCount);
+    } else {
+        preferenceModelEvaluateAll(m, weights);
+    }
+    memcpy(m->weights, weights, sizeof(m->weights));
+    m->hasCost = true;
+    return m->cost;
+}
+
+#if defined(__clang__)
+#pragma STDC FP_CONTRACT DEFAULT
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
+
+#endif
@@ -1,7 +1,9 @@
+#define _POSIX_C_SOURCE 200809L  // mmap / stat（csv_reader.h）
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include<math.h>
+#include "csv_reader.h"  // CSV の読み込み（各プログラム共通）
 //変更 一律加算　→　最後に最小の重みを足して最小値を0にする
 //距離にも重みを追加　
 //各条件の計算式の修正版
@@ -32,7 +34,7 @@ typedef struct {
 
 int main(int argc, char *argv[]) {
     double weights[NUM_PRE];//ユーザの好み、重み
-    FILE *inputFile;
+    CsvReader inputFile;
     FILE *outputFile;
     double POSITIVE_C =0; //コストの最小値（最小値を0にするため）
     int file_line_length=0;
@@ -49,39 +51,37 @@ int main(int argc, char *argv[]) {
         //printf("%s\n",argv[i + 1]);
     }
     //入力および出力ファイルの読み込み
-    inputFile = fopen(INPUT_FILE, "r");
-    if (inputFile == NULL) {
+    if (!csvOpen(&inputFile, INPUT_FILE, true)) {
         perror("エラー：入力ファイル");
         return 1;
     }
     outputFile = fopen(OUTPUT_FILE, "w");
     if (outputFile == NULL) {
         perror("エラー：出力ファイル");
-        fclose(inputFile);
+        csvClose(&inputFile);
         return 1;
     }
 
     //出力ファイルにヘッダーを書き込む、もともとカラムなし、追加したい場合は、djk.c関連のファイルも変更必要
     //fprintf(outputFile, "node1,node2,processed_result\n");
 
-    char line[MAX_LINE_LENGTH];
+    //カラムはヘッダ行の名前で引く
+    int columns[CSV_ROUTE_COLUMNS];
+    csvRouteColumns(&inputFile, columns);
     //ファイルの最後まで実行
-    while (fgets(line, sizeof(line), inputFile)) {
-        char *token;
+    while (csvNextRow(&inputFile)) {
         double values[NUM_COLUMNS];//１行のデータを格納
-        int index = 0;
-
-        //1行をカンマで分割して数値として格納
-        token = strtok(line, ",");
-        while (token != NULL && index < NUM_COLUMNS) {
-            values[index++] = atof(token);
-            token = strtok(NULL, ",");
-        }
+        int index;
+        if (!csvRouteValues(&inputFile, columns, values, &index)) continue;
         //カラムの確認
         if (index != NUM_COLUMNS) {
-            printf("行の形式が正しくありません: %s\n", line);
+            printf("行の形式が正しくありません: %d行目\n", inputFile.lineNo);
             continue;
         }
+        if (file_line_length >= MAX_LINE_LENGTH - 1) {
+            printf("行が多すぎます: %d行目以降は読み込みません\n", inputFile.lineNo);
+            break;
+        }
 
         //最初の余分な行を除去（カラム）
         if ((int)values[0] == 0 || (int)values[1] == 0){
@@ -113,7 +113,7 @@ int main(int argc, char *argv[]) {
     //for(int i=0;i<file_line_length;i++)fprintf(outputFile, "%d,%d,%.10f\n", (int)re[i].start, (int)re[i].end, re[i].weight - POSITIVE_C);    
 
     //ファイルを閉じる
-    fclose(inputFile);
+    csvClose(&inputFile);
     fclose(outputFile);
     //確認
     printf("処理が完了しました。結果は '%s' に保存されました。\n", OUTPUT_FILE);
@@ -1,33 +1,73 @@
 /* シンプル版: signal_inf.csv の信号を使って
  * スタート→信号→ゴールの経路を網羅的に列挙する
- * - イェンのアルゴリズム・基準1/2 等はすべて削除
+ * - --ksp K を付けるとイェンのアルゴリズムによるK最短経路モードになる
+ * - --threads N を付けると信号の組み合わせを N スレッドで並列に評価する（出力は1スレッドと同じ）
+ * - --prune を付けると下界で組み合わせを枝刈りする（--depth D で4個以上の信号の組み合わせも探索できる）
+ * - --pareto を付けると移動時間・待ち時間・距離・嗜好コストでパレート最適な経路を1回の探索で求める
+ * - --search astar / bidir で2点間の探索を A* / 双方向ダイクストラにする（既定は始点ごとの最短経路木）
+ * - --prefs w0,...,w12 で13個の重みから user_preference_ver4.4.c の式で作った嗜好コストが最小の経路を CCH で求める
+ * - --weights w0,...,w12 で嗜好コストをプロセス内で作る（up44 を実行して result.csv を書き直す必要がない）
+ * - --compact で経路をファイル名の文字列ではなくエッジ表の番号の配列で出力する
+ * - --top K で全網羅の経路を総時間の短い上位 K 本だけ保持しながら列挙する（--yellow N で出力する黄の本数を絞る）
+ * - --batch FILE でクエリを1行ずつ読み、データを1回だけ読み込んで結果を NDJSON（1行1結果）で出力する
+ * - --build-atlas FILE で "<変種> <クエリ>" の行ごとの経路を求め、経路アトラス（route_atlas.h）に書き出す
  * - 信号待ち時間も考慮せず、「距離＋勾配による歩行時間」のみを使う
  */
 
 #ifndef _USE_MATH_DEFINES
 #define _USE_MATH_DEFINES
 #endif
+#define _POSIX_C_SOURCE 200809L  // mmap / stat（graph_snapshot.h）
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdarg.h>
 #include <string.h>
 #include <float.h>
 #include <math.h>
 #include <stdbool.h>
+#include <pthread.h>
+#include <time.h>
+#include "graph_snapshot.h"
+#include "edge_index.h"
+#include "node_heap.h"
+#include "cch.h"
+#include "user_preference.h"
+#include "csv_reader.h"
+#include "route_set.h"
+#include "route_arena.h"
+#include "route_atlas.h"
 
 #ifndef M_PI
 #define M_PI 3.14159265358979323846
 #endif
 
-#define MAX_NODES       300
-#define MAX_EDGES       1000
 #define MAX_PATH_LENGTH 200
 #define MAX_SIGNALS     50   // signal_inf.csv 側の最大信号数を想定
+#define MAX_ROUTES      5000 // 1クエリで出力する経路の上限（全網羅経路を含む）
+#define DEFAULT_PARETO_LABELS 8  // パレート探索でノードごとに保持するラベル数の既定値
+#define MAX_PARETO_LABELS     64 // --labels で指定できる上限（ラベルの領域はノード数 × N × 8 個）
+#define DEFAULT_COMBINATION_SIZE 3  // 全網羅で同時に通る信号の数（既定）
+#define MAX_COMBINATION_SIZE     6  // --depth で指定できる上限
+#define STREAM_CHUNK_JOBS     1024  // --top で一度に列挙・評価する組み合わせの数
 
 #define INF DBL_MAX
-#define K_GRADIENT 0.5
+#define EARTH_RADIUS_M 6371000.0  // A* のヒューリスティック（大円距離）に使う地球の半径
+#define K_GRADIENT 0.5  // 勾配による速度補正係数の既定値
 #define DEFAULT_WALKING_SPEED 80.0  // m/min
 
+// 全点間テーブル（yen --build-apsp で作る）
+#define APSP_FILE    "oomiya_apsp.bin"
+#define APSP_MAGIC   "VTAPSP\0"
+#define APSP_VERSION 1
+
+// 縮約階層の縮約順序（yen --build-cch で作る）
+#define CCH_FILE     "oomiya_cch.bin"
+
+// 常駐モード（--serve）の応答区切り
+#define SERVE_READY_MARKER "#READY"
+#define SERVE_END_MARKER   "#END"
+
 /* ---------- データ構造 ---------- */
 
 typedef struct {
@@ -40,6 +80,8 @@ typedef struct {
     double signalGreen;
     double signalPhase;
     double signalExpected;  // 期待待ち時間
+    int    inGraph;         // result.csv で隣接として登録済みか
+    double preference;      // result.csv の重み（ユーザー嗜好のコスト）
 } EdgeData;
 
 typedef struct {
@@ -47,15 +89,86 @@ typedef struct {
     double lon;  // 経度
 } NodePosition;
 
+// 隣接リスト（CSR形式）
+// ノード u の隣接は adjTarget / adjEdge の [adjOffset[u], adjOffset[u+1]) の範囲
+// ノード数・エッジ数は読み込んだデータから決まる
 typedef struct {
-    int node;
-    int edgeIndex;  // EdgeData 配列のインデックス
-} GraphEdge;
+    int  nodeCount;   // 最大ノード番号+1
+    int *adjOffset;   // nodeCount+1 要素
+    int *adjTarget;   // 隣接ノード
+    int *adjEdge;     // EdgeData 配列のインデックス
+} Graph;
 
+// 探索用の作業領域（ノード数・エッジ数に合わせて確保し、探索のたびに使い回す）
+typedef struct {
+    double *dist;
+    int    *prev;
+    int    *prevEdge;   // v に到達したエッジ（経路復元で探索しない）
+    bool   *used;
+    bool   *avoidEdge;  // 避けるべきエッジ（edgeDataCount 要素）
+    NodeHeap heap;      // 未確定ノードの優先度付きキュー（キーは dist、A* では fScore）
+    double *fScore;     // A* のキー（dist + ヒューリスティック）
+    // 双方向探索のゴール側（prevRev[v] は v からゴールへ向かう次のノード）
+    double *distRev;
+    int    *prevRev;
+    int    *prevEdgeRev;
+    bool   *usedRev;
+    NodeHeap heapRev;
+    long    settledCount;  // 確定したノード数（探索方式の比較用）
+} SearchWorkspace;
+
+// 2点間の最短経路の探し方（--search）
+typedef enum {
+    SEARCH_TREE = 0,       // 始点ごとの最短経路木をクエリの間キャッシュする（既定）
+    SEARCH_DIJKSTRA,       // 1対1のダイクストラ（ゴールを確定したら終了）
+    SEARCH_ASTAR,          // 直線距離の下界をヒューリスティックにした A*
+    SEARCH_BIDIRECTIONAL   // スタートとゴールの両側からのダイクストラ
+} SearchMode;
+
+// 始点 source からの最短経路木（制約なし、travelSec による）
 typedef struct {
-    GraphEdge edges[8];  // ノードあたり最大8本程度と仮定
-    int edge_count;
-} GraphNode;
+    int     source;
+    double *dist;
+    int    *prev;
+    int    *prevEdge;
+} ShortestPathTree;
+
+// クエリ中に作った最短経路木のキャッシュ（始点ごとに1つ）
+// 木は個別に確保するため、返したポインタはキャッシュが伸びても変わらない
+typedef struct {
+    ShortestPathTree **trees;
+    int                count;
+    int                capacity;
+    int               *bySource;  // ノード番号 → trees のインデックス（無ければ -1）
+} ShortestPathTreeCache;
+
+// 全点間テーブル（yen --build-apsp で作る）のヘッダ
+// 本体は全ノードを始点とする最短経路木で、dist / prev / prevEdge をそれぞれ
+// nodeCount × nodeCount の配列（始点ごとに nodeCount 要素）として持つ
+typedef struct {
+    char     magic[8];
+    uint32_t version;
+    uint32_t nodeCount;
+    uint32_t edgeCount;
+    uint32_t reserved;
+    double   walkingSpeed;    // 作成時の歩行速度（m/min）
+    double   kGradient;       // 作成時の勾配係数
+    uint64_t graphHash;       // 隣接リストと移動時間のハッシュ（クエリと一致するか確認する）
+    uint64_t distOffset;
+    uint64_t prevOffset;
+    uint64_t prevEdgeOffset;
+    uint64_t fileSize;
+} ApspHeader;
+
+// 読み込んだ全点間テーブル（mmap）
+typedef struct {
+    void             *base;
+    size_t            size;
+    const ApspHeader *hdr;
+    ShortestPathTree *trees;   // 始点ごとの最短経路木（mmap 内を指す）
+    bool              active;  // 現在のクエリの移動時間と一致するか
+    bool              selected; // active を現在の移動時間で判定済みか（apspSelect）
+} ApspTable;
 
 typedef struct {
     double cost;                 // 秒
@@ -65,7 +178,7 @@ typedef struct {
 
 typedef struct {
     int signalEdgeIdx;           // どの信号か (-1の場合は信号なし)
-    int edges[MAX_PATH_LENGTH];  // 経路のエッジ列
+    int *edges;                  // 経路のエッジ列（クエリのアリーナ内。組み立て中は呼び出し側の作業用配列）
     int edgeCount;
     double totalDistance;        // m
     double totalTimeSeconds;     // 秒
@@ -73,25 +186,265 @@ typedef struct {
     int hasSignal;               // 経路に信号が含まれるか (1: 含む, 0: 含まない)
 } RouteResult;
 
+// 1クエリ分の指定（コマンドライン引数・常駐モードの1行から作る）
+typedef struct {
+    int    startNode;
+    int    endNode;
+    double walkingSpeed;
+    double kGradient;
+    int    kspCount;       // 0 なら全網羅モード、1以上なら K最短経路モード
+    bool   timeDependent;  // 全網羅の代わりに時間依存探索を使う（--td）
+    int    threadCount;    // 信号の組み合わせを評価するスレッド数（--threads、1 なら並列化しない）
+    int    enumDepth;      // 全網羅で同時に通る信号の最大数（--depth）
+    bool   prune;          // 下界による組み合わせの枝刈りを行う（--prune）
+    bool   pareto;         // 多基準のパレート最適経路を出力する（--pareto）
+    SearchMode searchMode; // 2点間の最短経路の探し方（--search）
+    int    paretoLabels;   // パレート探索でノードごとに保持するラベル数（--labels）
+    bool   usePreference;  // 嗜好コストが最小の経路を求める（--prefs）
+    bool   hasWeights;     // 嗜好コストを重みから作る（--weights または --prefs）
+    double preferenceWeights[PREFERENCE_WEIGHTS];  // up44 に渡していた13個の重み
+    bool   compact;        // 経路をエッジ番号の配列で出力する（--compact）
+    int    topK;           // 全網羅で保持する経路数（--top）。0 なら全件を集めてから選ぶ
+    int    yellowLimit;    // 出力する黄（全網羅経路）の上限（--yellow）。-1 なら制限なし
+} QueryOptions;
+
+// 標準出力に書き出す前に内容をためておく可変長バッファ
+typedef struct {
+    char  *data;
+    size_t length;
+    size_t capacity;
+} OutputBuffer;
+
+// 1クエリ分の可変な状態（単発・常駐モードは mainQuery、同時に処理するクエリはそれぞれ自分の分を使う）
+// グラフ・移動時間・最短経路木のキャッシュ・全点間テーブルは全てのクエリで共有する
+typedef struct {
+    SearchWorkspace ws;               // 探索用の作業領域
+    RouteArena      arena;            // 経路のエッジ列（クエリごとに routeArenaReset で空にする）
+    pthread_mutex_t arenaLock;        // --threads の並列評価中の切り出しを保護する
+    RouteSet        enumRouteSet;     // 全網羅で生成した経路の重複判定（クエリごとに routeSetClear で空にする）
+    OutputBuffer    out;              // printJSON が組み立てて1回の fwrite で書き出す
+    int            *compactLocalId;   // コンパクト出力でのエッジ表の番号（未使用は -1。最初に使うときに作る）
+    double         *preferenceCost;   // エッジごとの嗜好コスト（--prefs / --weights の重みから作る）
+    const double   *activePreference; // このクエリの嗜好コスト（NULL なら result.csv の値を使う）
+    SearchMode      searchMode;       // dijkstra() の探し方
+    bool            compact;          // 経路をエッジ番号の配列で出力する（--compact）
+} QueryContext;
+
 /* ---------- グローバル ---------- */
 
-GraphNode graph[MAX_NODES];
-EdgeData  edgeDataArray[MAX_EDGES];
-int       edgeDataCount = 0;
+Graph     graph;
+EdgeData *edgeDataArray    = NULL;
+int       edgeDataCount    = 0;
+int       edgeDataCapacity = 0;
+EdgeIndex edgeIndex;  // 正規化した (from,to) → edgeDataArray のインデックス
+int       maxNodeId = 0;
+
+// result.csv で隣接として登録するエッジ（読み込み順）。buildAdjacency で CSR に変換する
+int *graphEdgeList     = NULL;
+int  graphEdgeCount    = 0;
+int  graphEdgeCapacity = 0;
+
+ShortestPathTreeCache sptCache;
+pthread_mutex_t sptCacheLock = PTHREAD_MUTEX_INITIALIZER;  // 並列評価中のキャッシュ参照・追加を保護する
+static __thread SearchWorkspace *threadWs = NULL;          // ワーカースレッド自身の作業領域（メインスレッドは NULL）
+ApspTable apspTable;
+QueryContext mainQuery = { .arenaLock = PTHREAD_MUTEX_INITIALIZER, .searchMode = SEARCH_TREE };
+static __thread QueryContext *threadQuery = NULL;  // このスレッドが処理中のクエリ（NULL なら mainQuery）
+
+// 嗜好コストの特徴行列（user_preference_ver4.4.c と同じく全カラムそろった oomiya_route_inf_4.csv の行）と、行ごとのエッジ
+PreferenceModel preferenceModel;
+int            *preferenceRowEdge     = NULL;
+int             preferenceRowCapacity = 0;
+CchGraph       cchGraph;               // 縮約順序とショートカット（最初の --prefs クエリで作る）
+CchQuery       cchWs;
+bool           cchReady = false;
+pthread_mutex_t preferenceLock = PTHREAD_MUTEX_INITIALIZER;  // 特徴行列の評価のキャッシュと CCH のカスタマイズ・探索を保護する
 
 int   signalEdges[MAX_SIGNALS];
 int   signalCount = 0;
 
-NodePosition nodePositions[MAX_NODES];  // ノード位置情報
+NodePosition *nodePositions = NULL;  // ノード位置情報（graph.nodeCount 要素）
 
 double walkingSpeed = DEFAULT_WALKING_SPEED; // m/min
+double kGradient    = K_GRADIENT;            // 勾配による速度補正係数
+double *travelSec   = NULL;                  // エッジごとの移動時間（秒）。クエリごとに prepareTravelTimes で作る
+bool   travelSecReady = false;                // travelSec が walkingSpeed / kGradient の値で計算済み
+double heuristicSecPerMeter = 0.0;            // A* のヒューリスティック（直線距離 × これ）。0 なら使わない
+bool   heuristicReady = false;                // heuristicSecPerMeter が現在の travelSec で計算済み
+
+// JSON 出力
+char *edgeNamePool   = NULL;  // エッジごとの "from-to.geojson"（正規化済み）を続けて並べたもの
+int  *edgeNameOffset = NULL;  // edgeNamePool 内の開始位置（edgeDataCount + 1 要素）
+bool  holdJsonOutput = false; // true なら printJSON はクエリの出力バッファに残したままにする（バッチモード）
+bool  outputAtlas    = false; // printJSON は経路アトラス用の記録を書く（--build-atlas）
 
 /* ---------- 共通ユーティリティ ---------- */
 
+// 配列を必要な大きさまで拡張する（確保できなければ終了）
+void *growArray(void *ptr, int *capacity, int needed, size_t elemSize) {
+    if (needed <= *capacity) return ptr;
+    int newCap = *capacity > 0 ? *capacity : 256;
+    while (newCap < needed) newCap *= 2;
+    void *p = realloc(ptr, (size_t)newCap * elemSize);
+    if (!p) {
+        fprintf(stderr, "Error: メモリを確保できません\n");
+        exit(1);
+    }
+    *capacity = newCap;
+    return p;
+}
+
+// 現在のスレッドが処理中のクエリ（組み合わせの評価のワーカーは、呼び出し元のクエリを指す）
+QueryContext *currentQuery(void) {
+    return threadQuery ? threadQuery : &mainQuery;
+}
+
+// 現在のスレッドの探索用作業領域（組み合わせの評価のワーカーは自分の分、それ以外はクエリの分）
+SearchWorkspace *currentWorkspace(void) {
+    return threadWs ? threadWs : &currentQuery()->ws;
+}
+
 void initGraph(void) {
-    for (int i = 0; i < MAX_NODES; i++) {
-        graph[i].edge_count = 0;
+    edgeDataCount  = 0;
+    graphEdgeCount = 0;
+    maxNodeId      = 0;
+    edgeIndexFree(&edgeIndex);
+    edgeIndexInit(&edgeIndex, 1024);
+}
+
+// 探索用の作業領域を現在のグラフの大きさで確保する（スレッドごとに1つ持てる）
+void initSearchWorkspace(SearchWorkspace *ws) {
+    int n = graph.nodeCount;
+    ws->dist      = (double *)malloc(sizeof(double) * (size_t)n);
+    ws->prev      = (int *)malloc(sizeof(int) * (size_t)n);
+    ws->prevEdge  = (int *)malloc(sizeof(int) * (size_t)n);
+    ws->used      = (bool *)malloc(sizeof(bool) * (size_t)n);
+    ws->avoidEdge = (bool *)malloc(sizeof(bool) * (size_t)(edgeDataCount + 1));
+    ws->fScore      = (double *)malloc(sizeof(double) * (size_t)n);
+    ws->distRev     = (double *)malloc(sizeof(double) * (size_t)n);
+    ws->prevRev     = (int *)malloc(sizeof(int) * (size_t)n);
+    ws->prevEdgeRev = (int *)malloc(sizeof(int) * (size_t)n);
+    ws->usedRev     = (bool *)malloc(sizeof(bool) * (size_t)n);
+    if (!ws->dist || !ws->prev || !ws->prevEdge || !ws->used || !ws->avoidEdge ||
+        !ws->fScore || !ws->distRev || !ws->prevRev || !ws->prevEdgeRev || !ws->usedRev) {
+        fprintf(stderr, "Error: メモリを確保できません\n");
+        exit(1);
+    }
+    nodeHeapInit(&ws->heap, n);
+    nodeHeapInit(&ws->heapRev, n);
+    ws->settledCount = 0;
+}
+
+void freeSearchWorkspace(SearchWorkspace *ws) {
+    free(ws->dist);
+    free(ws->prev);
+    free(ws->prevEdge);
+    free(ws->used);
+    free(ws->avoidEdge);
+    free(ws->fScore);
+    free(ws->distRev);
+    free(ws->prevRev);
+    free(ws->prevEdgeRev);
+    free(ws->usedRev);
+    nodeHeapFree(&ws->heap);
+    nodeHeapFree(&ws->heapRev);
+    memset(ws, 0, sizeof(*ws));
+}
+
+// 並列に処理するクエリの状態を用意する（グラフを読み込んだ後に呼ぶ）
+void initQueryContext(QueryContext *q) {
+    memset(q, 0, sizeof(*q));
+    initSearchWorkspace(&q->ws);
+    pthread_mutex_init(&q->arenaLock, NULL);
+    q->searchMode = SEARCH_TREE;
+}
+
+void freeQueryContext(QueryContext *q) {
+    freeSearchWorkspace(&q->ws);
+    routeArenaFree(&q->arena);
+    pthread_mutex_destroy(&q->arenaLock);
+    routeSetFree(&q->enumRouteSet);
+    free(q->out.data);
+    free(q->compactLocalId);
+    free(q->preferenceCost);
+    memset(q, 0, sizeof(*q));
+}
+
+// 読み込んだエッジから CSR 形式の隣接リストと探索用の作業領域を作る
+// ノードごとの隣接の順序は result.csv の読み込み順（従来の隣接配列と同じ）
+void buildAdjacency(void) {
+    int n = maxNodeId + 1;
+
+    free(graph.adjOffset);
+    free(graph.adjTarget);
+    free(graph.adjEdge);
+    graph.nodeCount = n;
+    graph.adjOffset = (int *)calloc((size_t)n + 1, sizeof(int));
+    graph.adjTarget = (int *)malloc(sizeof(int) * (size_t)(graphEdgeCount * 2 + 1));
+    graph.adjEdge   = (int *)malloc(sizeof(int) * (size_t)(graphEdgeCount * 2 + 1));
+    if (!graph.adjOffset || !graph.adjTarget || !graph.adjEdge) {
+        fprintf(stderr, "Error: メモリを確保できません\n");
+        exit(1);
+    }
+
+    // 次数を数えて先頭位置を決める
+    for (int i = 0; i < graphEdgeCount; i++) {
+        EdgeData *e = &edgeDataArray[graphEdgeList[i]];
+        graph.adjOffset[e->from + 1]++;
+        if (e->to != e->from) graph.adjOffset[e->to + 1]++;
     }
+    for (int u = 0; u < n; u++) {
+        graph.adjOffset[u + 1] += graph.adjOffset[u];
+    }
+
+    // 読み込み順に詰める（双方向）
+    int *fill = (int *)malloc(sizeof(int) * (size_t)n);
+    memcpy(fill, graph.adjOffset, sizeof(int) * (size_t)n);
+    for (int i = 0; i < graphEdgeCount; i++) {
+        int edgeIdx = graphEdgeList[i];
+        EdgeData *e = &edgeDataArray[edgeIdx];
+        graph.adjTarget[fill[e->from]] = e->to;
+        graph.adjEdge[fill[e->from]++] = edgeIdx;
+        if (e->to != e->from) {
+            graph.adjTarget[fill[e->to]] = e->from;
+            graph.adjEdge[fill[e->to]++] = edgeIdx;
+        }
+    }
+    free(fill);
+
+    // ノード位置（読み込まれていないノードは 0.0）
+    free(nodePositions);
+    nodePositions = (NodePosition *)calloc((size_t)n, sizeof(NodePosition));
+
+    // エッジごとの移動時間（クエリごとに prepareTravelTimes で埋める）
+    free(travelSec);
+    travelSec = (double *)malloc(sizeof(double) * (size_t)(edgeDataCount + 1));
+    travelSecReady = false;
+
+    // 最短経路木のキャッシュ
+    for (int i = 0; i < sptCache.capacity; i++) {
+        free(sptCache.trees[i]->dist);
+        free(sptCache.trees[i]->prev);
+        free(sptCache.trees[i]->prevEdge);
+        free(sptCache.trees[i]);
+    }
+    free(sptCache.trees);
+    free(sptCache.bySource);
+    memset(&sptCache, 0, sizeof(sptCache));
+    sptCache.bySource = (int *)malloc(sizeof(int) * (size_t)n);
+    for (int i = 0; sptCache.bySource && i < n; i++) sptCache.bySource[i] = -1;
+
+    if (!nodePositions || !travelSec || !sptCache.bySource) {
+        fprintf(stderr, "Error: メモリを確保できません\n");
+        exit(1);
+    }
+
+    // 探索用の作業領域
+    freeSearchWorkspace(&mainQuery.ws);
+    initSearchWorkspace(&mainQuery.ws);
+
+    fprintf(stderr, "Graph: nodes=%d, edges=%d, adjacency=%d\n",
+            n, edgeDataCount, graph.adjOffset[n]);
 }
 
 void normalizeEdgeKey(int from, int to, int *outFrom, int *outTo) {
@@ -104,64 +457,103 @@ void normalizeEdgeKey(int from, int to, int *outFrom, int *outTo) {
     }
 }
 
-// EdgeData 配列から (from,to) に対応する edgeIndex を探す
+// EdgeData 配列から (from,to) に対応する edgeIndex を探す（ハッシュ表で定数時間）
 int findEdgeIndex(int from, int to) {
+    return edgeIndexFind(&edgeIndex, from, to);
+}
+
+// EdgeData 配列に (from,to) のエッジを追加し、索引にも登録する
+int appendEdge(int from, int to) {
+    edgeDataArray = (EdgeData *)growArray(edgeDataArray, &edgeDataCapacity,
+                                          edgeDataCount + 1, sizeof(EdgeData));
+    int edgeIdx = edgeDataCount++;
+    memset(&edgeDataArray[edgeIdx], 0, sizeof(EdgeData));
+    edgeDataArray[edgeIdx].from = from;
+    edgeDataArray[edgeIdx].to   = to;
+    edgeIndexInsert(&edgeIndex, from, to, edgeIdx);
+    if (from > maxNodeId) maxNodeId = from;
+    if (to   > maxNodeId) maxNodeId = to;
+    return edgeIdx;
+}
+
+// 危険な経路（移動時間に10倍のペナルティを付ける）
+bool isDangerousEdge(const EdgeData *e) {
     int nf, nt;
-    normalizeEdgeKey(from, to, &nf, &nt);
+    normalizeEdgeKey(e->from, e->to, &nf, &nt);
+    return (nf == 22 && nt == 194) || (nf == 18 && nt == 192);
+}
 
-    for (int i = 0; i < edgeDataCount; i++) {
-        int ef, et;
-        normalizeEdgeKey(edgeDataArray[i].from, edgeDataArray[i].to, &ef, &et);
-        if (ef == nf && et == nt) return i;
+// 移動時間が変わったら（クエリごとに）キャッシュした最短経路木を捨てる
+void sptCacheClear(void) {
+    for (int i = 0; i < sptCache.count; i++) {
+        sptCache.bySource[sptCache.trees[i]->source] = -1;
     }
-    return -1;
+    sptCache.count = 0;
 }
 
-// エッジの移動時間（秒）
-double getEdgeTimeSeconds(int from, int to) {
-    int edgeIdx = findEdgeIndex(from, to);
-    if (edgeIdx < 0) return INF;
+void prepareSearchHeuristic(void);
 
-    EdgeData *e = &edgeDataArray[edgeIdx];
-    
-    // 危険な経路に大きなペナルティを追加
-    int nf, nt;
-    normalizeEdgeKey(from, to, &nf, &nt);
-    bool isDangerousRoute = false;
-    int dangerousFrom = 0, dangerousTo = 0;
-    
-    // 危険な経路のチェック
-    if (nf == 22 && nt == 194) {
-        isDangerousRoute = true;
-        dangerousFrom = 22;
-        dangerousTo = 194;
-    } else if (nf == 18 && nt == 192) {
-        isDangerousRoute = true;
-        dangerousFrom = 18;
-        dangerousTo = 192;
+// クエリの歩行速度・勾配係数から全エッジの移動時間（秒）を計算して travelSec に入れる
+// 探索とメトリクス計算はこの配列だけを参照する（通れないエッジは INF）
+// 前のクエリと同じ値なら計算し直さず、最短経路木のキャッシュもそのまま使う
+void prepareTravelTimes(double ws, double kGrad) {
+    bool astar = currentQuery()->searchMode == SEARCH_ASTAR;
+    if (travelSecReady && ws == walkingSpeed && kGrad == kGradient) {
+        if (astar && !heuristicReady) prepareSearchHeuristic();
+        return;
     }
-    
-    // 勾配による速度補正（元コードと同じロジック）
-    double adjustedSpeed = walkingSpeed * (1.0 - K_GRADIENT * e->gradient);
-    if (adjustedSpeed <= 0.0) return INF;
+    walkingSpeed = ws;
+    kGradient    = kGrad;
 
-    double timeMinutes = e->distance / adjustedSpeed;  // 分
-    double timeSeconds = timeMinutes * 60.0;           // 秒
-    
-    // 危険な経路の場合は、時間に大きなペナルティを追加（10倍）
-    if (isDangerousRoute) {
-        timeSeconds *= 10.0;  // 10倍のペナルティ
-        fprintf(stderr, "警告: 危険な経路%d-%dを検出。時間にペナルティを追加: %.2f秒 → %.2f秒\n", 
-                dangerousFrom, dangerousTo, timeMinutes * 60.0, timeSeconds);
+    for (int i = 0; i < edgeDataCount; i++) {
+        EdgeData *e = &edgeDataArray[i];
+
+        // 勾配による速度補正（元コードと同じロジック）
+        double adjustedSpeed = walkingSpeed * (1.0 - kGradient * e->gradient);
+        if (adjustedSpeed <= 0.0) {
+            travelSec[i] = INF;
+            continue;
+        }
+
+        double timeMinutes = e->distance / adjustedSpeed;  // 分
+        double timeSeconds = timeMinutes * 60.0;           // 秒
+
+        // 危険な経路の場合は、時間に大きなペナルティを追加（10倍）
+        if (isDangerousEdge(e)) {
+            timeSeconds *= 10.0;  // 10倍のペナルティ
+            fprintf(stderr, "警告: 危険な経路%d-%dを検出。時間にペナルティを追加: %.2f秒 → %.2f秒\n",
+                    e->from < e->to ? e->from : e->to, e->from < e->to ? e->to : e->from,
+                    timeMinutes * 60.0, timeSeconds);
+        }
+        travelSec[i] = timeSeconds;
     }
-    
-    return timeSeconds;
+
+    // 移動時間が変わるため、前のクエリの最短経路木・ヒューリスティック・全点間テーブルの判定は使えない
+    sptCacheClear();
+    travelSecReady     = true;
+    heuristicReady     = false;
+    apspTable.selected = false;
+    if (astar) prepareSearchHeuristic();
+}
+
+// エッジの移動時間（秒）: prepareTravelTimes で計算済みの値を返す
+double getEdgeTimeSecondsByIndex(int edgeIdx) {
+    if (edgeIdx < 0) return INF;
+    return travelSec[edgeIdx];
+}
+
+// エッジの移動時間（秒）
+double getEdgeTimeSeconds(int from, int to) {
+    return getEdgeTimeSecondsByIndex(findEdgeIndex(from, to));
 }
 
 // 前方宣言
 double calculateBearing(double lat1, double lon1, double lat2, double lon2);
 bool isWithinAngleRange(double angle1, double angle2, double tolerance);
 bool appendSegment(RouteResult *res, const DijkstraResult *seg);
+void beginRoute(RouteResult *r, int *scratch, int signalEdgeIdx, int hasSignal);
+void storeRoute(RouteResult *dst, const RouteResult *src);
+int *copyRouteEdges(const int *edges, int edgeCount);
 void getTargetSignalEdges(int *targetSignalIndices, int *targetCount);
 void calcRouteMetricsWithWaitTimeAndBaseTime1(const int *edgeIdxs, int edgeCount,
                                                double *outDist, double *outTimeSec, bool useExpectedWaitTime, bool isBaseTime1);
@@ -176,61 +568,61 @@ bool calculateBaseTime1(int startNode, int endNode, double targetBearing, RouteR
 bool calculateBaseTime2(int startNode, int endNode, RouteResult *outRoute);
 
 // 全網羅経路を計算する関数（指定された信号から1個、2個、3個の組み合わせを全て探索）
-int calculateAllEnumRoutes(int startNode, int endNode, int signalCount, RouteResult *outRoutes, int maxRoutes);
+int calculateAllEnumRoutes(int startNode, int endNode, int signalCount, RouteResult *outRoutes, int maxRoutes,
+                           const QueryOptions *opt, RouteSet *seen);
 
 /* ---------- ダイクストラ（信号制限なし・待ち時間なし） ---------- */
 
 // 指定された信号エッジを避けるダイクストラ（方角制約なし）
 DijkstraResult dijkstraAvoidTargetSignals(int start, int goal, double targetBearing, int *avoidEdgeIndices, int avoidCount) {
-    double dist[MAX_NODES];
-    int    prev[MAX_NODES];
-    bool   used[MAX_NODES];
+    SearchWorkspace *ws = currentWorkspace();
+    double *dist     = ws->dist;
+    int    *prev     = ws->prev;
+    int    *prevEdge = ws->prevEdge;
+    bool   *used     = ws->used;
+    NodeHeap *heap   = &ws->heap;
     // 方角制約を使用するかどうか：常にfalse（方角制約を無効化）
     bool   useAngleConstraint = false;
     
     fprintf(stderr, "方角制約を使用しない（方角制約を無効化）\n");
     
     // 避けるべきエッジのセットを作成
-    bool avoidEdgeSet[MAX_EDGES];
-    for (int i = 0; i < MAX_EDGES; i++) {
+    bool *avoidEdgeSet = ws->avoidEdge;
+    for (int i = 0; i < edgeDataCount; i++) {
         avoidEdgeSet[i] = false;
     }
     int validAvoidCount = 0;
     for (int i = 0; i < avoidCount; i++) {
-        if (avoidEdgeIndices[i] >= 0 && avoidEdgeIndices[i] < MAX_EDGES) {
+        if (avoidEdgeIndices[i] >= 0 && avoidEdgeIndices[i] < edgeDataCount) {
             avoidEdgeSet[avoidEdgeIndices[i]] = true;
             validAvoidCount++;
         }
     }
     fprintf(stderr, "避けるべき信号エッジ: %d個設定\n", validAvoidCount);
 
-    for (int i = 0; i < MAX_NODES; i++) {
+    for (int i = 0; i < graph.nodeCount; i++) {
         dist[i] = INF;
         prev[i] = -1;
+        prevEdge[i] = -1;
         used[i] = false;
     }
     dist[start] = 0.0;
+    nodeHeapReset(heap, dist);
+    nodeHeapUpdate(heap, start);
 
     int visitedCount = 0;
     int skippedByAngleCount = 0;
     int skippedBySignalCount = 0;
     
     while (1) {
-        int    u   = -1;
-        double d_u = INF;
-        for (int i = 0; i < MAX_NODES; i++) {
-            if (!used[i] && dist[i] < d_u) {
-                d_u = dist[i];
-                u   = i;
-            }
-        }
+        int u = nodeHeapPop(heap);
         if (u == -1 || u == goal) break;
         used[u] = true;
         visitedCount++;
 
-        for (int i = 0; i < graph[u].edge_count; i++) {
-            int v       = graph[u].edges[i].node;
-            int edgeIdx = graph[u].edges[i].edgeIndex;
+        for (int i = graph.adjOffset[u]; i < graph.adjOffset[u + 1]; i++) {
+            int v       = graph.adjTarget[i];
+            int edgeIdx = graph.adjEdge[i];
             if (used[v]) continue;
             
             // 指定された信号エッジのみを避ける（他の信号は通ってもよい）
@@ -261,13 +653,15 @@ DijkstraResult dijkstraAvoidTargetSignals(int start, int goal, double targetBear
                 }
             }
 
-            double t = getEdgeTimeSeconds(u, v);
+            double t = travelSec[edgeIdx];
             if (t >= INF) continue;
 
             double nd = dist[u] + t;
             if (nd < dist[v]) {
                 dist[v] = nd;
                 prev[v] = u;
+                prevEdge[v] = edgeIdx;
+                nodeHeapUpdate(heap, v);
             }
         }
     }
@@ -284,7 +678,7 @@ DijkstraResult dijkstraAvoidTargetSignals(int start, int goal, double targetBear
     }
 
     // ノード列を復元 → エッジ列に変換
-    int nodes[MAX_PATH_LENGTH];
+    int nodes[MAX_PATH_LENGTH + 1];
     int nodeCount = 0;
     int cur       = goal;
 
@@ -292,7 +686,8 @@ DijkstraResult dijkstraAvoidTargetSignals(int start, int goal, double targetBear
         nodes[nodeCount++] = cur;
         cur = prev[cur];
     }
-    if (cur == -1) {
+    // cur が start に届かない場合は経路なし、または MAX_PATH_LENGTH を超える経路
+    if (cur != start) {
         res.cost       = INF;
         res.pathLength = 0;
         return res;
@@ -301,9 +696,7 @@ DijkstraResult dijkstraAvoidTargetSignals(int start, int goal, double targetBear
 
     // 逆順でエッジに
     for (int i = nodeCount - 1; i > 0; i--) {
-        int from = nodes[i];
-        int to   = nodes[i - 1];
-        int edgeIdx = findEdgeIndex(from, to);
+        int edgeIdx = prevEdge[nodes[i - 1]];
         if (edgeIdx < 0 || avoidEdgeSet[edgeIdx]) {
             res.cost       = INF;
             res.pathLength = 0;
@@ -317,34 +710,33 @@ DijkstraResult dijkstraAvoidTargetSignals(int start, int goal, double targetBear
 
 // ダイクストラ（信号エッジを除外、方角制約なし）
 DijkstraResult dijkstraWithAngleConstraint(int start, int goal, double targetBearing, bool avoidSignals) {
-    double dist[MAX_NODES];
-    int    prev[MAX_NODES];
-    bool   used[MAX_NODES];
+    SearchWorkspace *ws = currentWorkspace();
+    double *dist     = ws->dist;
+    int    *prev     = ws->prev;
+    int    *prevEdge = ws->prevEdge;
+    bool   *used     = ws->used;
+    NodeHeap *heap   = &ws->heap;
     // 方角制約を無効化
     bool   useAngleConstraint = false;
 
-    for (int i = 0; i < MAX_NODES; i++) {
+    for (int i = 0; i < graph.nodeCount; i++) {
         dist[i] = INF;
         prev[i] = -1;
+        prevEdge[i] = -1;
         used[i] = false;
     }
     dist[start] = 0.0;
+    nodeHeapReset(heap, dist);
+    nodeHeapUpdate(heap, start);
 
     while (1) {
-        int    u   = -1;
-        double d_u = INF;
-        for (int i = 0; i < MAX_NODES; i++) {
-            if (!used[i] && dist[i] < d_u) {
-                d_u = dist[i];
-                u   = i;
-            }
-        }
+        int u = nodeHeapPop(heap);
         if (u == -1 || u == goal) break;
         used[u] = true;
 
-        for (int i = 0; i < graph[u].edge_count; i++) {
-            int v       = graph[u].edges[i].node;
-            int edgeIdx = graph[u].edges[i].edgeIndex;
+        for (int i = graph.adjOffset[u]; i < graph.adjOffset[u + 1]; i++) {
+            int v       = graph.adjTarget[i];
+            int edgeIdx = graph.adjEdge[i];
             if (used[v]) continue;
             
             EdgeData *e = &edgeDataArray[edgeIdx];
@@ -361,13 +753,15 @@ DijkstraResult dijkstraWithAngleConstraint(int start, int goal, double targetBea
                 }
             }
 
-            double t = getEdgeTimeSeconds(u, v);
+            double t = travelSec[edgeIdx];
             if (t >= INF) continue;
 
             double nd = dist[u] + t;
             if (nd < dist[v]) {
                 dist[v] = nd;
                 prev[v] = u;
+                prevEdge[v] = edgeIdx;
+                nodeHeapUpdate(heap, v);
             }
         }
     }
@@ -381,7 +775,7 @@ DijkstraResult dijkstraWithAngleConstraint(int start, int goal, double targetBea
     }
 
     // ノード列を復元 → エッジ列に変換
-    int nodes[MAX_PATH_LENGTH];
+    int nodes[MAX_PATH_LENGTH + 1];
     int nodeCount = 0;
     int cur       = goal;
 
@@ -389,7 +783,8 @@ DijkstraResult dijkstraWithAngleConstraint(int start, int goal, double targetBea
         nodes[nodeCount++] = cur;
         cur = prev[cur];
     }
-    if (cur == -1) {
+    // cur が start に届かない場合は経路なし、または MAX_PATH_LENGTH を超える経路
+    if (cur != start) {
         res.cost       = INF;
         res.pathLength = 0;
         return res;
@@ -398,9 +793,7 @@ DijkstraResult dijkstraWithAngleConstraint(int start, int goal, double targetBea
 
     // 逆順でエッジに
     for (int i = nodeCount - 1; i > 0; i--) {
-        int from = nodes[i];
-        int to   = nodes[i - 1];
-        int edgeIdx = findEdgeIndex(from, to);
+        int edgeIdx = prevEdge[nodes[i - 1]];
         if (edgeIdx < 0) {
             res.cost       = INF;
             res.pathLength = 0;
@@ -414,44 +807,45 @@ DijkstraResult dijkstraWithAngleConstraint(int start, int goal, double targetBea
 
 // 信号エッジを除外したダイクストラ
 DijkstraResult dijkstraAvoidSignal(int start, int goal, int avoidEdgeIdx) {
-    double dist[MAX_NODES];
-    int    prev[MAX_NODES];
-    bool   used[MAX_NODES];
-
-    for (int i = 0; i < MAX_NODES; i++) {
+    SearchWorkspace *ws = currentWorkspace();
+    double *dist     = ws->dist;
+    int    *prev     = ws->prev;
+    int    *prevEdge = ws->prevEdge;
+    bool   *used     = ws->used;
+    NodeHeap *heap   = &ws->heap;
+
+    for (int i = 0; i < graph.nodeCount; i++) {
         dist[i] = INF;
         prev[i] = -1;
+        prevEdge[i] = -1;
         used[i] = false;
     }
     dist[start] = 0.0;
+    nodeHeapReset(heap, dist);
+    nodeHeapUpdate(heap, start);
 
     while (1) {
-        int    u   = -1;
-        double d_u = INF;
-        for (int i = 0; i < MAX_NODES; i++) {
-            if (!used[i] && dist[i] < d_u) {
-                d_u = dist[i];
-                u   = i;
-            }
-        }
+        int u = nodeHeapPop(heap);
         if (u == -1 || u == goal) break;
         used[u] = true;
 
-        for (int i = 0; i < graph[u].edge_count; i++) {
-            int v       = graph[u].edges[i].node;
-            int edgeIdx = graph[u].edges[i].edgeIndex;
+        for (int i = graph.adjOffset[u]; i < graph.adjOffset[u + 1]; i++) {
+            int v       = graph.adjTarget[i];
+            int edgeIdx = graph.adjEdge[i];
             if (used[v]) continue;
             
             // 避けるべき信号エッジをスキップ
             if (edgeIdx == avoidEdgeIdx) continue;
 
-            double t = getEdgeTimeSeconds(u, v);
+            double t = travelSec[edgeIdx];
             if (t >= INF) continue;
 
             double nd = dist[u] + t;
             if (nd < dist[v]) {
                 dist[v] = nd;
                 prev[v] = u;
+                prevEdge[v] = edgeIdx;
+                nodeHeapUpdate(heap, v);
             }
         }
     }
@@ -465,7 +859,7 @@ DijkstraResult dijkstraAvoidSignal(int start, int goal, int avoidEdgeIdx) {
     }
 
     // ノード列を復元 → エッジ列に変換
-    int nodes[MAX_PATH_LENGTH];
+    int nodes[MAX_PATH_LENGTH + 1];
     int nodeCount = 0;
     int cur       = goal;
 
@@ -473,7 +867,8 @@ DijkstraResult dijkstraAvoidSignal(int start, int goal, int avoidEdgeIdx) {
         nodes[nodeCount++] = cur;
         cur = prev[cur];
     }
-    if (cur == -1) {
+    // cur が start に届かない場合は経路なし、または MAX_PATH_LENGTH を超える経路
+    if (cur != start) {
         res.cost       = INF;
         res.pathLength = 0;
         return res;
@@ -482,9 +877,7 @@ DijkstraResult dijkstraAvoidSignal(int start, int goal, int avoidEdgeIdx) {
 
     // 逆順でエッジに
     for (int i = nodeCount - 1; i > 0; i--) {
-        int from = nodes[i];
-        int to   = nodes[i - 1];
-        int edgeIdx = findEdgeIndex(from, to);
+        int edgeIdx = prevEdge[nodes[i - 1]];
         if (edgeIdx < 0 || edgeIdx == avoidEdgeIdx) {
             res.cost       = INF;
             res.pathLength = 0;
@@ -496,44 +889,98 @@ DijkstraResult dijkstraAvoidSignal(int start, int goal, int avoidEdgeIdx) {
     return res;
 }
 
-DijkstraResult dijkstra(int start, int goal) {
-    double dist[MAX_NODES];
-    int    prev[MAX_NODES];
-    bool   used[MAX_NODES];
-
-    for (int i = 0; i < MAX_NODES; i++) {
+// start を根とする最短経路木を作る（ゴールで打ち切らずに到達できる全ノードを確定させる）
+// 確定済みノードの dist / prev は後から変わらないため、途中で打ち切った dijkstra(start, goal) と
+// 同じ経路がどのゴールに対しても得られる
+// グラフと travelSec は読むだけなので、作業領域 ws を分ければ複数スレッドから同時に呼べる
+void buildShortestPathTree(int start, ShortestPathTree *tree, SearchWorkspace *ws) {
+    double *dist     = tree->dist;
+    int    *prev     = tree->prev;
+    int    *prevEdge = tree->prevEdge;
+    bool   *used     = ws->used;
+    NodeHeap *heap   = &ws->heap;
+
+    tree->source = start;
+    for (int i = 0; i < graph.nodeCount; i++) {
         dist[i] = INF;
         prev[i] = -1;
+        prevEdge[i] = -1;
         used[i] = false;
     }
     dist[start] = 0.0;
+    nodeHeapReset(heap, dist);
+    nodeHeapUpdate(heap, start);
 
     while (1) {
-        int    u   = -1;
-        double d_u = INF;
-        for (int i = 0; i < MAX_NODES; i++) {
-            if (!used[i] && dist[i] < d_u) {
-                d_u = dist[i];
-                u   = i;
-            }
-        }
-        if (u == -1 || u == goal) break;
+        int u = nodeHeapPop(heap);
+        if (u == -1) break;
         used[u] = true;
+        ws->settledCount++;
 
-        for (int i = 0; i < graph[u].edge_count; i++) {
-            int v       = graph[u].edges[i].node;
+        for (int i = graph.adjOffset[u]; i < graph.adjOffset[u + 1]; i++) {
+            int v       = graph.adjTarget[i];
+            int edgeIdx = graph.adjEdge[i];
             if (used[v]) continue;
 
-            double t = getEdgeTimeSeconds(u, v);
+            double t = travelSec[edgeIdx];
             if (t >= INF) continue;
 
             double nd = dist[u] + t;
             if (nd < dist[v]) {
                 dist[v] = nd;
                 prev[v] = u;
+                prevEdge[v] = edgeIdx;
+                nodeHeapUpdate(heap, v);
             }
         }
     }
+}
+
+// start を根とする最短経路木（無ければ作ってキャッシュする）
+// 信号の組み合わせの並列評価中も呼べるよう、キャッシュの参照・追加は sptCacheLock で保護する
+const ShortestPathTree *getShortestPathTree(int start) {
+    // 全点間テーブルがこのクエリの移動時間で作られていれば、探索せずにそこから引く
+    if (apspTable.active) return &apspTable.trees[start];
+
+    pthread_mutex_lock(&sptCacheLock);
+    int slot = sptCache.bySource[start];
+    if (slot < 0) {
+        if (sptCache.count == sptCache.capacity) {
+            int oldCap = sptCache.capacity;
+            sptCache.trees = (ShortestPathTree **)growArray(sptCache.trees, &sptCache.capacity,
+                                                            sptCache.count + 1, sizeof(ShortestPathTree *));
+            for (int i = oldCap; i < sptCache.capacity; i++) {
+                ShortestPathTree *t = (ShortestPathTree *)malloc(sizeof(ShortestPathTree));
+                if (!t) {
+                    fprintf(stderr, "Error: メモリを確保できません\n");
+                    exit(1);
+                }
+                t->dist     = (double *)malloc(sizeof(double) * (size_t)graph.nodeCount);
+                t->prev     = (int *)malloc(sizeof(int) * (size_t)graph.nodeCount);
+                t->prevEdge = (int *)malloc(sizeof(int) * (size_t)graph.nodeCount);
+                if (!t->dist || !t->prev || !t->prevEdge) {
+                    fprintf(stderr, "Error: メモリを確保できません\n");
+                    exit(1);
+                }
+                sptCache.trees[i] = t;
+            }
+        }
+
+        slot = sptCache.count++;
+        buildShortestPathTree(start, sptCache.trees[slot], currentWorkspace());
+        sptCache.bySource[start] = slot;
+    }
+    const ShortestPathTree *tree = sptCache.trees[slot];
+    pthread_mutex_unlock(&sptCacheLock);
+    return tree;
+}
+
+// 最短経路木から goal までの経路をエッジ列で取り出す
+DijkstraResult pathFromTree(const ShortestPathTree *tree, int goal) {
+    const double *dist     = tree->dist;
+    const int    *prev     = tree->prev;
+    const int    *prevEdge = tree->prevEdge;
+    int           start    = tree->source;
 
     DijkstraResult res;
     res.cost       = dist[goal];
@@ -544,7 +991,7 @@ DijkstraResult dijkstra(int start, int goal) {
     }
 
     // ノード列を復元 → エッジ列に変換
-    int nodes[MAX_PATH_LENGTH];
+    int nodes[MAX_PATH_LENGTH + 1];
     int nodeCount = 0;
     int cur       = goal;
 
@@ -552,7 +999,8 @@ DijkstraResult dijkstra(int start, int goal) {
         nodes[nodeCount++] = cur;
         cur = prev[cur];
     }
-    if (cur == -1) {
+    // cur が start に届かない場合は経路なし、または MAX_PATH_LENGTH を超える経路
+    if (cur != start) {
         res.cost       = INF;
         res.pathLength = 0;
         return res;
@@ -561,9 +1009,7 @@ DijkstraResult dijkstra(int start, int goal) {
 
     // 逆順でエッジに
     for (int i = nodeCount - 1; i > 0; i--) {
-        int from = nodes[i];
-        int to   = nodes[i - 1];
-        int edgeIdx = findEdgeIndex(from, to);
+        int edgeIdx = prevEdge[nodes[i - 1]];
         if (edgeIdx < 0) {
             res.cost       = INF;
             res.pathLength = 0;
@@ -575,423 +1021,1483 @@ DijkstraResult dijkstra(int start, int goal) {
     return res;
 }
 
-/* ---------- メトリクス計算 ---------- */
-
-// 待ち時間を含めたメトリクス計算（待ち時間を0にする場合と期待値を使う場合）
-void calcRouteMetricsWithWaitTime(const int *edgeIdxs, int edgeCount,
-                                   double *outDist, double *outTimeSec, bool useExpectedWaitTime) {
-    calcRouteMetricsWithWaitTimeAndBaseTime1(edgeIdxs, edgeCount, outDist, outTimeSec, useExpectedWaitTime, false);
+// 2点間の大円距離（m）
+double haversineMeters(double lat1, double lon1, double lat2, double lon2) {
+    double dLat = (lat2 - lat1) * M_PI / 180.0;
+    double dLon = (lon2 - lon1) * M_PI / 180.0;
+    double a = sin(dLat / 2.0) * sin(dLat / 2.0) +
+               cos(lat1 * M_PI / 180.0) * cos(lat2 * M_PI / 180.0) * sin(dLon / 2.0) * sin(dLon / 2.0);
+    return 2.0 * EARTH_RADIUS_M * asin(sqrt(fmin(1.0, a)));
 }
 
-// 信号待ち時間を計算（基準位相を考慮）
-double calculateWaitTimeWithReference(int edgeIdx, double cumulativeTime, double referencePhase) {
-    EdgeData *edge = &edgeDataArray[edgeIdx];
-    if (!edge->isSignal || edge->signalCycle <= 0) return 0.0;
-    
-    double phaseDiff = fabs(edge->signalPhase - referencePhase);
-    double arrivalTime = cumulativeTime;
-    double timeIntoCycle = fmod(
-        arrivalTime - phaseDiff + edge->signalCycle,
-        edge->signalCycle
-    );
-    
-    if (timeIntoCycle > edge->signalGreen) {
-        return edge->signalCycle - timeIntoCycle;
-    }
-    return 0.0;
+bool hasNodePosition(int node) {
+    return nodePositions[node].lat != 0.0 || nodePositions[node].lon != 0.0;
 }
 
-// サイクルベースの待ち時間を含めたメトリクス計算
-// isBaseTime1=true: 基準時刻1（緑）- 信号の待ち時間は追加しない、60-209横断歩道の待ち時間は追加する
-// isBaseTime1=false: 基準時刻2（青）や赤 - 信号の待ち時間と60-209横断歩道の待ち時間の両方を追加する
-void calcRouteMetricsWithCycleBasedWaitTime(const int *edgeIdxs, int edgeCount,
-                                             double *outDist, double *outTimeSec, double *outWaitTimeSec, bool isBaseTime1) {
-    double totalDist = 0.0;
-    double totalTime = 0.0;
-    double totalWaitTime = 0.0;
-    double cumulativeTime = 0.0;
-    double signalWaitTime = 0.0;  // 信号の待ち時間のみ
-    double crosswalkWaitTime = 0.0;  // 60-209横断歩道の待ち時間のみ
-    
-    // 最初の信号エッジの位相を基準位相として取得
-    double referencePhase = 0.0;
-    bool hasReferencePhase = false;
-    for (int i = 0; i < edgeCount; i++) {
-        int idx = edgeIdxs[i];
-        if (idx >= 0 && idx < edgeDataCount) {
-            EdgeData *e = &edgeDataArray[idx];
-            if (e->isSignal && e->signalCycle > 0) {
-                referencePhase = e->signalPhase;
-                hasReferencePhase = true;
-                break;
-            }
+// A* のヒューリスティックを現在の移動時間に合わせて用意する
+// 全エッジの中で最も速い「両端の直線距離 / 移動時間」で直線距離を進むとみなした時間を下界にする。
+// 直線距離は三角不等式を満たすので、この下界は許容的かつ無矛盾（取り出した時点で確定してよい）。
+// 位置情報のないノードがある、または移動時間0で離れたノードを結ぶエッジがある場合は使わない
+void prepareSearchHeuristic(void) {
+    heuristicSecPerMeter = 0.0;
+    heuristicReady       = true;
+
+    for (int u = 1; u < graph.nodeCount; u++) {
+        if (graph.adjOffset[u + 1] > graph.adjOffset[u] && !hasNodePosition(u)) {
+            fprintf(stderr, "Warning: ノード%dの位置情報が無いため A* のヒューリスティックを使いません\n", u);
+            return;
         }
     }
-    
-    // 60-209のエッジインデックスを取得（正規化済み）
-    int crosswalk60_209Idx = -1;
-    int nf, nt;
-    normalizeEdgeKey(60, 209, &nf, &nt);
-    crosswalk60_209Idx = findEdgeIndex(nf, nt);
-    
-    for (int i = 0; i < edgeCount; i++) {
-        int idx = edgeIdxs[i];
-        if (idx < 0 || idx >= edgeDataCount) continue;
-        EdgeData *e = &edgeDataArray[idx];
-        totalDist += e->distance;
-        
-        // getEdgeTimeSecondsを使用して危険な経路のペナルティを適用
-        double travelTimeSeconds = getEdgeTimeSeconds(e->from, e->to);
-        if (travelTimeSeconds >= INF) continue;
-        totalTime += travelTimeSeconds;
-        cumulativeTime += travelTimeSeconds;
-        
-        // 信号エッジの場合、サイクルベースの待ち時間を計算
-        // 基準時刻1（isBaseTime1=true）の場合は信号の待ち時間を追加しない
-        if (e->isSignal && !isBaseTime1 && hasReferencePhase) {
-            double waitTime = calculateWaitTimeWithReference(idx, cumulativeTime, referencePhase);
-            signalWaitTime += waitTime;
-            totalWaitTime += waitTime;
-            totalTime += waitTime;
-            cumulativeTime += waitTime;
-        }
-        
-        // 60-209の横断歩道の場合（信号ではないが期待値が載っている）
-        // すべての経路（緑・青・赤）で待ち時間を追加する
-        if (idx == crosswalk60_209Idx) {
-            // signalExpectedが0.0の場合は、固定値20秒を使用
-            double crosswalkWait = 0.0;
-            if (e->signalExpected > 0.0) {
-                crosswalkWait = e->signalExpected * 60.0;  // 秒に変換
-            } else {
-                // signal_inf.csvにデータが無い場合のフォールバック: 20秒
-                crosswalkWait = 20.0;  // 秒
-                fprintf(stderr, "  警告: 60-209横断歩道のsignalExpectedが0.0のため、固定値20秒を使用します\n");
-            }
-            crosswalkWaitTime += crosswalkWait;
-            totalWaitTime += crosswalkWait;
-            totalTime += crosswalkWait;
-            cumulativeTime += crosswalkWait;
-            fprintf(stderr, "  60-209横断歩道: 待ち時間%.2f秒を追加 (isBaseTime1=%s, 累計信号待ち=%.2f秒, 累計横断歩道待ち=%.2f秒)\n", 
-                    crosswalkWait, isBaseTime1 ? "true" : "false", signalWaitTime, crosswalkWaitTime);
+
+    double maxSpeed = 0.0;  // m/秒
+    for (int i = 0; i < graphEdgeCount; i++) {
+        int edgeIdx = graphEdgeList[i];
+        EdgeData *e = &edgeDataArray[edgeIdx];
+        double t = travelSec[edgeIdx];
+        if (t >= INF) continue;
+        double d = haversineMeters(nodePositions[e->from].lat, nodePositions[e->from].lon,
+                                   nodePositions[e->to].lat, nodePositions[e->to].lon);
+        if (d <= 0.0) continue;
+        if (t <= 0.0) {
+            fprintf(stderr, "Warning: エッジ%d-%dの移動時間が0のため A* のヒューリスティックを使いません\n",
+                    e->from, e->to);
+            return;
         }
+        if (d / t > maxSpeed) maxSpeed = d / t;
     }
-    
-    fprintf(stderr, "  calcRouteMetricsWithCycleBasedWaitTime: 信号待ち=%.2f秒, 横断歩道待ち=%.2f秒, 合計待ち=%.2f秒 (isBaseTime1=%s)\n",
-            signalWaitTime, crosswalkWaitTime, totalWaitTime, isBaseTime1 ? "true" : "false");
-    
-    *outDist = totalDist;
-    *outTimeSec = totalTime;
-    *outWaitTimeSec = totalWaitTime;
+    // 丸め誤差で下界が実際の時間を超えないよう、わずかに小さくする
+    if (maxSpeed > 0.0) heuristicSecPerMeter = (1.0 - 1e-9) / maxSpeed;
 }
 
-// 待ち時間を含めたメトリクス計算（基準時刻1の場合は60-209の待ち時間を追加しない）
-void calcRouteMetricsWithWaitTimeAndBaseTime1(const int *edgeIdxs, int edgeCount,
-                                               double *outDist, double *outTimeSec, bool useExpectedWaitTime, bool isBaseTime1) {
-    double totalDist = 0.0;
-    double totalTime = 0.0;
+double searchHeuristic(int node, int goal) {
+    if (heuristicSecPerMeter <= 0.0) return 0.0;
+    return heuristicSecPerMeter * haversineMeters(nodePositions[node].lat, nodePositions[node].lon,
+                                                  nodePositions[goal].lat, nodePositions[goal].lon);
+}
 
-    // 60-209のエッジインデックスを取得（正規化済み）
-    int crosswalk60_209Idx = -1;
-    int nf, nt;
-    normalizeEdgeKey(60, 209, &nf, &nt);
-    crosswalk60_209Idx = findEdgeIndex(nf, nt);
+// 1対1の最短経路（A*）。useHeuristic が false ならゴールを確定した時点で終える通常のダイクストラ
+DijkstraResult astarSearch(int start, int goal, SearchWorkspace *ws, bool useHeuristic) {
+    double   *dist     = ws->dist;
+    int      *prev     = ws->prev;
+    int      *prevEdge = ws->prevEdge;
+    bool     *used     = ws->used;
+    double   *fScore   = ws->fScore;
+    NodeHeap *heap     = &ws->heap;
 
-    for (int i = 0; i < edgeCount; i++) {
-        int idx = edgeIdxs[i];
-        if (idx < 0 || idx >= edgeDataCount) continue;
-        EdgeData *e = &edgeDataArray[idx];
-        totalDist += e->distance;
+    for (int i = 0; i < graph.nodeCount; i++) {
+        dist[i] = INF;
+        prev[i] = -1;
+        prevEdge[i] = -1;
+        used[i] = false;
+    }
+    dist[start]   = 0.0;
+    fScore[start] = useHeuristic ? searchHeuristic(start, goal) : 0.0;
+    nodeHeapReset(heap, fScore);
+    nodeHeapUpdate(heap, start);
 
-        // getEdgeTimeSecondsを使用して危険な経路のペナルティを適用
-        double travelTimeSeconds = getEdgeTimeSeconds(e->from, e->to);
-        if (travelTimeSeconds >= INF) continue;
-        totalTime += travelTimeSeconds;
-        
-        // 信号エッジの場合、待ち時間を追加
-        // 基準時刻1（isBaseTime1=true）の場合は信号の待ち時間を追加しない
-        if (e->isSignal) {
-            if (useExpectedWaitTime && !isBaseTime1) {
-                totalTime += e->signalExpected * 60.0;  // 期待待ち時間を秒に変換
-            }
-            // useExpectedWaitTimeがfalse、またはisBaseTime1がtrueの場合は待ち時間0（追加しない）
-        }
-        
-        // 60-209の横断歩道の場合（信号ではないが期待値が載っている）
-        // すべての経路（緑・青・赤）で待ち時間を追加する（useExpectedWaitTimeがtrueの場合のみ）
-        if (idx == crosswalk60_209Idx && useExpectedWaitTime) {
-            if (e->signalExpected > 0.0) {
-                totalTime += e->signalExpected * 60.0;  // 期待待ち時間を秒に変換
-                fprintf(stderr, "  60-209横断歩道: 待ち時間%.2f秒を追加\n", 
-                        e->signalExpected * 60.0);
+    while (1) {
+        int u = nodeHeapPop(heap);
+        if (u == -1) break;
+        used[u] = true;
+        ws->settledCount++;
+        if (u == goal) break;
+
+        for (int i = graph.adjOffset[u]; i < graph.adjOffset[u + 1]; i++) {
+            int v       = graph.adjTarget[i];
+            int edgeIdx = graph.adjEdge[i];
+            if (used[v]) continue;
+
+            double t = travelSec[edgeIdx];
+            if (t >= INF) continue;
+
+            double nd = dist[u] + t;
+            if (nd < dist[v]) {
+                dist[v]     = nd;
+                prev[v]     = u;
+                prevEdge[v] = edgeIdx;
+                fScore[v]   = useHeuristic ? nd + searchHeuristic(v, goal) : nd;
+                nodeHeapUpdate(heap, v);
             }
         }
     }
 
-    *outDist    = totalDist;
-    *outTimeSec = totalTime;
+    ShortestPathTree tree = { start, dist, prev, prevEdge };
+    return pathFromTree(&tree, goal);
 }
 
-void calcRouteMetrics(const int *edgeIdxs, int edgeCount,
-                      double *outDist, double *outTimeSec) {
-    calcRouteMetricsWithWaitTime(edgeIdxs, edgeCount, outDist, outTimeSec, false);
-}
+// 1対1の最短経路（双方向ダイクストラ）
+// 移動時間は向きによらないので、ゴール側も同じ隣接リストで探索する。
+// 両側の未確定ノードの最小距離の和が、これまでに見つけた経路の長さ以上になったら終える
+DijkstraResult bidirectionalSearch(int start, int goal, SearchWorkspace *ws) {
+    double *dist[2]     = { ws->dist, ws->distRev };
+    int    *prev[2]     = { ws->prev, ws->prevRev };
+    int    *prevEdge[2] = { ws->prevEdge, ws->prevEdgeRev };
+    bool   *used[2]     = { ws->used, ws->usedRev };
+    NodeHeap *heap[2]   = { &ws->heap, &ws->heapRev };
+
+    for (int side = 0; side < 2; side++) {
+        for (int i = 0; i < graph.nodeCount; i++) {
+            dist[side][i] = INF;
+            prev[side][i] = -1;
+            prevEdge[side][i] = -1;
+            used[side][i] = false;
+        }
+        nodeHeapReset(heap[side], dist[side]);
+    }
+    dist[0][start] = 0.0;
+    dist[1][goal]  = 0.0;
+    nodeHeapUpdate(heap[0], start);
+    nodeHeapUpdate(heap[1], goal);
 
-/* ---------- ファイル読み込み ---------- */
+    double best = start == goal ? 0.0 : INF;  // 見つけた経路の最短
+    int    meet = start == goal ? start : -1; // その経路で両側が出会うノード
 
-// result.csv: "from,to,weight" を想定（weight は未使用でもよい）
-void loadGraphFromResult(const char *filename) {
-    FILE *fp = fopen(filename, "r");
-    if (!fp) {
-        fprintf(stderr, "Error: cannot open %s\n", filename);
-        return;
-    }
-
-    char line[512];
-    while (fgets(line, sizeof(line), fp)) {
-        if (line[0] == '\n' || line[0] == '\0') continue;
+    while (1) {
+        int top0 = nodeHeapPeek(heap[0]);
+        int top1 = nodeHeapPeek(heap[1]);
+        if (top0 == -1 || top1 == -1) break;
+        if (dist[0][top0] + dist[1][top1] >= best) break;
+
+        // 未確定ノードの距離が小さい側を進める
+        int side = dist[0][top0] <= dist[1][top1] ? 0 : 1;
+        int u = nodeHeapPop(heap[side]);
+        used[side][u] = true;
+        ws->settledCount++;
+
+        for (int i = graph.adjOffset[u]; i < graph.adjOffset[u + 1]; i++) {
+            int v       = graph.adjTarget[i];
+            int edgeIdx = graph.adjEdge[i];
+            if (used[side][v]) continue;
+
+            double t = travelSec[edgeIdx];
+            if (t >= INF) continue;
 
-        int from, to;
-        double w;
-        if (sscanf(line, "%d,%d,%lf", &from, &to, &w) != 3) continue;
-        if (from <= 0 || from >= MAX_NODES || to <= 0 || to >= MAX_NODES) continue;
-
-        int edgeIdx = findEdgeIndex(from, to);
-        if (edgeIdx < 0 && edgeDataCount < MAX_EDGES) {
-            edgeIdx = edgeDataCount++;
-            edgeDataArray[edgeIdx].from      = from;
-            edgeDataArray[edgeIdx].to        = to;
-            edgeDataArray[edgeIdx].distance  = 0.0;
-            edgeDataArray[edgeIdx].gradient  = 0.0;
-            edgeDataArray[edgeIdx].isSignal  = 0;
-        }
-
-        // グラフ（双方向）に追加（重複は避ける）
-        if (edgeIdx >= 0) {
-            bool exist = false;
-            for (int i = 0; i < graph[from].edge_count; i++) {
-                if (graph[from].edges[i].node == to) {
-                    exist = true;
-                    break;
-                }
+            double nd = dist[side][u] + t;
+            if (nd < dist[side][v]) {
+                dist[side][v]     = nd;
+                prev[side][v]     = u;
+                prevEdge[side][v] = edgeIdx;
+                nodeHeapUpdate(heap[side], v);
             }
-            if (!exist && graph[from].edge_count < 8) {
-                graph[from].edges[graph[from].edge_count].node      = to;
-                graph[from].edges[graph[from].edge_count].edgeIndex = edgeIdx;
-                graph[from].edge_count++;
+            if (dist[side][v] + dist[1 - side][v] < best) {
+                best = dist[side][v] + dist[1 - side][v];
+                meet = v;
             }
+        }
+    }
 
-            exist = false;
-            for (int i = 0; i < graph[to].edge_count; i++) {
-                if (graph[to].edges[i].node == from) {
-                    exist = true;
-                    break;
-                }
-            }
-            if (!exist && graph[to].edge_count < 8) {
-                graph[to].edges[graph[to].edge_count].node      = from;
-                graph[to].edges[graph[to].edge_count].edgeIndex = edgeIdx;
-                graph[to].edge_count++;
-            }
+    DijkstraResult res;
+    res.cost       = INF;
+    res.pathLength = 0;
+    if (meet < 0) return res;
+
+    // スタート → meet はスタート側の木から、meet → ゴールはゴール側の木を辿る
+    ShortestPathTree tree = { start, dist[0], prev[0], prevEdge[0] };
+    res = pathFromTree(&tree, meet);
+    if (res.cost >= INF) return res;
+    for (int cur = meet; cur != goal; cur = prev[1][cur]) {
+        if (res.pathLength >= MAX_PATH_LENGTH || prevEdge[1][cur] < 0) {
+            res.cost       = INF;
+            res.pathLength = 0;
+            return res;
         }
+        res.path[res.pathLength++] = prevEdge[1][cur];
+    }
+    res.cost = best;
+    return res;
+}
+
+// 制約なしの最短経路（探し方はクエリの searchMode による）
+// 既定では、全網羅経路で同じ始点（スタート・信号の端点）から何度も呼ばれるため、
+// 始点ごとの最短経路木をクエリの間キャッシュして使い回す
+DijkstraResult dijkstra(int start, int goal) {
+    switch (currentQuery()->searchMode) {
+        case SEARCH_DIJKSTRA:      return astarSearch(start, goal, currentWorkspace(), false);
+        case SEARCH_ASTAR:         return astarSearch(start, goal, currentWorkspace(), true);
+        case SEARCH_BIDIRECTIONAL: return bidirectionalSearch(start, goal, currentWorkspace());
+        default:                   return pathFromTree(getShortestPathTree(start), goal);
     }
+}
 
-    fclose(fp);
+/* ---------- 全点間テーブル ---------- */
+
+// テーブルが前提とするグラフ（隣接の順序と移動時間）のハッシュ
+// 歩行速度・勾配係数・データのどれかが違えば一致しない
+uint64_t apspGraphHash(void) {
+    int n = graph.nodeCount;
+    uint64_t h = SNAPSHOT_FNV_OFFSET;
+    h = snapshotHashBytes(h, graph.adjOffset, sizeof(int) * (size_t)(n + 1));
+    h = snapshotHashBytes(h, graph.adjTarget, sizeof(int) * (size_t)graph.adjOffset[n]);
+    h = snapshotHashBytes(h, graph.adjEdge,   sizeof(int) * (size_t)graph.adjOffset[n]);
+    h = snapshotHashBytes(h, travelSec,       sizeof(double) * (size_t)edgeDataCount);
+    return h;
 }
 
-// oomiya_route_inf_4.csv: from,to,distance,time_minutes,gradient,...,isSignal,...
-void loadRouteData(const char *filename) {
-    FILE *fp = fopen(filename, "r");
+void apspClose(void) {
+    if (apspTable.base) munmap(apspTable.base, apspTable.size);
+    free(apspTable.trees);
+    memset(&apspTable, 0, sizeof(apspTable));
+}
+
+// 全点間テーブルを mmap する（無い・形式が違う・グラフの大きさが違う場合は使わない）
+bool apspOpen(const char *path) {
+    apspClose();
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(ApspHeader)) {
+        close(fd);
+        return false;
+    }
+    void *base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) return false;
+
+    const ApspHeader *h = (const ApspHeader *)base;
+    uint64_t n     = (uint64_t)graph.nodeCount;
+    uint64_t cells = n * n;
+    if (memcmp(h->magic, APSP_MAGIC, sizeof(h->magic)) != 0 ||
+        h->version != APSP_VERSION ||
+        h->nodeCount != (uint32_t)graph.nodeCount ||
+        h->edgeCount != (uint32_t)edgeDataCount ||
+        h->fileSize != (uint64_t)st.st_size ||
+        h->distOffset     + cells * sizeof(double) > h->fileSize ||
+        h->prevOffset     + cells * sizeof(int)    > h->fileSize ||
+        h->prevEdgeOffset + cells * sizeof(int)    > h->fileSize) {
+        fprintf(stderr, "Warning: %s の形式またはグラフが一致しません（使用しません）\n", path);
+        munmap(base, (size_t)st.st_size);
+        return false;
+    }
+
+    apspTable.base  = base;
+    apspTable.size  = (size_t)st.st_size;
+    apspTable.hdr   = h;
+    apspTable.trees = (ShortestPathTree *)malloc(sizeof(ShortestPathTree) * (size_t)n);
+    if (!apspTable.trees) {
+        apspClose();
+        return false;
+    }
+    // ShortestPathTree は書き換えない（const の配列として参照する）
+    for (int s = 0; s < graph.nodeCount; s++) {
+        ShortestPathTree *t = &apspTable.trees[s];
+        t->source   = s;
+        t->dist     = (double *)((char *)base + h->distOffset)     + (size_t)s * n;
+        t->prev     = (int *)((char *)base + h->prevOffset)        + (size_t)s * n;
+        t->prevEdge = (int *)((char *)base + h->prevEdgeOffset)    + (size_t)s * n;
+    }
+    fprintf(stderr, "All-pairs table loaded: %s (walking_speed=%.2f, gradient_factor=%.2f)\n",
+            path, h->walkingSpeed, h->kGradient);
+    return true;
+}
+
+// クエリの移動時間がテーブル作成時と同じならテーブルを使う（prepareTravelTimes の後に呼ぶ）
+// 判定は移動時間が変わるまで使い回すので、2回目以降は何も書き換えない
+void apspSelect(void) {
+    if (apspTable.selected) return;
+    apspTable.selected = true;
+    apspTable.active   = false;
+    if (!apspTable.base) return;
+    if (apspTable.hdr->walkingSpeed != walkingSpeed || apspTable.hdr->kGradient != kGradient) return;
+    apspTable.active = apspGraphHash() == apspTable.hdr->graphHash;
+    if (!apspTable.active) {
+        fprintf(stderr, "Warning: 全点間テーブルが現在のデータと一致しないため使用しません\n");
+    }
+}
+
+typedef struct {
+    int     threadId;
+    int     threadCount;
+    double *dist;
+    int    *prev;
+    int    *prevEdge;
+} ApspWorker;
+
+// 始点 threadId, threadId + threadCount, ... の最短経路木を作る
+void *apspWorkerMain(void *arg) {
+    ApspWorker *w = (ApspWorker *)arg;
+    size_t n = (size_t)graph.nodeCount;
+
+    SearchWorkspace ws;
+    initSearchWorkspace(&ws);
+    for (int s = w->threadId; s < graph.nodeCount; s += w->threadCount) {
+        ShortestPathTree tree;
+        tree.dist     = w->dist     + (size_t)s * n;
+        tree.prev     = w->prev     + (size_t)s * n;
+        tree.prevEdge = w->prevEdge + (size_t)s * n;
+        buildShortestPathTree(s, &tree, &ws);
+    }
+    freeSearchWorkspace(&ws);
+    return NULL;
+}
+
+uint64_t apspAlignUp(uint64_t v) {
+    return (v + 7) & ~(uint64_t)7;
+}
+
+// 指定した歩行速度・勾配係数で全点間テーブルを作り、path に書き出す
+int buildApspTable(const char *path, double ws, double kGrad, int threadCount) {
+    prepareTravelTimes(ws, kGrad);
+
+    size_t n     = (size_t)graph.nodeCount;
+    size_t cells = n * n;
+
+    ApspHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, APSP_MAGIC, sizeof(hdr.magic));
+    hdr.version        = APSP_VERSION;
+    hdr.nodeCount      = (uint32_t)n;
+    hdr.edgeCount      = (uint32_t)edgeDataCount;
+    hdr.walkingSpeed   = walkingSpeed;
+    hdr.kGradient      = kGradient;
+    hdr.graphHash      = apspGraphHash();
+    hdr.distOffset     = apspAlignUp(sizeof(ApspHeader));
+    hdr.prevOffset     = apspAlignUp(hdr.distOffset + cells * sizeof(double));
+    hdr.prevEdgeOffset = apspAlignUp(hdr.prevOffset + cells * sizeof(int));
+    hdr.fileSize       = hdr.prevEdgeOffset + cells * sizeof(int);
+
+    double *dist     = (double *)malloc(sizeof(double) * cells);
+    int    *prev     = (int *)malloc(sizeof(int) * cells);
+    int    *prevEdge = (int *)malloc(sizeof(int) * cells);
+    if (!dist || !prev || !prevEdge) {
+        fprintf(stderr, "Error: メモリを確保できません\n");
+        return 1;
+    }
+
+    if (threadCount <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threadCount = cpus > 0 ? (int)cpus : 1;
+    }
+    if (threadCount > graph.nodeCount) threadCount = graph.nodeCount;
+
+    pthread_t  *threads = (pthread_t *)malloc(sizeof(pthread_t) * (size_t)threadCount);
+    ApspWorker *workers = (ApspWorker *)malloc(sizeof(ApspWorker) * (size_t)threadCount);
+    for (int t = 0; t < threadCount; t++) {
+        workers[t].threadId    = t;
+        workers[t].threadCount = threadCount;
+        workers[t].dist        = dist;
+        workers[t].prev        = prev;
+        workers[t].prevEdge    = prevEdge;
+        if (pthread_create(&threads[t], NULL, apspWorkerMain, &workers[t]) != 0) {
+            fprintf(stderr, "Error: スレッドを作成できません\n");
+            return 1;
+        }
+    }
+    for (int t = 0; t < threadCount; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    free(threads);
+    free(workers);
+
+    // 途中で失敗しても古いテーブルを壊さないよう、一時ファイルに書いてから置き換える
+    char tmpPath[512];
+    snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", path);
+    FILE *fp = fopen(tmpPath, "wb");
     if (!fp) {
-        fprintf(stderr, "Error: cannot open %s\n", filename);
-        return;
+        perror("エラー：出力ファイル");
+        return 1;
+    }
+    bool ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1 &&
+              fseek(fp, (long)hdr.distOffset, SEEK_SET) == 0 &&
+              fwrite(dist, sizeof(double), cells, fp) == cells &&
+              fseek(fp, (long)hdr.prevOffset, SEEK_SET) == 0 &&
+              fwrite(prev, sizeof(int), cells, fp) == cells &&
+              fseek(fp, (long)hdr.prevEdgeOffset, SEEK_SET) == 0 &&
+              fwrite(prevEdge, sizeof(int), cells, fp) == cells;
+    if (fclose(fp) != 0) ok = false;
+    free(dist);
+    free(prev);
+    free(prevEdge);
+
+    if (!ok || rename(tmpPath, path) != 0) {
+        fprintf(stderr, "Error: %s を書き込めません\n", path);
+        remove(tmpPath);
+        return 1;
     }
 
-    char line[1024];
-    // ヘッダ行スキップ
-    fgets(line, sizeof(line), fp);
+    fprintf(stderr, "全点間テーブルを作成しました: %s (nodes=%zu, walking_speed=%.2f, gradient_factor=%.2f, threads=%d, %llu bytes)\n",
+            path, n, walkingSpeed, kGradient, threadCount, (unsigned long long)hdr.fileSize);
+    return 0;
+}
 
-    while (fgets(line, sizeof(line), fp)) {
-        if (line[0] == '\n' || line[0] == '\0') continue;
+/* ---------- 嗜好コストの CCH（--prefs） ---------- */
+
+// 隣接リストだけのハッシュ（縮約順序は移動時間にも嗜好の重みにも依存しない）
+uint64_t cchTopologyHash(void) {
+    int n = graph.nodeCount;
+    uint64_t h = SNAPSHOT_FNV_OFFSET;
+    h = snapshotHashBytes(h, graph.adjOffset, sizeof(int) * (size_t)(n + 1));
+    h = snapshotHashBytes(h, graph.adjTarget, sizeof(int) * (size_t)graph.adjOffset[n]);
+    h = snapshotHashBytes(h, graph.adjEdge,   sizeof(int) * (size_t)graph.adjOffset[n]);
+    return h;
+}
+
+double elapsedMs(const struct timespec *since) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - since->tv_sec) * 1000.0 + (double)(now.tv_nsec - since->tv_nsec) / 1e6;
+}
+
+// ノード位置から縮約順序を作る（経度は緯度で縮めて距離の比を揃える。位置の無いノードは原点）
+void cchComputeNodeOrder(CchGraph *g) {
+    int n = graph.nodeCount;
+    double *x = (double *)malloc(sizeof(double) * (size_t)n);
+    double *y = (double *)malloc(sizeof(double) * (size_t)n);
+    if (!x || !y) {
+        fprintf(stderr, "Error: メモリを確保できません\n");
+        exit(1);
+    }
+    for (int i = 0; i < n; i++) {
+        x[i] = nodePositions[i].lon * cos(nodePositions[i].lat * M_PI / 180.0);
+        y[i] = nodePositions[i].lat;
+    }
+    cchComputeOrder(g, n, graph.adjOffset, graph.adjTarget, x, y);
+    free(x);
+    free(y);
+}
+
+// クエリのエッジごとの嗜好コストの領域（最初に使うときに1回だけ確保する）
+double *queryPreferenceCost(QueryContext *q) {
+    if (q->preferenceCost) return q->preferenceCost;
+    q->preferenceCost = (double *)malloc(sizeof(double) * (size_t)(edgeDataCount > 0 ? edgeDataCount : 1));
+    if (!q->preferenceCost) {
+        fprintf(stderr, "Error: メモリを確保できません\n");
+        exit(1);
+    }
+    return q->preferenceCost;
+}
+
+// 縮約順序を読み込み（無い・グラフが違う場合は作り）、ショートカットの形と下三角を用意する
+// 重みに依存しないので、プロセスの中で1回だけ行う
+void cchPrepare(void) {
+    if (cchReady) return;
+
+    struct timespec t0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    if (cchLoadOrder(&cchGraph, CCH_FILE, graph.nodeCount, cchTopologyHash())) {
+        fprintf(stderr, "CCH: 縮約順序を読み込みました: %s\n", CCH_FILE);
+    } else {
+        cchComputeNodeOrder(&cchGraph);
+        fprintf(stderr, "CCH: 縮約順序を作成しました（yen --build-cch で保存できます）\n");
+    }
+    cchBuildTopology(&cchGraph, graph.adjOffset, graph.adjTarget, graph.adjEdge);
+    cchQueryInit(&cchWs, graph.nodeCount);
+    cchReady = true;
+    const char *kernelName;
+    preferenceSelectKernel(&kernelName);
+    fprintf(stderr, "CCH: アーク %d 本, 下三角 %d 個 (%.2f ms), 嗜好コストの計算: %s\n",
+            cchGraph.arcCount, cchGraph.triOffset[cchGraph.arcCount], elapsedMs(&t0), kernelName);
+}
+
+// user_preference_ver4.4.c と同じ式でエッジごとの嗜好コストを作る
+// 全行のコストの最小値（0 より大きければ 0）を引いて最小を0にする。同じエッジの行が複数あれば
+// result.csv の読み込み（addResultEdge）と同じく先に現れた行を使う。行の無いエッジは通れない
+// 行ごとのコストは特徴行列から求める（前回のクエリと一部の重みだけが違えば、その項だけを更新する）
+void computePreferenceCosts(const double *weights, double *cost) {
+    const double *rowCost = preferenceModelEvaluate(&preferenceModel, weights);
+    double minCost = 0.0;
+    for (int e = 0; e < edgeDataCount; e++) cost[e] = INF;
+    for (int i = 0; i < preferenceModel.rowCount; i++) {
+        double c = rowCost[i];
+        if (c < minCost) minCost = c;
+        if (cost[preferenceRowEdge[i]] >= INF) cost[preferenceRowEdge[i]] = c;
+    }
+    for (int e = 0; e < edgeDataCount; e++) {
+        if (cost[e] < INF) cost[e] -= minCost;
+    }
+}
+
+// クエリの重みから嗜好コストを作り、このクエリの間は result.csv の値の代わりに使う
+// user_preference_ver4.4.c が result.csv に書く値と同じものをメモリ上で作るので、ファイルの書き直しと読み込みが要らない
+void applyPreferenceWeights(const double *weights) {
+    struct timespec t0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    QueryContext *q = currentQuery();
+    pthread_mutex_lock(&preferenceLock);
+    computePreferenceCosts(weights, queryPreferenceCost(q));
+    pthread_mutex_unlock(&preferenceLock);
+    q->activePreference = q->preferenceCost;
+    fprintf(stderr, "嗜好コスト: %d 行から作成 (%.3f ms)\n", preferenceModel.rowCount, elapsedMs(&t0));
+}
 
-        char *tok = strtok(line, ",");
-        if (!tok) continue;
-        int from = atoi(tok);
+// applyPreferenceWeights で作った嗜好コストで CCH をカスタマイズする（cchPrepare の後、preferenceLock の中で呼ぶ）
+void cchCustomizePreference(void) {
+    struct timespec t0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    cchCustomize(&cchGraph, currentQuery()->preferenceCost);
+    fprintf(stderr, "CCH: カスタマイズ %.3f ms\n", elapsedMs(&t0));
+}
 
-        tok = strtok(NULL, ",");
-        if (!tok) continue;
-        int to = atoi(tok);
+// 縮約順序を作って path に保存する
+int buildCchOrder(const char *path) {
+    CchGraph g;
+    memset(&g, 0, sizeof(g));
+    cchComputeNodeOrder(&g);
+    bool ok = cchSaveOrder(&g, path, cchTopologyHash());
+    cchFree(&g);
+    if (!ok) {
+        fprintf(stderr, "Error: %s を書き込めません\n", path);
+        return 1;
+    }
+    fprintf(stderr, "縮約順序を作成しました: %s (nodes=%d)\n", path, graph.nodeCount);
+    return 0;
+}
 
-        tok = strtok(NULL, ",");
-        if (!tok) continue;
-        double dist = atof(tok);
+// エッジ列から経路を作る（信号の有無と、サイクルベースの待ち時間を含めた距離・時間も設定する）
+// エッジ列はクエリのアリーナに複製するため、edges は呼び出し側の作業用配列でよい
+void setRouteEdges(RouteResult *outRoute, const int *edges, int edgeCount) {
+    outRoute->edges         = copyRouteEdges(edges, edgeCount);
+    outRoute->edgeCount     = edgeCount;
+    outRoute->signalEdgeIdx = -1;
+    outRoute->hasSignal     = 0;
+    for (int i = 0; i < edgeCount; i++) {
+        if (edgeDataArray[edges[i]].isSignal) {
+            if (!outRoute->hasSignal) outRoute->signalEdgeIdx = edges[i];
+            outRoute->hasSignal = 1;
+        }
+    }
+    double waitTimeSec;
+    calcRouteMetricsWithCycleBasedWaitTime(outRoute->edges, outRoute->edgeCount,
+                                           &outRoute->totalDistance, &outRoute->totalTimeSeconds, &waitTimeSec, false);
+}
 
-        tok = strtok(NULL, ",");   // time_minutes はスキップ
-        if (!tok) continue;
+/* ---------- K最短経路（イェンのアルゴリズム） ---------- */
 
-        tok = strtok(NULL, ",");   // gradient
-        if (!tok) continue;
-        double grad = atof(tok);
+// K最短経路の1本（ノード列とエッジ列の両方を持つ）
+typedef struct {
+    int    nodes[MAX_PATH_LENGTH + 1];
+    int    edges[MAX_PATH_LENGTH];
+    int    edgeCount;
+    double cost;  // travelSec の合計（待ち時間なし）
+} KspPath;
+
+// start から edges を順に辿ってノード列と移動時間を埋める
+bool kspPathFromEdges(int start, const int *edges, int edgeCount, KspPath *out) {
+    if (edgeCount > MAX_PATH_LENGTH) return false;
+
+    int cur = start;
+    out->nodes[0]  = start;
+    out->edgeCount = edgeCount;
+    out->cost      = 0.0;
+    for (int i = 0; i < edgeCount; i++) {
+        EdgeData *e = &edgeDataArray[edges[i]];
+        cur = e->from == cur ? e->to : e->from;
+        out->edges[i]     = edges[i];
+        out->nodes[i + 1] = cur;
+        out->cost        += travelSec[edges[i]];
+    }
+    return true;
+}
 
-        // さらに先のカラムから isSignal を取得（元の位置に依存）
-        // ここでは簡略化して、「次の数個を飛ばしてからフラグを読む」形
-        int isSignal = 0;
+bool kspSameEdges(const KspPath *a, const KspPath *b) {
+    if (a->edgeCount != b->edgeCount) return false;
+    return memcmp(a->edges, b->edges, sizeof(int) * (size_t)a->edgeCount) == 0;
+}
 
-        for (int i = 0; i < 3; i++) {
-            tok = strtok(NULL, ",");
-            if (!tok) break;
+// スパーノードからゴールまで、禁止ノード・禁止エッジを通らない最短経路（エッジ列）
+// ゴールを根とする最短経路木（移動時間は向きによらないので、各ノードからゴールへの最短経路になる）を使う
+// - 木の上の経路が禁止ノード・エッジに触れなければ、それがそのまま最短なので探索しない
+// - 触れる場合は、木の距離（制約なしの正確な残り時間）をヒューリスティックにした A* で探す
+bool kspSpurPath(int spurNode, int goal, const ShortestPathTree *goalTree,
+                 const bool *bannedNode, const bool *bannedEdge, double *fScore,
+                 int *outEdges, int *outCount, bool *outFromTree) {
+    const double *h = goalTree->dist;
+    *outFromTree = false;
+    if (h[spurNode] >= INF) return false;
+
+    // 木の上の経路をそのまま使えるか
+    int count = 0;
+    int cur   = spurNode;
+    bool treeOk = true;
+    while (cur != goal) {
+        int edgeIdx = goalTree->prevEdge[cur];
+        int next    = goalTree->prev[cur];
+        if (edgeIdx < 0 || next < 0 || bannedEdge[edgeIdx] || bannedNode[next] || count >= MAX_PATH_LENGTH) {
+            treeOk = false;
+            break;
         }
-        if (tok) {
-            isSignal = atoi(tok);
+        outEdges[count++] = edgeIdx;
+        cur = next;
+    }
+    if (treeOk) {
+        *outCount    = count;
+        *outFromTree = true;
+        return true;
+    }
+
+    // A*（ヒューリスティックは制約なしの正確な距離なので無矛盾、取り出した時点で確定）
+    SearchWorkspace *ws = currentWorkspace();
+    double   *dist     = ws->dist;
+    int      *prev     = ws->prev;
+    int      *prevEdge = ws->prevEdge;
+    bool     *used     = ws->used;
+    NodeHeap *heap     = &ws->heap;
+
+    for (int i = 0; i < graph.nodeCount; i++) {
+        dist[i] = INF;
+        prev[i] = -1;
+        prevEdge[i] = -1;
+        used[i] = false;
+    }
+    dist[spurNode]   = 0.0;
+    fScore[spurNode] = h[spurNode];
+    nodeHeapReset(heap, fScore);
+    nodeHeapUpdate(heap, spurNode);
+
+    while (1) {
+        int u = nodeHeapPop(heap);
+        if (u == -1 || u == goal) break;
+        used[u] = true;
+
+        for (int i = graph.adjOffset[u]; i < graph.adjOffset[u + 1]; i++) {
+            int v       = graph.adjTarget[i];
+            int edgeIdx = graph.adjEdge[i];
+            if (used[v] || bannedNode[v] || bannedEdge[edgeIdx]) continue;
+            if (h[v] >= INF) continue;
+
+            double t = travelSec[edgeIdx];
+            if (t >= INF) continue;
+
+            double nd = dist[u] + t;
+            if (nd < dist[v]) {
+                dist[v]     = nd;
+                prev[v]     = u;
+                prevEdge[v] = edgeIdx;
+                fScore[v]   = nd + h[v];
+                nodeHeapUpdate(heap, v);
+            }
         }
+    }
+    if (dist[goal] >= INF) return false;
+
+    // ゴールから逆に辿ってから並べ直す
+    count = 0;
+    for (cur = goal; cur != spurNode; cur = prev[cur]) {
+        if (count >= MAX_PATH_LENGTH) return false;
+        outEdges[count++] = prevEdge[cur];
+    }
+    for (int i = 0; i < count / 2; i++) {
+        int tmp = outEdges[i];
+        outEdges[i] = outEdges[count - 1 - i];
+        outEdges[count - 1 - i] = tmp;
+    }
+    *outCount = count;
+    return true;
+}
 
-        if (from <= 0 || to <= 0) continue;
+// イェンのアルゴリズムで startNode → endNode の移動時間が短い順に最大 K 本の単純経路を求める
+// 結果は outPaths（K 要素）に入れ、見つかった本数を返す
+int kShortestPaths(int startNode, int endNode, int K, KspPath *outPaths) {
+    if (K <= 0) return 0;
 
-        int edgeIdx = findEdgeIndex(from, to);
-        if (edgeIdx < 0 && edgeDataCount < MAX_EDGES) {
-            edgeIdx = edgeDataCount++;
-            edgeDataArray[edgeIdx].from = from;
-            edgeDataArray[edgeIdx].to   = to;
+    DijkstraResult first = dijkstra(startNode, endNode);
+    if (first.cost >= INF || !kspPathFromEdges(startNode, first.path, first.pathLength, &outPaths[0])) {
+        return 0;
+    }
+    int found = 1;
+
+    // スパー経路はすべてゴールを根とする木を使って求める
+    const ShortestPathTree *goalTree = getShortestPathTree(endNode);
+
+    bool   *bannedNode = (bool *)calloc((size_t)graph.nodeCount, sizeof(bool));
+    bool   *bannedEdge = currentWorkspace()->avoidEdge;
+    double *fScore     = (double *)malloc(sizeof(double) * (size_t)graph.nodeCount);
+    int    *bannedList = (int *)malloc(sizeof(int) * (size_t)K);
+    if (!bannedNode || !fScore || !bannedList) {
+        fprintf(stderr, "Error: メモリを確保できません\n");
+        exit(1);
+    }
+    for (int i = 0; i < edgeDataCount; i++) bannedEdge[i] = false;
+
+    // 候補（コストが同じなら先に見つかったものを優先する）
+    KspPath *candidates    = NULL;
+    int      candidateCount = 0;
+    int      candidateCap   = 0;
+    int      spurSearches   = 0;
+    int      spurFromTree   = 0;
+
+    while (found < K) {
+        const KspPath *last = &outPaths[found - 1];
+
+        for (int i = 0; i < last->edgeCount; i++) {
+            int spurNode = last->nodes[i];
+
+            // 同じルート（nodes[0..i]）を持つ確定済み経路の i 番目のエッジは通らない
+            int bannedCount = 0;
+            for (int j = 0; j < found; j++) {
+                const KspPath *p = &outPaths[j];
+                if (p->edgeCount <= i) continue;
+                if (memcmp(p->nodes, last->nodes, sizeof(int) * (size_t)(i + 1)) != 0) continue;
+                if (!bannedEdge[p->edges[i]]) {
+                    bannedEdge[p->edges[i]] = true;
+                    bannedList[bannedCount++] = p->edges[i];
+                }
+            }
+            // ルート上のノード（スパーノード以外）は通らない（ループを作らない）
+            for (int r = 0; r < i; r++) bannedNode[last->nodes[r]] = true;
+
+            int spurEdges[MAX_PATH_LENGTH];
+            int spurCount = 0;
+            bool fromTree = false;
+            bool ok = kspSpurPath(spurNode, endNode, goalTree, bannedNode, bannedEdge, fScore,
+                                  spurEdges, &spurCount, &fromTree);
+            if (fromTree) spurFromTree++;
+            else spurSearches++;
+
+            for (int b = 0; b < bannedCount; b++) bannedEdge[bannedList[b]] = false;
+            for (int r = 0; r < i; r++) bannedNode[last->nodes[r]] = false;
+
+            if (!ok || i + spurCount > MAX_PATH_LENGTH) continue;
+
+            // ルート + スパー経路
+            int edges[MAX_PATH_LENGTH];
+            memcpy(edges, last->edges, sizeof(int) * (size_t)i);
+            memcpy(edges + i, spurEdges, sizeof(int) * (size_t)spurCount);
+
+            candidates = (KspPath *)growArray(candidates, &candidateCap, candidateCount + 1, sizeof(KspPath));
+            KspPath *c = &candidates[candidateCount];
+            if (!kspPathFromEdges(startNode, edges, i + spurCount, c)) continue;
+
+            bool duplicate = false;
+            for (int j = 0; j < found && !duplicate; j++) duplicate = kspSameEdges(c, &outPaths[j]);
+            for (int j = 0; j < candidateCount && !duplicate; j++) duplicate = kspSameEdges(c, &candidates[j]);
+            if (!duplicate) candidateCount++;
         }
 
-        if (edgeIdx >= 0) {
-            edgeDataArray[edgeIdx].distance = dist;
-            edgeDataArray[edgeIdx].gradient = grad;
-            if (isSignal) edgeDataArray[edgeIdx].isSignal = 1;
-            // 信号情報は後でloadSignalDataで上書きされる
-            edgeDataArray[edgeIdx].signalCycle = 0.0;
-            edgeDataArray[edgeIdx].signalGreen = 0.0;
-            edgeDataArray[edgeIdx].signalPhase = 0.0;
-            edgeDataArray[edgeIdx].signalExpected = 0.0;
+        if (candidateCount == 0) break;
+
+        int best = 0;
+        for (int j = 1; j < candidateCount; j++) {
+            if (candidates[j].cost < candidates[best].cost) best = j;
         }
+        outPaths[found++] = candidates[best];
+        memmove(&candidates[best], &candidates[best + 1],
+                sizeof(KspPath) * (size_t)(candidateCount - best - 1));
+        candidateCount--;
     }
 
-    fclose(fp);
+    fprintf(stderr, "K最短経路: %d本 (A*によるスパー探索%d回, 木の経路をそのまま使用%d回)\n",
+            found, spurSearches, spurFromTree);
+
+    free(candidates);
+    free(bannedNode);
+    free(fScore);
+    free(bannedList);
+    return found;
 }
 
-// signal_inf.csv: from,to,cycle,green,phase,expected
-void loadSignalData(const char *filename) {
-    FILE *fp = fopen(filename, "r");
-    if (!fp) {
-        fprintf(stderr, "Warning: cannot open %s\n", filename);
-        return;
+/* ---------- 信号待ちを考慮した時間依存ダイクストラ ---------- */
+
+// 到着時刻から信号待ちを計算しながら、待ち時間込みで最速の経路を1回の探索で求める
+// 待ち時間は calcRouteMetricsWithCycleBasedWaitTime と同じ定義:
+// - 経路上で最初に通るサイクルのある信号の位相が基準位相になり、以降の信号はその基準で待ち時間を計算する
+// - 60-209 の横断歩道は到着時刻によらず期待待ち時間（無ければ20秒）を加える
+// 基準位相は経路によって変わるため、状態を (ノード, 基準位相) として探索する（状態0は信号を未通過）
+// 信号での待ちは到着が遅いほど出発も遅くなる（FIFO）ので、ラベルは取り出した時点で確定する
+bool timeDependentFastestRoute(int start, int goal, RouteResult *outRoute) {
+    int n = graph.nodeCount;
+
+    // 基準位相になりうる値（サイクルのある信号の位相）と、各エッジを通った後の状態
+    double *phases     = (double *)malloc(sizeof(double) * (size_t)(edgeDataCount + 1));
+    int    *edgeState  = (int *)malloc(sizeof(int) * (size_t)(edgeDataCount + 1));
+    int     phaseCount = 0;
+    if (!phases || !edgeState) {
+        fprintf(stderr, "Error: メモリを確保できません\n");
+        exit(1);
+    }
+    for (int i = 0; i < edgeDataCount; i++) {
+        EdgeData *e = &edgeDataArray[i];
+        edgeState[i] = 0;
+        if (!e->isSignal || e->signalCycle <= 0) continue;
+        int k = 0;
+        while (k < phaseCount && phases[k] != e->signalPhase) k++;
+        if (k == phaseCount) phases[phaseCount++] = e->signalPhase;
+        edgeState[i] = k + 1;
     }
 
-    char line[1024];
-    // ヘッダ行スキップ
-    fgets(line, sizeof(line), fp);
+    int    crosswalkIdx = findEdgeIndex(60, 209);
+    double crosswalkWait = 0.0;
+    if (crosswalkIdx >= 0) {
+        double expected = edgeDataArray[crosswalkIdx].signalExpected;
+        crosswalkWait = expected > 0.0 ? expected * 60.0 : 20.0;
+    }
 
-    signalCount = 0;
+    int     stateCount = phaseCount + 1;
+    int     labels     = n * stateCount;
+    double *arrival    = (double *)malloc(sizeof(double) * (size_t)labels);
+    int    *prevLabel  = (int *)malloc(sizeof(int) * (size_t)labels);
+    int    *prevEdge   = (int *)malloc(sizeof(int) * (size_t)labels);
+    bool   *used       = (bool *)calloc((size_t)labels, sizeof(bool));
+    if (!arrival || !prevLabel || !prevEdge || !used) {
+        fprintf(stderr, "Error: メモリを確保できません\n");
+        exit(1);
+    }
+    for (int i = 0; i < labels; i++) {
+        arrival[i]   = INF;
+        prevLabel[i] = -1;
+        prevEdge[i]  = -1;
+    }
 
-    while (fgets(line, sizeof(line), fp)) {
-        if (line[0] == '\n' || line[0] == '\0') continue;
+    NodeHeap heap;
+    nodeHeapInit(&heap, labels);
+    nodeHeapReset(&heap, arrival);
 
-        int from, to;
-        double cycle, green, phase, expected;
-        int n = sscanf(line, "%d,%d,%lf,%lf,%lf,%lf",
-                       &from, &to, &cycle, &green, &phase, &expected);
-        if (n < 6) {
-            fprintf(stderr, "Warning: failed to parse signal line: %s", line);
-            continue;
-        }
+    int startLabel = start * stateCount;
+    arrival[startLabel] = 0.0;
+    nodeHeapUpdate(&heap, startLabel);
 
-        int edgeIdx = findEdgeIndex(from, to);
-        if (edgeIdx < 0) {
-            fprintf(stderr,
-                    "Warning: signal edge %d-%d not found in graph\n",
-                    from, to);
-            continue;
+    int goalLabel = -1;
+    int settled   = 0;
+    while (1) {
+        int label = nodeHeapPop(&heap);
+        if (label == -1) break;
+        used[label] = true;
+        settled++;
+
+        int u     = label / stateCount;
+        int state = label % stateCount;
+        if (u == goal) {
+            goalLabel = label;
+            break;
         }
 
-        // 信号フラグと情報を保存
-        // 60-209は信号がない横断歩道なので、isSignalを1にしない
-        // ただし、期待待ち時間は保存する
-        int nf, nt;
-        normalizeEdgeKey(from, to, &nf, &nt);
-        bool isCrosswalk60_209 = (nf == 60 && nt == 209);
-        
-        if (!isCrosswalk60_209) {
-            edgeDataArray[edgeIdx].isSignal = 1;
+        for (int i = graph.adjOffset[u]; i < graph.adjOffset[u + 1]; i++) {
+            int v       = graph.adjTarget[i];
+            int edgeIdx = graph.adjEdge[i];
+
+            double t = travelSec[edgeIdx];
+            if (t >= INF) continue;
+
+            double time      = arrival[label] + t;
+            int    nextState = state;
+            if (edgeState[edgeIdx] > 0) {
+                if (nextState == 0) nextState = edgeState[edgeIdx];
+                time += calculateWaitTimeWithReference(edgeIdx, time, phases[nextState - 1]);
+            }
+            if (edgeIdx == crosswalkIdx) time += crosswalkWait;
+
+            int next = v * stateCount + nextState;
+            if (used[next] || time >= arrival[next]) continue;
+            arrival[next]   = time;
+            prevLabel[next] = label;
+            prevEdge[next]  = edgeIdx;
+            nodeHeapUpdate(&heap, next);
         }
-        edgeDataArray[edgeIdx].signalCycle = cycle;
-        edgeDataArray[edgeIdx].signalGreen = green;
-        edgeDataArray[edgeIdx].signalPhase = phase;
-        edgeDataArray[edgeIdx].signalExpected = expected;
+    }
 
-        if (!isCrosswalk60_209 && signalCount < MAX_SIGNALS) {
-            signalEdges[signalCount++] = edgeIdx;
-            fprintf(stderr,
-                    "Signal %d: edge %d (%d-%d) cycle=%.0f green=%.0f phase=%.2f expected=%.2f\n",
-                    signalCount, edgeIdx, from, to, cycle, green, phase, expected);
-        } else if (isCrosswalk60_209) {
-            fprintf(stderr,
-                    "Crosswalk (no signal) %d-%d: expected=%.2f\n",
-                    nf, nt, expected);
+    bool found = false;
+    if (goalLabel >= 0) {
+        // ゴールから逆に辿ってから並べ直す
+        int edges[MAX_PATH_LENGTH];
+        int count = 0;
+        for (int label = goalLabel; label != startLabel; label = prevLabel[label]) {
+            if (count >= MAX_PATH_LENGTH) {
+                count = -1;
+                break;
+            }
+            edges[count++] = prevEdge[label];
+        }
+        if (count >= 0) {
+            for (int i = 0; i < count / 2; i++) {
+                int tmp = edges[i];
+                edges[i] = edges[count - 1 - i];
+                edges[count - 1 - i] = tmp;
+            }
+            setRouteEdges(outRoute, edges, count);
+            outRoute->routeType = 2;
+            found = true;
+            fprintf(stderr, "時間依存探索: 待ち時間込み最速 %.2f秒 (メトリクス再計算 %.2f秒), edges=%d, 基準位相%d種類, 確定ラベル%d個\n",
+                    arrival[goalLabel], outRoute->totalTimeSeconds, count, phaseCount, settled);
         }
     }
 
-    fclose(fp);
-    fprintf(stderr, "Loaded %d signals from signal_inf.csv\n", signalCount);
+    nodeHeapFree(&heap);
+    free(phases);
+    free(edgeState);
+    free(arrival);
+    free(prevLabel);
+    free(prevEdge);
+    free(used);
+    return found;
 }
 
-// GeoJSONからノード位置情報を読み込む
-void loadNodePositions(void) {
-    // 初期化：位置情報が読み込まれていないノードは0.0で初期化
-    for (int i = 0; i < MAX_NODES; i++) {
-        nodePositions[i].lat = 0.0;
-        nodePositions[i].lon = 0.0;
+/* ---------- 多基準（パレート最適）経路探索 ---------- */
+
+// スタートからあるノードまでの経路1本分の基準値
+typedef struct {
+    double time;       // 移動時間（秒、travelSec の合計）
+    double wait;       // 信号・横断歩道の期待待ち時間（秒）
+    double dist;       // 距離（m）
+    double pref;       // result.csv の重みの合計
+    int    node;
+    int    edge;       // このノードに到達したエッジ（スタートは -1）
+    int    parent;     // 1つ前のラベル（スタートは -1）
+    int    edgeCount;
+    bool   dead;       // 他のラベルに支配されて捨てられた
+} ParetoLabel;
+
+// a が b を支配する（全ての基準で b 以下）。全て等しい場合も先にあった方を残す
+bool paretoDominates(const ParetoLabel *a, const ParetoLabel *b) {
+    return a->time <= b->time && a->wait <= b->wait && a->dist <= b->dist && a->pref <= b->pref;
+}
+
+// エッジを通るときの期待待ち時間（秒）
+// 信号は signal_inf.csv の期待値、60-209 の横断歩道は期待値（無ければ20秒）
+// 到着時刻によらない値にすることで、ラベルの基準値が経路の足し算で決まるようにする
+double expectedWaitSeconds(int edgeIdx, int crosswalkIdx) {
+    EdgeData *e = &edgeDataArray[edgeIdx];
+    if (e->isSignal) return e->signalExpected * 60.0;
+    if (edgeIdx == crosswalkIdx) return e->signalExpected > 0.0 ? e->signalExpected * 60.0 : 20.0;
+    return 0.0;
+}
+
+// (移動時間, 待ち時間, 距離, 嗜好コスト) の4基準でパレート最適な経路を1回の探索で求める
+// ラベル設定法: 待ち時間込みの時間が小さいラベルから順に確定し、各ノードでは
+// 互いに支配しないラベルだけを最大 maxLabels 個保持する（超える場合は待ち時間込みの時間が
+// 最も大きいものを捨てる）。ゴールのラベルに支配されるラベルはその先を探索しない。
+// 結果は待ち時間込みの時間が短い順に outRoutes に入れ、本数を返す（最大 maxLabels 本）
+int paretoRoutes(int start, int goal, int maxLabels, RouteResult *outRoutes) {
+    int n = graph.nodeCount;
+    const double *activePreference = currentQuery()->activePreference;
+
+    int crosswalkIdx = findEdgeIndex(60, 209);
+    int poolCap = n * maxLabels * 8;
+    if (poolCap < 1024) poolCap = 1024;
+
+    ParetoLabel *labels  = (ParetoLabel *)malloc(sizeof(ParetoLabel) * (size_t)poolCap);
+    double      *keys    = (double *)malloc(sizeof(double) * (size_t)poolCap);
+    int         *bag     = (int *)malloc(sizeof(int) * (size_t)n * (size_t)maxLabels);
+    int         *bagSize = (int *)calloc((size_t)n, sizeof(int));
+    if (!labels || !keys || !bag || !bagSize) {
+        fprintf(stderr, "Error: メモリを確保できません\n");
+        exit(1);
     }
-    
-    // 各ノードのGeoJSONファイルを読み込む
-    for (int nodeId = 1; nodeId < MAX_NODES; nodeId++) {
-        char filename[256];
-        snprintf(filename, sizeof(filename), "oomiya_point/%d.geojson", nodeId);
-        
-        FILE *fp = fopen(filename, "r");
-        if (!fp) continue;
-        
-        char line[1024];
-        if (fgets(line, sizeof(line), fp)) {
-            // 簡易JSONパース: coordinates を探す
-            // {"type":"Feature","geometry":{"type":"Point","coordinates":[139.64066147804263,35.94875901101989]}
-            char *coordsStart = strstr(line, "\"coordinates\":[");
-            if (coordsStart) {
-                double lon, lat;
-                if (sscanf(coordsStart, "\"coordinates\":[%lf,%lf]", &lon, &lat) == 2) {
-                    nodePositions[nodeId].lon = lon;
-                    nodePositions[nodeId].lat = lat;
+
+    NodeHeap heap;
+    nodeHeapInit(&heap, poolCap);
+    nodeHeapReset(&heap, keys);
+
+    int labelCount = 0;
+    int settled    = 0;
+    bool poolFull  = false;
+
+    ParetoLabel first = { 0.0, 0.0, 0.0, 0.0, start, -1, -1, 0, false };
+    labels[labelCount] = first;
+    keys[labelCount]   = 0.0;
+    bag[start * maxLabels + bagSize[start]++] = labelCount;
+    nodeHeapUpdate(&heap, labelCount++);
+
+    while (1) {
+        int id = nodeHeapPop(&heap);
+        if (id == -1) break;
+        if (labels[id].dead) continue;
+        settled++;
+
+        int u = labels[id].node;
+        if (u == goal) continue;
+
+        for (int i = graph.adjOffset[u]; i < graph.adjOffset[u + 1]; i++) {
+            int v       = graph.adjTarget[i];
+            int edgeIdx = graph.adjEdge[i];
+            double t = travelSec[edgeIdx];
+            if (t >= INF) continue;
+
+            const ParetoLabel *cur = &labels[id];
+            ParetoLabel cand;
+            cand.time      = cur->time + t;
+            cand.wait      = cur->wait + expectedWaitSeconds(edgeIdx, crosswalkIdx);
+            cand.dist      = cur->dist + edgeDataArray[edgeIdx].distance;
+            double pref = activePreference ? activePreference[edgeIdx] : edgeDataArray[edgeIdx].preference;
+            if (pref >= INF) continue;
+            cand.pref      = cur->pref + pref;
+            cand.node      = v;
+            cand.edge      = edgeIdx;
+            cand.parent    = id;
+            cand.edgeCount = cur->edgeCount + 1;
+            cand.dead      = false;
+            if (cand.edgeCount > MAX_PATH_LENGTH) continue;
+
+            // ゴールに既にある経路に支配されるなら、この先どう進んでも支配される
+            bool dominated = false;
+            for (int k = 0; k < bagSize[goal] && !dominated; k++) {
+                dominated = paretoDominates(&labels[bag[goal * maxLabels + k]], &cand);
+            }
+            int *vBag = &bag[v * maxLabels];
+            for (int k = 0; k < bagSize[v] && !dominated; k++) {
+                dominated = paretoDominates(&labels[vBag[k]], &cand);
+            }
+            if (dominated) continue;
+
+            // cand に支配されるラベルを捨てる
+            int kept = 0;
+            for (int k = 0; k < bagSize[v]; k++) {
+                if (paretoDominates(&cand, &labels[vBag[k]])) {
+                    labels[vBag[k]].dead = true;
+                } else {
+                    vBag[kept++] = vBag[k];
+                }
+            }
+            bagSize[v] = kept;
+
+            double candKey = cand.time + cand.wait;
+            if (bagSize[v] == maxLabels) {
+                int worst = 0;
+                for (int k = 1; k < bagSize[v]; k++) {
+                    if (keys[vBag[k]] > keys[vBag[worst]]) worst = k;
                 }
+                if (candKey >= keys[vBag[worst]]) continue;
+                labels[vBag[worst]].dead = true;
+                vBag[worst] = vBag[--bagSize[v]];
+            }
+
+            if (labelCount == poolCap) {
+                if (!poolFull) fprintf(stderr, "Warning: パレート探索のラベル数が上限(%d)に達しました\n", poolCap);
+                poolFull = true;
+                continue;
             }
+            labels[labelCount] = cand;
+            keys[labelCount]   = candKey;
+            vBag[bagSize[v]++] = labelCount;
+            nodeHeapUpdate(&heap, labelCount++);
         }
-        fclose(fp);
     }
-}
 
-// 2点間の方角（bearing）を計算（度）
-double calculateBearing(double lat1, double lon1, double lat2, double lon2) {
-    double dLon = (lon2 - lon1) * M_PI / 180.0;
-    double lat1Rad = lat1 * M_PI / 180.0;
-    double lat2Rad = lat2 * M_PI / 180.0;
-    
-    double y = sin(dLon) * cos(lat2Rad);
-    double x = cos(lat1Rad) * sin(lat2Rad) - sin(lat1Rad) * cos(lat2Rad) * cos(dLon);
-    
-    double bearing = atan2(y, x) * 180.0 / M_PI;
-    return fmod(bearing + 360.0, 360.0);  // 0-360度に正規化
+    // ゴールのラベルを待ち時間込みの時間が短い順に並べる
+    int *front = &bag[goal * maxLabels];
+    int  count = bagSize[goal];
+    for (int i = 1; i < count; i++) {
+        int id = front[i];
+        int j  = i - 1;
+        while (j >= 0 && (keys[front[j]] > keys[id] || (keys[front[j]] == keys[id] && front[j] > id))) {
+            front[j + 1] = front[j];
+            j--;
+        }
+        front[j + 1] = id;
+    }
+
+    int edges[MAX_PATH_LENGTH];
+    for (int i = 0; i < count; i++) {
+        const ParetoLabel *l = &labels[front[i]];
+        int k = l->edgeCount;
+        for (int id = front[i]; labels[id].parent >= 0; id = labels[id].parent) {
+            edges[--k] = labels[id].edge;
+        }
+        setRouteEdges(&outRoutes[i], edges, l->edgeCount);
+        fprintf(stderr, "  パレート経路[%d]: 移動時間=%.2f秒, 期待待ち時間=%.2f秒, 距離=%.2fm, 嗜好コスト=%.2f, edges=%d\n",
+                i, l->time, l->wait, l->dist, l->pref, l->edgeCount);
+    }
+    fprintf(stderr, "パレート探索: %d本 (ラベル生成%d個, 確定%d個, ノードごとの上限%d個)\n",
+            count, labelCount, settled, maxLabels);
+
+    nodeHeapFree(&heap);
+    free(labels);
+    free(keys);
+    free(bag);
+    free(bagSize);
+    return count;
 }
 
-// 角度差が±60度以内かチェック
-bool isWithinAngleRange(double angle1, double angle2, double tolerance) {
-    double diff = fabs(angle1 - angle2);
-    if (diff > 180.0) diff = 360.0 - diff;
-    return diff <= tolerance;
+/* ---------- メトリクス計算 ---------- */
+
+// 待ち時間を含めたメトリクス計算（待ち時間を0にする場合と期待値を使う場合）
+void calcRouteMetricsWithWaitTime(const int *edgeIdxs, int edgeCount,
+                                   double *outDist, double *outTimeSec, bool useExpectedWaitTime) {
+    calcRouteMetricsWithWaitTimeAndBaseTime1(edgeIdxs, edgeCount, outDist, outTimeSec, useExpectedWaitTime, false);
 }
 
-// 基準時刻1を計算する関数（信号を避けた最短経路、方角制約なし）
-// 指定された信号以外の信号を通る経路も考慮する
-bool calculateBaseTime1(int startNode, int endNode, double targetBearing, RouteResult *outRoute) {
-    // 指定された信号エッジのインデックスを取得（これらの信号は避ける）
-    int targetSignalIndices[28];
+// 信号待ち時間を計算（基準位相を考慮）
+double calculateWaitTimeWithReference(int edgeIdx, double cumulativeTime, double referencePhase) {
+    EdgeData *edge = &edgeDataArray[edgeIdx];
+    if (!edge->isSignal || edge->signalCycle <= 0) return 0.0;
+    
+    double phaseDiff = fabs(edge->signalPhase - referencePhase);
+    double arrivalTime = cumulativeTime;
+    double timeIntoCycle = fmod(
+        arrivalTime - phaseDiff + edge->signalCycle,
+        edge->signalCycle
+    );
+    
+    if (timeIntoCycle > edge->signalGreen) {
+        return edge->signalCycle - timeIntoCycle;
+    }
+    return 0.0;
+}
+
+// サイクルベースの待ち時間を含めたメトリクス計算
+// isBaseTime1=true: 基準時刻1（緑）- 信号の待ち時間は追加しない、60-209横断歩道の待ち時間は追加する
+// isBaseTime1=false: 基準時刻2（青）や赤 - 信号の待ち時間と60-209横断歩道の待ち時間の両方を追加する
+void calcRouteMetricsWithCycleBasedWaitTime(const int *edgeIdxs, int edgeCount,
+                                             double *outDist, double *outTimeSec, double *outWaitTimeSec, bool isBaseTime1) {
+    double totalDist = 0.0;
+    double totalTime = 0.0;
+    double totalWaitTime = 0.0;
+    double cumulativeTime = 0.0;
+    double signalWaitTime = 0.0;  // 信号の待ち時間のみ
+    double crosswalkWaitTime = 0.0;  // 60-209横断歩道の待ち時間のみ
+    
+    // 最初の信号エッジの位相を基準位相として取得
+    double referencePhase = 0.0;
+    bool hasReferencePhase = false;
+    for (int i = 0; i < edgeCount; i++) {
+        int idx = edgeIdxs[i];
+        if (idx >= 0 && idx < edgeDataCount) {
+            EdgeData *e = &edgeDataArray[idx];
+            if (e->isSignal && e->signalCycle > 0) {
+                referencePhase = e->signalPhase;
+                hasReferencePhase = true;
+                break;
+            }
+        }
+    }
+    
+    // 60-209のエッジインデックスを取得（正規化済み）
+    int crosswalk60_209Idx = -1;
+    int nf, nt;
+    normalizeEdgeKey(60, 209, &nf, &nt);
+    crosswalk60_209Idx = findEdgeIndex(nf, nt);
+    
+    for (int i = 0; i < edgeCount; i++) {
+        int idx = edgeIdxs[i];
+        if (idx < 0 || idx >= edgeDataCount) continue;
+        EdgeData *e = &edgeDataArray[idx];
+        totalDist += e->distance;
+        
+        // travelSec には危険な経路のペナルティも含まれている
+        double travelTimeSeconds = travelSec[idx];
+        if (travelTimeSeconds >= INF) continue;
+        totalTime += travelTimeSeconds;
+        cumulativeTime += travelTimeSeconds;
+        
+        // 信号エッジの場合、サイクルベースの待ち時間を計算
+        // 基準時刻1（isBaseTime1=true）の場合は信号の待ち時間を追加しない
+        if (e->isSignal && !isBaseTime1 && hasReferencePhase) {
+            double waitTime = calculateWaitTimeWithReference(idx, cumulativeTime, referencePhase);
+            signalWaitTime += waitTime;
+            totalWaitTime += waitTime;
+            totalTime += waitTime;
+            cumulativeTime += waitTime;
+        }
+        
+        // 60-209の横断歩道の場合（信号ではないが期待値が載っている）
+        // すべての経路（緑・青・赤）で待ち時間を追加する
+        if (idx == crosswalk60_209Idx) {
+            // signalExpectedが0.0の場合は、固定値20秒を使用
+            double crosswalkWait = 0.0;
+            if (e->signalExpected > 0.0) {
+                crosswalkWait = e->signalExpected * 60.0;  // 秒に変換
+            } else {
+                // signal_inf.csvにデータが無い場合のフォールバック: 20秒
+                crosswalkWait = 20.0;  // 秒
+                fprintf(stderr, "  警告: 60-209横断歩道のsignalExpectedが0.0のため、固定値20秒を使用します\n");
+            }
+            crosswalkWaitTime += crosswalkWait;
+            totalWaitTime += crosswalkWait;
+            totalTime += crosswalkWait;
+            cumulativeTime += crosswalkWait;
+            fprintf(stderr, "  60-209横断歩道: 待ち時間%.2f秒を追加 (isBaseTime1=%s, 累計信号待ち=%.2f秒, 累計横断歩道待ち=%.2f秒)\n", 
+                    crosswalkWait, isBaseTime1 ? "true" : "false", signalWaitTime, crosswalkWaitTime);
+        }
+    }
+    
+    fprintf(stderr, "  calcRouteMetricsWithCycleBasedWaitTime: 信号待ち=%.2f秒, 横断歩道待ち=%.2f秒, 合計待ち=%.2f秒 (isBaseTime1=%s)\n",
+            signalWaitTime, crosswalkWaitTime, totalWaitTime, isBaseTime1 ? "true" : "false");
+    
+    *outDist = totalDist;
+    *outTimeSec = totalTime;
+    *outWaitTimeSec = totalWaitTime;
+}
+
+// 待ち時間を含めたメトリクス計算（基準時刻1の場合は60-209の待ち時間を追加しない）
+void calcRouteMetricsWithWaitTimeAndBaseTime1(const int *edgeIdxs, int edgeCount,
+                                               double *outDist, double *outTimeSec, bool useExpectedWaitTime, bool isBaseTime1) {
+    double totalDist = 0.0;
+    double totalTime = 0.0;
+
+    // 60-209のエッジインデックスを取得（正規化済み）
+    int crosswalk60_209Idx = -1;
+    int nf, nt;
+    normalizeEdgeKey(60, 209, &nf, &nt);
+    crosswalk60_209Idx = findEdgeIndex(nf, nt);
+
+    for (int i = 0; i < edgeCount; i++) {
+        int idx = edgeIdxs[i];
+        if (idx < 0 || idx >= edgeDataCount) continue;
+        EdgeData *e = &edgeDataArray[idx];
+        totalDist += e->distance;
+
+        // travelSec には危険な経路のペナルティも含まれている
+        double travelTimeSeconds = travelSec[idx];
+        if (travelTimeSeconds >= INF) continue;
+        totalTime += travelTimeSeconds;
+        
+        // 信号エッジの場合、待ち時間を追加
+        // 基準時刻1（isBaseTime1=true）の場合は信号の待ち時間を追加しない
+        if (e->isSignal) {
+            if (useExpectedWaitTime && !isBaseTime1) {
+                totalTime += e->signalExpected * 60.0;  // 期待待ち時間を秒に変換
+            }
+            // useExpectedWaitTimeがfalse、またはisBaseTime1がtrueの場合は待ち時間0（追加しない）
+        }
+        
+        // 60-209の横断歩道の場合（信号ではないが期待値が載っている）
+        // すべての経路（緑・青・赤）で待ち時間を追加する（useExpectedWaitTimeがtrueの場合のみ）
+        if (idx == crosswalk60_209Idx && useExpectedWaitTime) {
+            if (e->signalExpected > 0.0) {
+                totalTime += e->signalExpected * 60.0;  // 期待待ち時間を秒に変換
+                fprintf(stderr, "  60-209横断歩道: 待ち時間%.2f秒を追加\n", 
+                        e->signalExpected * 60.0);
+            }
+        }
+    }
+
+    *outDist    = totalDist;
+    *outTimeSec = totalTime;
+}
+
+void calcRouteMetrics(const int *edgeIdxs, int edgeCount,
+                      double *outDist, double *outTimeSec) {
+    calcRouteMetricsWithWaitTime(edgeIdxs, edgeCount, outDist, outTimeSec, false);
+}
+
+/* ---------- ファイル読み込み ---------- */
+
+// result.csv の1行分をグラフ（双方向）に追加する
+// 隣接リストは全データの読み込み後に buildAdjacency でまとめて作る
+void addResultEdge(int from, int to, double weight) {
+    if (from <= 0 || to <= 0) return;
+
+    int edgeIdx = findEdgeIndex(from, to);
+    if (edgeIdx < 0 && (edgeIdx = appendEdge(from, to)) >= 0) {
+        edgeDataArray[edgeIdx].distance  = 0.0;
+        edgeDataArray[edgeIdx].gradient  = 0.0;
+        edgeDataArray[edgeIdx].isSignal  = 0;
+    }
+    // 既に隣接として登録済みのエッジ（重複行）は追加しない
+    if (edgeDataArray[edgeIdx].inGraph) return;
+    edgeDataArray[edgeIdx].inGraph    = 1;
+    edgeDataArray[edgeIdx].preference = weight;
+
+    graphEdgeList = (int *)growArray(graphEdgeList, &graphEdgeCapacity,
+                                     graphEdgeCount + 1, sizeof(int));
+    graphEdgeList[graphEdgeCount++] = edgeIdx;
+}
+
+// result.csv: "from,to,weight" を想定（weight はパレート探索の嗜好コストとして使う）
+// ファイルが無ければ false を返す（呼び出し側で oomiya_route_inf_4.csv の行から隣接を作る）
+bool loadGraphFromResult(const char *filename) {
+    CsvReader csv;
+    if (!csvOpen(&csv, filename, false)) return false;
+
+    while (csvNextRow(&csv)) {
+        int from, to;
+        double w;
+        if (!csvInt(&csv, 0, &from) || !csvInt(&csv, 1, &to) || !csvDouble(&csv, 2, &w)) {
+            csvWarn(&csv, "from,to,weight として読めません");
+            continue;
+        }
+        addResultEdge(from, to, w);
+    }
+
+    csvClose(&csv);
+    return true;
+}
+
+// result.csv が無いとき、up44 が書き出すのと同じ順（oomiya_route_inf_4.csv の全カラムそろった行の順）で
+// 隣接を登録する。嗜好コストは --weights / --prefs の重みから作るので 0 にしておく
+void loadGraphFromRouteRows(void) {
+    for (int i = 0; i < preferenceModel.rowCount; i++) {
+        const EdgeData *e = &edgeDataArray[preferenceRowEdge[i]];
+        addResultEdge(e->from, e->to, 0.0);
+    }
+}
+
+// oomiya_route_inf_4.csv の1行分をエッジ情報に反映する
+void addRouteRow(int from, int to, double dist, double grad, int isSignal) {
+    if (from <= 0 || to <= 0) return;
+
+    int edgeIdx = findEdgeIndex(from, to);
+    if (edgeIdx < 0) {
+        edgeIdx = appendEdge(from, to);
+    }
+
+    if (edgeIdx >= 0) {
+        edgeDataArray[edgeIdx].distance = dist;
+        edgeDataArray[edgeIdx].gradient = grad;
+        if (isSignal) edgeDataArray[edgeIdx].isSignal = 1;
+        // 信号情報は後でloadSignalDataで上書きされる
+        edgeDataArray[edgeIdx].signalCycle = 0.0;
+        edgeDataArray[edgeIdx].signalGreen = 0.0;
+        edgeDataArray[edgeIdx].signalPhase = 0.0;
+        edgeDataArray[edgeIdx].signalExpected = 0.0;
+    }
+}
+
+// oomiya_route_inf_4.csv の1行（values は先頭から PREFERENCE_COLUMNS 個、tokenCount は先頭からそろっているカラム数）
+// 距離・勾配・信号フラグをエッジに設定し、全カラムそろった行は嗜好コストの計算用に残しておく
+void addRouteValues(const double *values, int tokenCount) {
+    if (tokenCount < 5) return;
+    // 信号フラグは8番目のカラム（元の位置に依存）
+    int isSignal = tokenCount >= 8 ? (int)values[7] : 0;
+    addRouteRow((int)values[0], (int)values[1], values[2], values[4], isSignal);
+
+    // up44 と同じく、カラムが足りない行・ノード番号が0の行は使わない
+    if (tokenCount < PREFERENCE_COLUMNS || (int)values[0] == 0 || (int)values[1] == 0) return;
+    int edgeIdx = findEdgeIndex((int)values[0], (int)values[1]);
+    if (edgeIdx < 0) return;
+    preferenceRowEdge = (int *)growArray(preferenceRowEdge, &preferenceRowCapacity,
+                                         preferenceModel.rowCount + 1, sizeof(int));
+    preferenceRowEdge[preferenceModelAddRow(&preferenceModel, values)] = edgeIdx;
+}
+
+// oomiya_route_inf_4.csv: node1,node2,distance,time_minutes,gradient,...（カラムはヘッダ行の名前で引く）
+void loadRouteData(const char *filename) {
+    CsvReader csv;
+    if (!csvOpen(&csv, filename, true)) {
+        fprintf(stderr, "Error: cannot open %s\n", filename);
+        return;
+    }
+
+    int columns[CSV_ROUTE_COLUMNS];
+    csvRouteColumns(&csv, columns);
+    while (csvNextRow(&csv)) {
+        double values[CSV_ROUTE_COLUMNS];
+        int    tokenCount;
+        if (!csvRouteValues(&csv, columns, values, &tokenCount)) continue;
+        addRouteValues(values, tokenCount);
+    }
+
+    csvClose(&csv);
+}
+
+// signal_inf.csv の1行分をエッジ情報に反映する
+void addSignalRow(int from, int to, double cycle, double green, double phase, double expected) {
+    int edgeIdx = findEdgeIndex(from, to);
+    if (edgeIdx < 0) {
+        fprintf(stderr,
+                "Warning: signal edge %d-%d not found in graph\n",
+                from, to);
+        return;
+    }
+
+    // 信号フラグと情報を保存
+    // 60-209は信号がない横断歩道なので、isSignalを1にしない
+    // ただし、期待待ち時間は保存する
+    int nf, nt;
+    normalizeEdgeKey(from, to, &nf, &nt);
+    bool isCrosswalk60_209 = (nf == 60 && nt == 209);
+    
+    if (!isCrosswalk60_209) {
+        edgeDataArray[edgeIdx].isSignal = 1;
+    }
+    edgeDataArray[edgeIdx].signalCycle = cycle;
+    edgeDataArray[edgeIdx].signalGreen = green;
+    edgeDataArray[edgeIdx].signalPhase = phase;
+    edgeDataArray[edgeIdx].signalExpected = expected;
+
+    if (!isCrosswalk60_209 && signalCount < MAX_SIGNALS) {
+        signalEdges[signalCount++] = edgeIdx;
+        fprintf(stderr,
+                "Signal %d: edge %d (%d-%d) cycle=%.0f green=%.0f phase=%.2f expected=%.2f\n",
+                signalCount, edgeIdx, from, to, cycle, green, phase, expected);
+    } else if (isCrosswalk60_209) {
+        fprintf(stderr,
+                "Crosswalk (no signal) %d-%d: expected=%.2f\n",
+                nf, nt, expected);
+    }
+}
+
+// signal_inf.csv: from,to,cycle,green,phase,expected
+void loadSignalData(const char *filename) {
+    CsvReader csv;
+    if (!csvOpen(&csv, filename, true)) {
+        fprintf(stderr, "Warning: cannot open %s\n", filename);
+        return;
+    }
+
+    signalCount = 0;
+
+    int colFrom     = csvColumn(&csv, "node1");
+    int colTo       = csvColumn(&csv, "node2");
+    int colCycle    = csvColumn(&csv, "cycle");
+    int colGreen    = csvColumn(&csv, "green");
+    int colPhase    = csvColumn(&csv, "phase");
+    int colExpected = csvColumn(&csv, "expected");
+    while (csvNextRow(&csv)) {
+        int from, to;
+        double cycle, green, phase, expected;
+        if (!csvInt(&csv, colFrom, &from) || !csvInt(&csv, colTo, &to) ||
+            !csvDouble(&csv, colCycle, &cycle) || !csvDouble(&csv, colGreen, &green) ||
+            !csvDouble(&csv, colPhase, &phase) || !csvDouble(&csv, colExpected, &expected)) {
+            csvWarn(&csv, "failed to parse signal line");
+            continue;
+        }
+
+        addSignalRow(from, to, cycle, green, phase, expected);
+    }
+
+    csvClose(&csv);
+    fprintf(stderr, "Loaded %d signals from signal_inf.csv\n", signalCount);
+}
+
+// GeoJSONからノード位置情報を読み込む
+void loadNodePositions(void) {
+    // 初期化：位置情報が読み込まれていないノードは0.0で初期化
+    for (int i = 0; i < graph.nodeCount; i++) {
+        nodePositions[i].lat = 0.0;
+        nodePositions[i].lon = 0.0;
+    }
+    
+    // 各ノードのGeoJSONファイルを読み込む
+    for (int nodeId = 1; nodeId < graph.nodeCount; nodeId++) {
+        char filename[256];
+        snprintf(filename, sizeof(filename), "oomiya_point/%d.geojson", nodeId);
+        
+        FILE *fp = fopen(filename, "r");
+        if (!fp) continue;
+        
+        char line[1024];
+        if (fgets(line, sizeof(line), fp)) {
+            // 簡易JSONパース: coordinates を探す
+            // {"type":"Feature","geometry":{"type":"Point","coordinates":[139.64066147804263,35.94875901101989]}
+            char *coordsStart = strstr(line, "\"coordinates\":[");
+            if (coordsStart) {
+                double lon, lat;
+                if (sscanf(coordsStart, "\"coordinates\":[%lf,%lf]", &lon, &lat) == 2) {
+                    nodePositions[nodeId].lon = lon;
+                    nodePositions[nodeId].lat = lat;
+                }
+            }
+        }
+        fclose(fp);
+    }
+}
+
+// 2点間の方角（bearing）を計算（度）
+double calculateBearing(double lat1, double lon1, double lat2, double lon2) {
+    double dLon = (lon2 - lon1) * M_PI / 180.0;
+    double lat1Rad = lat1 * M_PI / 180.0;
+    double lat2Rad = lat2 * M_PI / 180.0;
+    
+    double y = sin(dLon) * cos(lat2Rad);
+    double x = cos(lat1Rad) * sin(lat2Rad) - sin(lat1Rad) * cos(lat2Rad) * cos(dLon);
+    
+    double bearing = atan2(y, x) * 180.0 / M_PI;
+    return fmod(bearing + 360.0, 360.0);  // 0-360度に正規化
+}
+
+// 角度差が±60度以内かチェック
+bool isWithinAngleRange(double angle1, double angle2, double tolerance) {
+    double diff = fabs(angle1 - angle2);
+    if (diff > 180.0) diff = 360.0 - diff;
+    return diff <= tolerance;
+}
+
+// 基準時刻1を計算する関数（信号を避けた最短経路、方角制約なし）
+// 指定された信号以外の信号を通る経路も考慮する
+bool calculateBaseTime1(int startNode, int endNode, double targetBearing, RouteResult *outRoute) {
+    // 指定された信号エッジのインデックスを取得（これらの信号は避ける）
+    int targetSignalIndices[28];
     int targetSignalCount = 0;
     getTargetSignalEdges(targetSignalIndices, &targetSignalCount);
     
@@ -1009,9 +2515,8 @@ bool calculateBaseTime1(int startNode, int endNode, double targetBearing, RouteR
     
     if (avoidSignalPath.cost < INF) {
         RouteResult r;
-        r.signalEdgeIdx = -1;
-        r.edgeCount = 0;
-        r.hasSignal = 0;
+        int rEdges[MAX_PATH_LENGTH];
+        beginRoute(&r, rEdges, -1, 0);
         
             if (appendSegment(&r, &avoidSignalPath)) {
             // 基準時刻1（緑色の経路）では、サイクルベースの待ち時間計算を使用
@@ -1061,7 +2566,7 @@ bool calculateBaseTime1(int startNode, int endNode, double targetBearing, RouteR
             fprintf(stderr, "基準時刻1候補: edges=%d, distance=%.2f m, time=%.2f sec (%.2f min), hasSignal=%d\n",
                     r.edgeCount, r.totalDistance, r.totalTimeSeconds, r.totalTimeSeconds / 60.0, r.hasSignal);
             
-            *outRoute = r;
+            storeRoute(outRoute, &r);
             return true;
         }
     } else {
@@ -1101,9 +2606,8 @@ bool calculateBaseTime1(int startNode, int endNode, double targetBearing, RouteR
         
         if (fallbackPath.cost < INF) {
             RouteResult r;
-            r.signalEdgeIdx = -1;
-            r.edgeCount = 0;
-            r.hasSignal = 0;
+            int rEdges[MAX_PATH_LENGTH];
+            beginRoute(&r, rEdges, -1, 0);
             
             if (appendSegment(&r, &fallbackPath)) {
                 // 基準時刻1（緑色の経路）では、サイクルベースの待ち時間計算を使用
@@ -1152,7 +2656,7 @@ bool calculateBaseTime1(int startNode, int endNode, double targetBearing, RouteR
                 fprintf(stderr, "基準時刻1（フォールバック）: edges=%d, distance=%.2f m, time=%.2f sec (%.2f min), hasSignal=%d\n",
                         r.edgeCount, r.totalDistance, r.totalTimeSeconds, r.totalTimeSeconds / 60.0, r.hasSignal);
                 
-                *outRoute = r;
+                storeRoute(outRoute, &r);
                 return true;
             }
         }
@@ -1182,9 +2686,8 @@ bool calculateBaseTime2(int startNode, int endNode, RouteResult *outRoute) {
         
         if (seg1.cost < INF && seg2.cost < INF) {
             RouteResult r;
-            r.signalEdgeIdx = edgeIdx;
-            r.edgeCount = 0;
-            r.hasSignal = 1;
+            int rEdges[MAX_PATH_LENGTH];
+            beginRoute(&r, rEdges, edgeIdx, 1);
             
             if (appendSegment(&r, &seg1)) {
                 if (r.edgeCount < MAX_PATH_LENGTH)
@@ -1224,7 +2727,7 @@ bool calculateBaseTime2(int startNode, int endNode, RouteResult *outRoute) {
                             waitTime, signalWaitTimeOnly, crosswalkWaitTime, r.totalTimeSeconds);
                     if (r.totalTimeSeconds < minTime) {
                         minTime = r.totalTimeSeconds;
-                        bestRoute = r;
+                        storeRoute(&bestRoute, &r);
                         found = true;
                     }
                 }
@@ -1237,9 +2740,8 @@ bool calculateBaseTime2(int startNode, int endNode, RouteResult *outRoute) {
         
         if (seg1.cost < INF && seg2.cost < INF) {
             RouteResult r;
-            r.signalEdgeIdx = edgeIdx;
-            r.edgeCount = 0;
-            r.hasSignal = 1;
+            int rEdges[MAX_PATH_LENGTH];
+            beginRoute(&r, rEdges, edgeIdx, 1);
             
             if (appendSegment(&r, &seg1)) {
                 if (r.edgeCount < MAX_PATH_LENGTH)
@@ -1279,7 +2781,7 @@ bool calculateBaseTime2(int startNode, int endNode, RouteResult *outRoute) {
                             waitTime, signalWaitTimeOnly, crosswalkWaitTime, r.totalTimeSeconds);
                     if (r.totalTimeSeconds < minTime) {
                         minTime = r.totalTimeSeconds;
-                        bestRoute = r;
+                        storeRoute(&bestRoute, &r);
                         found = true;
                     }
                 }
@@ -1344,9 +2846,8 @@ bool findRouteThroughSignals(int startNode, int endNode, int *signalIndices, int
         
         if (seg1.cost < INF && seg2.cost < INF) {
             RouteResult r;
-            r.signalEdgeIdx = edgeIdx;
-            r.edgeCount = 0;
-            r.hasSignal = 1;
+            int rEdges[MAX_PATH_LENGTH];
+            beginRoute(&r, rEdges, edgeIdx, 1);
             
             if (appendSegment(&r, &seg1)) {
                 if (r.edgeCount < MAX_PATH_LENGTH)
@@ -1354,7 +2855,7 @@ bool findRouteThroughSignals(int startNode, int endNode, int *signalIndices, int
                 if (appendSegment(&r, &seg2)) {
                     calcRouteMetricsWithWaitTimeAndBaseTime1(r.edges, r.edgeCount,
                                                  &r.totalDistance, &r.totalTimeSeconds, true, false);
-                    *outRoute = r;
+                    storeRoute(outRoute, &r);
                     return true;
                 }
             }
@@ -1366,9 +2867,8 @@ bool findRouteThroughSignals(int startNode, int endNode, int *signalIndices, int
         
         if (seg1.cost < INF && seg2.cost < INF) {
             RouteResult r;
-            r.signalEdgeIdx = edgeIdx;
-            r.edgeCount = 0;
-            r.hasSignal = 1;
+            int rEdges[MAX_PATH_LENGTH];
+            beginRoute(&r, rEdges, edgeIdx, 1);
             
             if (appendSegment(&r, &seg1)) {
                 if (r.edgeCount < MAX_PATH_LENGTH)
@@ -1376,7 +2876,7 @@ bool findRouteThroughSignals(int startNode, int endNode, int *signalIndices, int
                 if (appendSegment(&r, &seg2)) {
                     calcRouteMetricsWithWaitTimeAndBaseTime1(r.edges, r.edgeCount,
                                                  &r.totalDistance, &r.totalTimeSeconds, true, false);
-                    *outRoute = r;
+                    storeRoute(outRoute, &r);
                     return true;
                 }
             }
@@ -1405,9 +2905,8 @@ bool findRouteThroughSignals(int startNode, int endNode, int *signalIndices, int
             // 中間の信号を通過
             int current = firstTo;
             RouteResult r;
-            r.edgeCount = 0;
-            r.hasSignal = 1;
-            r.signalEdgeIdx = firstEdgeIdx;
+            int rEdges[MAX_PATH_LENGTH];
+            beginRoute(&r, rEdges, firstEdgeIdx, 1);
             
             if (!appendSegment(&r, &seg1)) continue;
             if (r.edgeCount < MAX_PATH_LENGTH)
@@ -1441,7 +2940,7 @@ bool findRouteThroughSignals(int startNode, int endNode, int *signalIndices, int
                 if (seg2.cost < INF && appendSegment(&r, &seg2)) {
                     calcRouteMetricsWithWaitTimeAndBaseTime1(r.edges, r.edgeCount,
                                                  &r.totalDistance, &r.totalTimeSeconds, true, false);
-                    *outRoute = r;
+                    storeRoute(outRoute, &r);
                     return true;
                 }
             }
@@ -1451,38 +2950,299 @@ bool findRouteThroughSignals(int startNode, int endNode, int *signalIndices, int
     return false;
 }
 
-// 組み合わせを生成して経路を探索する再帰関数
-void generateCombinations(int startNode, int endNode, int *signalIndices, int signalCount,
-                          int *current, int currentSize, int maxSize, int startIdx,
-                          RouteResult *outRoutes, int *outCount, int maxRoutes, int *calculatedCount) {
-    if (*outCount >= maxRoutes) return;
-    
+// 信号の組み合わせ1つ分の評価（並列評価では各スレッドが別々の要素を埋める）
+typedef struct {
+    int         signals[MAX_COMBINATION_SIZE];
+    int         size;
+    double      lowerBound;  // 待ち時間なしの移動時間の下界（枝刈りしない場合は 0）
+    bool        found;
+    RouteResult route;
+} CombinationJob;
+
+// 枝刈り用の下界（待ち時間なしの移動時間、秒）
+// 信号 i, j の両方を通る経路は、どちらかを先に通るため
+//   スタート→i→j→ゴール または スタート→j→i→ゴール の最短の移動時間以上かかる。
+// 組み合わせの下界は含まれる信号の組ごとの下界の最大値とし、信号を増やしても小さくならない
+typedef struct {
+    int     count;   // 信号数（targetSignalIndices の並び）
+    double *single;  // [i]: 信号 i を通る経路の下界
+    double *pair;    // [i * count + j]: 信号 i と j を両方通る経路の下界
+} CombinationBounds;
+
+// 組み合わせの評価をワーカースレッドに配る
+typedef struct {
+    int             startNode;
+    int             endNode;
+    CombinationJob *jobs;
+    int             jobCount;
+    int             nextJob;  // 次に評価する組み合わせ（lock で保護）
+    long            settledCount;  // ワーカーが確定したノード数の合計（lock で保護）
+    pthread_mutex_t lock;
+    QueryContext   *query;    // 評価中のクエリ（経路のエッジ列はこのアリーナに置く）
+} CombinationBatch;
+
+// 信号 i の向き（dir=0: from→to, 1: to→from）ごとの入口・出口
+int signalEntry(int edgeIdx, int dir) {
+    return dir == 0 ? edgeDataArray[edgeIdx].from : edgeDataArray[edgeIdx].to;
+}
+
+int signalExit(int edgeIdx, int dir) {
+    return dir == 0 ? edgeDataArray[edgeIdx].to : edgeDataArray[edgeIdx].from;
+}
+
+// スタート・ゴール・信号の両端からの最短経路木を使って下界を作る
+void buildCombinationBounds(int startNode, int endNode, const int *signalIndices, int signalCount,
+                            CombinationBounds *bounds) {
+    bounds->count  = signalCount;
+    bounds->single = (double *)malloc(sizeof(double) * (size_t)(signalCount > 0 ? signalCount : 1));
+    bounds->pair   = (double *)malloc(sizeof(double) * (size_t)(signalCount * signalCount > 0 ? signalCount * signalCount : 1));
+    if (!bounds->single || !bounds->pair) {
+        fprintf(stderr, "Error: メモリを確保できません\n");
+        exit(1);
+    }
+
+    // 移動時間は向きによらないため、x→ゴールはゴールを根とする木の dist[x] で求まる
+    const double *fromStart = getShortestPathTree(startNode)->dist;
+    const double *toGoal    = getShortestPathTree(endNode)->dist;
+
+    for (int i = 0; i < signalCount; i++) {
+        int    ei = signalIndices[i];
+        double ti = travelSec[ei];
+        double best = INF;
+        for (int di = 0; di < 2; di++) {
+            double t = fromStart[signalEntry(ei, di)] + ti + toGoal[signalExit(ei, di)];
+            if (t < best) best = t;
+        }
+        bounds->single[i] = best;
+    }
+
+    for (int i = 0; i < signalCount; i++) {
+        bounds->pair[i * signalCount + i] = bounds->single[i];
+        for (int j = i + 1; j < signalCount; j++) {
+            double best = INF;
+            // first を先に通り、second を後に通る
+            for (int order = 0; order < 2; order++) {
+                int first  = signalIndices[order == 0 ? i : j];
+                int second = signalIndices[order == 0 ? j : i];
+                for (int d1 = 0; d1 < 2; d1++) {
+                    const double *fromFirst = getShortestPathTree(signalExit(first, d1))->dist;
+                    for (int d2 = 0; d2 < 2; d2++) {
+                        double t = fromStart[signalEntry(first, d1)] + travelSec[first] +
+                                   fromFirst[signalEntry(second, d2)] + travelSec[second] +
+                                   toGoal[signalExit(second, d2)];
+                        if (t < best) best = t;
+                    }
+                }
+            }
+            bounds->pair[i * signalCount + j] = best;
+            bounds->pair[j * signalCount + i] = best;
+        }
+    }
+}
+
+void freeCombinationBounds(CombinationBounds *bounds) {
+    free(bounds->single);
+    free(bounds->pair);
+    memset(bounds, 0, sizeof(*bounds));
+}
+
+// maxSize 個の信号の組み合わせを辞書順に列挙して jobs に追加する再帰関数
+// bounds を渡すと、途中までの組み合わせの下界が best を超えた時点でその先を列挙しない
+// （下界は信号を増やしても小さくならないため、その組み合わせを含むものは全て best より遅い）
+void generateCombinations(int *signalIndices, int signalCount,
+                          int *current, int *currentPos, int currentSize, int maxSize, int startIdx,
+                          const CombinationBounds *bounds, double bound, double best,
+                          CombinationJob *jobs, int *jobCount, int *prunedCount) {
     if (currentSize == maxSize) {
-        RouteResult r;
-        (*calculatedCount)++;  // 試行回数をカウント
-        if (findRouteThroughSignals(startNode, endNode, current, currentSize, &r)) {
-            r.routeType = 2;  // 赤
-            outRoutes[*outCount] = r;
-            // 最初の5件と最後の5件、および10件ごとにログ出力
-            if (*outCount < 5 || (*outCount >= (*outCount / 10) * 10 && *outCount < (*outCount / 10) * 10 + 5) || *outCount >= maxRoutes - 5) {
-                fprintf(stderr, "  経路[%d]: totalTimeSeconds=%.2f秒 (移動時間+信号待ち時間)\n", 
-                        *outCount, r.totalTimeSeconds);
+        CombinationJob *job = &jobs[(*jobCount)++];
+        memcpy(job->signals, current, sizeof(int) * (size_t)maxSize);
+        job->size       = maxSize;
+        job->lowerBound = bound;
+        job->found      = false;
+        return;
+    }
+
+    for (int i = startIdx; i < signalCount; i++) {
+        double next = bound;
+        if (bounds) {
+            if (bounds->single[i] > next) next = bounds->single[i];
+            for (int k = 0; k < currentSize; k++) {
+                double b = bounds->pair[currentPos[k] * bounds->count + i];
+                if (b > next) next = b;
+            }
+            if (next > best) {
+                (*prunedCount)++;
+                continue;
             }
-            (*outCount)++;
+        }
+        current[currentSize]    = signalIndices[i];
+        currentPos[currentSize] = i;
+        generateCombinations(signalIndices, signalCount, current, currentPos, currentSize + 1, maxSize, i + 1,
+                             bounds, next, best, jobs, jobCount, prunedCount);
+    }
+}
+
+void evaluateCombination(int startNode, int endNode, CombinationJob *job) {
+    // findRouteThroughSignals内でcalcRouteMetricsWithWaitTime(..., true)が呼ばれるため、
+    // 移動時間+信号待ち時間が計算される
+    job->found = findRouteThroughSignals(startNode, endNode, job->signals, job->size, &job->route);
+    if (job->found) job->route.routeType = 2;  // 赤
+}
+
+// 未評価の組み合わせを1つずつ取り出して評価する（作業領域はスレッドごとに持つ）
+void *combinationWorkerMain(void *arg) {
+    CombinationBatch *batch = (CombinationBatch *)arg;
+
+    SearchWorkspace ws;
+    initSearchWorkspace(&ws);
+    threadWs    = &ws;
+    threadQuery = batch->query;
+
+    for (;;) {
+        pthread_mutex_lock(&batch->lock);
+        int i = batch->nextJob++;
+        pthread_mutex_unlock(&batch->lock);
+        if (i >= batch->jobCount) break;
+        evaluateCombination(batch->startNode, batch->endNode, &batch->jobs[i]);
+    }
+
+    pthread_mutex_lock(&batch->lock);
+    batch->settledCount += ws.settledCount;
+    pthread_mutex_unlock(&batch->lock);
+
+    threadWs    = NULL;
+    threadQuery = NULL;
+    freeSearchWorkspace(&ws);
+    return NULL;
+}
+
+// 全ての組み合わせを評価する。threadCount が2以上ならワーカースレッドに分担させる
+// 結果は jobs の各要素に入るため、スレッド数によらず列挙順に取り出せる
+void evaluateCombinations(int startNode, int endNode, int *signalIndices, int signalCount,
+                          CombinationJob *jobs, int jobCount, int threadCount) {
+    if (threadCount > jobCount) threadCount = jobCount;
+    if (threadCount <= 1) {
+        for (int i = 0; i < jobCount; i++) {
+            evaluateCombination(startNode, endNode, &jobs[i]);
         }
         return;
     }
-    
-    for (int i = startIdx; i < signalCount && *outCount < maxRoutes; i++) {
-        current[currentSize] = signalIndices[i];
-        generateCombinations(startNode, endNode, signalIndices, signalCount,
-                            current, currentSize + 1, maxSize, i + 1,
-                            outRoutes, outCount, maxRoutes, calculatedCount);
+
+    // 経路探索の始点になるのはスタートと信号の両端だけなので、先に最短経路木を作っておき
+    // ワーカーがキャッシュの作成待ちで止まらないようにする
+    if (currentQuery()->searchMode == SEARCH_TREE) {
+        getShortestPathTree(startNode);
+        for (int i = 0; i < signalCount; i++) {
+            getShortestPathTree(edgeDataArray[signalIndices[i]].from);
+            getShortestPathTree(edgeDataArray[signalIndices[i]].to);
+        }
+    }
+
+    CombinationBatch batch;
+    batch.startNode = startNode;
+    batch.endNode   = endNode;
+    batch.jobs      = jobs;
+    batch.jobCount  = jobCount;
+    batch.nextJob   = 0;
+    batch.settledCount = 0;
+    batch.query     = currentQuery();
+    pthread_mutex_init(&batch.lock, NULL);
+
+    pthread_t *threads = (pthread_t *)malloc(sizeof(pthread_t) * (size_t)threadCount);
+    if (!threads) {
+        fprintf(stderr, "Error: メモリを確保できません\n");
+        exit(1);
+    }
+    int started = 0;
+    for (int t = 0; t < threadCount; t++) {
+        if (pthread_create(&threads[t], NULL, combinationWorkerMain, &batch) != 0) {
+            fprintf(stderr, "Warning: スレッドを作成できません（%d本で続行します）\n", started);
+            break;
+        }
+        started++;
+    }
+    // 1本も作れなければこのスレッドで評価する
+    if (started == 0) combinationWorkerMain(&batch);
+    for (int t = 0; t < started; t++) {
+        pthread_join(threads[t], NULL);
+    }
+
+    currentWorkspace()->settledCount += batch.settledCount;
+    pthread_mutex_destroy(&batch.lock);
+    free(threads);
+}
+
+// 評価済みの組み合わせを列挙順に outRoutes に追加する（maxRoutes 本に達したら打ち切る）
+// 下界が maxLowerBound を超える経路は、最短（赤）になり得ないため追加しない
+// logAll が false なら、最初の5件と最後の5件、および10件ごとにログ出力
+void collectCombinationRoutes(const CombinationJob *jobs, int jobCount, RouteResult *outRoutes,
+                              int *outCount, int maxRoutes, int *calculatedCount, double maxLowerBound, bool logAll) {
+    for (int i = 0; i < jobCount && *outCount < maxRoutes; i++) {
+        (*calculatedCount)++;  // 試行回数をカウント（経路探索を試みた回数）
+        if (!jobs[i].found || jobs[i].lowerBound > maxLowerBound) continue;
+
+        outRoutes[*outCount] = jobs[i].route;
+        if (logAll) {
+            fprintf(stderr, "  経路[%d]: totalTimeSeconds=%.2f秒 (移動時間+信号待ち時間が計算済み)\n",
+                    *outCount, jobs[i].route.totalTimeSeconds);
+        } else if (*outCount < 5 || (*outCount >= (*outCount / 10) * 10 && *outCount < (*outCount / 10) * 10 + 5) || *outCount >= maxRoutes - 5) {
+            fprintf(stderr, "  経路[%d]: totalTimeSeconds=%.2f秒 (移動時間+信号待ち時間)\n",
+                    *outCount, jobs[i].route.totalTimeSeconds);
+        }
+        (*outCount)++;
+    }
+}
+
+// 評価済みの組み合わせを列挙順に seen へ登録し、登録済みの経路（基準時刻1/2、それまでに生成した経路）と
+// 同じエッジ列になったものは見つからなかったものとして扱う。列挙順に判定するため、スレッド数によらず同じ結果になる
+// owners を渡すと登録番号ごとに残した組み合わせを記録し、重複した側の下界が小さければ残した側の下界をそれに下げる
+// （枝刈りでは下界が最短以下の組み合わせが1つでもあれば経路を出力していたため、その条件を保つ）
+int dropDuplicateCombinations(CombinationJob *jobs, int jobCount, RouteSet *seen,
+                              CombinationJob ***owners, int *ownerCapacity) {
+    int dropped = 0;
+    for (int i = 0; i < jobCount; i++) {
+        if (!jobs[i].found) continue;
+        int index;
+        if (routeSetInsert(seen, jobs[i].route.edges, jobs[i].route.edgeCount, &index)) {
+            if (owners) {
+                int oldCapacity = *ownerCapacity;
+                *owners = (CombinationJob **)growArray(*owners, ownerCapacity, seen->count, sizeof(CombinationJob *));
+                for (int k = oldCapacity; k < *ownerCapacity; k++) (*owners)[k] = NULL;
+                (*owners)[index] = &jobs[i];
+            }
+            continue;
+        }
+        if (owners && index < *ownerCapacity && (*owners)[index] &&
+            jobs[i].lowerBound < (*owners)[index]->lowerBound) {
+            (*owners)[index]->lowerBound = jobs[i].lowerBound;
+        }
+        jobs[i].found = false;
+        dropped++;
+    }
+    return dropped;
+}
+
+// 評価済みの組み合わせのうち、赤の候補になる経路のサイクルベースの総時間の最小値で best を更新する
+// （基準時刻1/2と同じ経路・重複した経路は dropDuplicateCombinations で除いてある）
+void updateCombinationIncumbent(const CombinationJob *jobs, int jobCount, double *best) {
+    for (int i = 0; i < jobCount; i++) {
+        if (!jobs[i].found) continue;
+
+        double dist, timeSec, waitTimeSec;
+        calcRouteMetricsWithCycleBasedWaitTime(jobs[i].route.edges, jobs[i].route.edgeCount,
+                                               &dist, &timeSec, &waitTimeSec, false);
+        if (timeSec < *best) *best = timeSec;
     }
 }
 
-// 全網羅経路を計算する関数（指定された信号から1個、2個、3個の組み合わせを全て探索）
-int calculateAllEnumRoutes(int startNode, int endNode, int signalCount, RouteResult *outRoutes, int maxRoutes) {
+// 全網羅経路を計算する関数（指定された信号から1個、2個、…、opt->enumDepth 個の組み合わせを全て探索）
+// opt->threadCount が2以上なら組み合わせの評価を並列に行う（出力の順序は1スレッドの場合と同じ）
+// opt->prune が true なら、待ち時間なしの移動時間の下界が暫定の最短（サイクルベースの総時間）を
+// 超える組み合わせを評価せず、最終的に最短より下界が大きい経路も出力しない。
+// 赤に選ばれる経路は枝刈りしない場合と同じになる。
+// seen には赤の候補から除く経路（基準時刻1/2）を登録しておく。同じエッジ列の経路は1本だけ出力する
+int calculateAllEnumRoutes(int startNode, int endNode, int signalCount, RouteResult *outRoutes, int maxRoutes,
+                           const QueryOptions *opt, RouteSet *seen) {
     int count = 0;
     int calculatedCount = 0;  // 実際に計算した経路数
     
@@ -1497,55 +3257,374 @@ int calculateAllEnumRoutes(int startNode, int endNode, int signalCount, RouteRes
         fprintf(stderr, "Warning: 指定された信号エッジが見つかりませんでした\n");
         return 0;
     }
+
+    int maxDepth = opt->enumDepth;
+    if (maxDepth > MAX_COMBINATION_SIZE) maxDepth = MAX_COMBINATION_SIZE;
+    if (maxDepth > targetSignalCount) maxDepth = targetSignalCount;
+
+    CombinationBounds  bounds;
+    CombinationBounds *boundsPtr = NULL;
+    double             best      = INF;  // 暫定の最短（サイクルベースの総時間）
+    CombinationJob   **owners    = NULL; // 枝刈りする場合の登録番号ごとの組み合わせ
+    int                ownerCapacity = 0;
+    int                duplicateCount = 0;
+    if (opt->prune) {
+        buildCombinationBounds(startNode, endNode, targetSignalIndices, targetSignalCount, &bounds);
+        boundsPtr = &bounds;
+    }
+
+    // 深さ（同時に通る信号の数）ごとに列挙・評価する。枝刈りする場合は浅い組み合わせの結果を暫定解にする
+    CombinationJob *jobsByDepth[MAX_COMBINATION_SIZE + 1] = { NULL };
+    int             jobCountByDepth[MAX_COMBINATION_SIZE + 1] = { 0 };
+    int             current[MAX_COMBINATION_SIZE];
+    int             currentPos[MAX_COMBINATION_SIZE];
+    for (int size = 1, combos = 1; size <= maxDepth; size++) {
+        combos = combos * (targetSignalCount - size + 1) / size;  // C(targetSignalCount, size)
+        if (!opt->prune && count >= maxRoutes) break;
+
+        fprintf(stderr, "%d個の信号を通る経路を探索中...\n", size);
+        CombinationJob *jobs = (CombinationJob *)malloc(sizeof(CombinationJob) * (size_t)combos);
+        if (!jobs) {
+            fprintf(stderr, "Error: メモリを確保できません\n");
+            exit(1);
+        }
+        int jobCount    = 0;
+        int prunedCount = 0;
+        generateCombinations(targetSignalIndices, targetSignalCount, current, currentPos, 0, size, 0,
+                             boundsPtr, 0.0, best, jobs, &jobCount, &prunedCount);
+        if (opt->prune && best < INF) {
+            fprintf(stderr, "  下界による枝刈り: %d通りを評価 (%d箇所で打ち切り、暫定最短=%.2f秒)\n",
+                    jobCount, prunedCount, best);
+        }
+
+        if (opt->threadCount > 1 && jobCount > 1) {
+            fprintf(stderr, "信号の組み合わせ%d通りを%dスレッドで評価します\n", jobCount, opt->threadCount);
+        }
+        evaluateCombinations(startNode, endNode, targetSignalIndices, targetSignalCount, jobs, jobCount, opt->threadCount);
+        duplicateCount += dropDuplicateCombinations(jobs, jobCount, seen, opt->prune ? &owners : NULL, &ownerCapacity);
+
+        if (opt->prune) {
+            // 経路の出力は最短が確定してから行う
+            updateCombinationIncumbent(jobs, jobCount, &best);
+            jobsByDepth[size]     = jobs;
+            jobCountByDepth[size] = jobCount;
+            continue;
+        }
+
+        int countBefore = count;
+        int calculatedBefore = calculatedCount;
+        collectCombinationRoutes(jobs, jobCount, outRoutes, &count, maxRoutes, &calculatedCount, INF, size == 1);
+        if (size == 1) {
+            fprintf(stderr, "1個の信号を通る経路: %d本生成 (試行: %d回、全試行で移動時間+信号待ち時間を計算)\n",
+                    count, calculatedCount);
+        } else {
+            fprintf(stderr, "%d個の信号を通る経路: %d本生成 (試行: %d回)\n",
+                    size, count - countBefore, calculatedCount - calculatedBefore);
+        }
+        free(jobs);
+    }
+
+    if (opt->prune) {
+        for (int size = 1; size <= maxDepth; size++) {
+            if (!jobsByDepth[size]) continue;
+            int countBefore = count;
+            int calculatedBefore = calculatedCount;
+            collectCombinationRoutes(jobsByDepth[size], jobCountByDepth[size], outRoutes, &count, maxRoutes,
+                                     &calculatedCount, best, size == 1);
+            fprintf(stderr, "%d個の信号を通る経路: %d本生成 (試行: %d回、最短=%.2f秒を超える下界の経路は除外)\n",
+                    size, count - countBefore, calculatedCount - calculatedBefore, best);
+            free(jobsByDepth[size]);
+        }
+        freeCombinationBounds(&bounds);
+        free(owners);
+    }
     
-    // 1個、2個、3個の組み合わせを全て生成
-    int current[3];
-    
-    // 1個の組み合わせ
-    fprintf(stderr, "1個の信号を通る経路を探索中...\n");
-    for (int i = 0; i < targetSignalCount && count < maxRoutes; i++) {
-        current[0] = targetSignalIndices[i];
-        RouteResult r;
-        calculatedCount++;  // 試行回数をカウント（経路探索を試みた回数）
-        // findRouteThroughSignals内でcalcRouteMetricsWithWaitTime(..., true)が呼ばれるため、
-        // 移動時間+信号待ち時間が計算される
-        if (findRouteThroughSignals(startNode, endNode, current, 1, &r)) {
-            r.routeType = 2;  // 赤
-            outRoutes[count++] = r;
-            // 各経路について、移動時間+信号待ち時間が計算されていることを確認
-            fprintf(stderr, "  経路[%d]: totalTimeSeconds=%.2f秒 (移動時間+信号待ち時間が計算済み)\n", 
-                    count - 1, r.totalTimeSeconds);
-        }
-    }
-    fprintf(stderr, "1個の信号を通る経路: %d本生成 (試行: %d回、全試行で移動時間+信号待ち時間を計算)\n", count, calculatedCount);
-    
-    // 2個の組み合わせ
-    fprintf(stderr, "2個の信号を通る経路を探索中...\n");
-    int countBefore2 = count;
-    int calculatedBefore2 = calculatedCount;
-    generateCombinations(startNode, endNode, targetSignalIndices, targetSignalCount,
-                        current, 0, 2, 0, outRoutes, &count, maxRoutes, &calculatedCount);
-    fprintf(stderr, "2個の信号を通る経路: %d本生成 (試行: %d回)\n", 
-            count - countBefore2, calculatedCount - calculatedBefore2);
-    
-    // 3個の組み合わせ
-    fprintf(stderr, "3個の信号を通る経路を探索中...\n");
-    int countBefore3 = count;
-    int calculatedBefore3 = calculatedCount;
-    generateCombinations(startNode, endNode, targetSignalIndices, targetSignalCount,
-                        current, 0, 3, 0, outRoutes, &count, maxRoutes, &calculatedCount);
-    fprintf(stderr, "3個の信号を通る経路: %d本生成 (試行: %d回)\n", 
-            count - countBefore3, calculatedCount - calculatedBefore3);
-    
-    fprintf(stderr, "全網羅経路計算完了: 合計%d本生成 (総試行回数: %d回)\n", count, calculatedCount);
+    fprintf(stderr, "全網羅経路計算完了: 合計%d本生成 (総試行回数: %d回、同じ経路の重複 %d本を除外)\n",
+            count, calculatedCount, duplicateCount);
     fprintf(stderr, "注意: 全%d本の経路について、findRouteThroughSignals内で移動時間+信号待ち時間が計算されています\n", count);
     fprintf(stderr, "最短経路を選ぶ際、全%d本のtotalTimeSecondsを比較します\n", count);
     
     return count;
 }
 
+/* ---------- 全網羅の上位K本（--top） ---------- */
+
+// 組み合わせを辞書順に少しずつ取り出すためのカーソル
+// generateCombinations の再帰と同じ順序・同じ枝刈りを、途中で止めて再開できる形にしたもの
+typedef struct {
+    int    size;                              // 組み合わせの信号数
+    int    depth;                             // 選び終えた信号の数（-1 なら列挙し終えた）
+    int    pos[MAX_COMBINATION_SIZE + 1];     // pos[k]: 深さ k で選んでいる（次に試す）信号の番号
+    double bound[MAX_COMBINATION_SIZE + 1];   // bound[k]: 先頭 k 個の組み合わせの下界
+} CombinationCursor;
+
+void combinationCursorInit(CombinationCursor *c, int size) {
+    c->size     = size;
+    c->depth    = 0;
+    c->pos[0]   = 0;
+    c->bound[0] = 0.0;
+}
+
+// 次の組み合わせを最大 maxJobs 個 jobs に取り出す（bounds があれば下界が best を超えるものは除く）
+int nextCombinations(CombinationCursor *c, const int *signalIndices, int signalCount,
+                     const CombinationBounds *bounds, double best,
+                     CombinationJob *jobs, int maxJobs, int *prunedCount) {
+    int jobCount = 0;
+    while (c->depth >= 0 && jobCount < maxJobs) {
+        int d = c->depth;
+        if (d == c->size) {
+            CombinationJob *job = &jobs[jobCount++];
+            for (int k = 0; k < c->size; k++) job->signals[k] = signalIndices[c->pos[k]];
+            job->size       = c->size;
+            job->lowerBound = c->bound[d];
+            job->found      = false;
+            if (--c->depth >= 0) c->pos[c->depth]++;
+            continue;
+        }
+
+        int i = c->pos[d];
+        if (i >= signalCount) {
+            if (--c->depth >= 0) c->pos[c->depth]++;
+            continue;
+        }
+
+        double next = c->bound[d];
+        if (bounds) {
+            if (bounds->single[i] > next) next = bounds->single[i];
+            for (int k = 0; k < d; k++) {
+                double b = bounds->pair[c->pos[k] * bounds->count + i];
+                if (b > next) next = b;
+            }
+            if (next > best) {
+                (*prunedCount)++;
+                c->pos[d]++;
+                continue;
+            }
+        }
+        c->bound[d + 1] = next;
+        c->pos[d + 1]   = i + 1;
+        c->depth        = d + 1;
+    }
+    return jobCount;
+}
+
+// サイクルベースの総時間が短い順に上位 K 本を保持するヒープ（根が保持している中で最も遅い経路）
+// 経路のエッジ列はヒープの要素ごとに固定の領域に複製するため、組み合わせの評価結果はすぐ捨てられる
+typedef struct {
+    RouteResult route;
+    long        order;  // 列挙順（同じ時間なら先に見つかった方を上位にする）
+} TopRouteEntry;
+
+typedef struct {
+    TopRouteEntry *entries;
+    int           *edgeStore;  // capacity * MAX_PATH_LENGTH
+    int            count;
+    int            capacity;
+} TopRoutes;
+
+void topRoutesInit(TopRoutes *top, int capacity) {
+    top->entries   = (TopRouteEntry *)malloc(sizeof(TopRouteEntry) * (size_t)capacity);
+    top->edgeStore = (int *)malloc(sizeof(int) * (size_t)capacity * MAX_PATH_LENGTH);
+    if (!top->entries || !top->edgeStore) {
+        fprintf(stderr, "Error: メモリを確保できません\n");
+        exit(1);
+    }
+    top->count    = 0;
+    top->capacity = capacity;
+}
+
+void topRoutesFree(TopRoutes *top) {
+    free(top->entries);
+    free(top->edgeStore);
+    memset(top, 0, sizeof(*top));
+}
+
+bool topRouteWorse(const TopRouteEntry *a, const TopRouteEntry *b) {
+    if (a->route.totalTimeSeconds != b->route.totalTimeSeconds) {
+        return a->route.totalTimeSeconds > b->route.totalTimeSeconds;
+    }
+    return a->order > b->order;
+}
+
+void topRoutesSiftDown(TopRoutes *top, int i) {
+    TopRouteEntry *e = top->entries;
+    for (;;) {
+        int l = 2 * i + 1, r = l + 1, worst = i;
+        if (l < top->count && topRouteWorse(&e[l], &e[worst])) worst = l;
+        if (r < top->count && topRouteWorse(&e[r], &e[worst])) worst = r;
+        if (worst == i) return;
+        TopRouteEntry tmp = e[i];
+        e[i] = e[worst];
+        e[worst] = tmp;
+        i = worst;
+    }
+}
+
+// 保持している経路のうち最も遅いものの総時間（K 本に満たなければ INF）
+double topRoutesThreshold(const TopRoutes *top) {
+    return top->count < top->capacity ? INF : top->entries[0].route.totalTimeSeconds;
+}
+
+// 評価済みの経路を候補にする（上位 K 本に入らなければ捨てる）
+void topRoutesOffer(TopRoutes *top, const RouteResult *route, long order) {
+    TopRouteEntry cand;
+    cand.route = *route;
+    cand.order = order;
+
+    int *slot;
+    if (top->count < top->capacity) {
+        // 空いている領域を使い、葉から根へ上げる
+        slot = top->edgeStore + (size_t)top->count * MAX_PATH_LENGTH;
+        int i = top->count++;
+        while (i > 0) {
+            int parent = (i - 1) / 2;
+            if (!topRouteWorse(&cand, &top->entries[parent])) break;
+            top->entries[i] = top->entries[parent];
+            i = parent;
+        }
+        memcpy(slot, route->edges, sizeof(int) * (size_t)route->edgeCount);
+        cand.route.edges = slot;
+        top->entries[i] = cand;
+        return;
+    }
+    if (!topRouteWorse(&top->entries[0], &cand)) return;
+
+    // 最も遅い経路（根）の領域を使い回して入れ替える
+    slot = top->entries[0].route.edges;
+    memcpy(slot, route->edges, sizeof(int) * (size_t)route->edgeCount);
+    cand.route.edges = slot;
+    top->entries[0] = cand;
+    topRoutesSiftDown(top, 0);
+}
+
+int compareTopRouteEntries(const void *a, const void *b) {
+    const TopRouteEntry *x = (const TopRouteEntry *)a;
+    const TopRouteEntry *y = (const TopRouteEntry *)b;
+    if (topRouteWorse(x, y)) return 1;
+    if (topRouteWorse(y, x)) return -1;
+    return 0;
+}
+
+// 全網羅経路のうちサイクルベースの総時間が短い上位 opt->topK 本を、短い順に outRoutes に入れる
+// 組み合わせは STREAM_CHUNK_JOBS 個ずつ列挙・評価し、見つかった経路はその場で1回だけ評価して
+// 上位 K 本に入らなければ捨てる。組み合わせの数が増えてもメモリは K と1回分の組み合わせの分しか使わない。
+// seen に登録済みの経路（基準時刻1/2）と、既に見つけた経路と同じエッジ列の経路は候補にしない
+// （見つけた経路はハッシュだけを覚えておく。後から見つかった同じ経路は列挙順で必ず下位になるため、評価せずに捨ててよい）。
+// opt->prune が true なら、下界が K 本目の総時間を超える組み合わせを評価しない（上位 K 本は変わらない）
+int streamTopEnumRoutes(int startNode, int endNode, RouteResult *outRoutes, const QueryOptions *opt,
+                        const RouteSet *seen) {
+    int targetSignalIndices[28];
+    int targetSignalCount = 0;
+    getTargetSignalEdges(targetSignalIndices, &targetSignalCount);
+
+    fprintf(stderr, "指定された信号エッジ: %d個見つかりました\n", targetSignalCount);
+    if (targetSignalCount == 0) {
+        fprintf(stderr, "Warning: 指定された信号エッジが見つかりませんでした\n");
+        return 0;
+    }
+
+    int maxDepth = opt->enumDepth;
+    if (maxDepth > MAX_COMBINATION_SIZE) maxDepth = MAX_COMBINATION_SIZE;
+    if (maxDepth > targetSignalCount) maxDepth = targetSignalCount;
+
+    CombinationBounds  bounds;
+    CombinationBounds *boundsPtr = NULL;
+    if (opt->prune) {
+        buildCombinationBounds(startNode, endNode, targetSignalIndices, targetSignalCount, &bounds);
+        boundsPtr = &bounds;
+    }
+
+    CombinationJob *jobs = (CombinationJob *)malloc(sizeof(CombinationJob) * STREAM_CHUNK_JOBS);
+    if (!jobs) {
+        fprintf(stderr, "Error: メモリを確保できません\n");
+        exit(1);
+    }
+    TopRoutes top;
+    topRoutesInit(&top, opt->topK);
+    RouteFingerprints found = { NULL, 0, 0 };
+
+    long order = 0;
+    int  evaluated = 0, scored = 0, duplicates = 0, prunedCount = 0;
+    for (int size = 1; size <= maxDepth; size++) {
+        CombinationCursor cursor;
+        combinationCursorInit(&cursor, size);
+        int evaluatedBefore = evaluated, scoredBefore = scored;
+        for (;;) {
+            int jobCount = nextCombinations(&cursor, targetSignalIndices, targetSignalCount, boundsPtr,
+                                            topRoutesThreshold(&top), jobs, STREAM_CHUNK_JOBS, &prunedCount);
+            if (jobCount == 0) break;
+
+            // この回の経路のエッジ列は評価が終われば要らないため、アリーナを元の位置まで戻す
+            RouteArena    *arena = &currentQuery()->arena;
+            RouteArenaMark mark  = routeArenaMark(arena);
+            evaluateCombinations(startNode, endNode, targetSignalIndices, targetSignalCount, jobs, jobCount,
+                                 opt->threadCount);
+            evaluated += jobCount;
+
+            for (int i = 0; i < jobCount; i++, order++) {
+                if (!jobs[i].found) continue;
+                RouteResult *r = &jobs[i].route;
+                uint64_t hash = routeSetHash(r->edges, r->edgeCount);
+                if (routeSetContains(seen, r->edges, r->edgeCount) || !routeFingerprintsInsert(&found, hash)) {
+                    duplicates++;
+                    continue;
+                }
+
+                // サイクルベースの厳密な待ち時間計算で評価する（この経路を評価するのはここだけ）
+                double waitTimeSec;
+                calcRouteMetricsWithCycleBasedWaitTime(r->edges, r->edgeCount,
+                                                       &r->totalDistance, &r->totalTimeSeconds, &waitTimeSec, false);
+                scored++;
+                topRoutesOffer(&top, r, order);
+            }
+            routeArenaRewind(arena, mark);
+        }
+        fprintf(stderr, "%d個の信号を通る経路: 評価%d通り, 候補%d本 (上位%d本の最遅=%.2f秒)\n",
+                size, evaluated - evaluatedBefore, scored - scoredBefore, opt->topK, topRoutesThreshold(&top));
+    }
+
+    qsort(top.entries, (size_t)top.count, sizeof(TopRouteEntry), compareTopRouteEntries);
+    for (int i = 0; i < top.count; i++) {
+        storeRoute(&outRoutes[i], &top.entries[i].route);
+        outRoutes[i].routeType = 2;
+    }
+    int count = top.count;
+    fprintf(stderr, "全網羅経路（上位%d本）: %d本を保持 (評価%d通り, サイクルベース評価%d本, 重複%d本を除外, 枝刈り%d箇所)\n",
+            opt->topK, count, evaluated, scored, duplicates, prunedCount);
+
+    topRoutesFree(&top);
+    routeFingerprintsFree(&found);
+    free(jobs);
+    if (boundsPtr) freeCombinationBounds(&bounds);
+    return count;
+}
+
 /* ---------- 経路の結合 ---------- */
 
+// 経路の組み立てを始める（エッジ列は scratch に追加していき、storeRoute でクエリのアリーナに移す）
+void beginRoute(RouteResult *r, int *scratch, int signalEdgeIdx, int hasSignal) {
+    r->signalEdgeIdx = signalEdgeIdx;
+    r->edges         = scratch;
+    r->edgeCount     = 0;
+    r->hasSignal     = hasSignal;
+}
+
+// エッジ列を現在のクエリのアリーナに複製する（並列評価のワーカーからも呼ばれる）
+int *copyRouteEdges(const int *edges, int edgeCount) {
+    QueryContext *q = currentQuery();
+    pthread_mutex_lock(&q->arenaLock);
+    int *stored = routeArenaAlloc(&q->arena, (size_t)edgeCount);
+    pthread_mutex_unlock(&q->arenaLock);
+    memcpy(stored, edges, sizeof(int) * (size_t)edgeCount);
+    return stored;
+}
+
+// 組み立てた経路を dst に保存する（エッジ列はクエリのアリーナに移す）
+void storeRoute(RouteResult *dst, const RouteResult *src) {
+    *dst = *src;
+    dst->edges = copyRouteEdges(src->edges, src->edgeCount);
+}
+
 // res に DijkstraResult の path を後ろから順に追加
 bool appendSegment(RouteResult *res, const DijkstraResult *seg) {
     for (int i = 0; i < seg->pathLength; i++) {
@@ -1557,106 +3636,446 @@ bool appendSegment(RouteResult *res, const DijkstraResult *seg) {
 
 /* ---------- JSON 出力 ---------- */
 
-void printJSON(const RouteResult *routes, int routeCount) {
-    printf("[\n");
-    for (int i = 0; i < routeCount; i++) {
-        const RouteResult *r = &routes[i];
+// バッファに extra バイト追加できるようにする（確保できなければ終了）
+void outReserve(OutputBuffer *b, size_t extra) {
+    if (b->length + extra <= b->capacity) return;
+    size_t newCap = b->capacity > 0 ? b->capacity : 65536;
+    while (newCap < b->length + extra) newCap *= 2;
+    char *p = (char *)realloc(b->data, newCap);
+    if (!p) {
+        fprintf(stderr, "Error: メモリを確保できません\n");
+        exit(1);
+    }
+    b->data = p;
+    b->capacity = newCap;
+}
 
-        printf("  {\n");
-        // userPref: edge を "from-to.geojson" の複数行で
-        printf("    \"userPref\": \"");
-        for (int j = 0; j < r->edgeCount; j++) {
-            EdgeData *e = &edgeDataArray[r->edges[j]];
-            int nf, nt;
-            normalizeEdgeKey(e->from, e->to, &nf, &nt);
-            printf("%d-%d.geojson", nf, nt);
-            if (j < r->edgeCount - 1) printf("\\n");
-        }
-        printf("\",\n");
+void outAppend(OutputBuffer *b, const char *s, size_t n) {
+    outReserve(b, n);
+    memcpy(b->data + b->length, s, n);
+    b->length += n;
+}
 
-        printf("    \"signalEdgeIdx\": %d,\n", r->signalEdgeIdx);
-        printf("    \"totalDistance\": %.2f,\n", r->totalDistance);
-        printf("    \"totalTime\": %.2f,\n", r->totalTimeSeconds / 60.0);
-        
-        // 待ち時間を計算
-        double totalWaitTime = 0.0;
-        if (r->routeType == 2 || r->routeType == 3) {
-            // 最短全網羅経路（赤）または全網羅経路（黄）の場合、サイクルベース計算で得られた待ち時間を使用
-            double dist, timeSec, waitTimeSec;
-            calcRouteMetricsWithCycleBasedWaitTime(r->edges, r->edgeCount, &dist, &timeSec, &waitTimeSec, false);
-            totalWaitTime = waitTimeSec / 60.0;  // 秒を分に変換
-        } else if (r->routeType == 1) {
-            // 基準時刻1（緑）の場合：信号の待ち時間は含まれないが、60-209横断歩道の待ち時間は含まれる
-            double dist, timeSec, waitTimeSec;
-            calcRouteMetricsWithCycleBasedWaitTime(r->edges, r->edgeCount, &dist, &timeSec, &waitTimeSec, true);
-            totalWaitTime = waitTimeSec / 60.0;  // 秒を分に変換
-        } else if (r->routeType == 0) {
-            // 基準時刻2（青）の場合：信号の待ち時間は含まれないが、60-209横断歩道の待ち時間は含まれる
-            double dist, timeSec, waitTimeSec;
-            calcRouteMetricsWithCycleBasedWaitTime(r->edges, r->edgeCount, &dist, &timeSec, &waitTimeSec, false);
-            // waitTimeSecには信号の待ち時間と60-209横断歩道の待ち時間の両方が含まれている
-            // 信号の待ち時間のみを除外
-            int crosswalk60_209Idx = -1;
-            int nf, nt;
-            normalizeEdgeKey(60, 209, &nf, &nt);
-            crosswalk60_209Idx = findEdgeIndex(nf, nt);
-            double crosswalkWaitTime = 0.0;
-            if (crosswalk60_209Idx >= 0 && crosswalk60_209Idx < edgeDataCount) {
-                for (int j = 0; j < r->edgeCount; j++) {
-                    if (r->edges[j] == crosswalk60_209Idx) {
-                        EdgeData *e = &edgeDataArray[crosswalk60_209Idx];
-                        if (e->signalExpected > 0.0) {
-                            crosswalkWaitTime = e->signalExpected * 60.0;  // 秒
-                            break;
-                        }
+void outString(OutputBuffer *b, const char *s) {
+    outAppend(b, s, strlen(s));
+}
+
+void outInt(OutputBuffer *b, int v) {
+    char tmp[16];
+    int  n = 0;
+    unsigned int u = v < 0 ? 0u - (unsigned int)v : (unsigned int)v;
+    do {
+        tmp[n++] = (char)('0' + u % 10);
+        u /= 10;
+    } while (u > 0);
+    outReserve(b, (size_t)n + 1);
+    if (v < 0) b->data[b->length++] = '-';
+    while (n > 0) b->data[b->length++] = tmp[--n];
+}
+
+// printf と同じ書式で追加する（%.2f など、printf と同じ表記にしたい数値に使う）
+void outPrintf(OutputBuffer *b, const char *fmt, ...) {
+    va_list ap;
+    outReserve(b, 64);
+    va_start(ap, fmt);
+    int n = vsnprintf(b->data + b->length, b->capacity - b->length, fmt, ap);
+    va_end(ap);
+    if (n < 0) return;
+    if ((size_t)n >= b->capacity - b->length) {
+        outReserve(b, (size_t)n + 1);
+        va_start(ap, fmt);
+        vsnprintf(b->data + b->length, b->capacity - b->length, fmt, ap);
+        va_end(ap);
+    }
+    b->length += (size_t)n;
+}
+
+// ためた内容を1回で書き出し、バッファを空にする（領域は次のクエリで使い回す）
+void outFlush(OutputBuffer *b, FILE *fp) {
+    if (b->length > 0) fwrite(b->data, 1, b->length, fp);
+    b->length = 0;
+}
+
+// エッジごとの "from-to.geojson" を読み込み後に1回だけ作る（printJSON は memcpy するだけになる）
+void buildEdgeNames(void) {
+    size_t poolSize = 0;
+    char   name[64];
+    for (int i = 0; i < edgeDataCount; i++) {
+        int nf, nt;
+        normalizeEdgeKey(edgeDataArray[i].from, edgeDataArray[i].to, &nf, &nt);
+        poolSize += (size_t)snprintf(name, sizeof(name), "%d-%d.geojson", nf, nt);
+    }
+
+    free(edgeNamePool);
+    free(edgeNameOffset);
+    edgeNamePool   = (char *)malloc(poolSize + 1);
+    edgeNameOffset = (int *)malloc(sizeof(int) * (size_t)(edgeDataCount + 1));
+    if (!edgeNamePool || !edgeNameOffset) {
+        fprintf(stderr, "Error: メモリを確保できません\n");
+        exit(1);
+    }
+
+    int offset = 0;
+    for (int i = 0; i < edgeDataCount; i++) {
+        int nf, nt;
+        normalizeEdgeKey(edgeDataArray[i].from, edgeDataArray[i].to, &nf, &nt);
+        edgeNameOffset[i] = offset;
+        offset += snprintf(edgeNamePool + offset, poolSize + 1 - (size_t)offset, "%d-%d.geojson", nf, nt);
+    }
+    edgeNameOffset[edgeDataCount] = offset;
+}
+
+// クエリのコンパクト出力でのエッジ表の番号（最初に使うときに全て未使用 -1 で作る）
+int *queryCompactLocalId(QueryContext *q) {
+    if (q->compactLocalId) return q->compactLocalId;
+    q->compactLocalId = (int *)malloc(sizeof(int) * (size_t)(edgeDataCount + 1));
+    if (!q->compactLocalId) {
+        fprintf(stderr, "Error: メモリを確保できません\n");
+        exit(1);
+    }
+    for (int i = 0; i <= edgeDataCount; i++) q->compactLocalId[i] = -1;
+    return q->compactLocalId;
+}
+
+// 経路の待ち時間（分）を routeType ごとの定義で求める
+double routeWaitMinutes(const RouteResult *r) {
+    double totalWaitTime = 0.0;
+    if (r->routeType == 2 || r->routeType == 3) {
+        // 最短全網羅経路（赤）または全網羅経路（黄）の場合、サイクルベース計算で得られた待ち時間を使用
+        double dist, timeSec, waitTimeSec;
+        calcRouteMetricsWithCycleBasedWaitTime(r->edges, r->edgeCount, &dist, &timeSec, &waitTimeSec, false);
+        totalWaitTime = waitTimeSec / 60.0;  // 秒を分に変換
+    } else if (r->routeType == 1) {
+        // 基準時刻1（緑）の場合：信号の待ち時間は含まれないが、60-209横断歩道の待ち時間は含まれる
+        double dist, timeSec, waitTimeSec;
+        calcRouteMetricsWithCycleBasedWaitTime(r->edges, r->edgeCount, &dist, &timeSec, &waitTimeSec, true);
+        totalWaitTime = waitTimeSec / 60.0;  // 秒を分に変換
+    } else if (r->routeType == 0) {
+        // 基準時刻2（青）の場合：信号の待ち時間は含まれないが、60-209横断歩道の待ち時間は含まれる
+        double dist, timeSec, waitTimeSec;
+        calcRouteMetricsWithCycleBasedWaitTime(r->edges, r->edgeCount, &dist, &timeSec, &waitTimeSec, false);
+        // waitTimeSecには信号の待ち時間と60-209横断歩道の待ち時間の両方が含まれている
+        // 信号の待ち時間のみを除外
+        int crosswalk60_209Idx = -1;
+        int nf, nt;
+        normalizeEdgeKey(60, 209, &nf, &nt);
+        crosswalk60_209Idx = findEdgeIndex(nf, nt);
+        double crosswalkWaitTime = 0.0;
+        if (crosswalk60_209Idx >= 0 && crosswalk60_209Idx < edgeDataCount) {
+            for (int j = 0; j < r->edgeCount; j++) {
+                if (r->edges[j] == crosswalk60_209Idx) {
+                    EdgeData *e = &edgeDataArray[crosswalk60_209Idx];
+                    if (e->signalExpected > 0.0) {
+                        crosswalkWaitTime = e->signalExpected * 60.0;  // 秒
+                        break;
                     }
                 }
             }
-            totalWaitTime = crosswalkWaitTime / 60.0;  // 60-209横断歩道の待ち時間のみ（秒を分に変換）
         }
-        printf("    \"totalWaitTime\": %.2f,\n", totalWaitTime);
-        
-        printf("    \"routeType\": %d,\n", r->routeType);
-        printf("    \"hasSignal\": %d\n", r->hasSignal);
-        printf("  }");
-        if (i < routeCount - 1) printf(",");
-        printf("\n");
+        totalWaitTime = crosswalkWaitTime / 60.0;  // 60-209横断歩道の待ち時間のみ（秒を分に変換）
     }
-    printf("]\n");
+    return totalWaitTime;
 }
 
-/* ---------- メイン ---------- */
+// 従来形式: userPref に "from-to.geojson" を "\n" 区切りで並べる
+void writeRoutesJSON(OutputBuffer *b, const RouteResult *routes, int routeCount) {
+    outString(b, "[\n");
+    for (int i = 0; i < routeCount; i++) {
+        const RouteResult *r = &routes[i];
 
-int main(int argc, char *argv[]) {
-    if (argc != 4) {
-        fprintf(stderr, "Usage: %s <start_node> <end_node> <walking_speed>\n", argv[0]);
-        return 1;
+        outString(b, "  {\n");
+        outString(b, "    \"userPref\": \"");
+        for (int j = 0; j < r->edgeCount; j++) {
+            int e = r->edges[j];
+            outAppend(b, edgeNamePool + edgeNameOffset[e], (size_t)(edgeNameOffset[e + 1] - edgeNameOffset[e]));
+            if (j < r->edgeCount - 1) outAppend(b, "\\n", 2);
+        }
+        outString(b, "\",\n");
+
+        outString(b, "    \"signalEdgeIdx\": ");
+        outInt(b, r->signalEdgeIdx);
+        outPrintf(b, ",\n    \"totalDistance\": %.2f,\n", r->totalDistance);
+        outPrintf(b, "    \"totalTime\": %.2f,\n", r->totalTimeSeconds / 60.0);
+        outPrintf(b, "    \"totalWaitTime\": %.2f,\n", routeWaitMinutes(r));
+        outString(b, "    \"routeType\": ");
+        outInt(b, r->routeType);
+        outString(b, ",\n    \"hasSignal\": ");
+        outInt(b, r->hasSignal);
+        outString(b, i < routeCount - 1 ? "\n  },\n" : "\n  }\n");
     }
+    outString(b, "]\n");
+}
 
-    int    startNode = atoi(argv[1]);
-    int    endNode   = atoi(argv[2]);
-    double ws        = atof(argv[3]);
-    if (ws > 0.0) walkingSpeed = ws;
+// コンパクト形式（--compact）: 空白を入れず1行で出力する
+//   {"edges":[[from,to],...],"routes":[{"edges":[0,1,...],"signalEdgeIdx":..,...},...]}
+// 先頭の edges は出力中の経路が使うエッジ（正規化した from < to）の表で、各経路の edges はその番号
+void writeRoutesCompactJSON(OutputBuffer *b, const RouteResult *routes, int routeCount) {
+    int *compactLocalId = queryCompactLocalId(currentQuery());
+    int *table = NULL;
+    int  tableCount = 0, tableCap = 0;
+    for (int i = 0; i < routeCount; i++) {
+        for (int j = 0; j < routes[i].edgeCount; j++) {
+            int e = routes[i].edges[j];
+            if (compactLocalId[e] >= 0) continue;
+            table = (int *)growArray(table, &tableCap, tableCount + 1, sizeof(int));
+            compactLocalId[e] = tableCount;
+            table[tableCount++] = e;
+        }
+    }
 
-    if (startNode < 1 || startNode >= MAX_NODES ||
-        endNode   < 1 || endNode   >= MAX_NODES) {
-        fprintf(stderr, "Error: invalid node number\n");
-        return 1;
+    outString(b, "{\"edges\":[");
+    for (int k = 0; k < tableCount; k++) {
+        int nf, nt;
+        normalizeEdgeKey(edgeDataArray[table[k]].from, edgeDataArray[table[k]].to, &nf, &nt);
+        if (k > 0) outAppend(b, ",", 1);
+        outAppend(b, "[", 1);
+        outInt(b, nf);
+        outAppend(b, ",", 1);
+        outInt(b, nt);
+        outAppend(b, "]", 1);
+    }
+    outString(b, "],\"routes\":[");
+    for (int i = 0; i < routeCount; i++) {
+        const RouteResult *r = &routes[i];
+        if (i > 0) outAppend(b, ",", 1);
+        outString(b, "{\"edges\":[");
+        for (int j = 0; j < r->edgeCount; j++) {
+            if (j > 0) outAppend(b, ",", 1);
+            outInt(b, compactLocalId[r->edges[j]]);
+        }
+        outString(b, "],\"signalEdgeIdx\":");
+        outInt(b, r->signalEdgeIdx);
+        outPrintf(b, ",\"totalDistance\":%.2f,\"totalTime\":%.2f,\"totalWaitTime\":%.2f,\"routeType\":",
+                  r->totalDistance, r->totalTimeSeconds / 60.0, routeWaitMinutes(r));
+        outInt(b, r->routeType);
+        outString(b, ",\"hasSignal\":");
+        outInt(b, r->hasSignal);
+        outAppend(b, "}", 1);
     }
+    outString(b, "]}\n");
+
+    // 次の出力のために番号を未使用に戻す
+    for (int k = 0; k < tableCount; k++) compactLocalId[table[k]] = -1;
+    free(table);
+}
+
+// 経路アトラスの作成用（--build-atlas）: 経路数に続けて、経路ごとに RouteAtlasRoute と
+// edgeDataArray のインデックスの列を書く（作成側で (from,to) に直してアトラスのエッジ表に入れる）
+void writeRoutesAtlasRecord(OutputBuffer *b, const RouteResult *routes, int routeCount) {
+    int32_t count = routeCount;
+    outAppend(b, (const char *)&count, sizeof(count));
+    for (int i = 0; i < routeCount; i++) {
+        const RouteResult *r = &routes[i];
+        RouteAtlasRoute ar;
+        memset(&ar, 0, sizeof(ar));
+        ar.totalDistance = r->totalDistance;
+        ar.totalTime     = r->totalTimeSeconds / 60.0;
+        ar.totalWaitTime = routeWaitMinutes(r);
+        ar.edgeCount     = (uint32_t)r->edgeCount;
+        ar.routeType     = r->routeType;
+        ar.hasSignal     = r->hasSignal;
+        outAppend(b, (const char *)&ar, sizeof(ar));
+        outAppend(b, (const char *)r->edges, sizeof(int) * (size_t)r->edgeCount);
+    }
+}
+
+// 経路をJSONで標準出力に書き出す（形式はクエリの compact による）
+void printJSON(const RouteResult *routes, int routeCount) {
+    QueryContext *q = currentQuery();
+    if (outputAtlas) {
+        writeRoutesAtlasRecord(&q->out, routes, routeCount);
+    } else if (q->compact) {
+        writeRoutesCompactJSON(&q->out, routes, routeCount);
+    } else {
+        writeRoutesJSON(&q->out, routes, routeCount);
+    }
+    if (!holdJsonOutput) outFlush(&q->out, stdout);
+}
+
+/* ---------- メイン ---------- */
+
+// 全データを読み込む（常駐モードでは起動時に1回だけ呼ぶ）
+// スナップショット（oomiya_graph.snap）があり元ファイルと一致するセクションはそこから読み込み、
+// それ以外は従来どおりテキストを解析する（up44 が result.csv を書き直しても他のセクションはそのまま使う）
+void loadAllData(void) {
+    GraphSnapshot snap;
+    bool hasSnap = snapshotOpen(SNAPSHOT_FILE, &snap,
+                                SNAP_SECTION(SNAP_SRC_RESULT) | SNAP_SECTION(SNAP_SRC_ROUTE) |
+                                SNAP_SECTION(SNAP_SRC_SIGNAL) | SNAP_SECTION(SNAP_SRC_POINT));
 
     initGraph();
-    loadGraphFromResult("result.csv");
-    loadRouteData("oomiya_route_inf_4.csv");
+
+    bool hasResult = true;
+    if (hasSnap && snap.valid[SNAP_SRC_RESULT]) {
+        const SnapResultRow *rows = snapshotResultRows(&snap);
+        for (uint32_t i = 0; i < snap.hdr->resultCount; i++) {
+            addResultEdge(rows[i].from, rows[i].to, rows[i].weight);
+        }
+    } else {
+        hasResult = loadGraphFromResult("result.csv");
+    }
+
+    if (hasSnap && snap.valid[SNAP_SRC_ROUTE]) {
+        const SnapRouteRow *rows = snapshotRouteRows(&snap);
+        for (uint32_t i = 0; i < snap.hdr->routeCount; i++) {
+            addRouteValues(rows[i].values, rows[i].tokenCount);
+        }
+    } else {
+        loadRouteData("oomiya_route_inf_4.csv");
+    }
+    if (!hasResult) {
+        fprintf(stderr, "Note: result.csv が無いため oomiya_route_inf_4.csv の行から隣接を作ります\n");
+        loadGraphFromRouteRows();
+    }
+
     fprintf(stderr, "Loading signal data...\n");
-    loadSignalData("signal_inf.csv");
+    if (hasSnap && snap.valid[SNAP_SRC_SIGNAL]) {
+        const SnapSignalRow *rows = snapshotSignalRows(&snap);
+        signalCount = 0;
+        for (uint32_t i = 0; i < snap.hdr->signalCount; i++) {
+            addSignalRow(rows[i].from, rows[i].to, rows[i].cycle, rows[i].green,
+                         rows[i].phase, rows[i].expected);
+        }
+    } else {
+        loadSignalData("signal_inf.csv");
+    }
     fprintf(stderr, "Loaded %d signals total\n", signalCount);
+
+    buildAdjacency();
+
     fprintf(stderr, "Loading node positions...\n");
-    loadNodePositions();
+    if (hasSnap && snap.valid[SNAP_SRC_POINT]) {
+        const SnapPoint *points = snapshotPoints(&snap);
+        for (int i = 0; i < graph.nodeCount; i++) {
+            if ((uint32_t)i < snap.hdr->pointCapacity) {
+                nodePositions[i].lat = points[i].lat;
+                nodePositions[i].lon = points[i].lon;
+            } else {
+                nodePositions[i].lat = 0.0;
+                nodePositions[i].lon = 0.0;
+            }
+        }
+    } else {
+        loadNodePositions();
+    }
     fprintf(stderr, "Node positions loaded\n");
 
-    // 経路を保存する配列
+    if (hasSnap) snapshotClose(&snap);
+
+    buildEdgeNames();
+
+    // 全点間テーブルがあれば読み込む（使うかどうかはクエリごとに apspSelect で決める）
+    apspOpen(APSP_FILE);
+}
+
+RouteResult *allocRoutes(int count) {
+    RouteResult *routes = (RouteResult *)malloc(sizeof(RouteResult) * (size_t)count);
+    if (!routes) {
+        fprintf(stderr, "Error: メモリを確保できません\n");
+        exit(1);
+    }
+    return routes;
+}
+
+// 全網羅経路（timeDependent なら時間依存探索の最速経路1本）を求める
+// クエリの enumRouteSet に登録済みの経路（基準時刻1/2）と同じもの、互いに同じエッジ列のものは含めない
+// opt->topK が1以上なら上位 K 本だけを総時間の短い順に求める（評価済みのため appendEnumRoutes では再計算しない）
+int calculateEnumRoutes(int startNode, int endNode, RouteResult *outRoutes, int maxRoutes, const QueryOptions *opt) {
+    RouteSet *enumRouteSet = &currentQuery()->enumRouteSet;
+    if (!opt->timeDependent && opt->topK > 0) {
+        return streamTopEnumRoutes(startNode, endNode, outRoutes, opt, enumRouteSet);
+    }
+    if (!opt->timeDependent) {
+        return calculateAllEnumRoutes(startNode, endNode, signalCount, outRoutes, maxRoutes, opt, enumRouteSet);
+    }
+    // 組み合わせを列挙せず、待ち時間込みで最速の1本だけを時間依存探索で求める
+    int index;
+    if (!timeDependentFastestRoute(startNode, endNode, &outRoutes[0])) return 0;
+    return routeSetInsert(enumRouteSet, outRoutes[0].edges, outRoutes[0].edgeCount, &index) ? 1 : 0;
+}
+
+// 全網羅経路を routes に追加する。サイクルベースの厳密な待ち時間を含めた総時間が最短の1本を赤、残りを黄とする
+// 基準時刻1/2と同じ経路・重複した経路は calculateEnumRoutes で除いてあるため、各経路の再計算は1回だけ行う
+// ranked が true なら enumRoutes は評価済みで短い順に並んでいる（--top）ため、再計算せずに先頭を赤にする
+// 黄は yellowLimit 本まで（-1 なら制限なし）
+void appendEnumRoutes(RouteResult *enumRoutes, int enumCount, bool ranked, RouteResult *routes, int *routeCount,
+                      int maxRoutes, int yellowLimit) {
+    fprintf(stderr, "\n=== 全%d本の経路から最短経路を選出（全経路のtotalTimeSecondsを比較） ===\n", enumCount);
+    int bestIdx = ranked && enumCount > 0 ? 0 : -1;
+    double bestTime = INF;
+
+    for (int i = 0; i < enumCount && !ranked; i++) {
+        RouteResult *r = &enumRoutes[i];
+
+        // サイクルベースの厳密な待ち時間計算で再計算
+        double dist, timeSec, waitTimeSec;
+        calcRouteMetricsWithCycleBasedWaitTime(r->edges, r->edgeCount, &dist, &timeSec, &waitTimeSec, false);
+
+        // 最初の5件、最後の5件、最短経路候補が更新された時のみログ出力
+        if (i < 5 || i >= enumCount - 5) {
+            fprintf(stderr, "  経路[%d]: 移動時間=%.2f秒, サイクルベース待ち時間=%.2f秒, 合計=%.2f秒\n",
+                    i, timeSec - waitTimeSec, waitTimeSec, timeSec);
+        } else if (timeSec < bestTime) {
+            fprintf(stderr, "  経路[%d]: 新たな最短候補! 合計=%.2f秒 (サイクルベース計算)\n", i, timeSec);
+        }
+
+        r->totalDistance = dist;
+        r->totalTimeSeconds = timeSec;
+        if (timeSec < bestTime) {
+            bestTime = timeSec;
+            bestIdx = i;
+        }
+    }
+    fprintf(stderr, "全%d本の経路をチェックしました\n", enumCount);
+
+    // 最短の全網羅経路を赤色で追加（1本のみ）
+    if (bestIdx >= 0) {
+        enumRoutes[bestIdx].routeType = 2;  // 赤
+        routes[(*routeCount)++] = enumRoutes[bestIdx];
+        fprintf(stderr, "最短全網羅経路（赤）: edges=%d, distance=%.2f m, time=%.2f sec (%.2f min)\n",
+                enumRoutes[bestIdx].edgeCount, enumRoutes[bestIdx].totalDistance,
+                enumRoutes[bestIdx].totalTimeSeconds, enumRoutes[bestIdx].totalTimeSeconds / 60.0);
+    }
+
+    // その他の全網羅経路を黄色で追加（routeType=3）
+    int yellowCount = 0;
+    for (int i = 0; i < enumCount && *routeCount < maxRoutes; i++) {
+        if (i == bestIdx) continue;  // 最短経路は既に追加済み
+        if (yellowLimit >= 0 && yellowCount >= yellowLimit) break;
+        enumRoutes[i].routeType = 3;  // 黄色（全網羅経路）
+        routes[(*routeCount)++] = enumRoutes[i];
+        yellowCount++;
+    }
+    fprintf(stderr, "全網羅経路（黄色）: %d本追加\n", yellowCount);
+}
+
+// 1クエリ分の経路計算を行い、結果をJSONで標準出力に書き出す
+// 読み込み済みのグラフは変更しないため、常駐モードで繰り返し呼び出せる
+// timeDependent が true なら全網羅の代わりに時間依存探索で最速経路（赤）だけを求める
+int runQuery(const QueryOptions *opt) {
+    int    startNode = opt->startNode;
+    int    endNode   = opt->endNode;
+    double ws        = opt->walkingSpeed;
+    double kGrad     = opt->kGradient;
+
+    if (startNode < 1 || startNode >= graph.nodeCount ||
+        endNode   < 1 || endNode   >= graph.nodeCount) {
+        fprintf(stderr, "Error: invalid node number\n");
+        return 1;
+    }
+
+    // エッジごとの移動時間はクエリの最初に1回だけ計算する
+    prepareTravelTimes(ws > 0.0 ? ws : DEFAULT_WALKING_SPEED, kGrad);
+    apspSelect();
+    RouteSet *enumRouteSet = &currentQuery()->enumRouteSet;
+    routeSetClear(enumRouteSet);
+
+    // 経路を保存する配列（エッジ列はクエリのアリーナにあり、1本あたりは数十バイト）
     // 28個の信号の場合、1個:28, 2個:C(28,2)=378, 3個:C(28,3)=3276 の組み合わせがあるため、十分なサイズを確保
-    RouteResult routes[5000];  // 全網羅経路を含むため余裕を持たせる
+    RouteResult *routes = allocRoutes(MAX_ROUTES);  // 全網羅経路を含むため余裕を持たせる
+    // --top なら全網羅経路は上位 K 本だけを評価済み・短い順で受け取る
+    bool ranked       = opt->topK > 0 && !opt->timeDependent;
+    int  enumCapacity = ranked ? opt->topK : MAX_ROUTES;
     int routeCount = 0;
     
     RouteResult baseTime1Route;  // 基準時刻1（信号を避けた最短経路、方角制約なし）
@@ -1718,116 +4137,23 @@ int main(int argc, char *argv[]) {
         
         // ========== 第三段階：全網羅（指定信号の1,2,3個の組み合わせを通る経路、待ち時間期待値） ==========
         // 基準時刻1が見つからない場合も全網羅経路を計算
-        fprintf(stderr, "\n=== 第三段階：全網羅（指定信号の1,2,3個の組み合わせを通る経路、待ち時間期待値）を探索 ===\n");
-        RouteResult allEnumRoutes[5000];  // 全網羅経路を一時保存（28個の信号に対応）
-        int allEnumRouteCount = calculateAllEnumRoutes(startNode, endNode, signalCount, allEnumRoutes, 5000);
-        fprintf(stderr, "全網羅経路: %d本生成\n", allEnumRouteCount);
-        
-        // 基準時刻2を緑で追加
-        if (hasBaseTime2Route) {
-            baseTime2Route.routeType = 1;  // 緑
-            routes[routeCount++] = baseTime2Route;
-        }
-        
-        // 全網羅経路の中で、実際の信号待ち時間を含めた総時間が最短の経路を見つける（赤色で表示）
-        fprintf(stderr, "\n=== 全%d本の経路から最短経路を選出（全経路のtotalTimeSecondsを比較） ===\n", allEnumRouteCount);
-        int bestEnumRouteIdx = -1;
-        double bestEnumRouteTime = INF;
-        int checkedCount = 0;  // 実際にチェックした経路数
-        
-        for (int i = 0; i < allEnumRouteCount; i++) {
-            RouteResult *r = &allEnumRoutes[i];
-            
-            // 基準時刻2と重複していない経路のみを対象とする
-            bool isBaseTime2 = false;
-            
-            if (hasBaseTime2Route && r->edgeCount == baseTime2Route.edgeCount) {
-                bool same = true;
-                for (int j = 0; j < r->edgeCount; j++) {
-                    if (r->edges[j] != baseTime2Route.edges[j]) {
-                        same = false;
-                        break;
-                    }
-                }
-                if (same) isBaseTime2 = true;
-            }
-            
-            // 重複していない経路で、総時間が最短のものを探す
-            // 網羅的経路の最終比較では、サイクルベースの厳密な待ち時間計算を使用
-            if (!isBaseTime2) {
-                checkedCount++;
-                
-                // サイクルベースの厳密な待ち時間計算で再計算
-                double dist, timeSec, waitTimeSec;
-                calcRouteMetricsWithCycleBasedWaitTime(r->edges, r->edgeCount, &dist, &timeSec, &waitTimeSec, false);
-                
-                // 最初の5件、最後の5件、最短経路候補が更新された時のみログ出力
-                if (i < 5 || i >= allEnumRouteCount - 5 || timeSec < bestEnumRouteTime) {
-                    if (i < 5) {
-                        fprintf(stderr, "  経路[%d]: 移動時間=%.2f秒, サイクルベース待ち時間=%.2f秒, 合計=%.2f秒\n",
-                                i, timeSec - waitTimeSec, waitTimeSec, timeSec);
-                    } else if (i >= allEnumRouteCount - 5) {
-                        fprintf(stderr, "  経路[%d]: 移動時間=%.2f秒, サイクルベース待ち時間=%.2f秒, 合計=%.2f秒\n",
-                                i, timeSec - waitTimeSec, waitTimeSec, timeSec);
-                    } else if (timeSec < bestEnumRouteTime) {
-                        fprintf(stderr, "  経路[%d]: 新たな最短候補! 合計=%.2f秒 (サイクルベース計算)\n", i, timeSec);
-                    }
-                }
-                
-                if (timeSec < bestEnumRouteTime) {
-                    bestEnumRouteTime = timeSec;
-                    bestEnumRouteIdx = i;
-                    // 厳密な計算結果を更新
-                    r->totalDistance = dist;
-                    r->totalTimeSeconds = timeSec;
-                }
-            }
-        }
-        fprintf(stderr, "全%d本の経路をチェックしました（重複除外後: %d本）\n", allEnumRouteCount, checkedCount);
-        
-        // 最短の全網羅経路を赤色で追加（1本のみ）
-        if (bestEnumRouteIdx >= 0) {
-            allEnumRoutes[bestEnumRouteIdx].routeType = 2;  // 赤
-            routes[routeCount++] = allEnumRoutes[bestEnumRouteIdx];
-            fprintf(stderr, "最短全網羅経路（赤）: edges=%d, distance=%.2f m, time=%.2f sec (%.2f min)\n",
-                    allEnumRoutes[bestEnumRouteIdx].edgeCount,
-                    allEnumRoutes[bestEnumRouteIdx].totalDistance,
-                    allEnumRoutes[bestEnumRouteIdx].totalTimeSeconds,
-                    allEnumRoutes[bestEnumRouteIdx].totalTimeSeconds / 60.0);
-        }
-        
-        // その他の全網羅経路を黄色で追加（routeType=3）
-        int yellowCount = 0;
-        for (int i = 0; i < allEnumRouteCount; i++) {
-            if (i == bestEnumRouteIdx) continue;  // 最短経路は既に追加済み
-            
-            RouteResult *r = &allEnumRoutes[i];
-            
-            // 基準時刻2と重複していない経路のみを追加
-            bool isBaseTime2 = false;
-            if (hasBaseTime2Route && r->edgeCount == baseTime2Route.edgeCount) {
-                bool same = true;
-                for (int j = 0; j < r->edgeCount; j++) {
-                    if (r->edges[j] != baseTime2Route.edges[j]) {
-                        same = false;
-                        break;
-                    }
-                }
-                if (same) isBaseTime2 = true;
-            }
-            
-            if (!isBaseTime2 && routeCount < 5000) {
-                // サイクルベースの厳密な待ち時間計算で再計算
-                double dist, timeSec, waitTimeSec;
-                calcRouteMetricsWithCycleBasedWaitTime(r->edges, r->edgeCount, &dist, &timeSec, &waitTimeSec, false);
-                r->totalDistance = dist;
-                r->totalTimeSeconds = timeSec;
-                r->routeType = 3;  // 黄色（全網羅経路）
-                routes[routeCount++] = *r;
-                yellowCount++;
-            }
+        fprintf(stderr, "\n=== 第三段階：全網羅（指定信号の1,2,3個の組み合わせを通る経路、待ち時間期待値）を探索 ===\n");
+        // 基準時刻2と同じ経路は赤・黄に選ばれないため、全網羅の結果から除く
+        int index;
+        if (hasBaseTime2Route) routeSetInsert(enumRouteSet, baseTime2Route.edges, baseTime2Route.edgeCount, &index);
+        RouteResult *allEnumRoutes = allocRoutes(enumCapacity);  // 全網羅経路を一時保存（28個の信号に対応）
+        int allEnumRouteCount = calculateEnumRoutes(startNode, endNode, allEnumRoutes, enumCapacity, opt);
+        fprintf(stderr, "全網羅経路: %d本生成\n", allEnumRouteCount);
+        
+        // 基準時刻2を緑で追加
+        if (hasBaseTime2Route) {
+            baseTime2Route.routeType = 1;  // 緑
+            routes[routeCount++] = baseTime2Route;
         }
-        fprintf(stderr, "全網羅経路（黄色）: %d本追加\n", yellowCount);
+        
+        // 最短を赤、その他を黄で追加
+        appendEnumRoutes(allEnumRoutes, allEnumRouteCount, ranked, routes, &routeCount, MAX_ROUTES, opt->yellowLimit);
+        free(allEnumRoutes);
     }
     // 基準時刻1 < 基準時刻2 の場合
     else if (baseTime1Seconds < baseTime2Seconds) {
@@ -1842,8 +4168,12 @@ int main(int argc, char *argv[]) {
         // ========== 第三段階：全網羅（指定信号の1,2,3個の組み合わせを通る経路、待ち時間期待値） ==========
         // 基準時刻1 >= 基準時刻2 の場合のみ全網羅経路を計算
         fprintf(stderr, "\n=== 第三段階：全網羅（指定信号の1,2,3個の組み合わせを通る経路、待ち時間期待値）を探索 ===\n");
-        RouteResult allEnumRoutes[5000];  // 全網羅経路を一時保存（28個の信号に対応）
-        int allEnumRouteCount = calculateAllEnumRoutes(startNode, endNode, signalCount, allEnumRoutes, 5000);
+        // 基準時刻1/2と同じ経路は赤・黄に選ばれないため、全網羅の結果から除く
+        int index;
+        routeSetInsert(enumRouteSet, baseTime1Route.edges, baseTime1Route.edgeCount, &index);
+        if (hasBaseTime2Route) routeSetInsert(enumRouteSet, baseTime2Route.edges, baseTime2Route.edgeCount, &index);
+        RouteResult *allEnumRoutes = allocRoutes(enumCapacity);  // 全網羅経路を一時保存（28個の信号に対応）
+        int allEnumRouteCount = calculateEnumRoutes(startNode, endNode, allEnumRoutes, enumCapacity, opt);
         fprintf(stderr, "全網羅経路: %d本生成\n", allEnumRouteCount);
         
         fprintf(stderr, "\n=== 表示条件に基づいて経路を分類 ===\n");
@@ -1859,130 +4189,9 @@ int main(int argc, char *argv[]) {
             routes[routeCount++] = baseTime2Route;
         }
         
-        // 全網羅経路の中で、実際の信号待ち時間を含めた総時間が最短の経路を見つける（赤色で表示）
-        fprintf(stderr, "\n=== 全%d本の経路から最短経路を選出（全経路のtotalTimeSecondsを比較） ===\n", allEnumRouteCount);
-        int bestEnumRouteIdx = -1;
-        double bestEnumRouteTime = INF;
-        int checkedCount = 0;  // 実際にチェックした経路数
-        
-        for (int i = 0; i < allEnumRouteCount; i++) {
-            RouteResult *r = &allEnumRoutes[i];
-            
-            // 基準時刻1/2と重複していない経路のみを対象とする
-            bool isBaseTime1 = false;
-            bool isBaseTime2 = false;
-            
-            if (r->edgeCount == baseTime1Route.edgeCount) {
-                bool same = true;
-                for (int j = 0; j < r->edgeCount; j++) {
-                    if (r->edges[j] != baseTime1Route.edges[j]) {
-                        same = false;
-                        break;
-                    }
-                }
-                if (same) isBaseTime1 = true;
-            }
-            
-            if (hasBaseTime2Route && r->edgeCount == baseTime2Route.edgeCount) {
-                bool same = true;
-                for (int j = 0; j < r->edgeCount; j++) {
-                    if (r->edges[j] != baseTime2Route.edges[j]) {
-                        same = false;
-                        break;
-                    }
-                }
-                if (same) isBaseTime2 = true;
-            }
-            
-            // 重複していない経路で、総時間が最短のものを探す
-            // 網羅的経路の最終比較では、サイクルベースの厳密な待ち時間計算を使用
-            if (!isBaseTime1 && !isBaseTime2) {
-                checkedCount++;
-                
-                // サイクルベースの厳密な待ち時間計算で再計算
-                double dist, timeSec, waitTimeSec;
-                calcRouteMetricsWithCycleBasedWaitTime(r->edges, r->edgeCount, &dist, &timeSec, &waitTimeSec, false);
-                
-                // 最初の5件、最後の5件、最短経路候補が更新された時のみログ出力
-                if (i < 5 || i >= allEnumRouteCount - 5 || timeSec < bestEnumRouteTime) {
-                    if (i < 5) {
-                        fprintf(stderr, "  経路[%d]: 移動時間=%.2f秒, サイクルベース待ち時間=%.2f秒, 合計=%.2f秒\n",
-                                i, timeSec - waitTimeSec, waitTimeSec, timeSec);
-                    } else if (i >= allEnumRouteCount - 5) {
-                        fprintf(stderr, "  経路[%d]: 移動時間=%.2f秒, サイクルベース待ち時間=%.2f秒, 合計=%.2f秒\n",
-                                i, timeSec - waitTimeSec, waitTimeSec, timeSec);
-                    } else if (timeSec < bestEnumRouteTime) {
-                        fprintf(stderr, "  経路[%d]: 新たな最短候補! 合計=%.2f秒 (サイクルベース計算)\n", i, timeSec);
-                    }
-                }
-                
-                if (timeSec < bestEnumRouteTime) {
-                    bestEnumRouteTime = timeSec;
-                    bestEnumRouteIdx = i;
-                    // 厳密な計算結果を更新
-                    r->totalDistance = dist;
-                    r->totalTimeSeconds = timeSec;
-                }
-            }
-        }
-        fprintf(stderr, "全%d本の経路をチェックしました（重複除外後: %d本）\n", allEnumRouteCount, checkedCount);
-        
-        // 最短の全網羅経路を赤色で追加（1本のみ）
-        if (bestEnumRouteIdx >= 0) {
-            allEnumRoutes[bestEnumRouteIdx].routeType = 2;  // 赤
-            routes[routeCount++] = allEnumRoutes[bestEnumRouteIdx];
-            fprintf(stderr, "最短全網羅経路（赤）: edges=%d, distance=%.2f m, time=%.2f sec (%.2f min)\n",
-                    allEnumRoutes[bestEnumRouteIdx].edgeCount,
-                    allEnumRoutes[bestEnumRouteIdx].totalDistance,
-                    allEnumRoutes[bestEnumRouteIdx].totalTimeSeconds,
-                    allEnumRoutes[bestEnumRouteIdx].totalTimeSeconds / 60.0);
-        }
-        
-        // その他の全網羅経路を黄色で追加（routeType=3）
-        int yellowCount = 0;
-        for (int i = 0; i < allEnumRouteCount; i++) {
-            if (i == bestEnumRouteIdx) continue;  // 最短経路は既に追加済み
-            
-            RouteResult *r = &allEnumRoutes[i];
-            
-            // 基準時刻1/2と重複していない経路のみを追加
-            bool isBaseTime1 = false;
-            bool isBaseTime2 = false;
-            
-            if (r->edgeCount == baseTime1Route.edgeCount) {
-                bool same = true;
-                for (int j = 0; j < r->edgeCount; j++) {
-                    if (r->edges[j] != baseTime1Route.edges[j]) {
-                        same = false;
-                        break;
-                    }
-                }
-                if (same) isBaseTime1 = true;
-            }
-            
-            if (hasBaseTime2Route && r->edgeCount == baseTime2Route.edgeCount) {
-                bool same = true;
-                for (int j = 0; j < r->edgeCount; j++) {
-                    if (r->edges[j] != baseTime2Route.edges[j]) {
-                        same = false;
-                        break;
-                    }
-                }
-                if (same) isBaseTime2 = true;
-            }
-            
-            if (!isBaseTime1 && !isBaseTime2 && routeCount < 5000) {
-                // サイクルベースの厳密な待ち時間計算で再計算
-                double dist, timeSec, waitTimeSec;
-                calcRouteMetricsWithCycleBasedWaitTime(r->edges, r->edgeCount, &dist, &timeSec, &waitTimeSec, false);
-                r->totalDistance = dist;
-                r->totalTimeSeconds = timeSec;
-                r->routeType = 3;  // 黄色（全網羅経路）
-                routes[routeCount++] = *r;
-                yellowCount++;
-            }
-        }
-        fprintf(stderr, "全網羅経路（黄色）: %d本追加\n", yellowCount);
+        // 最短を赤、その他を黄で追加
+        appendEnumRoutes(allEnumRoutes, allEnumRouteCount, ranked, routes, &routeCount, MAX_ROUTES, opt->yellowLimit);
+        free(allEnumRoutes);
     }
     
     fprintf(stderr, "\n最終出力: %d本の経路\n", routeCount);
@@ -1997,8 +4206,958 @@ int main(int argc, char *argv[]) {
     fprintf(stderr, "- 緑（基準時刻1）: %d本\n", greenCount);
     fprintf(stderr, "- 赤（最短全網羅）: %d本\n", redCount);
     fprintf(stderr, "- 黄（全網羅経路）: %d本\n", yellowCount);
+    const RouteArena *arena = &currentQuery()->arena;
+    fprintf(stderr, "経路のエッジ列: %zu個 (%.1f KB、確保済み %.1f KB)\n", arena->used,
+            arena->used * sizeof(int) / 1024.0, arena->reserved * sizeof(int) / 1024.0);
     
     printJSON(routes, routeCount);
 
+    free(routes);
+    return 0;
+}
+
+// K最短経路モード: 移動時間が短い順に最大 K 本の経路をJSONで出力する
+// 1本目を赤（routeType=2）、2本目以降を黄（routeType=3）とし、時間・待ち時間は全網羅経路と同じく
+// サイクルベースの待ち時間を含めて計算する
+int runKspQuery(int startNode, int endNode, double ws, double kGrad, int K) {
+    if (startNode < 1 || startNode >= graph.nodeCount ||
+        endNode   < 1 || endNode   >= graph.nodeCount || K < 1) {
+        fprintf(stderr, "Error: invalid node number\n");
+        return 1;
+    }
+
+    prepareTravelTimes(ws > 0.0 ? ws : DEFAULT_WALKING_SPEED, kGrad);
+    apspSelect();
+
+    KspPath     *paths  = (KspPath *)malloc(sizeof(KspPath) * (size_t)K);
+    RouteResult *routes = (RouteResult *)malloc(sizeof(RouteResult) * (size_t)K);
+    if (!paths || !routes) {
+        fprintf(stderr, "Error: メモリを確保できません\n");
+        exit(1);
+    }
+
+    int count = kShortestPaths(startNode, endNode, K, paths);
+    for (int i = 0; i < count; i++) {
+        RouteResult *r = &routes[i];
+        setRouteEdges(r, paths[i].edges, paths[i].edgeCount);
+        r->routeType = i == 0 ? 2 : 3;
+        fprintf(stderr, "  K最短経路[%d]: 移動時間=%.2f秒, 待ち時間込み=%.2f秒, edges=%d\n",
+                i, paths[i].cost, r->totalTimeSeconds, r->edgeCount);
+    }
+
+    printJSON(routes, count);
+
+    free(paths);
+    free(routes);
+    return 0;
+}
+
+// パレート探索モード: 多基準でパレート最適な経路をJSONで出力する
+// サイクルベースの待ち時間を含めた時間が最短のものを赤（routeType=2）、それ以外を黄（routeType=3）とする
+int runParetoQuery(const QueryOptions *opt) {
+    if (opt->startNode < 1 || opt->startNode >= graph.nodeCount ||
+        opt->endNode   < 1 || opt->endNode   >= graph.nodeCount) {
+        fprintf(stderr, "Error: invalid node number\n");
+        return 1;
+    }
+
+    prepareTravelTimes(opt->walkingSpeed > 0.0 ? opt->walkingSpeed : DEFAULT_WALKING_SPEED, opt->kGradient);
+
+    RouteResult *routes = (RouteResult *)malloc(sizeof(RouteResult) * (size_t)opt->paretoLabels);
+    if (!routes) {
+        fprintf(stderr, "Error: メモリを確保できません\n");
+        exit(1);
+    }
+
+    int count = paretoRoutes(opt->startNode, opt->endNode, opt->paretoLabels, routes);
+    int best  = -1;
+    for (int i = 0; i < count; i++) {
+        routes[i].routeType = 3;
+        if (best < 0 || routes[i].totalTimeSeconds < routes[best].totalTimeSeconds) best = i;
+    }
+    if (best >= 0) routes[best].routeType = 2;
+
+    printJSON(routes, count);
+
+    free(routes);
+    return 0;
+}
+
+// 嗜好コストモード: 13個の重みから user_preference_ver4.4.c の式で作った嗜好コストが最小の経路を CCH で求め、赤（routeType=2）として出力する
+// 時間・待ち時間は全網羅経路と同じくサイクルベースの待ち時間を含めて計算する
+int runPreferenceQuery(const QueryOptions *opt) {
+    if (opt->startNode < 1 || opt->startNode >= graph.nodeCount ||
+        opt->endNode   < 1 || opt->endNode   >= graph.nodeCount) {
+        fprintf(stderr, "Error: invalid node number\n");
+        return 1;
+    }
+
+    prepareTravelTimes(opt->walkingSpeed > 0.0 ? opt->walkingSpeed : DEFAULT_WALKING_SPEED, opt->kGradient);
+
+    // CCH の重みと探索の作業領域は全てのクエリで1つなので、カスタマイズから探索までを続けて行う
+    RouteResult route;
+    int    edges[MAX_PATH_LENGTH];
+    int    edgeCount  = 0;
+    int    routeCount = 0;
+    double cost;
+    pthread_mutex_lock(&preferenceLock);
+    cchPrepare();
+    cchCustomizePreference();
+    cchWs.settledCount = 0;
+    bool found   = cchQuery(&cchGraph, &cchWs, opt->startNode, opt->endNode, edges, MAX_PATH_LENGTH, &edgeCount, &cost);
+    long settled = cchWs.settledCount;
+    pthread_mutex_unlock(&preferenceLock);
+
+    if (found) {
+        setRouteEdges(&route, edges, edgeCount);
+        route.routeType = 2;
+        routeCount = 1;
+        fprintf(stderr, "  嗜好コスト最小経路: コスト=%.4f, 待ち時間込み=%.2f秒, edges=%d, 確定ノード数 %ld\n",
+                cost, route.totalTimeSeconds, route.edgeCount, settled);
+    } else {
+        fprintf(stderr, "  嗜好コスト最小経路が見つかりません\n");
+    }
+
+    printJSON(&route, routeCount);
+    return 0;
+}
+
+/* ---------- クエリの指定 ---------- */
+
+#define MAX_QUERY_ARGS 32
+
+// "<start_node> <end_node> <walking_speed> [gradient_factor] [--ksp K] [--td] [--threads N] [--depth D] [--prune]
+//  [--pareto [--labels N]] [--search tree|dijkstra|astar|bidir] [--prefs w0,...,w12] [--weights w0,...,w12] [--compact]
+//  [--top K] [--yellow N]" を解析する
+bool parseQueryArgs(int argc, char **argv, QueryOptions *opt) {
+    opt->startNode    = 0;
+    opt->endNode      = 0;
+    opt->walkingSpeed = DEFAULT_WALKING_SPEED;
+    opt->kGradient    = K_GRADIENT;
+    opt->kspCount     = 0;
+    opt->timeDependent = false;
+    opt->threadCount  = 1;
+    opt->enumDepth    = DEFAULT_COMBINATION_SIZE;
+    opt->prune        = false;
+    opt->pareto       = false;
+    opt->searchMode   = SEARCH_TREE;
+    opt->paretoLabels = DEFAULT_PARETO_LABELS;
+    opt->usePreference = false;
+    opt->hasWeights   = false;
+    opt->compact      = false;
+    opt->topK         = 0;
+    opt->yellowLimit  = -1;
+
+    int positional = 0;
+    for (int i = 0; i < argc; i++) {
+        if (strcmp(argv[i], "--ksp") == 0) {
+            if (i + 1 >= argc) return false;
+            opt->kspCount = atoi(argv[++i]);
+            if (opt->kspCount < 1 || opt->kspCount > MAX_ROUTES) return false;
+        } else if (strcmp(argv[i], "--td") == 0) {
+            opt->timeDependent = true;
+        } else if (strcmp(argv[i], "--threads") == 0) {
+            if (i + 1 >= argc) return false;
+            opt->threadCount = atoi(argv[++i]);
+            if (opt->threadCount <= 0) {
+                long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+                opt->threadCount = cpus > 0 ? (int)cpus : 1;
+            }
+        } else if (strcmp(argv[i], "--depth") == 0) {
+            if (i + 1 >= argc) return false;
+            opt->enumDepth = atoi(argv[++i]);
+            if (opt->enumDepth < 1 || opt->enumDepth > MAX_COMBINATION_SIZE) return false;
+        } else if (strcmp(argv[i], "--prune") == 0) {
+            opt->prune = true;
+        } else if (strcmp(argv[i], "--pareto") == 0) {
+            opt->pareto = true;
+        } else if (strcmp(argv[i], "--search") == 0) {
+            if (i + 1 >= argc) return false;
+            const char *mode = argv[++i];
+            if      (strcmp(mode, "tree") == 0)     opt->searchMode = SEARCH_TREE;
+            else if (strcmp(mode, "dijkstra") == 0) opt->searchMode = SEARCH_DIJKSTRA;
+            else if (strcmp(mode, "astar") == 0)    opt->searchMode = SEARCH_ASTAR;
+            else if (strcmp(mode, "bidir") == 0)    opt->searchMode = SEARCH_BIDIRECTIONAL;
+            else return false;
+        } else if (strcmp(argv[i], "--labels") == 0) {
+            if (i + 1 >= argc) return false;
+            opt->paretoLabels = atoi(argv[++i]);
+            if (opt->paretoLabels < 1 || opt->paretoLabels > MAX_PARETO_LABELS) return false;
+        } else if (strcmp(argv[i], "--prefs") == 0 || strcmp(argv[i], "--weights") == 0) {
+            // up44 の引数と同じ順の13個の重みをカンマ区切りで受け取る
+            // --prefs は嗜好コスト最小の経路を求め、--weights は他のモード（--pareto）の嗜好コストにだけ使う
+            if (strcmp(argv[i], "--prefs") == 0) opt->usePreference = true;
+            if (i + 1 >= argc) return false;
+            const char *p = argv[++i];
+            for (int w = 0; w < PREFERENCE_WEIGHTS; w++) {
+                char *end;
+                opt->preferenceWeights[w] = strtod(p, &end);
+                if (end == p || *end != (w + 1 < PREFERENCE_WEIGHTS ? ',' : '\0')) return false;
+                p = end + 1;
+            }
+            opt->hasWeights = true;
+        } else if (strcmp(argv[i], "--compact") == 0) {
+            opt->compact = true;
+        } else if (strcmp(argv[i], "--top") == 0) {
+            if (i + 1 >= argc) return false;
+            opt->topK = atoi(argv[++i]);
+            if (opt->topK < 1 || opt->topK > MAX_ROUTES) return false;
+        } else if (strcmp(argv[i], "--yellow") == 0) {
+            if (i + 1 >= argc) return false;
+            opt->yellowLimit = atoi(argv[++i]);
+            if (opt->yellowLimit < 0) return false;
+        } else if (strncmp(argv[i], "--", 2) == 0) {
+            return false;
+        } else {
+            switch (positional++) {
+                case 0: opt->startNode    = atoi(argv[i]); break;
+                case 1: opt->endNode      = atoi(argv[i]); break;
+                case 2: opt->walkingSpeed = atof(argv[i]); break;
+                case 3: opt->kGradient    = atof(argv[i]); break;
+                default: return false;
+            }
+        }
+    }
+    return positional >= 3;
+}
+
+// 1行を空白で区切って parseQueryArgs に渡す（line は書き換える）
+bool parseQueryLine(char *line, QueryOptions *opt) {
+    char *args[MAX_QUERY_ARGS];
+    int   argc = 0;
+    for (char *tok = strtok(line, " \t\r\n"); tok; tok = strtok(NULL, " \t\r\n")) {
+        if (argc >= MAX_QUERY_ARGS) return false;
+        args[argc++] = tok;
+    }
+    return parseQueryArgs(argc, args, opt);
+}
+
+// 1クエリを q の状態で実行する（q ごとに別のスレッドから同時に呼んでよい）
+// 移動時間・全点間テーブルの判定は共有するため、同時に実行するクエリの歩行速度・勾配係数は揃えること
+int executeQuery(QueryContext *q, const QueryOptions *opt) {
+    static const char *searchModeNames[] = { "tree", "dijkstra", "astar", "bidir" };
+    int rc;
+
+    threadQuery   = q;
+    q->searchMode = opt->searchMode;
+    q->compact    = opt->compact;
+    routeArenaReset(&q->arena);
+    q->ws.settledCount = 0;
+    if (opt->hasWeights) {
+        applyPreferenceWeights(opt->preferenceWeights);
+    } else {
+        q->activePreference = NULL;
+    }
+    if (opt->usePreference) {
+        rc = runPreferenceQuery(opt);
+    } else if (opt->pareto) {
+        rc = runParetoQuery(opt);
+    } else if (opt->kspCount > 0) {
+        rc = runKspQuery(opt->startNode, opt->endNode, opt->walkingSpeed, opt->kGradient, opt->kspCount);
+    } else {
+        rc = runQuery(opt);
+    }
+    fprintf(stderr, "探索方式=%s: 確定ノード数 %ld\n", searchModeNames[q->searchMode], q->ws.settledCount);
+    threadQuery = NULL;
+    return rc;
+}
+
+// 全ての探索方式が最短経路木と同じ移動時間を返すか、2点の組を変えて確認する
+// step ごとにノードを間引いて（step=1 なら全ての組）、方式ごとの確定ノード数も表示する
+int checkSearchModes(double ws, double kGrad, int step) {
+    static const char *names[] = { "tree", "dijkstra", "astar", "bidir" };
+    long settled[4]    = { 0, 0, 0, 0 };
+    int  mismatches[4] = { 0, 0, 0, 0 };
+    int  pairs = 0;
+
+    mainQuery.searchMode = SEARCH_ASTAR;  // ヒューリスティックも用意させる
+    prepareTravelTimes(ws, kGrad);
+    apspSelect();
+    if (step < 1) step = 1;
+
+    for (int s = 1; s < graph.nodeCount; s += step) {
+        if (graph.adjOffset[s + 1] == graph.adjOffset[s]) continue;
+        const ShortestPathTree *tree = getShortestPathTree(s);
+        for (int g = 1; g < graph.nodeCount; g += step) {
+            if (graph.adjOffset[g + 1] == graph.adjOffset[g]) continue;
+            double expected = tree->dist[g];
+            pairs++;
+            for (int mode = SEARCH_DIJKSTRA; mode <= SEARCH_BIDIRECTIONAL; mode++) {
+                mainQuery.searchMode = (SearchMode)mode;
+                mainQuery.ws.settledCount = 0;
+                DijkstraResult r = dijkstra(s, g);
+                settled[mode] += mainQuery.ws.settledCount;
+
+                bool same = (expected >= INF && r.cost >= INF) ||
+                            (expected < INF && fabs(r.cost - expected) <= 1e-6 * (1.0 + expected));
+                if (!same) {
+                    if (mismatches[mode]++ < 10) {
+                        fprintf(stderr, "不一致: %s %d→%d: %.6f秒 (最短経路木: %.6f秒)\n",
+                                names[mode], s, g, r.cost, expected);
+                    }
+                }
+            }
+        }
+    }
+    mainQuery.searchMode = SEARCH_TREE;
+
+    printf("探索方式の確認: %d組\n", pairs);
+    for (int mode = SEARCH_DIJKSTRA; mode <= SEARCH_BIDIRECTIONAL; mode++) {
+        printf("  %-8s 不一致 %d組, 確定ノード数 平均 %.1f\n", names[mode], mismatches[mode],
+               pairs > 0 ? (double)settled[mode] / pairs : 0.0);
+    }
+    return mismatches[SEARCH_DIJKSTRA] + mismatches[SEARCH_ASTAR] + mismatches[SEARCH_BIDIRECTIONAL] > 0 ? 1 : 0;
+}
+
+// CCH の嗜好コスト最小経路が、同じコストでのダイクストラと一致するか確認する
+// 重みを trials 組ランダムに作り、step ごとに間引いたノードの組で比べる
+int checkCch(int trials, int step) {
+    cchPrepare();
+    if (step < 1) step = 1;
+
+    size_t n = (size_t)graph.nodeCount;
+    ShortestPathTree tree;
+    tree.dist     = (double *)malloc(sizeof(double) * n);
+    tree.prev     = (int *)malloc(sizeof(int) * n);
+    tree.prevEdge = (int *)malloc(sizeof(int) * n);
+    if (!tree.dist || !tree.prev || !tree.prevEdge) {
+        fprintf(stderr, "Error: メモリを確保できません\n");
+        exit(1);
+    }
+
+    double *preferenceCost = queryPreferenceCost(&mainQuery);
+    double *savedTravelSec = travelSec;
+    travelSec = preferenceCost;  // 最短経路木を嗜好コストで作る
+    unsigned long long seed = 88172645463325252ULL;
+    long settled = 0, treeSettled = 0;
+    int  pairs = 0, trees = 0, mismatches = 0;
+    double customizeMs = 0.0;
+
+    for (int trial = 0; trial < trials; trial++) {
+        double weights[PREFERENCE_WEIGHTS];
+        for (int w = 0; w < PREFERENCE_WEIGHTS; w++) {
+            seed ^= seed << 13; seed ^= seed >> 7; seed ^= seed << 17;
+            weights[w] = (double)(seed % 2001) / 1000.0 - 1.0;  // -1.0 .. 1.0
+        }
+        weights[0] = fabs(weights[0]) + 0.1;  // 距離
+        weights[2] = 0.05 + weights[2] * 0.05;  // 最大勾配のしきい値
+        weights[3] = -0.05 + weights[3] * 0.05; // 最小勾配のしきい値
+
+        struct timespec t0;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        computePreferenceCosts(weights, preferenceCost);
+        cchCustomize(&cchGraph, preferenceCost);
+        customizeMs += elapsedMs(&t0);
+
+        for (int s = 1; s < graph.nodeCount; s += step) {
+            if (graph.adjOffset[s + 1] == graph.adjOffset[s]) continue;
+            mainQuery.ws.settledCount = 0;
+            buildShortestPathTree(s, &tree, &mainQuery.ws);
+            for (int g = 1; g < graph.nodeCount; g += step) {
+                if (graph.adjOffset[g + 1] == graph.adjOffset[g]) continue;
+                pairs++;
+                int    edges[MAX_PATH_LENGTH];
+                int    edgeCount = 0;
+                double cost = INF;
+                cchWs.settledCount = 0;
+                bool found = cchQuery(&cchGraph, &cchWs, s, g, edges, MAX_PATH_LENGTH, &edgeCount, &cost);
+                settled += cchWs.settledCount;
+
+                // 展開したエッジ列が s から g へつながり、コストの合計が一致するか
+                double sum = 0.0;
+                int    at  = s;
+                for (int i = 0; found && i < edgeCount; i++) {
+                    const EdgeData *e = &edgeDataArray[edges[i]];
+                    if      (e->from == at) at = e->to;
+                    else if (e->to == at)   at = e->from;
+                    else                    found = false;
+                    sum += preferenceCost[edges[i]];
+                }
+                double expected = tree.dist[g];
+                bool same = found ? (at == g && expected < INF &&
+                                     fabs(cost - expected) <= 1e-6 * (1.0 + expected) &&
+                                     fabs(sum - expected) <= 1e-6 * (1.0 + expected))
+                                  : expected >= INF;
+                if (!same && mismatches++ < 10) {
+                    fprintf(stderr, "不一致: 試行%d %d→%d: CCH %.6f (エッジ合計 %.6f) ダイクストラ %.6f\n",
+                            trial, s, g, found ? cost : -1.0, sum, expected);
+                }
+            }
+            treeSettled += mainQuery.ws.settledCount;
+            trees++;
+        }
+    }
+    travelSec = savedTravelSec;
+    free(tree.dist);
+    free(tree.prev);
+    free(tree.prevEdge);
+
+    printf("CCH の確認: 重み %d 組, %d組, 不一致 %d組\n", trials, pairs, mismatches);
+    printf("  カスタマイズ 平均 %.3f ms, 確定ノード数 平均 %.1f（最短経路木1本あたり %.1f）\n",
+           trials > 0 ? customizeMs / trials : 0.0,
+           pairs > 0 ? (double)settled / pairs : 0.0,
+           trees > 0 ? (double)treeSettled / trees : 0.0);
+    return mismatches > 0 ? 1 : 0;
+}
+
+/* ---------- 常駐モード ---------- */
+
+// 標準入力から "<start_node> <end_node> <walking_speed> [gradient_factor] [--ksp K] [--td] [--threads N] [--depth D] [--prune] [--pareto [--labels N]] [--prefs w0,...,w12] [--weights w0,...,w12] [--compact] [--top K] [--yellow N]" を1行ずつ受け取り、
+// 結果のJSONの後に SERVE_END_MARKER の行を出力する。
+// グラフ・信号・ノード位置は起動時に1回だけ読み込む。
+int serveLoop(void) {
+    char line[1024];
+
+    fprintf(stderr, "yen: 常駐モードで待機中\n");
+    printf("%s\n", SERVE_READY_MARKER);
+    fflush(stdout);
+
+    while (fgets(line, sizeof(line), stdin)) {
+        if (line[0] == '\n' || line[0] == '\0') continue;
+        if (strncmp(line, "quit", 4) == 0) break;
+
+        QueryOptions opt;
+        if (!parseQueryLine(line, &opt)) {
+            printf("{\"error\": \"invalid request\"}\n");
+        } else if (executeQuery(&mainQuery, &opt) != 0) {
+            printf("{\"error\": \"invalid node number\"}\n");
+        }
+        printf("%s\n", SERVE_END_MARKER);
+        fflush(stdout);
+    }
+    return 0;
+}
+
+/* ---------- バッチモード ---------- */
+
+// データを読み込んだ後、ワーカースレッドが自分の QueryContext でクエリを同時に処理する。
+// グラフ・移動時間・最短経路木のキャッシュ・全点間テーブルは全てのワーカーで共有する。
+// 移動時間は全てのクエリで1つなので、クエリを歩行速度・勾配係数ごとのグループに分け、
+// グループごとにメインスレッドで移動時間を用意してからワーカーに配る（最短経路木はグループの間使い回す）。
+// 結果は入力の順に並べ直して1行1結果で書き出す（--build-atlas では全て受け取ってからアトラスにする）。
+
+typedef struct {
+    char        *text;    // 入力の行（前後の空白を除いたもの）
+    int          lineNo;  // 入力の行番号（1始まり）
+    int          variant; // 経路アトラスの変種（--build-atlas の行の先頭の値）
+    bool         valid;   // parseQueryArgs で解析できたか
+    QueryOptions opt;
+} BatchQuery;
+
+typedef struct {
+    char  **lines;    // 入力の順番ごとの結果（NDJSON の1行、書き出したら解放する）
+    size_t *lengths;
+    int     count;
+    int     nextOut;  // 次に書き出す入力の順番
+    FILE   *out;      // NULL なら書き出さずに lines に残す
+} BatchOutput;
+
+// ワーカースレッドに配る1グループ分のクエリ（order の [next, last) の範囲）
+typedef struct {
+    const int      *order;
+    int             next;   // 次に処理する order の位置（lock で保護）
+    int             last;
+    BatchOutput    *bo;     // 結果の受け取り（lock で保護）
+    pthread_mutex_t lock;
+} BatchGroup;
+
+typedef struct {
+    BatchGroup  *group;
+    QueryContext query;  // このワーカーのクエリの状態（グループをまたいで使い回す）
+} BatchWorker;
+
+BatchQuery *batchQueries = NULL;  // compareBatchOrder から参照する
+
+// 移動時間を決める歩行速度（0 以下なら既定値。runQuery などと同じ）
+double batchWalkingSpeed(const BatchQuery *q) {
+    return q->opt.walkingSpeed > 0.0 ? q->opt.walkingSpeed : DEFAULT_WALKING_SPEED;
+}
+
+// 移動時間が同じクエリを続けて並べる（解析できなかったクエリは先頭にまとめる）
+int compareBatchMetric(const BatchQuery *qa, const BatchQuery *qb) {
+    if (qa->valid != qb->valid) return qa->valid ? 1 : -1;
+    if (!qa->valid) return 0;
+    double wa = batchWalkingSpeed(qa), wb = batchWalkingSpeed(qb);
+    if (wa != wb) return wa < wb ? -1 : 1;
+    if (qa->opt.kGradient != qb->opt.kGradient) return qa->opt.kGradient < qb->opt.kGradient ? -1 : 1;
+    return 0;
+}
+
+int compareBatchOrder(const void *a, const void *b) {
+    int ia = *(const int *)a, ib = *(const int *)b;
+    int c = compareBatchMetric(&batchQueries[ia], &batchQueries[ib]);
+    return c != 0 ? c : ia - ib;
+}
+
+// JSON の文字列として追加する
+void outJsonString(OutputBuffer *b, const char *s) {
+    outAppend(b, "\"", 1);
+    for (; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') {
+            char esc[2] = { '\\', (char)c };
+            outAppend(b, esc, 2);
+        } else if (c < 0x20) {
+            outPrintf(b, "\\u%04x", c);
+        } else {
+            outAppend(b, (const char *)&c, 1);
+        }
+    }
+    outAppend(b, "\"", 1);
+}
+
+// 1クエリを ctx の状態で実行し、結果を NDJSON の1行として line に追加する
+// printJSON の出力は改行と行頭の字下げを除いて1行にする（JSON の文字列の中に改行は無い）
+// 経路アトラスの作成中は printJSON が書いた記録をそのまま追加する（失敗したクエリは何も追加しない）
+void runBatchQuery(QueryContext *ctx, OutputBuffer *line, const BatchQuery *q) {
+    OutputBuffer *out = &ctx->out;
+    out->length = 0;
+    bool ok = q->valid && executeQuery(ctx, &q->opt) == 0;
+    if (outputAtlas) {
+        if (ok) outAppend(line, out->data, out->length);
+        out->length = 0;
+        return;
+    }
+
+    outString(line, "{\"line\":");
+    outInt(line, q->lineNo);
+    outString(line, ",\"query\":");
+    outJsonString(line, q->text);
+    if (!q->valid) {
+        outString(line, ",\"error\":\"invalid request\"}\n");
+    } else if (!ok) {
+        outString(line, ",\"error\":\"invalid node number\"}\n");
+    } else {
+        outString(line, ",\"result\":");
+        const char *p = out->data, *end = out->data + out->length;
+        while (p < end) {
+            if (*p == '\n') {
+                p++;
+                while (p < end && *p == ' ') p++;
+                continue;
+            }
+            const char *from = p;
+            while (p < end && *p != '\n') p++;
+            outAppend(line, from, (size_t)(p - from));
+        }
+        outString(line, "}\n");
+    }
+    out->length = 0;
+}
+
+// 入力の順番 index の結果を受け取り、先頭から揃った分を書き出す
+void batchStoreResult(BatchOutput *bo, int index, const char *data, size_t length) {
+    if (index < 0 || index >= bo->count || bo->lines[index]) return;
+    bo->lines[index] = (char *)malloc(length > 0 ? length : 1);
+    if (!bo->lines[index]) {
+        fprintf(stderr, "Error: メモリを確保できません\n");
+        exit(1);
+    }
+    memcpy(bo->lines[index], data, length);
+    bo->lengths[index] = length;
+    if (!bo->out) return;
+
+    while (bo->nextOut < bo->count && bo->lines[bo->nextOut]) {
+        fwrite(bo->lines[bo->nextOut], 1, bo->lengths[bo->nextOut], bo->out);
+        free(bo->lines[bo->nextOut]);
+        bo->lines[bo->nextOut] = (char *)"";  // 書き出し済み（NULL 以外）
+        bo->nextOut++;
+    }
+}
+
+// ワーカースレッド: グループのクエリを1つずつ取って処理し、結果を入力の順番の位置に渡す
+void *batchWorkerMain(void *arg) {
+    BatchWorker *w = (BatchWorker *)arg;
+    BatchGroup  *g = w->group;
+    OutputBuffer line = { NULL, 0, 0 };
+    for (;;) {
+        pthread_mutex_lock(&g->lock);
+        int k = g->next < g->last ? g->next++ : g->last;
+        pthread_mutex_unlock(&g->lock);
+        if (k >= g->last) break;
+
+        line.length = 0;
+        runBatchQuery(&w->query, &line, &batchQueries[g->order[k]]);
+        pthread_mutex_lock(&g->lock);
+        batchStoreResult(g->bo, g->order[k], line.data, line.length);
+        pthread_mutex_unlock(&g->lock);
+    }
+    free(line.data);
+    return NULL;
+}
+
+// グループのクエリが共有する移動時間・A* のヒューリスティック・全点間テーブルの判定を、
+// ワーカーを起動する前にメインスレッドで用意する（ワーカーの中の prepareTravelTimes / apspSelect は何も書き換えない）
+void prepareBatchGroup(const int *order, int first, int last) {
+    const BatchQuery *q = &batchQueries[order[first]];
+    if (!q->valid) return;  // 解析できなかったクエリだけのグループ
+
+    bool astar = false;
+    for (int k = first; k < last; k++) {
+        if (batchQueries[order[k]].opt.searchMode == SEARCH_ASTAR) astar = true;
+    }
+    mainQuery.searchMode = astar ? SEARCH_ASTAR : SEARCH_TREE;
+    prepareTravelTimes(batchWalkingSpeed(q), q->opt.kGradient);
+    apspSelect();
+    mainQuery.searchMode = SEARCH_TREE;
+}
+
+// 入力からクエリを読む（空行と # で始まる行は飛ばす）
+// withVariant なら行の先頭の整数を経路アトラスの変種として読み、残りをクエリとする
+int readBatchQueries(FILE *in, BatchQuery **out, bool withVariant) {
+    BatchQuery *queries  = NULL;
+    int         count    = 0;
+    int         capacity = 0;
+    char       *buf      = NULL;
+    size_t      bufSize  = 0;
+    int         lineNo   = 0;
+
+    while (getline(&buf, &bufSize, in) != -1) {
+        lineNo++;
+        char *p = buf;
+        while (*p == ' ' || *p == '\t') p++;
+        size_t len = strlen(p);
+        while (len > 0 && (p[len - 1] == '\n' || p[len - 1] == '\r' || p[len - 1] == ' ' || p[len - 1] == '\t')) {
+            p[--len] = '\0';
+        }
+        if (len == 0 || p[0] == '#') continue;
+
+        queries = (BatchQuery *)growArray(queries, &capacity, count + 1, sizeof(BatchQuery));
+        BatchQuery *q = &queries[count++];
+        q->text   = (char *)malloc(len + 1);
+        char *tmp = (char *)malloc(len + 1);
+        if (!q->text || !tmp) {
+            fprintf(stderr, "Error: メモリを確保できません\n");
+            exit(1);
+        }
+        memcpy(q->text, p, len + 1);
+        memcpy(tmp, p, len + 1);
+        q->lineNo  = lineNo;
+        q->variant = 0;
+        char *query = tmp;
+        bool  hasVariant = true;
+        if (withVariant) {
+            char *end;
+            long  v = strtol(tmp, &end, 10);
+            hasVariant = end != tmp && (*end == ' ' || *end == '\t');
+            q->variant = (int)v;
+            query = end;
+        }
+        q->valid = hasVariant && parseQueryLine(query, &q->opt) && q->opt.startNode >= 1 && q->opt.endNode >= 1;
+        free(tmp);
+    }
+    free(buf);
+    *out = queries;
+    return count;
+}
+
+// batchQueries の count 件を workerCount 本のワーカースレッド（0 なら CPU 数）で処理し、結果を bo に渡す
+// データは読み込み済みであること。実際に使ったワーカー数を返す
+int runBatchWorkers(int count, int workerCount, BatchOutput *bo) {
+    int  *order   = (int *)malloc(sizeof(int) * (size_t)(count > 0 ? count : 1));
+    bool  needCch = false;
+    if (!order) {
+        fprintf(stderr, "Error: メモリを確保できません\n");
+        exit(1);
+    }
+    for (int i = 0; i < count; i++) {
+        order[i] = i;
+        if (batchQueries[i].valid && batchQueries[i].opt.usePreference) needCch = true;
+    }
+    qsort(order, (size_t)count, sizeof(int), compareBatchOrder);
+
+    if (workerCount <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        workerCount = cpus > 0 ? (int)cpus : 1;
+    }
+    if (workerCount > count) workerCount = count > 0 ? count : 1;
+
+    if (needCch) cchPrepare();  // 縮約順序は最初の --prefs クエリを待たずに作っておく
+    holdJsonOutput = true;
+
+    BatchWorker *workers = (BatchWorker *)calloc((size_t)workerCount, sizeof(BatchWorker));
+    pthread_t   *threads = (pthread_t *)malloc(sizeof(pthread_t) * (size_t)workerCount);
+    if (!workers || !threads) {
+        fprintf(stderr, "Error: メモリを確保できません\n");
+        exit(1);
+    }
+    for (int w = 0; w < workerCount; w++) initQueryContext(&workers[w].query);
+
+    for (int first = 0; first < count;) {
+        int last = first + 1;
+        while (last < count && compareBatchMetric(&batchQueries[order[first]], &batchQueries[order[last]]) == 0) last++;
+        prepareBatchGroup(order, first, last);
+
+        BatchGroup group = { order, first, last, bo };
+        pthread_mutex_init(&group.lock, NULL);
+        int threadCount = last - first < workerCount ? last - first : workerCount;
+        int started = 0;
+        for (int w = 0; w < threadCount; w++) {
+            workers[w].group = &group;
+            if (threadCount == 1) break;
+            if (pthread_create(&threads[w], NULL, batchWorkerMain, &workers[w]) != 0) {
+                fprintf(stderr, "Warning: スレッドを作成できません（%d本で続行します）\n", started);
+                break;
+            }
+            started++;
+        }
+        // 1本も作らなければこのスレッドで処理する
+        if (started == 0) batchWorkerMain(&workers[0]);
+        for (int w = 0; w < started; w++) {
+            pthread_join(threads[w], NULL);
+        }
+        pthread_mutex_destroy(&group.lock);
+        first = last;
+    }
+
+    for (int w = 0; w < workerCount; w++) freeQueryContext(&workers[w].query);
+    free(workers);
+    free(threads);
+    holdJsonOutput = false;
+    free(order);
+    return workerCount;
+}
+
+// 入力を開いてクエリを読む（"-" なら標準入力）。開けなければ -1
+int loadBatchQueries(const char *inPath, bool withVariant) {
+    FILE *in = strcmp(inPath, "-") == 0 ? stdin : fopen(inPath, "r");
+    if (!in) {
+        fprintf(stderr, "Error: %s を開けません\n", inPath);
+        return -1;
+    }
+    int count = readBatchQueries(in, &batchQueries, withVariant);
+    if (in != stdin) fclose(in);
+    return count;
+}
+
+void freeBatch(int count, BatchOutput *bo) {
+    for (int i = 0; i < count; i++) free(batchQueries[i].text);
+    free(batchQueries);
+    batchQueries = NULL;
+    free(bo->lines);
+    free(bo->lengths);
+}
+
+// 入力（"-" なら標準入力）の1行1クエリを workerCount 個のワーカーで処理し、結果を NDJSON で出力する
+// 各行は {"line":行番号,"query":"入力の行","result":printJSON と同じ JSON} または {...,"error":"..."}
+int runBatch(const char *inPath, const char *outPath, int workerCount) {
+    int count = loadBatchQueries(inPath, false);
+    if (count < 0) return 1;
+
+    FILE *out = outPath ? fopen(outPath, "w") : stdout;
+    if (!out) {
+        fprintf(stderr, "Error: %s に書き込めません\n", outPath);
+        return 1;
+    }
+
+    BatchOutput bo = { NULL, NULL, count, 0, out };
+    bo.lines   = (char **)calloc((size_t)(count > 0 ? count : 1), sizeof(char *));
+    bo.lengths = (size_t *)calloc((size_t)(count > 0 ? count : 1), sizeof(size_t));
+    if (!bo.lines || !bo.lengths) {
+        fprintf(stderr, "Error: メモリを確保できません\n");
+        exit(1);
+    }
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    loadAllData();
+    workerCount = runBatchWorkers(count, workerCount, &bo);
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    fprintf(stderr, "バッチ: %d件を %d スレッドで処理 (%.1f ms)\n", count, workerCount,
+            (t1.tv_sec - t0.tv_sec) * 1000.0 + (t1.tv_nsec - t0.tv_nsec) / 1e6);
+
+    if (out != stdout) fclose(out); else fflush(out);
+    freeBatch(count, &bo);
     return 0;
 }
+
+// "<変種> <クエリ>" の行ごとに経路を求め、(始点, 終点, 変種) をキーにした経路アトラスを書き出す
+// 同じ始点・終点でも変種（例: 経路集のファイル番号）を変えれば別のキーになる
+int buildRouteAtlas(const char *inPath, const char *outPath, int workerCount) {
+    int count = loadBatchQueries(inPath, true);
+    if (count < 0) return 1;
+
+    BatchOutput bo = { NULL, NULL, count, 0, NULL };
+    bo.lines   = (char **)calloc((size_t)(count > 0 ? count : 1), sizeof(char *));
+    bo.lengths = (size_t *)calloc((size_t)(count > 0 ? count : 1), sizeof(size_t));
+    if (!bo.lines || !bo.lengths) {
+        fprintf(stderr, "Error: メモリを確保できません\n");
+        exit(1);
+    }
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    loadAllData();
+    outputAtlas = true;
+    workerCount = runBatchWorkers(count, workerCount, &bo);
+    outputAtlas = false;
+
+    // 入力の順にキーを追加する（求められなかったクエリは飛ばす）
+    RouteAtlasBuilder b;
+    routeAtlasBuilderInit(&b);
+    int failed = 0;
+    for (int i = 0; i < count; i++) {
+        const BatchQuery *q = &batchQueries[i];
+        const char *p   = bo.lines[i];
+        size_t      len = bo.lengths[i];
+        int32_t     routeCount;
+        if (!p || len < sizeof(routeCount)) {
+            fprintf(stderr, "Warning: %d行目の経路を求められませんでした: %s\n", q->lineNo, q->text);
+            free(bo.lines[i]);
+            failed++;
+            continue;
+        }
+        memcpy(&routeCount, p, sizeof(routeCount));
+        p += sizeof(routeCount);
+
+        routeAtlasBeginEntry(&b, q->opt.startNode, q->opt.endNode, q->variant);
+        for (int k = 0; k < routeCount; k++) {
+            RouteAtlasRoute ar;
+            memcpy(&ar, p, sizeof(ar));
+            p += sizeof(ar);
+            routeAtlasAddRoute(&b, ar.totalDistance, ar.totalTime, ar.totalWaitTime, ar.routeType, ar.hasSignal);
+            for (uint32_t j = 0; j < ar.edgeCount; j++) {
+                int e;
+                memcpy(&e, p, sizeof(e));
+                p += sizeof(e);
+                routeAtlasAddEdge(&b, edgeDataArray[e].from, edgeDataArray[e].to);
+            }
+        }
+        free(bo.lines[i]);
+    }
+
+    bool ok = routeAtlasWrite(&b, outPath);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    if (ok) {
+        fprintf(stderr, "経路アトラスを作成しました: %s (キー %zu 個, 経路 %zu 本, エッジ表 %zu 本, 失敗 %d 件, %d スレッド, %.1f ms)\n",
+                outPath, b.entryCount, b.routeCount, b.edgeCount, failed, workerCount,
+                (t1.tv_sec - t0.tv_sec) * 1000.0 + (t1.tv_nsec - t0.tv_nsec) / 1e6);
+    }
+    routeAtlasBuilderFree(&b);
+    freeBatch(count, &bo);
+    return ok && failed == 0 ? 0 : 1;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc == 2 && strcmp(argv[1], "--serve") == 0) {
+        loadAllData();
+        return serveLoop();
+    }
+
+    if (argc >= 3 && strcmp(argv[1], "--batch") == 0) {
+        const char *outPath     = NULL;
+        int         workerCount = 1;
+        for (int i = 3; i < argc; i++) {
+            if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+                workerCount = atoi(argv[++i]);
+            } else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+                outPath = argv[++i];
+            }
+        }
+        return runBatch(argv[2], outPath, workerCount);
+    }
+
+    if (argc >= 3 && strcmp(argv[1], "--build-atlas") == 0) {
+        const char *outPath     = ROUTE_ATLAS_FILE;
+        int         workerCount = 1;
+        for (int i = 3; i < argc; i++) {
+            if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+                workerCount = atoi(argv[++i]);
+            } else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+                outPath = argv[++i];
+            }
+        }
+        return buildRouteAtlas(argv[2], outPath, workerCount);
+    }
+
+    if (argc >= 3 && strcmp(argv[1], "--build-apsp") == 0) {
+        double      ws          = atof(argv[2]);
+        double      kGrad       = K_GRADIENT;
+        int         threadCount = 0;
+        const char *outPath     = APSP_FILE;
+        for (int i = 3; i < argc; i++) {
+            if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+                threadCount = atoi(argv[++i]);
+            } else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+                outPath = argv[++i];
+            } else {
+                kGrad = atof(argv[i]);
+            }
+        }
+        loadAllData();
+        return buildApspTable(outPath, ws > 0.0 ? ws : DEFAULT_WALKING_SPEED, kGrad, threadCount);
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "--build-cch") == 0) {
+        const char *outPath = CCH_FILE;
+        if (argc >= 4 && strcmp(argv[2], "--output") == 0) outPath = argv[3];
+        loadAllData();
+        return buildCchOrder(outPath);
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "--check-cch") == 0) {
+        int trials = argc >= 3 ? atoi(argv[2]) : 3;
+        int step   = argc >= 4 ? atoi(argv[3]) : 1;
+        loadAllData();
+        return checkCch(trials, step);
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "--check-search") == 0) {
+        double ws    = argc >= 3 ? atof(argv[2]) : DEFAULT_WALKING_SPEED;
+        double kGrad = argc >= 4 ? atof(argv[3]) : K_GRADIENT;
+        int    step  = argc >= 5 ? atoi(argv[4]) : 1;
+        loadAllData();
+        return checkSearchModes(ws > 0.0 ? ws : DEFAULT_WALKING_SPEED, kGrad, step);
+    }
+
+    QueryOptions opt;
+    if (!parseQueryArgs(argc - 1, argv + 1, &opt)) {
+        fprintf(stderr, "Usage: %s <start_node> <end_node> <walking_speed> [gradient_factor] [--ksp K] [--td] [--threads N] [--depth D] [--prune]\n"
+                        "              [--search tree|dijkstra|astar|bidir] [--top K] [--yellow N]\n"
+                        "       %s <start_node> <end_node> <walking_speed> [gradient_factor] --pareto [--labels N]\n"
+                        "       %s <start_node> <end_node> <walking_speed> [gradient_factor] --prefs w0,...,w12\n"
+                        "       %s <start_node> <end_node> <walking_speed> [gradient_factor] --pareto --weights w0,...,w12\n",
+                argv[0], argv[0], argv[0], argv[0]);
+        fprintf(stderr, "            (--ksp K: 移動時間が短い順に K 本（最大 %d）の経路を出力するK最短経路モード)\n", MAX_ROUTES);
+        fprintf(stderr, "            (--td: 全網羅の代わりに信号待ち込みの時間依存探索で最速経路を求める)\n");
+        fprintf(stderr, "            (--threads N: 信号の組み合わせを N スレッドで評価する。0 なら CPU 数)\n");
+        fprintf(stderr, "            (--depth D: 全網羅で同時に通る信号の最大数。既定 %d、最大 %d)\n",
+                DEFAULT_COMBINATION_SIZE, MAX_COMBINATION_SIZE);
+        fprintf(stderr, "            (--prune: 下界が最短経路より遅い組み合わせを評価・出力しない)\n");
+        fprintf(stderr, "            (--pareto: 移動時間・待ち時間・距離・嗜好コストでパレート最適な経路を出力する。\n"
+                        "             --labels N はノードごとに保持するラベル数、既定 %d、最大 %d)\n",
+                DEFAULT_PARETO_LABELS, MAX_PARETO_LABELS);
+        fprintf(stderr, "            (--search: 2点間の最短経路の探し方。tree は始点ごとの最短経路木をキャッシュ（既定）、\n"
+                        "             dijkstra は1対1のダイクストラ、astar は直線距離を下界にした A*、bidir は双方向探索)\n");
+        fprintf(stderr, "            (--prefs: 13個の重みから user_preference_ver4.4.c の式で作った嗜好コストが最小の経路を CCH で求める)\n");
+        fprintf(stderr, "            (--weights: 嗜好コストを result.csv の代わりに13個の重みからプロセス内で作る)\n");
+        fprintf(stderr, "            (--compact: 経路を \"from-to.geojson\" の文字列ではなく、エッジ表 [[from,to],...] の\n"
+                        "             番号の配列で1行に出力する。どのモードとも組み合わせられる)\n");
+        fprintf(stderr, "            (--top K: 全網羅の経路を総時間の短い上位 K 本（最大 %d）だけ保持しながら列挙する。\n"
+                        "             全件を集めないためメモリが K に比例し、--prune では K 本目の時間で枝刈りする)\n", MAX_ROUTES);
+        fprintf(stderr, "            (--yellow N: 出力する黄（全網羅経路）を短い順に N 本までにする)\n");
+        fprintf(stderr, "       %s --serve   (標準入力から1行1クエリで受け付ける常駐モード)\n", argv[0]);
+        fprintf(stderr, "       %s --batch <FILE|-> [--workers N] [--output FILE]\n", argv[0]);
+        fprintf(stderr, "            (1行1クエリのファイルを N スレッドで処理し、結果を1行1件の NDJSON で出力する。0 なら CPU 数)\n");
+        fprintf(stderr, "       %s --build-atlas <FILE|-> [--workers N] [--output FILE]\n", argv[0]);
+        fprintf(stderr, "            (\"<変種> <クエリ>\" の行ごとの経路を (始点, 終点, 変種) をキーにした経路アトラス %s にまとめる)\n",
+                ROUTE_ATLAS_FILE);
+        fprintf(stderr, "       %s --build-apsp <walking_speed> [gradient_factor] [--threads N] [--output FILE]\n", argv[0]);
+        fprintf(stderr, "            (全点間テーブル %s を作成する)\n", APSP_FILE);
+        fprintf(stderr, "       %s --build-cch [--output FILE]   (嗜好コスト用の縮約順序 %s を作成する)\n", argv[0], CCH_FILE);
+        fprintf(stderr, "       %s --check-cch [trials] [step]   (CCH の経路がダイクストラと一致するか確認する)\n", argv[0]);
+        fprintf(stderr, "       %s --check-search [walking_speed] [gradient_factor] [step]\n", argv[0]);
+        fprintf(stderr, "            (各探索方式の移動時間が最短経路木と一致するか確認する)\n");
+        return 1;
+    }
+
+    if (opt.startNode < 1 || opt.endNode < 1) {
+        fprintf(stderr, "Error: invalid node number\n");
+        return 1;
+    }
+
+    // ノード番号の上限はデータを読み込んでから executeQuery で確認する
+    loadAllData();
+    return executeQuery(&mainQuery, &opt);
+}